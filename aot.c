@@ -0,0 +1,334 @@
+#include "aot.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include "defs.h"
+#include "debug.h"
+#include "parser.h"
+#include "ir.h"
+#include "jit.h"
+
+extern char** environ;
+
+#pragma region --- AOT ---
+
+uint32_t aot_hash_code(const char* code, int length)
+{
+    // FNV-1a, module is only used for exactly the same script
+    uint32_t hash = 2166136261u;
+
+    for (int i = 0; i < length; i++)
+    {
+        hash = (hash ^ (uint8_t)code[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+uint64_t* aot_stack_at(struct ExecutionContext* context, int index)
+{
+    return &context->stack[index];
+}
+
+struct ExecutionAotRuntime aot_runtime = {
+    .stack_at = &aot_stack_at,
+    .push_value = &context_stack_push_value,
+};
+
+bool aot_is_function_start(const char* code, int position)
+{
+    // Only literals returning i32 can be in the compiled subset, 'i32(' not preceded by
+    // another identifier character or '.'
+    if (position < 3 || strncmp(&code[position - 3], "i32", 3) != 0)
+    {
+        return false;
+    }
+
+    return position == 3 || !(parse_is_identifier_char(code[position - 4]) || code[position - 4] == '.');
+}
+
+void aot_write_function(FILE* file, struct ExecutionIrFunction* function)
+{
+    fprintf(file, "static void fts_aot_function_%d(struct ExecutionContext* context, int frame_start_stack_index)\n{\n", function->function_position);
+
+    if (function->param_count > 0)
+    {
+        fprintf(file, "    const uint64_t* args = fts_aot_runtime->stack_at(context, frame_start_stack_index);\n");
+    }
+
+    for (int i = 0; i < function->instruction_count; i++)
+    {
+        struct ExecutionIrInstruction* instruction = &function->instructions[i];
+
+        switch (instruction->op)
+        {
+        case IR_OP_CONST:
+            fprintf(file, "    int32_t v%d = (int32_t)%lldll;\n", i, (long long)instruction->value);
+            break;
+        case IR_OP_PARAM:
+            fprintf(file, "    int32_t v%d = (int32_t)args[%lld];\n", i, (long long)instruction->value);
+            break;
+        case IR_OP_ADD:
+            // wraps around like fts_add
+            fprintf(file, "    int32_t v%d = (int32_t)((uint32_t)v%d + (uint32_t)v%d);\n", i, instruction->a, instruction->b);
+            break;
+        }
+    }
+
+    // Same push as fts_add does for its i32 result
+    fprintf(file, "    uint64_t result = (uint64_t)(int64_t)v%d;\n", function->result);
+    fprintf(file, "    fts_aot_runtime->push_value(context, (struct ExecutionContextStackValue) { .type = %d, .size = 1, .ptr = &result });\n}\n\n", NATIVE_TYPE_I32);
+}
+
+bool aot_write_module(FILE* file, const char* code)
+{
+    int code_length = strlen(code);
+    struct ExecutionIrFunction* functions = malloc(sizeof(struct ExecutionIrFunction) * MAX_JIT_FUNCTIONS);
+    int function_count = 0;
+
+    if (!functions)
+    {
+        return false;
+    }
+
+    // Interface types are repeated, module is compiled without runtime headers
+    fprintf(file, "// Generated from a script by aot_compile_script, do not edit\n\n");
+    fprintf(file, "#include <stdint.h>\n\n");
+    fprintf(file, "struct ExecutionContext;\n\n");
+    fprintf(file, "struct ExecutionContextStackValue { uint8_t type; int size; uint64_t* ptr; };\n\n");
+    fprintf(file, "struct ExecutionAotRuntime\n{\n");
+    fprintf(file, "    uint64_t* (*stack_at)(struct ExecutionContext* context, int index);\n");
+    fprintf(file, "    int (*push_value)(struct ExecutionContext* context, struct ExecutionContextStackValue value);\n};\n\n");
+    fprintf(file, "struct ExecutionAotFunction\n{\n");
+    fprintf(file, "    int32_t function_position;\n    int32_t param_count;\n    int32_t add_count;\n    int32_t fuel_cost;\n");
+    fprintf(file, "    void (*code)(struct ExecutionContext* context, int frame_start_stack_index);\n};\n\n");
+    fprintf(file, "static const struct ExecutionAotRuntime* fts_aot_runtime;\n\n");
+    fprintf(file, "void fts_aot_init(const struct ExecutionAotRuntime* runtime)\n{\n    fts_aot_runtime = runtime;\n}\n\n");
+
+    for (int position = 0; position < code_length && function_count < MAX_JIT_FUNCTIONS; position++)
+    {
+        if (code[position] == '"')
+        {
+            // skip string literals, same as context_skip_string
+            for (position++; position < code_length && code[position] != '"'; position++)
+            {
+                if (code[position] == '\\')
+                {
+                    position++;
+                }
+            }
+
+            continue;
+        }
+
+        if (code[position] != '(' || !aot_is_function_start(code, position))
+        {
+            continue;
+        }
+
+        // Functions are identified by the position exec_function gives them
+        int function_position = position + 1;
+
+        while (function_position < code_length && isspace(code[function_position]))
+        {
+            function_position++;
+        }
+
+        if (ir_build_function(code, code_length, function_position, NULL, 0, &functions[function_count]))
+        {
+            aot_write_function(file, &functions[function_count]);
+            function_count++;
+        }
+    }
+
+    fprintf(file, "const uint32_t fts_aot_abi_version = %d;\n", AOT_ABI_VERSION);
+    fprintf(file, "const uint32_t fts_aot_code_hash = %uu;\n", aot_hash_code(code, code_length));
+    fprintf(file, "const int32_t fts_aot_code_length = %d;\n", code_length);
+    fprintf(file, "const int32_t fts_aot_function_count = %d;\n\n", function_count);
+    fprintf(file, "const struct ExecutionAotFunction fts_aot_functions[] = {\n");
+
+    for (int i = 0; i < function_count; i++)
+    {
+        struct ExecutionIrFunction* function = &functions[i];
+
+        fprintf(file, "    { %d, %d, %d, %d, &fts_aot_function_%d },\n",
+            function->function_position, function->param_count, function->add_count, function->fuel_cost, function->function_position);
+    }
+
+    // table cannot be empty in C
+    fprintf(file, "    { -1, 0, 0, 0, 0 },\n};\n");
+
+    free(functions);
+
+    return true;
+}
+
+bool aot_run_compiler(const char* output_path, const char* source_path)
+{
+    // Compiler is started directly with an argument array, so paths are never 
+    // interpreted by a shell. CC can hold a command with arguments, e.g. 'ccache gcc',
+    // it is split on spaces like make does.
+    char compiler[AOT_MAX_COMPILER_LENGTH];
+    char* argv[AOT_MAX_COMPILER_ARGS + 7];
+    int argc = 0;
+    const char* environment_compiler = getenv("CC");
+    int length = snprintf(compiler, sizeof(compiler), "%s", environment_compiler && *environment_compiler ? environment_compiler : AOT_DEFAULT_COMPILER);
+
+    if (length < 0 || length >= (int)sizeof(compiler))
+    {
+        debug("ERR!: AOT compiler command is too long\n");
+        return false;
+    }
+
+    for (char* token = strtok(compiler, " \t"); token; token = strtok(NULL, " \t"))
+    {
+        if (argc >= AOT_MAX_COMPILER_ARGS)
+        {
+            debug("ERR!: AOT compiler command has too many arguments\n");
+            return false;
+        }
+
+        argv[argc++] = token;
+    }
+
+    if (argc == 0)
+    {
+        debug("ERR!: AOT compiler command is empty\n");
+        return false;
+    }
+
+    argv[argc++] = "-O2";
+    argv[argc++] = "-shared";
+    argv[argc++] = "-fPIC";
+    argv[argc++] = "-o";
+    argv[argc++] = (char*)output_path;
+    argv[argc++] = (char*)source_path;
+    argv[argc] = NULL;
+
+#ifdef TOKEN_DEBUG
+    debug("Compiling AOT module with %s: %s -> %s\n", argv[0], source_path, output_path);
+#endif
+
+    pid_t pid;
+    int status;
+
+    if (posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ) != 0)
+    {
+        debug("ERR!: Cannot start AOT compiler '%s'\n", argv[0]);
+        return false;
+    }
+
+    while (waitpid(pid, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+        {
+            debug("ERR!: Cannot wait for AOT compiler '%s'\n", argv[0]);
+            return false;
+        }
+    }
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+bool aot_compile_script(const char* code, const char* output_path)
+{
+    char source_path[1024];
+    int length = snprintf(source_path, sizeof(source_path), "%s.c", output_path);
+
+    if (length < 0 || length >= (int)sizeof(source_path))
+    {
+        debug("ERR!: AOT output path '%s' is too long\n", output_path);
+        return false;
+    }
+
+    FILE* file = fopen(source_path, "w");
+
+    if (!file)
+    {
+        debug("ERR!: Cannot write AOT source '%s'\n", source_path);
+        return false;
+    }
+
+    bool written = aot_write_module(file, code);
+
+    if (fclose(file) != 0 || !written)
+    {
+        debug("ERR!: Cannot write AOT source '%s'\n", source_path);
+        return false;
+    }
+
+    if (!aot_run_compiler(output_path, source_path))
+    {
+        debug("ERR!: AOT compilation of '%s' failed\n", source_path);
+        return false;
+    }
+
+    return true;
+}
+
+bool aot_load(struct ExecutionContext* context, const char* path)
+{
+    void* module = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+
+    if (!module)
+    {
+        debug("ERR!: Cannot load AOT module '%s': %s\n", path, dlerror());
+        return false;
+    }
+
+    const uint32_t* abi_version = dlsym(module, "fts_aot_abi_version");
+    const uint32_t* code_hash = dlsym(module, "fts_aot_code_hash");
+    const int32_t* code_length = dlsym(module, "fts_aot_code_length");
+    const int32_t* function_count = dlsym(module, "fts_aot_function_count");
+    const struct ExecutionAotFunction* functions = dlsym(module, "fts_aot_functions");
+    void (*init)(const struct ExecutionAotRuntime*) = (void (*)(const struct ExecutionAotRuntime*))dlsym(module, "fts_aot_init");
+
+    if (!abi_version || !code_hash || !code_length || !function_count || !functions || !init || *abi_version != AOT_ABI_VERSION)
+    {
+        debug("ERR!: '%s' is not an AOT module of this runtime\n", path);
+        dlclose(module);
+        return false;
+    }
+
+    // Functions are identified by code positions, so the script has to be the same
+    if (*code_length != context->code_len || *code_hash != aot_hash_code(context->code, context->code_len))
+    {
+        debug("ERR!: AOT module '%s' was built from another script\n", path);
+        dlclose(module);
+        return false;
+    }
+
+    init(&aot_runtime);
+
+    for (int i = 0; i < *function_count; i++)
+    {
+        const struct ExecutionAotFunction* function = &functions[i];
+
+        if (!jit_register_function(
+            context,
+            function->function_position,
+            JIT_BACKEND_AOT,
+            function->code,
+            function->param_count,
+            function->add_count,
+            function->fuel_cost
+        )) {
+            debug("ERR!: No space left for AOT function at %d, it stays interpreted\n", function->function_position);
+        }
+    }
+
+#ifdef TOKEN_DEBUG
+    debug("Loaded AOT module '%s' with %d functions\n", path, *function_count);
+#endif
+
+    return true;
+}
+
+#pragma endregion --- AOT ---
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "context.h"
+
+#pragma region --- AOT ---
+
+// Bumped when the module interface below changes, modules of other versions are not loaded
+#define AOT_ABI_VERSION 1
+
+// Compiler used when CC is not set in the environment
+#define AOT_DEFAULT_COMPILER "cc"
+// Limits of the CC command, it is split into arguments without a shell
+#define AOT_MAX_COMPILER_LENGTH 256
+#define AOT_MAX_COMPILER_ARGS 16
+
+// Runtime services handed to a module when it is loaded, modules do not link against
+// the runtime, so hosts do not need to export their symbols
+struct ExecutionAotRuntime
+{
+    uint64_t* (*stack_at)(struct ExecutionContext* context, int index);
+    int (*push_value)(struct ExecutionContext* context, struct ExecutionContextStackValue value);
+};
+
+// Entry of 'fts_aot_functions' table of a module, code follows ExecutionJitCode
+struct ExecutionAotFunction
+{
+    int32_t function_position;
+    int32_t param_count;
+    int32_t add_count;
+    int32_t fuel_cost;
+    void (*code)(struct ExecutionContext* context, int frame_start_stack_index);
+};
+
+// Translates every function literal of the script which is in the compiled subset (see ir.h)
+// to C, next to 'output_path' with '.c' appended, and builds it into a shared object
+bool aot_compile_script(const char* code, const char* output_path);
+
+// Loads a module built from the same script, calls of its functions run compiled code
+// from the first call. Module stays loaded until exit.
+bool aot_load(struct ExecutionContext* context, const char* path);
+
+#pragma endregion --- AOT ---
@@ -0,0 +1,794 @@
+#include "array.h"
+
+#include <string.h>
+#include <pthread.h>
+
+#include "debug.h"
+#include "columns.h"
+#include "str.h"
+#include "map.h"
+
+#if ARRAY_SIMD_KERNELS && (defined(__x86_64__) || defined(__i386__))
+    #define ARRAY_SIMD_X86 1
+    #include <immintrin.h>
+#endif
+
+#pragma region --- ARRAY ---
+
+struct ExecutionArray* array_create(uint8_t element_type, uint32_t length)
+{
+    if (!check_type_is_numeric(element_type))
+    {
+        debug("ERR!: Arrays can only hold numeric types\n");
+        return NULL;
+    }
+
+    uint8_t element_size = get_size_of_native_type(element_type);
+    struct ExecutionArray* array = object_create(sizeof(struct ExecutionArray) + (size_t)length * element_size);
+
+    array->length = length;
+    array->element_type = element_type;
+    array->element_size = element_size;
+    memset(array->data, 0, (size_t)length * element_size);
+
+    return array;
+}
+
+bool array_load(struct ExecutionArray* array, int64_t index, uint64_t* value)
+{
+    if (!array || index < 0 || index >= array->length)
+    {
+        return false;
+    }
+
+    *value = 0;
+    memcpy(value, &array->data[index * array->element_size], array->element_size);
+
+    return true;
+}
+
+bool array_store(struct ExecutionArray* array, int64_t index, struct ExecutionContextStackValue value)
+{
+    if (!array || index < 0 || index >= array->length)
+    {
+        return false;
+    }
+
+    if (value.type != array->element_type && !(check_type_is_integer(value.type) && check_type_is_integer(array->element_type)))
+    {
+        return false;
+    }
+
+    // Integers are converted by keeping the low bytes
+    memcpy(&array->data[index * array->element_size], value.ptr, array->element_size);
+
+    return true;
+}
+
+bool array_index_from_value(struct ExecutionContextStackValue value, int64_t* index)
+{
+    switch (value.type)
+    {
+        case NATIVE_TYPE_I8: *index = *(int8_t*)value.ptr; return true;
+        case NATIVE_TYPE_U8: *index = *(uint8_t*)value.ptr; return true;
+        case NATIVE_TYPE_I16: *index = *(int16_t*)value.ptr; return true;
+        case NATIVE_TYPE_U16: *index = *(uint16_t*)value.ptr; return true;
+        case NATIVE_TYPE_I32: *index = *(int32_t*)value.ptr; return true;
+        case NATIVE_TYPE_U32: *index = *(uint32_t*)value.ptr; return true;
+        case NATIVE_TYPE_I64: *index = *(int64_t*)value.ptr; return true;
+        // larger values are out of range of any array anyway
+        case NATIVE_TYPE_U64: *index = *(uint64_t*)value.ptr > INT64_MAX ? -1 : *(int64_t*)value.ptr; return true;
+    }
+
+    return false;
+}
+
+bool array_check_element_type(struct ExecutionContextStackValue value, uint8_t element_type)
+{
+    if (value.type != STACK_TYPE_ARRAY)
+    {
+        return false;
+    }
+
+    struct ExecutionArray* array = *(struct ExecutionArray**)value.ptr;
+
+    // Arrays in zeroed struct fields are not allocated yet
+    return !array || array->element_type == element_type;
+}
+
+#pragma endregion --- ARRAY ---
+
+#pragma region --- ARRAY SCALAR KERNELS ---
+
+// Plain loops for every element type, used for the tails of vector kernels as
+// well. Integer arithmetic is done in 'wrap' type, so it wraps in the element 
+// type like the vector lanes do.
+#define ARRAY_SCALAR_KERNELS(name, type, wrap) \
+    void array_sum_##name(const void* data, uint32_t length, void* result) \
+    { \
+        const type* values = data; \
+        type sum = 0; \
+        for (uint32_t i = 0; i < length; i++) sum = (wrap)sum + (wrap)values[i]; \
+        *(type*)result = sum; \
+    } \
+    void array_min_##name(const void* data, uint32_t length, void* result) \
+    { \
+        const type* values = data; \
+        type min = values[0]; \
+        for (uint32_t i = 1; i < length; i++) if (values[i] < min) min = values[i]; \
+        *(type*)result = min; \
+    } \
+    void array_max_##name(const void* data, uint32_t length, void* result) \
+    { \
+        const type* values = data; \
+        type max = values[0]; \
+        for (uint32_t i = 1; i < length; i++) if (values[i] > max) max = values[i]; \
+        *(type*)result = max; \
+    } \
+    void array_dot_##name(const void* a, const void* b, uint32_t length, void* result) \
+    { \
+        const type* values_a = a; \
+        const type* values_b = b; \
+        type sum = 0; \
+        for (uint32_t i = 0; i < length; i++) sum = (wrap)sum + (wrap)values_a[i] * (wrap)values_b[i]; \
+        *(type*)result = sum; \
+    } \
+    void array_scale_##name(void* data, uint32_t length, const void* value) \
+    { \
+        type* values = data; \
+        type factor = *(const type*)value; \
+        for (uint32_t i = 0; i < length; i++) values[i] = (wrap)values[i] * (wrap)factor; \
+    } \
+    void array_add_##name(const void* a, const void* b, void* result, uint32_t length) \
+    { \
+        const type* values_a = a; \
+        const type* values_b = b; \
+        type* values = result; \
+        for (uint32_t i = 0; i < length; i++) values[i] = (wrap)values_a[i] + (wrap)values_b[i]; \
+    } \
+    void array_compare_##name(const void* data, uint32_t length, const void* value, uint8_t compare, uint8_t* mask) \
+    { \
+        const type* values = data; \
+        type other = *(const type*)value; \
+        for (uint32_t i = 0; i < length; i++) \
+        { \
+            mask[i] = compare == ARRAY_COMPARE_LESS ? values[i] < other \
+                : compare == ARRAY_COMPARE_GREATER ? values[i] > other \
+                : values[i] == other; \
+        } \
+    } \
+    uint32_t array_count_##name(const void* data, uint32_t length) \
+    { \
+        const type* values = data; \
+        uint32_t count = 0; \
+        for (uint32_t i = 0; i < length; i++) count += values[i] != 0; \
+        return count; \
+    }
+
+#define ARRAY_SCALAR_TABLE(name) \
+    (struct ArrayKernels) { \
+        .sum = &array_sum_##name, .min = &array_min_##name, .max = &array_max_##name, \
+        .dot = &array_dot_##name, .scale = &array_scale_##name, .add = &array_add_##name, \
+        .compare = &array_compare_##name, .count = &array_count_##name \
+    }
+
+ARRAY_SCALAR_KERNELS(i8, int8_t, uint32_t)
+ARRAY_SCALAR_KERNELS(u8, uint8_t, uint32_t)
+ARRAY_SCALAR_KERNELS(i16, int16_t, uint32_t)
+ARRAY_SCALAR_KERNELS(u16, uint16_t, uint32_t)
+ARRAY_SCALAR_KERNELS(i32, int32_t, uint32_t)
+ARRAY_SCALAR_KERNELS(u32, uint32_t, uint32_t)
+ARRAY_SCALAR_KERNELS(f32, float, float)
+ARRAY_SCALAR_KERNELS(i64, int64_t, uint64_t)
+ARRAY_SCALAR_KERNELS(u64, uint64_t, uint64_t)
+ARRAY_SCALAR_KERNELS(f64, double, double)
+
+#pragma endregion --- ARRAY SCALAR KERNELS ---
+
+#ifdef ARRAY_SIMD_X86
+
+#pragma region --- ARRAY VECTOR KERNELS ---
+
+// Kernels are generated for SSE2 and AVX2 from the same templates, AVX2 ones are
+// compiled for that target only, so the binary still runs on older CPUs. Tails 
+// and lanes of reductions are finished by the scalar kernels.
+#define ARRAY_TARGET_SSE2 __attribute__((target("sse2")))
+#define ARRAY_TARGET_AVX2 __attribute__((target("avx2")))
+
+#define ARRAY_VECTOR_SUM(name, target, type, vector, width, zero, load, add, store) \
+    target void array_sum_##name(const void* data, uint32_t length, void* result) \
+    { \
+        const type* values = data; \
+        vector sum = zero(); \
+        uint32_t i = 0; \
+        for (; i + width <= length; i += width) sum = add(sum, load((const void*)&values[i])); \
+        type lanes[width + 1]; \
+        store((void*)lanes, sum); \
+        array_sum_##type##_tail(values + i, length - i, &lanes[width]); \
+        array_sum_##type##_tail(lanes, width + 1, result); \
+    }
+
+#define ARRAY_VECTOR_MIN_MAX(name, target, type, vector, width, load, op, store, scalar) \
+    target void array_##name(const void* data, uint32_t length, void* result) \
+    { \
+        const type* values = data; \
+        if (length < width) \
+        { \
+            scalar(data, length, result); \
+            return; \
+        } \
+        vector best = load((const void*)values); \
+        uint32_t i = width; \
+        for (; i + width <= length; i += width) best = op(best, load((const void*)&values[i])); \
+        type lanes[width + 1]; \
+        store((void*)lanes, best); \
+        /* tail overlaps the last full vector, which is harmless for min and max */ \
+        scalar(values + length - width, width, &lanes[width]); \
+        scalar(lanes, width + 1, result); \
+    }
+
+#define ARRAY_VECTOR_DOT(name, target, type, vector, width, zero, load, mul, add, store) \
+    target void array_dot_##name(const void* a, const void* b, uint32_t length, void* result) \
+    { \
+        const type* values_a = a; \
+        const type* values_b = b; \
+        vector sum = zero(); \
+        uint32_t i = 0; \
+        for (; i + width <= length; i += width) \
+        { \
+            sum = add(sum, mul(load((const void*)&values_a[i]), load((const void*)&values_b[i]))); \
+        } \
+        type lanes[width + 1]; \
+        store((void*)lanes, sum); \
+        array_dot_##type##_tail(values_a + i, values_b + i, length - i, &lanes[width]); \
+        array_sum_##type##_tail(lanes, width + 1, result); \
+    }
+
+#define ARRAY_VECTOR_SCALE(name, target, type, vector, width, set1, load, mul, store) \
+    target void array_scale_##name(void* data, uint32_t length, const void* value) \
+    { \
+        type* values = data; \
+        vector factor = set1(*(const type*)value); \
+        uint32_t i = 0; \
+        for (; i + width <= length; i += width) \
+        { \
+            store((void*)&values[i], mul(load((const void*)&values[i]), factor)); \
+        } \
+        array_scale_##type##_tail(values + i, length - i, value); \
+    }
+
+#define ARRAY_VECTOR_ADD(name, target, type, vector, width, load, add, store) \
+    target void array_add_##name(const void* a, const void* b, void* result, uint32_t length) \
+    { \
+        const type* values_a = a; \
+        const type* values_b = b; \
+        type* values = result; \
+        uint32_t i = 0; \
+        for (; i + width <= length; i += width) \
+        { \
+            store((void*)&values[i], add(load((const void*)&values_a[i]), load((const void*)&values_b[i]))); \
+        } \
+        array_add_##type##_tail(values_a + i, values_b + i, values + i, length - i); \
+    }
+
+#define ARRAY_VECTOR_COMPARE(name, target, type, vector, width, set1, load, less, greater, equal, movemask) \
+    target void array_compare_##name(const void* data, uint32_t length, const void* value, uint8_t compare, uint8_t* mask) \
+    { \
+        const type* values = data; \
+        vector other = set1(*(const type*)value); \
+        uint32_t i = 0; \
+        for (; i + width <= length; i += width) \
+        { \
+            vector current = load((const void*)&values[i]); \
+            vector result = compare == ARRAY_COMPARE_LESS ? less(current, other) \
+                : compare == ARRAY_COMPARE_GREATER ? greater(current, other) \
+                : equal(current, other); \
+            int bits = movemask(result); \
+            for (int lane = 0; lane < width; lane++) mask[i + lane] = (bits >> lane) & 1; \
+        } \
+        array_compare_##type##_tail(values + i, length - i, value, compare, mask + i); \
+    }
+
+// Tails go through the scalar kernels, named by the C type used in templates
+#define array_sum_int32_t_tail array_sum_i32
+#define array_sum_int64_t_tail array_sum_i64
+#define array_sum_float_tail array_sum_f32
+#define array_sum_double_tail array_sum_f64
+#define array_dot_int32_t_tail array_dot_i32
+#define array_dot_float_tail array_dot_f32
+#define array_dot_double_tail array_dot_f64
+#define array_scale_int32_t_tail array_scale_i32
+#define array_scale_float_tail array_scale_f32
+#define array_scale_double_tail array_scale_f64
+#define array_add_int32_t_tail array_add_i32
+#define array_add_int64_t_tail array_add_i64
+#define array_add_float_tail array_add_f32
+#define array_add_double_tail array_add_f64
+#define array_compare_int32_t_tail array_compare_i32
+#define array_compare_float_tail array_compare_f32
+#define array_compare_double_tail array_compare_f64
+
+// Missing comparisons and masks expressed with the available instructions
+#define ARRAY_SSE2_MASK_EPI32(value) _mm_movemask_ps(_mm_castsi128_ps(value))
+#define ARRAY_AVX2_MASK_EPI32(value) _mm256_movemask_ps(_mm256_castsi256_ps(value))
+#define ARRAY_AVX2_LT_EPI32(a, b) _mm256_cmpgt_epi32(b, a)
+#define ARRAY_AVX2_LT_PS(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define ARRAY_AVX2_GT_PS(a, b) _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define ARRAY_AVX2_EQ_PS(a, b) _mm256_cmp_ps(a, b, _CMP_EQ_OQ)
+#define ARRAY_AVX2_LT_PD(a, b) _mm256_cmp_pd(a, b, _CMP_LT_OQ)
+#define ARRAY_AVX2_GT_PD(a, b) _mm256_cmp_pd(a, b, _CMP_GT_OQ)
+#define ARRAY_AVX2_EQ_PD(a, b) _mm256_cmp_pd(a, b, _CMP_EQ_OQ)
+
+// SSE2, part of the x86-64 baseline
+ARRAY_VECTOR_SUM(i32_sse2, ARRAY_TARGET_SSE2, int32_t, __m128i, 4, _mm_setzero_si128, _mm_loadu_si128, _mm_add_epi32, _mm_storeu_si128)
+ARRAY_VECTOR_SUM(i64_sse2, ARRAY_TARGET_SSE2, int64_t, __m128i, 2, _mm_setzero_si128, _mm_loadu_si128, _mm_add_epi64, _mm_storeu_si128)
+ARRAY_VECTOR_SUM(f32_sse2, ARRAY_TARGET_SSE2, float, __m128, 4, _mm_setzero_ps, _mm_loadu_ps, _mm_add_ps, _mm_storeu_ps)
+ARRAY_VECTOR_SUM(f64_sse2, ARRAY_TARGET_SSE2, double, __m128d, 2, _mm_setzero_pd, _mm_loadu_pd, _mm_add_pd, _mm_storeu_pd)
+
+ARRAY_VECTOR_MIN_MAX(min_f32_sse2, ARRAY_TARGET_SSE2, float, __m128, 4, _mm_loadu_ps, _mm_min_ps, _mm_storeu_ps, array_min_f32)
+ARRAY_VECTOR_MIN_MAX(max_f32_sse2, ARRAY_TARGET_SSE2, float, __m128, 4, _mm_loadu_ps, _mm_max_ps, _mm_storeu_ps, array_max_f32)
+ARRAY_VECTOR_MIN_MAX(min_f64_sse2, ARRAY_TARGET_SSE2, double, __m128d, 2, _mm_loadu_pd, _mm_min_pd, _mm_storeu_pd, array_min_f64)
+ARRAY_VECTOR_MIN_MAX(max_f64_sse2, ARRAY_TARGET_SSE2, double, __m128d, 2, _mm_loadu_pd, _mm_max_pd, _mm_storeu_pd, array_max_f64)
+
+ARRAY_VECTOR_DOT(f32_sse2, ARRAY_TARGET_SSE2, float, __m128, 4, _mm_setzero_ps, _mm_loadu_ps, _mm_mul_ps, _mm_add_ps, _mm_storeu_ps)
+ARRAY_VECTOR_DOT(f64_sse2, ARRAY_TARGET_SSE2, double, __m128d, 2, _mm_setzero_pd, _mm_loadu_pd, _mm_mul_pd, _mm_add_pd, _mm_storeu_pd)
+
+ARRAY_VECTOR_SCALE(f32_sse2, ARRAY_TARGET_SSE2, float, __m128, 4, _mm_set1_ps, _mm_loadu_ps, _mm_mul_ps, _mm_storeu_ps)
+ARRAY_VECTOR_SCALE(f64_sse2, ARRAY_TARGET_SSE2, double, __m128d, 2, _mm_set1_pd, _mm_loadu_pd, _mm_mul_pd, _mm_storeu_pd)
+
+ARRAY_VECTOR_ADD(i32_sse2, ARRAY_TARGET_SSE2, int32_t, __m128i, 4, _mm_loadu_si128, _mm_add_epi32, _mm_storeu_si128)
+ARRAY_VECTOR_ADD(i64_sse2, ARRAY_TARGET_SSE2, int64_t, __m128i, 2, _mm_loadu_si128, _mm_add_epi64, _mm_storeu_si128)
+ARRAY_VECTOR_ADD(f32_sse2, ARRAY_TARGET_SSE2, float, __m128, 4, _mm_loadu_ps, _mm_add_ps, _mm_storeu_ps)
+ARRAY_VECTOR_ADD(f64_sse2, ARRAY_TARGET_SSE2, double, __m128d, 2, _mm_loadu_pd, _mm_add_pd, _mm_storeu_pd)
+
+ARRAY_VECTOR_COMPARE(i32_sse2, ARRAY_TARGET_SSE2, int32_t, __m128i, 4, _mm_set1_epi32, _mm_loadu_si128, _mm_cmplt_epi32, _mm_cmpgt_epi32, _mm_cmpeq_epi32, ARRAY_SSE2_MASK_EPI32)
+ARRAY_VECTOR_COMPARE(f32_sse2, ARRAY_TARGET_SSE2, float, __m128, 4, _mm_set1_ps, _mm_loadu_ps, _mm_cmplt_ps, _mm_cmpgt_ps, _mm_cmpeq_ps, _mm_movemask_ps)
+ARRAY_VECTOR_COMPARE(f64_sse2, ARRAY_TARGET_SSE2, double, __m128d, 2, _mm_set1_pd, _mm_loadu_pd, _mm_cmplt_pd, _mm_cmpgt_pd, _mm_cmpeq_pd, _mm_movemask_pd)
+
+ARRAY_TARGET_SSE2 uint32_t array_count_u8_sse2(const void* data, uint32_t length)
+{
+    // Masks are byte arrays, 16 of them are checked with one compare
+    const uint8_t* values = data;
+    uint32_t count = 0;
+    uint32_t i = 0;
+
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i zero = _mm_cmpeq_epi8(_mm_loadu_si128((const void*)&values[i]), _mm_setzero_si128());
+        count += 16 - __builtin_popcount(_mm_movemask_epi8(zero));
+    }
+
+    return count + array_count_u8(values + i, length - i);
+}
+
+// AVX2
+ARRAY_VECTOR_SUM(i32_avx2, ARRAY_TARGET_AVX2, int32_t, __m256i, 8, _mm256_setzero_si256, _mm256_loadu_si256, _mm256_add_epi32, _mm256_storeu_si256)
+ARRAY_VECTOR_SUM(i64_avx2, ARRAY_TARGET_AVX2, int64_t, __m256i, 4, _mm256_setzero_si256, _mm256_loadu_si256, _mm256_add_epi64, _mm256_storeu_si256)
+ARRAY_VECTOR_SUM(f32_avx2, ARRAY_TARGET_AVX2, float, __m256, 8, _mm256_setzero_ps, _mm256_loadu_ps, _mm256_add_ps, _mm256_storeu_ps)
+ARRAY_VECTOR_SUM(f64_avx2, ARRAY_TARGET_AVX2, double, __m256d, 4, _mm256_setzero_pd, _mm256_loadu_pd, _mm256_add_pd, _mm256_storeu_pd)
+
+ARRAY_VECTOR_MIN_MAX(min_i32_avx2, ARRAY_TARGET_AVX2, int32_t, __m256i, 8, _mm256_loadu_si256, _mm256_min_epi32, _mm256_storeu_si256, array_min_i32)
+ARRAY_VECTOR_MIN_MAX(max_i32_avx2, ARRAY_TARGET_AVX2, int32_t, __m256i, 8, _mm256_loadu_si256, _mm256_max_epi32, _mm256_storeu_si256, array_max_i32)
+ARRAY_VECTOR_MIN_MAX(min_f32_avx2, ARRAY_TARGET_AVX2, float, __m256, 8, _mm256_loadu_ps, _mm256_min_ps, _mm256_storeu_ps, array_min_f32)
+ARRAY_VECTOR_MIN_MAX(max_f32_avx2, ARRAY_TARGET_AVX2, float, __m256, 8, _mm256_loadu_ps, _mm256_max_ps, _mm256_storeu_ps, array_max_f32)
+ARRAY_VECTOR_MIN_MAX(min_f64_avx2, ARRAY_TARGET_AVX2, double, __m256d, 4, _mm256_loadu_pd, _mm256_min_pd, _mm256_storeu_pd, array_min_f64)
+ARRAY_VECTOR_MIN_MAX(max_f64_avx2, ARRAY_TARGET_AVX2, double, __m256d, 4, _mm256_loadu_pd, _mm256_max_pd, _mm256_storeu_pd, array_max_f64)
+
+ARRAY_VECTOR_DOT(i32_avx2, ARRAY_TARGET_AVX2, int32_t, __m256i, 8, _mm256_setzero_si256, _mm256_loadu_si256, _mm256_mullo_epi32, _mm256_add_epi32, _mm256_storeu_si256)
+ARRAY_VECTOR_DOT(f32_avx2, ARRAY_TARGET_AVX2, float, __m256, 8, _mm256_setzero_ps, _mm256_loadu_ps, _mm256_mul_ps, _mm256_add_ps, _mm256_storeu_ps)
+ARRAY_VECTOR_DOT(f64_avx2, ARRAY_TARGET_AVX2, double, __m256d, 4, _mm256_setzero_pd, _mm256_loadu_pd, _mm256_mul_pd, _mm256_add_pd, _mm256_storeu_pd)
+
+ARRAY_VECTOR_SCALE(i32_avx2, ARRAY_TARGET_AVX2, int32_t, __m256i, 8, _mm256_set1_epi32, _mm256_loadu_si256, _mm256_mullo_epi32, _mm256_storeu_si256)
+ARRAY_VECTOR_SCALE(f32_avx2, ARRAY_TARGET_AVX2, float, __m256, 8, _mm256_set1_ps, _mm256_loadu_ps, _mm256_mul_ps, _mm256_storeu_ps)
+ARRAY_VECTOR_SCALE(f64_avx2, ARRAY_TARGET_AVX2, double, __m256d, 4, _mm256_set1_pd, _mm256_loadu_pd, _mm256_mul_pd, _mm256_storeu_pd)
+
+ARRAY_VECTOR_ADD(i32_avx2, ARRAY_TARGET_AVX2, int32_t, __m256i, 8, _mm256_loadu_si256, _mm256_add_epi32, _mm256_storeu_si256)
+ARRAY_VECTOR_ADD(i64_avx2, ARRAY_TARGET_AVX2, int64_t, __m256i, 4, _mm256_loadu_si256, _mm256_add_epi64, _mm256_storeu_si256)
+ARRAY_VECTOR_ADD(f32_avx2, ARRAY_TARGET_AVX2, float, __m256, 8, _mm256_loadu_ps, _mm256_add_ps, _mm256_storeu_ps)
+ARRAY_VECTOR_ADD(f64_avx2, ARRAY_TARGET_AVX2, double, __m256d, 4, _mm256_loadu_pd, _mm256_add_pd, _mm256_storeu_pd)
+
+ARRAY_VECTOR_COMPARE(i32_avx2, ARRAY_TARGET_AVX2, int32_t, __m256i, 8, _mm256_set1_epi32, _mm256_loadu_si256, ARRAY_AVX2_LT_EPI32, _mm256_cmpgt_epi32, _mm256_cmpeq_epi32, ARRAY_AVX2_MASK_EPI32)
+ARRAY_VECTOR_COMPARE(f32_avx2, ARRAY_TARGET_AVX2, float, __m256, 8, _mm256_set1_ps, _mm256_loadu_ps, ARRAY_AVX2_LT_PS, ARRAY_AVX2_GT_PS, ARRAY_AVX2_EQ_PS, _mm256_movemask_ps)
+ARRAY_VECTOR_COMPARE(f64_avx2, ARRAY_TARGET_AVX2, double, __m256d, 4, _mm256_set1_pd, _mm256_loadu_pd, ARRAY_AVX2_LT_PD, ARRAY_AVX2_GT_PD, ARRAY_AVX2_EQ_PD, _mm256_movemask_pd)
+
+ARRAY_TARGET_AVX2 uint32_t array_count_u8_avx2(const void* data, uint32_t length)
+{
+    const uint8_t* values = data;
+    uint32_t count = 0;
+    uint32_t i = 0;
+
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i zero = _mm256_cmpeq_epi8(_mm256_loadu_si256((const void*)&values[i]), _mm256_setzero_si256());
+        count += 32 - __builtin_popcount((uint32_t)_mm256_movemask_epi8(zero));
+    }
+
+    return count + array_count_u8(values + i, length - i);
+}
+
+#pragma endregion --- ARRAY VECTOR KERNELS ---
+
+#endif
+
+#pragma region --- ARRAY DISPATCH ---
+
+struct ArrayKernels array_kernels[NATIVE_TYPE_DOUBLE + 1];
+pthread_once_t array_kernels_once = PTHREAD_ONCE_INIT;
+
+void array_kernels_select()
+{
+    array_kernels[NATIVE_TYPE_I8] = ARRAY_SCALAR_TABLE(i8);
+    array_kernels[NATIVE_TYPE_U8] = ARRAY_SCALAR_TABLE(u8);
+    array_kernels[NATIVE_TYPE_I16] = ARRAY_SCALAR_TABLE(i16);
+    array_kernels[NATIVE_TYPE_U16] = ARRAY_SCALAR_TABLE(u16);
+    array_kernels[NATIVE_TYPE_I32] = ARRAY_SCALAR_TABLE(i32);
+    array_kernels[NATIVE_TYPE_U32] = ARRAY_SCALAR_TABLE(u32);
+    array_kernels[NATIVE_TYPE_FLOAT] = ARRAY_SCALAR_TABLE(f32);
+    array_kernels[NATIVE_TYPE_I64] = ARRAY_SCALAR_TABLE(i64);
+    array_kernels[NATIVE_TYPE_U64] = ARRAY_SCALAR_TABLE(u64);
+    array_kernels[NATIVE_TYPE_DOUBLE] = ARRAY_SCALAR_TABLE(f64);
+
+#ifdef ARRAY_SIMD_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse2"))
+    {
+        // Wrapping addition is the same for signed and unsigned lanes
+        array_kernels[NATIVE_TYPE_I32].sum = array_kernels[NATIVE_TYPE_U32].sum = &array_sum_i32_sse2;
+        array_kernels[NATIVE_TYPE_I64].sum = array_kernels[NATIVE_TYPE_U64].sum = &array_sum_i64_sse2;
+        array_kernels[NATIVE_TYPE_FLOAT].sum = &array_sum_f32_sse2;
+        array_kernels[NATIVE_TYPE_DOUBLE].sum = &array_sum_f64_sse2;
+
+        array_kernels[NATIVE_TYPE_FLOAT].min = &array_min_f32_sse2;
+        array_kernels[NATIVE_TYPE_FLOAT].max = &array_max_f32_sse2;
+        array_kernels[NATIVE_TYPE_DOUBLE].min = &array_min_f64_sse2;
+        array_kernels[NATIVE_TYPE_DOUBLE].max = &array_max_f64_sse2;
+
+        array_kernels[NATIVE_TYPE_FLOAT].dot = &array_dot_f32_sse2;
+        array_kernels[NATIVE_TYPE_DOUBLE].dot = &array_dot_f64_sse2;
+
+        array_kernels[NATIVE_TYPE_FLOAT].scale = &array_scale_f32_sse2;
+        array_kernels[NATIVE_TYPE_DOUBLE].scale = &array_scale_f64_sse2;
+
+        array_kernels[NATIVE_TYPE_I32].add = array_kernels[NATIVE_TYPE_U32].add = &array_add_i32_sse2;
+        array_kernels[NATIVE_TYPE_I64].add = array_kernels[NATIVE_TYPE_U64].add = &array_add_i64_sse2;
+        array_kernels[NATIVE_TYPE_FLOAT].add = &array_add_f32_sse2;
+        array_kernels[NATIVE_TYPE_DOUBLE].add = &array_add_f64_sse2;
+
+        array_kernels[NATIVE_TYPE_I32].compare = &array_compare_i32_sse2;
+        array_kernels[NATIVE_TYPE_FLOAT].compare = &array_compare_f32_sse2;
+        array_kernels[NATIVE_TYPE_DOUBLE].compare = &array_compare_f64_sse2;
+
+        array_kernels[NATIVE_TYPE_I8].count = array_kernels[NATIVE_TYPE_U8].count = &array_count_u8_sse2;
+    }
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        array_kernels[NATIVE_TYPE_I32].sum = array_kernels[NATIVE_TYPE_U32].sum = &array_sum_i32_avx2;
+        array_kernels[NATIVE_TYPE_I64].sum = array_kernels[NATIVE_TYPE_U64].sum = &array_sum_i64_avx2;
+        array_kernels[NATIVE_TYPE_FLOAT].sum = &array_sum_f32_avx2;
+        array_kernels[NATIVE_TYPE_DOUBLE].sum = &array_sum_f64_avx2;
+
+        array_kernels[NATIVE_TYPE_I32].min = &array_min_i32_avx2;
+        array_kernels[NATIVE_TYPE_I32].max = &array_max_i32_avx2;
+        array_kernels[NATIVE_TYPE_FLOAT].min = &array_min_f32_avx2;
+        array_kernels[NATIVE_TYPE_FLOAT].max = &array_max_f32_avx2;
+        array_kernels[NATIVE_TYPE_DOUBLE].min = &array_min_f64_avx2;
+        array_kernels[NATIVE_TYPE_DOUBLE].max = &array_max_f64_avx2;
+
+        // Low 32 bits of the product are the same for signed and unsigned lanes
+        array_kernels[NATIVE_TYPE_I32].dot = array_kernels[NATIVE_TYPE_U32].dot = &array_dot_i32_avx2;
+        array_kernels[NATIVE_TYPE_FLOAT].dot = &array_dot_f32_avx2;
+        array_kernels[NATIVE_TYPE_DOUBLE].dot = &array_dot_f64_avx2;
+
+        array_kernels[NATIVE_TYPE_I32].scale = array_kernels[NATIVE_TYPE_U32].scale = &array_scale_i32_avx2;
+        array_kernels[NATIVE_TYPE_FLOAT].scale = &array_scale_f32_avx2;
+        array_kernels[NATIVE_TYPE_DOUBLE].scale = &array_scale_f64_avx2;
+
+        array_kernels[NATIVE_TYPE_I32].add = array_kernels[NATIVE_TYPE_U32].add = &array_add_i32_avx2;
+        array_kernels[NATIVE_TYPE_I64].add = array_kernels[NATIVE_TYPE_U64].add = &array_add_i64_avx2;
+        array_kernels[NATIVE_TYPE_FLOAT].add = &array_add_f32_avx2;
+        array_kernels[NATIVE_TYPE_DOUBLE].add = &array_add_f64_avx2;
+
+        array_kernels[NATIVE_TYPE_I32].compare = &array_compare_i32_avx2;
+        array_kernels[NATIVE_TYPE_FLOAT].compare = &array_compare_f32_avx2;
+        array_kernels[NATIVE_TYPE_DOUBLE].compare = &array_compare_f64_avx2;
+
+        array_kernels[NATIVE_TYPE_I8].count = array_kernels[NATIVE_TYPE_U8].count = &array_count_u8_avx2;
+    }
+
+    #ifdef TOKEN_DEBUG
+        debug("Array kernels selected (sse2: %d, avx2: %d)\n", __builtin_cpu_supports("sse2") != 0, __builtin_cpu_supports("avx2") != 0);
+    #endif
+#endif
+}
+
+void array_kernels_init()
+{
+    pthread_once(&array_kernels_once, &array_kernels_select);
+}
+
+const struct ArrayKernels* array_get_kernels(uint8_t element_type)
+{
+    return check_type_is_numeric(element_type) ? &array_kernels[element_type] : NULL;
+}
+
+#pragma endregion --- ARRAY DISPATCH ---
+
+#pragma region --- ARRAY SCRIPT FUNCTIONS ---
+
+bool array_get_args(struct ExecutionContext* context, int count, struct ExecutionContextStackValue* args)
+{
+    // Reads exactly 'count' arguments of the native frame, first one is the array
+    int index = context->native_frame_stack_index;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (index >= context->stack_index)
+        {
+            return false;
+        }
+
+        args[i] = context_stack_get_value_at_index(context, index);
+        index += args[i].size;
+    }
+
+    return index == context->stack_index
+        && args[0].type == STACK_TYPE_ARRAY
+        && *(struct ExecutionArray**)args[0].ptr;
+}
+
+void array_push(struct ExecutionContext* context, struct ExecutionArray* array)
+{
+    uint64_t array_value = (uint64_t)array;
+
+    context_stack_push_value(
+        context,
+        (struct ExecutionContextStackValue) { .ptr = &array_value, .type = STACK_TYPE_ARRAY, .size = get_size_of_native_type(STACK_TYPE_ARRAY) }
+    );
+}
+
+void array_push_element(struct ExecutionContext* context, struct ExecutionArray* array, uint64_t element)
+{
+    context_stack_push_value(
+        context,
+        (struct ExecutionContextStackValue) { .ptr = &element, .type = array->element_type, .size = array->element_size }
+    );
+}
+
+bool array_get_scalar(struct ExecutionArray* array, struct ExecutionContextStackValue value, uint64_t* scalar)
+{
+    // Scalar arguments follow the element store rules
+    if (value.type != array->element_type && !(check_type_is_integer(value.type) && check_type_is_integer(array->element_type)))
+    {
+        return false;
+    }
+
+    *scalar = *value.ptr;
+    return true;
+}
+
+// len(array) -> i32
+void fts_len(struct ExecutionContext* context)
+{
+    struct ExecutionContextStackValue args[1];
+    uint64_t length;
+
+    if (context->native_frame_stack_index + 1 == context->stack_index 
+        && context->stack_type[context->native_frame_stack_index] == STACK_TYPE_COLUMNS
+        && context->stack[context->native_frame_stack_index])
+    {
+        // Column collections count records
+        length = ((struct ExecutionColumns*)context->stack[context->native_frame_stack_index])->length;
+    }
+    else if (context->native_frame_stack_index + 1 == context->stack_index 
+        && context->stack_type[context->native_frame_stack_index] == NATIVE_TYPE_STRING)
+    {
+        uint32_t string_length;
+
+        string_get_data(&context->stack[context->native_frame_stack_index], &string_length);
+        length = string_length;
+    }
+    else if (context->native_frame_stack_index + 1 == context->stack_index 
+        && context->stack_type[context->native_frame_stack_index] == STACK_TYPE_MAP
+        && context->stack[context->native_frame_stack_index])
+    {
+        // Maps count entries
+        length = ((struct ExecutionMap*)context->stack[context->native_frame_stack_index])->count;
+    }
+    else if (array_get_args(context, 1, args))
+    {
+        length = (*(struct ExecutionArray**)args[0].ptr)->length;
+    }
+    else
+    {
+        debug("ERR!: len expects an array, a string or a map\n");
+        return;
+    }
+
+    context_stack_push_value(
+        context,
+        (struct ExecutionContextStackValue) { .ptr = &length, .type = NATIVE_TYPE_I32, .size = get_size_of_native_type(NATIVE_TYPE_I32) }
+    );
+}
+
+// sum(array) -> element, integers wrap
+void fts_sum(struct ExecutionContext* context)
+{
+    struct ExecutionContextStackValue args[1];
+
+    if (!array_get_args(context, 1, args))
+    {
+        debug("ERR!: sum expects an array\n");
+        return;
+    }
+
+    struct ExecutionArray* array = *(struct ExecutionArray**)args[0].ptr;
+    uint64_t result = 0;
+
+    array_get_kernels(array->element_type)->sum(array->data, array->length, &result);
+    array_push_element(context, array, result);
+}
+
+void array_min_max(struct ExecutionContext* context, bool max)
+{
+    struct ExecutionContextStackValue args[1];
+
+    if (!array_get_args(context, 1, args) || (*(struct ExecutionArray**)args[0].ptr)->length == 0)
+    {
+        debug("ERR!: %s expects a non empty array\n", max ? "max" : "min");
+        return;
+    }
+
+    struct ExecutionArray* array = *(struct ExecutionArray**)args[0].ptr;
+    const struct ArrayKernels* kernels = array_get_kernels(array->element_type);
+    uint64_t result = 0;
+
+    (max ? kernels->max : kernels->min)(array->data, array->length, &result);
+    array_push_element(context, array, result);
+}
+
+// min(array) -> element
+void fts_min(struct ExecutionContext* context)
+{
+    array_min_max(context, false);
+}
+
+// max(array) -> element
+void fts_max(struct ExecutionContext* context)
+{
+    array_min_max(context, true);
+}
+
+bool array_get_pair(struct ExecutionContext* context, struct ExecutionArray** a, struct ExecutionArray** b)
+{
+    struct ExecutionContextStackValue args[2];
+
+    if (!array_get_args(context, 2, args) || args[1].type != STACK_TYPE_ARRAY || !*(struct ExecutionArray**)args[1].ptr)
+    {
+        return false;
+    }
+
+    *a = *(struct ExecutionArray**)args[0].ptr;
+    *b = *(struct ExecutionArray**)args[1].ptr;
+
+    return (*a)->element_type == (*b)->element_type && (*a)->length == (*b)->length;
+}
+
+// dot(a, b) -> element, arrays have to be of the same type and length
+void fts_dot(struct ExecutionContext* context)
+{
+    struct ExecutionArray* a;
+    struct ExecutionArray* b;
+
+    if (!array_get_pair(context, &a, &b))
+    {
+        debug("ERR!: dot expects two arrays of the same type and length\n");
+        return;
+    }
+
+    uint64_t result = 0;
+
+    array_get_kernels(a->element_type)->dot(a->data, b->data, a->length, &result);
+    array_push_element(context, a, result);
+}
+
+// add(a, b) -> new array with element wise sums
+void fts_array_add(struct ExecutionContext* context)
+{
+    struct ExecutionArray* a;
+    struct ExecutionArray* b;
+
+    if (!array_get_pair(context, &a, &b))
+    {
+        debug("ERR!: add expects two arrays of the same type and length\n");
+        return;
+    }
+
+    struct ExecutionArray* result = array_create(a->element_type, a->length);
+
+    array_get_kernels(a->element_type)->add(a->data, b->data, result->data, a->length);
+    array_push(context, result);
+}
+
+// scale(array, value), multiplies elements in place
+void fts_scale(struct ExecutionContext* context)
+{
+    struct ExecutionContextStackValue args[2];
+    uint64_t factor;
+
+    if (!array_get_args(context, 2, args) || !array_get_scalar(*(struct ExecutionArray**)args[0].ptr, args[1], &factor))
+    {
+        debug("ERR!: scale expects an array and a value of its element type\n");
+        return;
+    }
+
+    struct ExecutionArray* array = *(struct ExecutionArray**)args[0].ptr;
+
+    array_get_kernels(array->element_type)->scale(array->data, array->length, &factor);
+}
+
+void array_compare(struct ExecutionContext* context, uint8_t compare, const char* name)
+{
+    struct ExecutionContextStackValue args[2];
+    uint64_t value;
+
+    if (!array_get_args(context, 2, args) || !array_get_scalar(*(struct ExecutionArray**)args[0].ptr, args[1], &value))
+    {
+        debug("ERR!: %s expects an array and a value of its element type\n", name);
+        return;
+    }
+
+    struct ExecutionArray* array = *(struct ExecutionArray**)args[0].ptr;
+    struct ExecutionArray* mask = array_create(NATIVE_TYPE_U8, array->length);
+
+    array_get_kernels(array->element_type)->compare(array->data, array->length, &value, compare, mask->data);
+    array_push(context, mask);
+}
+
+// less(array, value) -> u8[] mask, 1 where element < value
+void fts_less(struct ExecutionContext* context)
+{
+    array_compare(context, ARRAY_COMPARE_LESS, "less");
+}
+
+// greater(array, value) -> u8[] mask, 1 where element > value
+void fts_greater(struct ExecutionContext* context)
+{
+    array_compare(context, ARRAY_COMPARE_GREATER, "greater");
+}
+
+// equal(array, value) -> u8[] mask, 1 where element == value, strings go to fts_string_equal
+void fts_equal(struct ExecutionContext* context)
+{
+    if (context->native_frame_stack_index < context->stack_index 
+        && context->stack_type[context->native_frame_stack_index] == NATIVE_TYPE_STRING)
+    {
+        fts_string_equal(context);
+        return;
+    }
+
+    array_compare(context, ARRAY_COMPARE_EQUAL, "equal");
+}
+
+// count(array) -> i32 number of non zero elements
+void fts_count(struct ExecutionContext* context)
+{
+    struct ExecutionContextStackValue args[1];
+
+    if (!array_get_args(context, 1, args))
+    {
+        debug("ERR!: count expects an array\n");
+        return;
+    }
+
+    struct ExecutionArray* array = *(struct ExecutionArray**)args[0].ptr;
+    uint64_t count = array_get_kernels(array->element_type)->count(array->data, array->length);
+
+    context_stack_push_value(
+        context,
+        (struct ExecutionContextStackValue) { .ptr = &count, .type = NATIVE_TYPE_I32, .size = get_size_of_native_type(NATIVE_TYPE_I32) }
+    );
+}
+
+#pragma endregion --- ARRAY SCRIPT FUNCTIONS ---
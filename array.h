@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "context.h"
+
+#pragma region --- ARRAY ---
+
+// Contiguous elements of one numeric native type, referenced from the stack by
+// STACK_TYPE_ARRAY values. Elements follow the header and are reference free,
+// so the array does not need a free hook.
+struct ExecutionArray
+{
+    uint32_t length;
+    uint8_t element_type;
+    uint8_t element_size;
+    uint8_t data[] __attribute__((aligned(8)));
+};
+
+enum ArrayCompare
+{
+    ARRAY_COMPARE_LESS,
+    ARRAY_COMPARE_GREATER,
+    ARRAY_COMPARE_EQUAL
+};
+
+// Kernels of one element type, 'result' and 'value' point to a single element.
+// Filled with scalar loops and replaced by vector versions the CPU supports.
+struct ArrayKernels
+{
+    void (*sum)(const void* data, uint32_t length, void* result);
+    void (*min)(const void* data, uint32_t length, void* result);
+    void (*max)(const void* data, uint32_t length, void* result);
+    void (*dot)(const void* a, const void* b, uint32_t length, void* result);
+    void (*scale)(void* data, uint32_t length, const void* value);
+    void (*add)(const void* a, const void* b, void* result, uint32_t length);
+    void (*compare)(const void* data, uint32_t length, const void* value, uint8_t compare, uint8_t* mask);
+    uint32_t (*count)(const void* data, uint32_t length);
+};
+
+// Zero initialized array, NULL when element type is not numeric
+struct ExecutionArray* array_create(uint8_t element_type, uint32_t length);
+
+// Picks kernels for the running CPU, safe to call many times
+void array_kernels_init();
+
+const struct ArrayKernels* array_get_kernels(uint8_t element_type);
+
+// Element is copied into the low bytes of the stack slot, like struct fields
+bool array_load(struct ExecutionArray* array, int64_t index, uint64_t* value);
+
+// Same conversions as struct field stores: equal types or integer to integer
+bool array_store(struct ExecutionArray* array, int64_t index, struct ExecutionContextStackValue value);
+
+// Reads any integer stack value as a signed index
+bool array_index_from_value(struct ExecutionContextStackValue value, int64_t* index);
+
+// True for array values of the element type, not allocated arrays match any type
+bool array_check_element_type(struct ExecutionContextStackValue value, uint8_t element_type);
+
+void fts_len(struct ExecutionContext* context);
+void fts_sum(struct ExecutionContext* context);
+void fts_min(struct ExecutionContext* context);
+void fts_max(struct ExecutionContext* context);
+void fts_dot(struct ExecutionContext* context);
+void fts_scale(struct ExecutionContext* context);
+void fts_less(struct ExecutionContext* context);
+void fts_greater(struct ExecutionContext* context);
+void fts_equal(struct ExecutionContext* context);
+void fts_count(struct ExecutionContext* context);
+
+// add(a, b) on two arrays, called by 'add' for array arguments
+void fts_array_add(struct ExecutionContext* context);
+
+#pragma endregion --- ARRAY ---
@@ -1 +1 @@
-gcc *.c -o fastscript
\ No newline at end of file
+gcc *.c -o fastscript -lpthread -ldl
\ No newline at end of file
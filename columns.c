@@ -0,0 +1,117 @@
+#include "columns.h"
+
+#include <string.h>
+
+#include "debug.h"
+
+#pragma region --- COLUMNS ---
+
+void columns_free(const void* object_ref)
+{
+    struct ExecutionColumns* columns = (struct ExecutionColumns*)((uint8_t*)object_ref + sizeof(struct ref));
+
+    for (int i = 0; i < columns->definition->fields.count; i++)
+    {
+        object_deref(columns->columns[i]);
+    }
+
+    object_deref(columns->definition);
+}
+
+struct ExecutionColumns* columns_create(struct ExecutionContextStructDefinition* definition, uint32_t length)
+{
+    struct ExecutionContextStructDefinitionFieldList* fields = &definition->fields;
+
+    for (int i = 0; i < fields->count; i++)
+    {
+        if (!check_type_is_numeric(fields->data[i].type.native))
+        {
+            debug("ERR!: Column of field '%s' cannot be created, only numeric fields are supported\n", fields->data[i].name);
+            return NULL;
+        }
+    }
+
+    struct ExecutionColumns* columns = object_create_with_free(
+        sizeof(struct ExecutionColumns) + fields->count * sizeof(struct ExecutionArray*),
+        &columns_free
+    );
+
+    columns->definition = object_share(object_ref(definition));
+    columns->length = length;
+
+    for (int i = 0; i < fields->count; i++)
+    {
+        // Columns are handed out as arrays and can reach other threads together
+        // with the collection, which is only shared as a whole, collection has 
+        // no trace hook so they are shared right away
+        columns->columns[i] = object_share(object_ref(array_create(fields->data[i].type.native, length)));
+    }
+
+    return columns;
+}
+
+struct ExecutionArray* columns_get_column(struct ExecutionColumns* columns, const char* field_name)
+{
+    struct ExecutionContextStructDefinitionFieldList* fields = &columns->definition->fields;
+
+    for (int i = 0; i < fields->count; i++)
+    {
+        if (strncmp(fields->data[i].name, field_name, MAX_IDENTIFIER_LENGTH) == 0)
+        {
+            return columns->columns[i];
+        }
+    }
+
+    return NULL;
+}
+
+bool columns_load(struct ExecutionColumns* columns, int64_t index, uint8_t* data)
+{
+    if (!columns || index < 0 || index >= columns->length)
+    {
+        return false;
+    }
+
+    struct ExecutionContextStructDefinitionFieldList* fields = &columns->definition->fields;
+
+    for (int i = 0; i < fields->count; i++)
+    {
+        struct ExecutionArray* column = columns->columns[i];
+        memcpy(&data[fields->data[i].offset], &column->data[index * column->element_size], column->element_size);
+    }
+
+    return true;
+}
+
+bool columns_store(struct ExecutionColumns* columns, int64_t index, const uint8_t* data)
+{
+    if (!columns || index < 0 || index >= columns->length)
+    {
+        return false;
+    }
+
+    struct ExecutionContextStructDefinitionFieldList* fields = &columns->definition->fields;
+
+    for (int i = 0; i < fields->count; i++)
+    {
+        struct ExecutionArray* column = columns->columns[i];
+        memcpy(&column->data[index * column->element_size], &data[fields->data[i].offset], column->element_size);
+    }
+
+    return true;
+}
+
+bool columns_check_definition(struct ExecutionContextStackValue value, struct ExecutionContextStructDefinition* definition)
+{
+    if (value.type != STACK_TYPE_COLUMNS)
+    {
+        return false;
+    }
+
+    struct ExecutionColumns* columns = *(struct ExecutionColumns**)value.ptr;
+
+    // Collections in zeroed struct fields are not allocated yet
+    return !columns || columns->definition == definition;
+}
+
+#pragma endregion --- COLUMNS ---
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "context.h"
+#include "array.h"
+
+#pragma region --- COLUMNS ---
+
+// Records of one struct type stored column-wise, every field of the definition
+// has its own array in field list order. Scanning one field touches only its
+// column, which is the same array the built-ins and indexing work with.
+struct ExecutionColumns
+{
+    struct ExecutionContextStructDefinition* definition;
+    uint32_t length;
+    struct ExecutionArray* columns[];
+};
+
+// Zero initialized records, NULL when a field of the struct is not numeric
+struct ExecutionColumns* columns_create(struct ExecutionContextStructDefinition* definition, uint32_t length);
+
+// Column of the named field, NULL when the field does not exist
+struct ExecutionArray* columns_get_column(struct ExecutionColumns* columns, const char* field_name);
+
+// Gathers one record into instance data laid out by the definition
+bool columns_load(struct ExecutionColumns* columns, int64_t index, uint8_t* data);
+
+// Scatters instance data laid out by the definition into one record
+bool columns_store(struct ExecutionColumns* columns, int64_t index, const uint8_t* data);
+
+// True for collections of the struct, not allocated collections match any struct
+bool columns_check_definition(struct ExecutionContextStackValue value, struct ExecutionContextStructDefinition* definition);
+
+#pragma endregion --- COLUMNS ---
@@ -6,16 +6,65 @@
 
 #include "defs.h"
 #include "object.h"
+#include "coroutine.h"
 #include "debug.h"
+#include "parser.h"
 
 #pragma region --- CONTEXT ---
 
-void context_struct_definition_field_list_add(
+bool context_struct_definition_field_list_add(
     struct ExecutionContextStructDefinitionFieldList* list, 
     struct ExecutionContextStructFieldDefinition def
 ) {
+    if (list->count >= MAX_STRUCT_FIELDS)
+    {
+        debug("ERR!: Struct cannot have more than %d fields\n", MAX_STRUCT_FIELDS);
+        return false;
+    }
+
+    if (list->count >= list->capacity)
+    {
+        int capacity = list->capacity > 0 ? list->capacity * 2 : 8;
+        struct ExecutionContextStructFieldDefinition* data = realloc(list->data, capacity * sizeof(def));
+
+        if (!data)
+        {
+            debug("ERR!: Out of memory for struct fields\n");
+            return false;
+        }
+
+        list->data = data;
+        list->capacity = capacity;
+    }
+
     list->data[list->count] = def;
     list->count++;
+    return true;
+}
+
+void context_struct_definition_free(const void* object_ref)
+{
+    // Free hook of struct definitions
+    struct ExecutionContextStructDefinition* definition = (struct ExecutionContextStructDefinition*)((uint8_t*)object_ref + sizeof(struct ref));
+
+    free(definition->fields.data);
+    free(definition->static_fields.data);
+    free(definition->static_data);
+}
+
+struct ExecutionContextStructFieldDefinition* context_struct_definition_field_list_find(
+    struct ExecutionContextStructDefinitionFieldList* list, 
+    const char* name
+) {
+    for (int i = 0; i < list->count; i++)
+    {
+        if (strncmp(list->data[i].name, name, MAX_IDENTIFIER_LENGTH) == 0)
+        {
+            return &list->data[i];
+        }
+    }
+
+    return NULL;
 }
 
 int context_eof(struct ExecutionContext* context)
@@ -35,6 +84,25 @@ void context_skip_spaces(struct ExecutionContext* context)
     };
 }
 
+void context_skip_string(struct ExecutionContext* context)
+{
+    // Moves past a '"' literal at the current position, so code skipping over it
+    // does not see braces or semicolons inside
+    context->position++;
+
+    while (context->position < context->code_len && context->code[context->position] != '"')
+    {
+        if (context->code[context->position] == '\\')
+        {
+            context->position++;
+        }
+
+        context->position++;
+    }
+
+    context->position++;
+}
+
 bool check_type_is_assignable_to(uint8_t current_type, uint8_t new_type)
 {
     if (!(current_type & STACK_TYPE_DYNAMIC) && !(current_type == STACK_TYPE_ACQUIRE))
@@ -48,6 +116,24 @@ bool check_type_is_assignable_to(uint8_t current_type, uint8_t new_type)
     return true;
 }
 
+bool check_type_is_integer(uint8_t type)
+{
+    return (type >= NATIVE_TYPE_I8 && type <= NATIVE_TYPE_U32) || type == NATIVE_TYPE_I64 || type == NATIVE_TYPE_U64;
+}
+
+bool check_type_is_numeric(uint8_t type)
+{
+    return check_type_is_integer(type) || type == NATIVE_TYPE_FLOAT || type == NATIVE_TYPE_DOUBLE;
+}
+
+bool check_type_is_reference(uint8_t type)
+{
+    // Value is an address of a reference counted object, or an immediate value
+    // tagged by OBJECT_IMMEDIATE_TAG
+    return type == STACK_TYPE_STRUCT || type == STACK_TYPE_OBJECT || type == STACK_TYPE_ARRAY
+        || type == STACK_TYPE_COLUMNS || type == NATIVE_TYPE_STRING || type == STACK_TYPE_MAP;
+}
+
 int get_size_of_native_type(uint8_t type)
 {
     if (type == STACK_TYPE_ACQUIRE)
@@ -98,7 +184,123 @@ int get_size_of_type(struct ExecutionContextTypeInfo type_info)
     return get_size_of_native_type(type_info.native);
 }
 
-void destruct_struct(struct ExecutionContextStructDefinition* definition, uint8_t* data);
+int get_alignment_of_native_type(uint8_t type)
+{
+    // all native types are naturally aligned
+    int size = get_size_of_native_type(type);
+
+    return size > 0 ? size : 1;
+}
+
+int get_alignment_of_type(struct ExecutionContextTypeInfo type_info)
+{
+    if (type_info.native == STACK_TYPE_STRUCT_INSTANCE)
+    {   
+        if (!type_info.complex)
+        {
+            debug("ERR!: Complex type is NULL\n");
+            return 1;
+        }
+
+        return type_info.complex->alignment;
+    }
+
+    return get_alignment_of_native_type(type_info.native);
+}
+
+int context_struct_definition_layout(struct ExecutionContextStructDefinitionFieldList* fields, bool reorder, int* alignment)
+{
+    // Assigns offsets to all fields and returns size of the struct, when reorder 
+    // is enabled fields are placed from the largest alignment to the smallest, 
+    // every size is a multiple of its alignment so this leaves no padding between them
+    int order[MAX_STRUCT_FIELDS];
+    int max_alignment = 1;
+
+    for (int i = 0; i < fields->count; i++)
+    {
+        int j = i;
+
+        // stable insertion sort, equal alignments keep declaration order
+        while (reorder && j > 0 && get_alignment_of_type(fields->data[order[j - 1]].type) < get_alignment_of_type(fields->data[i].type))
+        {
+            order[j] = order[j - 1];
+            --j;
+        }
+
+        order[j] = i;
+    }
+
+    int size = 0;
+
+    for (int i = 0; i < fields->count; i++)
+    {
+        struct ExecutionContextStructFieldDefinition* field = &fields->data[order[i]];
+        int field_alignment = get_alignment_of_type(field->type);
+
+        size = (size + field_alignment - 1) / field_alignment * field_alignment;
+        field->offset = size;
+        size += get_size_of_type(field->type);
+
+        if (field_alignment > max_alignment)
+        {
+            max_alignment = field_alignment;
+        }
+    }
+
+    *alignment = max_alignment;
+
+    // tail padding, so instances placed one after another stay aligned
+    return (size + max_alignment - 1) / max_alignment * max_alignment;
+}
+
+void context_struct_definition_build_reference_map(struct ExecutionContextStructDefinition* definition)
+{
+    // Has to be called after layout, flattens references of nested struct instances 
+    // so destruction does not need to walk the fields
+    int count = 0;
+
+    for (int i = 0; i < definition->fields.count && count >= 0; i++)
+    {
+        struct ExecutionContextStructFieldDefinition* field = &definition->fields.data[i];
+
+        if (check_type_is_reference(field->type.native))
+        {
+            if (count >= MAX_STRUCT_REFERENCE_OFFSETS)
+            {
+                count = -1;
+                break;
+            }
+
+            definition->reference_offsets[count++] = field->offset;
+        }
+        else if (field->type.native == STACK_TYPE_STRUCT_INSTANCE && field->type.complex)
+        {
+            struct ExecutionContextStructDefinition* nested = field->type.complex;
+
+            if (nested->reference_count < 0 || count + nested->reference_count > MAX_STRUCT_REFERENCE_OFFSETS)
+            {
+                count = -1;
+                break;
+            }
+
+            for (int j = 0; j < nested->reference_count; j++)
+            {
+                definition->reference_offsets[count++] = field->offset + nested->reference_offsets[j];
+            }
+        }
+    }
+
+    definition->reference_count = count;
+
+    if (count != 0)
+    {
+        definition->flags |= EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_NEEDS_DESTRUCTOR;
+    }
+    else 
+    {
+        definition->flags &= ~EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_NEEDS_DESTRUCTOR;
+    }
+}
 
 void destruct_field_list(struct ExecutionContextStructDefinitionFieldList* fields, uint8_t* data)
 {
@@ -106,7 +308,7 @@ void destruct_field_list(struct ExecutionContextStructDefinitionFieldList* field
     {
         struct ExecutionContextStructFieldDefinition* field_definition = &fields->data[i];
 
-        if (field_definition->type.native == STACK_TYPE_OBJECT || field_definition->type.native == STACK_TYPE_STRUCT)
+        if (check_type_is_reference(field_definition->type.native))
         {
             object_deref(*(void**)&data[field_definition->offset]);
         }
@@ -118,44 +320,204 @@ void destruct_field_list(struct ExecutionContextStructDefinitionFieldList* field
 
 void destruct_struct(struct ExecutionContextStructDefinition* definition, uint8_t* data)
 {
-    if ((definition->flags & 0x2) == 0)
+    if ((definition->flags & EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_NEEDS_DESTRUCTOR) == 0)
     {
         // No need to destruct, there is no references inside
         return;
     }
 
-    destruct_field_list(&definition->fields, data);
+    if (definition->reference_count < 0)
+    {
+        // Reference map overflowed, fallback to walking the fields
+        destruct_field_list(&definition->fields, data);
+        return;
+    }
+
+    for (int i = 0; i < definition->reference_count; i++)
+    {
+        object_deref(*(void**)&data[definition->reference_offsets[i]]);
+    }
 }
 
-#pragma region --- CONTEXT STACK ---
+void destruct_object(const void* object_ref)
+{
+    // Free hook of heap instances, data layout is the same as for instances on 
+    // the stack: definition pointer followed by the fields
+    uint8_t* object = (uint8_t*)object_ref + sizeof(struct ref);
+    struct ExecutionContextStructDefinition* definition = *(struct ExecutionContextStructDefinition**)object;
 
-struct ExecutionContextStackValue context_stack_get_value_at_index(struct ExecutionContext* context, int index)
+    destruct_struct(definition, object + sizeof(definition));
+    object_deref(definition);
+}
+
+void trace_field_list(struct ExecutionContextStructDefinitionFieldList* fields, uint8_t* data, ObjectVisitor visit, void* visit_data)
 {
-    int len = 1;
+    for (int i = 0; i < fields->count; i++)
+    {
+        struct ExecutionContextStructFieldDefinition* field_definition = &fields->data[i];
+        void* field_object = *(void**)&data[field_definition->offset];
 
-    if (context->stack_type[index] == STACK_TYPE_STRUCT_INSTANCE)
+        // All references are visited for sharing, cycle collector skips objects without trace
+        if (check_type_is_reference(field_definition->type.native) && field_object && !((uintptr_t)field_object & OBJECT_IMMEDIATE_TAG))
+        {
+            visit(field_object, visit_data);
+        }
+        else if (field_definition->type.native == STACK_TYPE_STRUCT_INSTANCE && field_definition->type.complex) {
+            struct ExecutionContextStructDefinition* field_type = field_definition->type.complex;
+
+            if (field_type->flags & EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_NEEDS_DESTRUCTOR)
+            {
+                trace_field_list(&field_type->fields, &data[field_definition->offset], visit, visit_data);
+            }
+        }
+    }
+}
+
+void trace_object(const void* object, ObjectVisitor visit, void* visit_data)
+{
+    // Trace hook of heap instances, visits the definition and objects referenced by the fields
+    uint8_t* data = (uint8_t*)object;
+    struct ExecutionContextStructDefinition* definition = *(struct ExecutionContextStructDefinition**)data;
+
+    visit(definition, visit_data);
+
+    if (definition->flags & EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_NEEDS_DESTRUCTOR)
+    {
+        trace_field_list(&definition->fields, data + sizeof(definition), visit, visit_data);
+    }
+}
+
+void copy_field_list(struct ExecutionContextStructDefinitionFieldList* fields, uint8_t* data)
+{
+    for (int i = 0; i < fields->count; i++)
     {
-        int len_index = index + 1;
+        struct ExecutionContextStructFieldDefinition* field_definition = &fields->data[i];
 
-        while (context->stack_type[len_index] != STACK_TYPE_STRUCT_END)
+        if (check_type_is_reference(field_definition->type.native))
         {
-            ++len_index;
-        }     
+            object_ref(*(void**)&data[field_definition->offset]);
+        }
+        else if (field_definition->type.native == STACK_TYPE_STRUCT_INSTANCE && field_definition->type.complex) {
+            copy_struct(field_definition->type.complex, &data[field_definition->offset]);
+        }
+    }
+}
 
-        len = len_index - index;  
+void copy_struct(struct ExecutionContextStructDefinition* definition, uint8_t* data)
+{
+    // Data was copied bytewise, the copy needs its own references. Moves skip this.
+    if ((definition->flags & EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_NEEDS_DESTRUCTOR) == 0)
+    {
+        return;
     }
 
-    if (context->stack_type[index] == STACK_TYPE_STRUCT_END)
+    if (definition->reference_count < 0)
+    {
+        copy_field_list(&definition->fields, data);
+        return;
+    }
+
+    for (int i = 0; i < definition->reference_count; i++)
     {
-        int len_index = index - 1;
+        object_ref(*(void**)&data[definition->reference_offsets[i]]);
+    }
+}
+
+int context_struct_instance_stack_size(struct ExecutionContextStructDefinition* definition)
+{
+    // definition pointer followed by instance data rounded up to whole stack slots
+    return 1 + (definition->size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+}
+
+#pragma region --- CONTEXT FUEL ---
 
-        while (context->stack_type[len_index] != STACK_TYPE_STRUCT_INSTANCE)
+void context_set_fuel(struct ExecutionContext* context, int64_t fuel, ExecutionContextFuelHook hook, void* user_data)
+{
+    context->fuel = fuel;
+    context->fuel_hook = hook;
+    context->fuel_hook_data = user_data;
+}
+
+bool context_fuel_exhausted(struct ExecutionContext* context)
+{
+    if (!context_is_running(context))
+    {
+        return false;
+    }
+
+    if (context->fuel_hook)
+    {
+        // Hook can do host work here (check deadline, service other scripts) 
+        // and then grant more fuel to continue
+        int64_t fuel = context->fuel_hook(context, context->fuel_hook_data);
+
+        if (context->state == EXECUTION_CONTEXT_STATE_SUSPENDED)
         {
-            --len_index;
-        }     
+            // Hook asked to give the thread to other scripts, continue when resumed
+            context_yield(context);
+        }
 
-        len = index - len_index;
-        index = len_index;  
+        if (fuel > 0 && context_is_running(context))
+        {
+            context->fuel = fuel;
+            return true;
+        }
+    }
+
+    debug("ERR!: Fuel budget exhausted, aborting execution\n");
+    context_abort(context);
+    return false;
+}
+
+void context_abort(struct ExecutionContext* context)
+{
+    context->state = EXECUTION_CONTEXT_STATE_ABORTED;
+    context->fuel = 0;
+}
+
+void context_suspend(struct ExecutionContext* context)
+{
+    // Only marks the context, it yields when the current native function or 
+    // fuel hook returns
+    if (context_is_running(context))
+    {
+        context->state = EXECUTION_CONTEXT_STATE_SUSPENDED;
+    }
+}
+
+void context_yield(struct ExecutionContext* context)
+{
+    if (!context->coroutine)
+    {
+        debug("ERR!: Context is not running as a coroutine and cannot be suspended\n");
+        context_abort(context);
+        return;
+    }
+
+    exec_coroutine_yield(context->coroutine);
+}
+
+#pragma endregion --- CONTEXT FUEL ---
+
+#pragma region --- CONTEXT STACK ---
+
+struct ExecutionContextStackValue context_stack_get_value_at_index(struct ExecutionContext* context, int index)
+{
+    // Struct instance starts with a STACK_TYPE_STRUCT_INSTANCE slot holding the definition,
+    // all following data slots are STACK_TYPE_STRUCT_END, so the start can be found from any slot
+    int len = 1;
+
+    if (context->stack_type[index] == STACK_TYPE_STRUCT_END)
+    {
+        while (context->stack_type[index] != STACK_TYPE_STRUCT_INSTANCE)
+        {
+            --index;
+        }
+    }
+
+    if (context->stack_type[index] == STACK_TYPE_STRUCT_INSTANCE)
+    {
+        len = context_struct_instance_stack_size(*(struct ExecutionContextStructDefinition**)&context->stack[index]);
     }
 
     return (struct ExecutionContextStackValue) { 
@@ -170,32 +532,75 @@ struct ExecutionContextStackValue context_stack_get_last_value(struct ExecutionC
     return context_stack_get_value_at_index(context, context->stack_index - 1);
 }
 
+void context_stack_value_ref(struct ExecutionContextStackValue value)
+{
+    // Takes references held by the value, done for every copy that owns its data
+
+    if (check_type_is_reference(value.type))
+    {
+        // for struct and object value will contain and address to a reference
+        // counted object
+        object_ref(*(void**)value.ptr);
+    }
+    else if (value.type == STACK_TYPE_STRUCT_INSTANCE)
+    {
+        // for struct instance, first field will always be its type and it needs to be 
+        // reference counted, same for references in the data
+        struct ExecutionContextStructDefinition* definition = *(void**)value.ptr;
+
+        object_ref(definition);
+        copy_struct(definition, (uint8_t*)(value.ptr + 1));
+    }
+}
+
+void context_stack_own_value_at_index(struct ExecutionContext* context, int index)
+{
+    // Borrowed value takes its own references, so it can outlive the variable it was read from
+    if (!(context->stack_flags[index] & STACK_FLAG_BORROWED))
+    {
+        return;
+    }
+
+    context->stack_flags[index] &= ~STACK_FLAG_BORROWED;
+    context_stack_value_ref(context_stack_get_value_at_index(context, index));
+}
+
+void context_stack_own_borrowed_values(struct ExecutionContext* context)
+{
+    // Called before a variable holding references is overwritten, 
+    // temporaries borrowed from it would be left dangling otherwise
+    struct ExecutionContextStackIterator iterator = context_stack_iterate(context);
+
+    while (iterator.stack_index > 0)
+    {
+        context_stack_iterator_next(context, &iterator);
+        context_stack_own_value_at_index(context, iterator.stack_index);
+    }
+}
+
 void context_stack_reset_value_at_index(struct ExecutionContext* context, int index, struct ExecutionContextStackValue value)
 {
     // method is unsafe, does not care about existing data and references, 
     // should be only used to initialize or force override stack data
+    context->stack_flags[index] = STACK_FLAG_NONE;
 
-    if (value.type == STACK_TYPE_STRUCT || value.type == STACK_TYPE_OBJECT)
+    if (check_type_is_reference(value.type))
     {
-        // for struct and object value will contain and address to a reference
-        // counted object
         object_ref(*(void**)value.ptr);
     }
     
     if (value.type == STACK_TYPE_STRUCT_INSTANCE)
     {
-        // for struct instance, first field will always be its type and it needs to be 
-        // reference counted after adding to the stack
-        object_ref(*(void**)value.ptr);
+        struct ExecutionContextStructDefinition* definition = *(void**)value.ptr;
+        int stack_size = context_struct_instance_stack_size(definition);
 
-        memcpy(&context->stack[index], value.ptr, value.size);
+        memmove(&context->stack[index], value.ptr, stack_size * sizeof(context->stack[0]));
+        context_stack_value_ref((struct ExecutionContextStackValue) { .ptr = &context->stack[index], .type = value.type, .size = stack_size });
         context->stack_type[index] = value.type;
 
-        int stack_size = (value.size - 1) / 8 + 1;
-
         for (int i = 1; i < stack_size; i++)
         {
-            context->stack_type[index + i] = value.type;
+            context->stack_type[index + i] = STACK_TYPE_STRUCT_END;
         }
     }
     else
@@ -212,23 +617,67 @@ struct ExecutionContextStackValue context_stack_unset_value_at_index(struct Exec
 
     struct ExecutionContextStackValue current_value = context_stack_get_value_at_index(context, index);
 
-    if (current_value.type == STACK_TYPE_STRUCT || current_value.type == STACK_TYPE_OBJECT)
+    if (context->stack_flags[index] & STACK_FLAG_BORROWED)
+    {
+        // References belong to the variable the value was read from
+        context->stack_flags[index] = STACK_FLAG_NONE;
+        return current_value;
+    }
+
+    if (check_type_is_reference(current_value.type))
     {
         object_deref(*(void**)current_value.ptr);
     }
     else if (current_value.type == STACK_TYPE_STRUCT_INSTANCE)
     {
-        destruct_struct(*(void**)current_value.ptr, ((uint8_t*)current_value.ptr) + sizeof(void*));
+        struct ExecutionContextStructDefinition* definition = *(void**)current_value.ptr;
+
+        destruct_struct(definition, ((uint8_t*)current_value.ptr) + sizeof(void*));
+
+        // instance holds a reference to its definition, see context_stack_reset_value_at_index
+        object_deref(definition);
     }
 
     return current_value;
 }
 
+void context_stack_move_value_at_index(struct ExecutionContext* context, int index, struct ExecutionContextStackValue value)
+{
+    // Like reset, but ownership of the references is taken over from the source, 
+    // so the source slots have to be dropped afterwards without unsetting them.
+    // When the value is already in place (declaration over a temporary) only types are restored
+    int stack_size = value.type == STACK_TYPE_STRUCT_INSTANCE 
+        ? context_struct_instance_stack_size(*(struct ExecutionContextStructDefinition**)value.ptr) 
+        : 1;
+    int source_index = value.ptr - context->stack;
+
+    if (source_index >= 0 && source_index < context->stack_index && (context->stack_flags[source_index] & STACK_FLAG_BORROWED))
+    {
+        // Storing into a variable, borrowed temporary has to own its references first.
+        // Slot type can be already overridden by the declaration, so value type is used
+        context->stack_flags[source_index] = STACK_FLAG_NONE;
+        context_stack_value_ref(value);
+    }
+
+    if (value.ptr != &context->stack[index])
+    {
+        memmove(&context->stack[index], value.ptr, stack_size * sizeof(context->stack[0]));
+    }
+
+    context->stack_type[index] = value.type;
+    context->stack_flags[index] = STACK_FLAG_NONE;
+
+    for (int i = 1; i < stack_size; i++)
+    {
+        context->stack_type[index + i] = STACK_TYPE_STRUCT_END;
+    }
+}
+
 void context_stack_set_value_at_index(struct ExecutionContext* context, int index, struct ExecutionContextStackValue value)
 {
     // index should always point at the beggining of the struct
 
-    struct ExecutionContextStackValue current_value = context_stack_unset_value_at_index(context, index);
+    struct ExecutionContextStackValue current_value = context_stack_get_value_at_index(context, index);
 
     if (!check_type_is_assignable_to(current_value.type, value.type))
     {
@@ -236,6 +685,7 @@ void context_stack_set_value_at_index(struct ExecutionContext* context, int inde
         return;
     }
 
+    context_stack_unset_value_at_index(context, index);
     context_stack_reset_value_at_index(context, index, value);
 }
 
@@ -246,7 +696,9 @@ int context_stack_push_value(struct ExecutionContext* context, struct ExecutionC
         return -1;
     }
 
-    int stack_size = (value.size - 1) / 8 + 1;
+    int stack_size = value.type == STACK_TYPE_STRUCT_INSTANCE 
+        ? context_struct_instance_stack_size(*(struct ExecutionContextStructDefinition**)value.ptr) 
+        : (value.size - 1) / 8 + 1;
     int index = context->stack_index;
     context->stack_index += stack_size;
 
@@ -259,6 +711,55 @@ int context_stack_push_value(struct ExecutionContext* context, struct ExecutionC
     return index;
 }
 
+int context_stack_push_borrowed_value(struct ExecutionContext* context, struct ExecutionContextStackValue value)
+{
+    // Pushes a copy without taking references, see STACK_FLAG_BORROWED
+    int stack_size = value.type == STACK_TYPE_STRUCT_INSTANCE 
+        ? context_struct_instance_stack_size(*(struct ExecutionContextStructDefinition**)value.ptr) 
+        : 1;
+    int index = context->stack_index;
+    context->stack_index += stack_size;
+
+    memcpy(&context->stack[index], value.ptr, stack_size * sizeof(context->stack[0]));
+    context->stack_type[index] = value.type;
+    context->stack_flags[index] = STACK_FLAG_BORROWED;
+
+    for (int i = 1; i < stack_size; i++)
+    {
+        context->stack_type[index + i] = STACK_TYPE_STRUCT_END;
+    }
+
+    #ifdef TOKEN_DEBUG
+        debug("Pushed borrowed to stack (count: %d, value: %d, type: %s)\n", context->stack_index, context->stack[index], get_stack_type_name(context->stack_type[index]));
+    #endif
+
+    return index;
+}
+
+int context_stack_push_struct_instance(struct ExecutionContext* context, struct ExecutionContextStructDefinition* definition, uint8_t* data)
+{
+    // Pushes a copy of instance data stored without its definition, e.g. in a field
+    int stack_size = context_struct_instance_stack_size(definition);
+    int index = context->stack_index;
+    context->stack_index += stack_size;
+
+    object_ref(definition);
+
+    context->stack[index] = (uint64_t)definition;
+    context->stack[index + stack_size - 1] = 0;
+    memcpy(&context->stack[index + 1], data, definition->size);
+    copy_struct(definition, (uint8_t*)&context->stack[index + 1]);
+    context->stack_type[index] = STACK_TYPE_STRUCT_INSTANCE;
+    context->stack_flags[index] = STACK_FLAG_NONE;
+
+    for (int i = 1; i < stack_size; i++)
+    {
+        context->stack_type[index + i] = STACK_TYPE_STRUCT_END;
+    }
+
+    return index;
+}
+
 int context_stack_pop_value(struct ExecutionContext* context)
 {
     if (context->stack_index == 0) 
@@ -301,8 +802,26 @@ struct ExecutionContextStackValue context_stack_iterator_next(struct ExecutionCo
 
 void context_scope_init(struct ExecutionContext* context)
 {
-    context->scopes[context->scope_index].variable_count = 0;
-    context->scopes[context->scope_index].min_stack_index = context->stack_index;
+    struct ExecutionContextScope* scope = &context->scopes[context->scope_index];
+
+    if (context->scope_index == 0)
+    {
+        scope->variables = context->global_variables;
+        scope->variable_capacity = MAX_SCOPE_VARIABLES;
+    }
+    else
+    {
+        // Only the innermost function scope adds variables, so it can take
+        // everything after the variables of the scope below it
+        struct ExecutionContextScope* previous = &context->scopes[context->scope_index - 1];
+        scope->variables = context->scope_index == 1 ? context->local_variables : previous->variables + previous->variable_count;
+
+        int available = MAX_LOCAL_VARIABLES - (int)(scope->variables - context->local_variables);
+        scope->variable_capacity = available < MAX_SCOPE_VARIABLES ? available : MAX_SCOPE_VARIABLES;
+    }
+
+    scope->variable_count = 0;
+    scope->min_stack_index = context->stack_index;
 }
 
 struct ExecutionContextScope* context_get_scope(struct ExecutionContext* context)
@@ -375,9 +894,16 @@ struct ExecutionContextVariable* context_scope_add_variable(
     const char* name, 
     int stack_index
 ) {
+    if (scope->variable_count >= scope->variable_capacity)
+    {
+        debug("ERR!: Too many variables in scope, cannot add '%s'\n", name);
+        return NULL;
+    }
+
     int index = scope->variable_count++;
     strncpy(scope->variables[index].name, name, MAX_IDENTIFIER_LENGTH);
     scope->variables[index].stack_index = stack_index;
+    scope->variables[index].flags = VARIABLE_FLAG_NONE;
 
     #ifdef TOKEN_DEBUG
         debug("Adding variable '%s' (stack index: %d) to scope.\n", name, stack_index);
@@ -386,11 +912,24 @@ struct ExecutionContextVariable* context_scope_add_variable(
     return &scope->variables[index];
 }
 
-struct ExecutionContextStackValue context_scope_get_last_value_on_stack_in_scope(struct ExecutionContext* context)
+int context_scope_get_variables_end_stack_index(struct ExecutionContext* context)
 {
     struct ExecutionContextScope* scope = context_get_scope(context);
 
-    if (context->stack_index == scope->min_stack_index + scope->variable_count)
+    if (scope->variable_count == 0)
+    {
+        return scope->min_stack_index;
+    }
+
+    // variables are added in stack order and struct instances take more than one slot
+    int last_stack_index = scope->variables[scope->variable_count - 1].stack_index;
+
+    return last_stack_index + context_stack_get_value_at_index(context, last_stack_index).size;
+}
+
+struct ExecutionContextStackValue context_scope_get_last_value_on_stack_in_scope(struct ExecutionContext* context)
+{
+    if (context->stack_index == context_scope_get_variables_end_stack_index(context))
     {
         return (struct ExecutionContextStackValue) 
         {
@@ -418,7 +957,8 @@ struct ExecutionContextStackValue context_variable_get_value(struct ExecutionCon
 
 void context_variable_push_into_stack(struct ExecutionContext* context, struct ExecutionContextVariable* variable)
 {
-    context_stack_push_value(context, context_variable_get_value(context, variable));
+    // Variable outlives expression temporaries, reading it does not touch reference counts
+    context_stack_push_borrowed_value(context, context_variable_get_value(context, variable));
 }
 
 struct ExecutionContextVariable* context_add_variable(
@@ -440,6 +980,7 @@ struct ExecutionContextVariable* context_add_variable(
     if (!override)
     {
         context->stack[stack_index] = 0;
+        context->stack_flags[stack_index] = STACK_FLAG_NONE;
     }
     else 
     {
@@ -510,6 +1051,53 @@ struct ExecutionContextVariable* context_lookup_variable(struct ExecutionContext
     return &local_scope->variables[lookup];
 }
 
+struct ExecutionContextTypeInfo context_get_value_type(struct ExecutionContextTypeInfo type_info)
+{
+    // struct name used as a type of a variable, field or argument means 
+    // an instance of that struct stored by value
+    if (type_info.native == STACK_TYPE_STRUCT && type_info.complex)
+    {
+        type_info.native = STACK_TYPE_STRUCT_INSTANCE;
+    }
+
+    return type_info;
+}
+
+struct ExecutionContextTypeInfo context_parse_array_type(struct ExecutionContext* context, struct ExecutionContextTypeInfo element_type)
+{
+    // Numeric type followed by '[]' and a name is an array type, struct type makes
+    // a column collection. '[' is left for the caller otherwise, it can be a bound 
+    // function or an allocation.
+    bool is_struct = element_type.native == STACK_TYPE_STRUCT;
+
+    if ((!check_type_is_numeric(element_type.native) && !is_struct) || context->code[context->position] != '[')
+    {
+        return element_type;
+    }
+
+    int position = context->position;
+
+    context->position++;
+    context_skip_spaces(context);
+
+    if (context->code[context->position] == ']')
+    {
+        context->position++;
+        context_skip_spaces(context);
+
+        if (parse_is_identifier_start(context->code[context->position]))
+        {
+            return (struct ExecutionContextTypeInfo) { 
+                .native = is_struct ? STACK_TYPE_COLUMNS : STACK_TYPE_ARRAY, 
+                .complex = element_type.complex 
+            };
+        }
+    }
+
+    context->position = position;
+    return element_type;
+}
+
 struct ExecutionContextTypeInfo context_get_type_from_identifier(
     struct ExecutionContext* context,
     const char* identifier, 
@@ -519,6 +1107,7 @@ struct ExecutionContextTypeInfo context_get_type_from_identifier(
     struct ExecutionContextTypeInfo type_info;
     type_info.native = 255;
     type_info.complex = NULL;
+    type_info.is_const = false;
 
     if (identifier_length == 3 && strncmp(identifier, "var", 3) == 0)
     {
@@ -529,6 +1118,12 @@ struct ExecutionContextTypeInfo context_get_type_from_identifier(
     {
         type_info.native = STACK_TYPE_ACQUIRE;
     }
+    else if (identifier_length == 5 && strncmp(identifier, "const", 5) == 0)
+    {
+        // like 'let', but the variable cannot be assigned later
+        type_info.native = STACK_TYPE_ACQUIRE;
+        type_info.is_const = true;
+    }
     else if (identifier_length == 4 && strncmp(identifier, "void", 4) == 0)
     {
         type_info.native = NATIVE_TYPE_VOID;
@@ -584,6 +1179,22 @@ struct ExecutionContextTypeInfo context_get_type_from_identifier(
         type_info.native = NATIVE_TYPE_U64;
         type_info.complex = &context->native_types[NATIVE_TYPE_U64];
     }
+    else if (identifier_length == 6 && strncmp(identifier, "string", 6) == 0)
+    {
+        type_info.native = NATIVE_TYPE_STRING;
+        type_info.complex = &context->native_types[NATIVE_TYPE_STRING];
+    }
+    else if (identifier_length == 3 && strncmp(identifier, "map", 3) == 0)
+    {
+        type_info.native = STACK_TYPE_MAP;
+        type_info.complex = &context->native_types[STACK_TYPE_MAP];
+    }
+    else if (identifier_length == 6 && strncmp(identifier, "object", 6) == 0)
+    {
+        // Reference to any heap object
+        type_info.native = STACK_TYPE_OBJECT;
+        type_info.complex = &context->native_types[STACK_TYPE_OBJECT];
+    }
     else 
     {
         struct ExecutionContextVariable* variable = context_lookup_variable(context, identifier);
@@ -599,19 +1210,31 @@ struct ExecutionContextTypeInfo context_get_type_from_identifier(
             }
         }
 
-        *found_variable = variable;
+        if (found_variable)
+        {
+            *found_variable = variable;
+        }
     }
 
     if (type_info.complex)
     {
         uint64_t value = (uint64_t)type_info.complex;
-
-        context_stack_push_value(context, (struct ExecutionContextStackValue) 
+        struct ExecutionContextStackValue type_value = 
         {
             .type = type_info.native == STACK_TYPE_STRUCT ? STACK_TYPE_STRUCT : NATIVE_TYPE_TYPEDEF,
             .size = get_size_of_native_type(NATIVE_TYPE_TYPEDEF),
             .ptr = &value 
-        });
+        };
+
+        if (type_info.native == STACK_TYPE_STRUCT)
+        {
+            // struct definition is held by the variable it was found in
+            context_stack_push_borrowed_value(context, type_value);
+        }
+        else 
+        {
+            context_stack_push_value(context, type_value);
+        }
     }
 
     return type_info;
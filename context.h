@@ -1,3 +1,5 @@
+#pragma once
+
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -10,6 +12,8 @@ struct ExecutionContextTypeInfo
 {
     uint8_t native;
     struct ExecutionContextStructDefinition* complex;
+    // declared with 'const'
+    bool is_const;
 };
 
 struct ExecutionContextStructFieldDefinition
@@ -27,28 +31,36 @@ struct ExecutionContextStructFunctionDefintion
     struct ExecutionContextStructFieldDefinition parameters[8];
 };
 
+// Fields of one struct, the layout orders them in a buffer of this size
+#define MAX_STRUCT_FIELDS 64
+
 struct ExecutionContextStructDefinitionFieldList
 {
-    struct ExecutionContextStructFieldDefinition data[8];
+    // grows on add, freed with the definition
+    struct ExecutionContextStructFieldDefinition* data;
     int count;
     int capacity;
 };
 
-void context_struct_definition_field_list_add(
+bool context_struct_definition_field_list_add(
     struct ExecutionContextStructDefinitionFieldList* list, 
     struct ExecutionContextStructFieldDefinition def
 );
+void context_struct_definition_free(const void* object_ref);
 
 enum ExecutionContextStructDefinitionFlags
 {
-    EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_NONE,
-    EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_NATIVE,
-    EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_STRUCT,
-    EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_CLASS,
-    EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_NEEDS_DESTRUCTOR,
-    EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_TUPLE,
+    EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_NONE = 0x0,
+    EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_NATIVE = 0x1,
+    EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_STRUCT = 0x2,
+    EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_CLASS = 0x4,
+    // instance holds references, without it the struct is trivially destructible
+    EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_NEEDS_DESTRUCTOR = 0x8,
+    EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_TUPLE = 0x10,
 };
 
+#define MAX_STRUCT_REFERENCE_OFFSETS 32
+
 struct ExecutionContextStructDefinition
 {
     struct ExecutionContextStructDefinitionFieldList fields;
@@ -56,20 +68,42 @@ struct ExecutionContextStructDefinition
      // see ExecutionContextStructDefinitionFlags
     uint8_t flags; 
     int size;
+    // alignment required by the largest field, size is always its multiple
+    int alignment;
     int static_size;
     uint8_t* static_data;
     uint8_t native_type;
+    // Offsets of all references inside instance data including nested struct 
+    // instances, -1 when there are too many and fields have to be walked
+    int reference_count;
+    int reference_offsets[MAX_STRUCT_REFERENCE_OFFSETS];
+};
+
+enum ExecutionContextVariableFlags
+{
+    VARIABLE_FLAG_NONE = 0x0,
+    // declared with 'const', cannot be assigned
+    VARIABLE_FLAG_CONST = 0x1,
 };
 
 struct ExecutionContextVariable
 {
     char name[MAX_IDENTIFIER_LENGTH];
     int stack_index;
+    uint8_t flags;
 };
 
+// Global scope holds native functions as well
+#define MAX_SCOPE_VARIABLES 64
+// Variables of all function scopes of a context together
+#define MAX_LOCAL_VARIABLES 256
+
 struct ExecutionContextScope
 {
-    struct ExecutionContextVariable variables[16];
+    // global scope points to global_variables of the context, function scopes
+    // to consecutive ranges of its local_variables
+    struct ExecutionContextVariable* variables;
+    int variable_capacity;
     int variable_count;
     int min_stack_index;
 };
@@ -81,6 +115,255 @@ struct ExecutionContextStackValue
     uint64_t* ptr;
 };
 
+enum ExecutionContextState
+{
+    EXECUTION_CONTEXT_STATE_RUNNING,
+    EXECUTION_CONTEXT_STATE_ABORTED,
+    // waiting for the host to resume it, see ExecutionCoroutine
+    EXECUTION_CONTEXT_STATE_SUSPENDED,
+    EXECUTION_CONTEXT_STATE_FINISHED,
+};
+
+// Fuel cost of a single step of exec_expression and of entering a call, 
+// calls are more expensive because they also parse arguments and push scope
+#define FUEL_COST_OPERATION 1
+#define FUEL_COST_CALL 8
+
+struct ExecutionContext;
+struct ExecutionScheduler;
+struct ExecutionSchedulerTask;
+struct ExecutionCoroutine;
+struct ExecutionLoop;
+
+// Called when fuel drops to zero, returns amount of fuel granted for further 
+// execution, returning 0 or less aborts the execution
+typedef int64_t (*ExecutionContextFuelHook)(struct ExecutionContext* context, void* user_data);
+
+#define MAX_REGISTRY_FUNCTIONS 64
+
+enum ExecutionRegistryFunctionFlags
+{
+    REGISTRY_FUNCTION_FLAG_NONE = 0x0,
+    // result only depends on the arguments and nothing else is changed, calls with
+    // constant arguments are evaluated before execution
+    REGISTRY_FUNCTION_FLAG_PURE = 0x1,
+};
+
+struct ExecutionRegistryFunction
+{
+    char name[MAX_IDENTIFIER_LENGTH];
+    void (*func)(struct ExecutionContext* context);
+    uint8_t flags;
+};
+
+// Native types and native functions available to scripts, it is filled once by 
+// the host and after that only read, so it can be shared by many contexts 
+// running on different threads
+struct ExecutionRegistry
+{
+    struct ExecutionContextStructDefinition native_types[22];
+    struct ExecutionRegistryFunction functions[MAX_REGISTRY_FUNCTIONS];
+    int function_count;
+};
+
+enum ExecutionContextStackFlags
+{
+    STACK_FLAG_NONE = 0x0,
+    // Slot holds a copy of a variable without taking references, it is valid while 
+    // the variable is alive and has to be owned before it is stored anywhere
+    STACK_FLAG_BORROWED = 0x1,
+};
+
+#define MAX_STACK_SIZE 256
+
+#define MAX_ESCAPE_ANALYZED_FUNCTIONS 16
+#define MAX_ESCAPE_STACK_SITES 32
+
+// Results of escape analysis, see escape.h
+struct ExecutionContextEscapeInfo
+{
+    // code positions of function literals which were already analyzed
+    int analyzed_functions[MAX_ESCAPE_ANALYZED_FUNCTIONS];
+    int analyzed_function_count;
+    // code positions of 'new' expressions which can stay on the stack
+    int stack_sites[MAX_ESCAPE_STACK_SITES];
+    int stack_site_count;
+};
+
+#define MAX_TYPED_ASSIGNMENTS 64
+
+// Results of type inference, see infer.h
+struct ExecutionContextInferenceInfo
+{
+    // code positions of '=' of assignments proven to keep the variable type, ascending
+    int typed_assignments[MAX_TYPED_ASSIGNMENTS];
+    int typed_assignment_count;
+    // type errors found before execution, script does not run when there are any
+    int error_count;
+};
+
+#define MAX_FOLDED_EXPRESSIONS 128
+#define MAX_DEAD_STATEMENTS 64
+
+// Expression replaced by its value computed before execution
+struct ExecutionContextFoldedExpression
+{
+    int start_position;
+    int end_position;
+    uint8_t type;
+    uint64_t value;
+};
+
+// Statement without any effect, execution continues after its ';'
+struct ExecutionContextDeadStatement
+{
+    int start_position;
+    int end_position;
+};
+
+// Results of constant folding, see fold.h
+struct ExecutionContextFoldInfo
+{
+    // both ascending by start position
+    struct ExecutionContextFoldedExpression expressions[MAX_FOLDED_EXPRESSIONS];
+    int expression_count;
+    struct ExecutionContextDeadStatement dead_statements[MAX_DEAD_STATEMENTS];
+    int dead_statement_count;
+};
+
+#define MAX_INLINED_CALLS 64
+
+// Call of a known function replaced by its body, see inline.h
+struct ExecutionContextInlinedCall
+{
+    // from the callee name to after ')' of the call
+    int start_position;
+    int end_position;
+    // first character after '{' of the callee body
+    int body_position;
+};
+
+struct ExecutionContextInlineInfo
+{
+    // ascending by start position
+    struct ExecutionContextInlinedCall calls[MAX_INLINED_CALLS];
+    int call_count;
+};
+
+#define MAX_JIT_FUNCTIONS 16
+#define MAX_JIT_FEEDBACK_ARGS 8
+
+// Call count and compiled code of one function literal, see jit.h
+struct ExecutionContextJitFunction
+{
+    int function_position;
+    uint32_t call_count;
+    // see ExecutionJitState
+    uint8_t state;
+    // see ExecutionJitBackend
+    uint8_t backend;
+    uint8_t param_count;
+    // every argument is checked against its parameter type before compiled code runs
+    uint8_t param_types[MAX_JIT_FEEDBACK_ARGS];
+    // type feedback of interpreted calls: types of argument slots, STACK_TYPE_DYNAMIC 
+    // for a slot which had more than one type, -1 count before the first call and
+    // when calls had different numbers of slots
+    uint8_t feedback_types[MAX_JIT_FEEDBACK_ARGS];
+    int8_t feedback_count;
+    // code assumes types of 'var'/'let' parameters from feedback
+    bool speculative;
+    uint16_t deopt_count;
+    uint8_t compile_count;
+    int add_count;
+    int fuel_cost;
+    // global 'add' variable checked before compiled code runs, resolved again
+    // when number of globals changes
+    int add_stack_index;
+    int global_variable_count;
+    void* code;
+};
+
+struct ExecutionContextJitInfo
+{
+    struct ExecutionContextJitFunction functions[MAX_JIT_FUNCTIONS];
+    int function_count;
+};
+
+#define MAX_REGISTER_FUNCTIONS 16
+#define MAX_REGISTER_INSTRUCTIONS 64
+#define MAX_REGISTERS 32
+#define MAX_REGISTER_CALL_ARGS 6
+
+// How interpreted function bodies are executed
+enum ExecutionEngine
+{
+    // exec_function_body walks the code and evaluates expressions on the stack
+    EXECUTION_ENGINE_STACK,
+    // bodies are compiled to register code on their first call, see regvm.h
+    EXECUTION_ENGINE_REGISTER,
+};
+
+// One instruction of register code, operands are register indices in the function frame
+struct ExecutionContextRegisterInstruction
+{
+    // see ExecutionRegisterOp, rewritten to a quickened or fused form while running
+    uint8_t op;
+    // op the instruction was compiled to, quickened forms fall back to it
+    uint8_t generic_op;
+    // value type the quickened form was specialized for
+    uint8_t quickened_type;
+    uint8_t deopt_count;
+    // type of a constant, declared type of a local
+    uint8_t type;
+    uint8_t arg_count;
+    int8_t dst;
+    int8_t args[MAX_REGISTER_CALL_ARGS];
+    // constant value, or callee value a quickened call was specialized for
+    uint64_t value;
+    // executions since compiled or last deoptimized
+    uint32_t count;
+    // name of a global, code position and length
+    int name_position;
+    int name_length;
+    // global slot of the name, resolved again when number of globals changes
+    int global_stack_index;
+    int global_variable_count;
+};
+
+// Register code of one function literal, registers are stack slots of its frame:
+// parameters first, then locals and temporaries
+struct ExecutionContextRegisterFunction
+{
+    int function_position;
+    // see ExecutionRegisterState
+    uint8_t state;
+    uint8_t param_count;
+    uint8_t register_count;
+    // declared parameter types, STACK_TYPE_ACQUIRE for 'var' and 'let' parameters
+    uint8_t param_types[MAX_REGISTERS];
+    struct ExecutionContextRegisterInstruction instructions[MAX_REGISTER_INSTRUCTIONS];
+    int instruction_count;
+};
+
+struct ExecutionContextRegisterInfo
+{
+    struct ExecutionContextRegisterFunction functions[MAX_REGISTER_FUNCTIONS];
+    int function_count;
+};
+
+// Code of a script with results of the analysis done before it runs. Built once by
+// exec_script_create and only read after that, so every context running the same
+// code shares it. Reference counted, contexts hold a reference.
+struct ExecutionScript
+{
+    const char* code;
+    int code_len;
+    struct ExecutionRegistry* registry;
+    struct ExecutionContextInferenceInfo inference;
+    struct ExecutionContextFoldInfo fold;
+    struct ExecutionContextInlineInfo inlining;
+};
+
 struct ExecutionContext
 {
     const char* code;
@@ -89,11 +372,43 @@ struct ExecutionContext
     struct ExecutionContextScope* global_scope;
     struct ExecutionContextScope scopes[16];
     int scope_index;
-    uint64_t stack[64];
-    uint8_t stack_type[64];
+    struct ExecutionContextVariable global_variables[MAX_SCOPE_VARIABLES];
+    struct ExecutionContextVariable local_variables[MAX_LOCAL_VARIABLES];
+    uint64_t stack[MAX_STACK_SIZE];
+    uint8_t stack_type[MAX_STACK_SIZE];
+    // see ExecutionContextStackFlags, only first slot of a value is used
+    uint8_t stack_flags[MAX_STACK_SIZE];
     int stack_index;
     int stack_variables;
-    struct ExecutionContextStructDefinition native_types[18];
+    // first argument of currently called native function
+    int native_frame_stack_index;
+    struct ExecutionRegistry* registry;
+    // points to registry native types, must not be modified
+    struct ExecutionContextStructDefinition* native_types;
+    // see ExecutionContextState
+    uint8_t state;
+    int64_t fuel;
+    ExecutionContextFuelHook fuel_hook;
+    void* fuel_hook_data;
+    // optional, when NULL spawned tasks run immediately on the calling thread
+    struct ExecutionScheduler* scheduler;
+    // spawned and not joined yet, handles given to the script are their ids
+    struct ExecutionSchedulerTask* tasks;
+    uint64_t last_task_id;
+    // set when context runs as a coroutine and can be suspended
+    struct ExecutionCoroutine* coroutine;
+    // set when coroutine is driven by an event loop, natives use it for async I/O
+    struct ExecutionLoop* loop;
+    // owned by the host, natives can use it to find host state for the context
+    void* user_data;
+    // referenced, shared with child contexts
+    struct ExecutionScript* script;
+    struct ExecutionContextEscapeInfo escape;
+    struct ExecutionContextJitInfo jit;
+    // see ExecutionEngine, host can change it before the context runs
+    uint8_t engine;
+    // allocated on the first call of the register engine
+    struct ExecutionContextRegisterInfo* registers;
 };
 
 enum ExecutionContextIdentifierResultType
@@ -102,6 +417,7 @@ enum ExecutionContextIdentifierResultType
     EXECUTION_CONTEXT_IDENTIFIER_RESULT_TYPE,
     EXECUTION_CONTEXT_IDENTIFIER_RESULT_VARIABLE,
     EXECUTION_CONTEXT_IDENTIFIER_RESULT_VALUE,
+    EXECUTION_CONTEXT_IDENTIFIER_RESULT_FIELD,
     EXECUTION_CONTEXT_IDENTIFIER_RESULT_ERROR,
 };
 
@@ -111,6 +427,11 @@ struct ExecutionContextIdentifierResult
     union {
         struct ExecutionContextTypeInfo type_data;
         struct ExecutionContextVariable* variable_data;
+        // field of a struct instance stored in a variable, can be assigned to
+        struct {
+            struct ExecutionContextVariable* variable;
+            struct ExecutionContextStructFieldDefinition* field;
+        } field_data;
     };
 };
 
@@ -119,14 +440,54 @@ struct ExecutionContextStackIterator
     int stack_index;
 };
 
+struct ExecutionContextStructFieldDefinition* context_struct_definition_field_list_find(
+    struct ExecutionContextStructDefinitionFieldList* list, 
+    const char* name
+);
+
 int context_eof(struct ExecutionContext* context);
 void context_skip_spaces(struct ExecutionContext* context);
+void context_skip_string(struct ExecutionContext* context);
 bool check_type_is_assignable_to(uint8_t current_type, uint8_t new_type);
+bool check_type_is_integer(uint8_t type);
+bool check_type_is_numeric(uint8_t type);
+bool check_type_is_reference(uint8_t type);
 int get_size_of_native_type(uint8_t type);
 int get_size_of_type(struct ExecutionContextTypeInfo type_info);
-void destruct_struct(struct ExecutionContextStructDefinition* definition, uint8_t* data);
+int get_alignment_of_native_type(uint8_t type);
+int get_alignment_of_type(struct ExecutionContextTypeInfo type_info);
+int context_struct_definition_layout(struct ExecutionContextStructDefinitionFieldList* fields, bool reorder, int* alignment);
+void context_struct_definition_build_reference_map(struct ExecutionContextStructDefinition* definition);
 void destruct_field_list(struct ExecutionContextStructDefinitionFieldList* fields, uint8_t* data);
 void destruct_struct(struct ExecutionContextStructDefinition* definition, uint8_t* data);
+void destruct_object(const void* object_ref);
+void trace_field_list(struct ExecutionContextStructDefinitionFieldList* fields, uint8_t* data, ObjectVisitor visit, void* visit_data);
+void trace_object(const void* object, ObjectVisitor visit, void* visit_data);
+void copy_field_list(struct ExecutionContextStructDefinitionFieldList* fields, uint8_t* data);
+void copy_struct(struct ExecutionContextStructDefinition* definition, uint8_t* data);
+int context_struct_instance_stack_size(struct ExecutionContextStructDefinition* definition);
+
+#pragma region --- CONTEXT FUEL ---
+
+void context_set_fuel(struct ExecutionContext* context, int64_t fuel, ExecutionContextFuelHook hook, void* user_data);
+bool context_fuel_exhausted(struct ExecutionContext* context);
+void context_abort(struct ExecutionContext* context);
+void context_suspend(struct ExecutionContext* context);
+void context_yield(struct ExecutionContext* context);
+
+static inline bool context_consume_fuel(struct ExecutionContext* context, int amount)
+{
+    // hot path is only a decrement and a compare, hook is called on exhaustion
+    context->fuel -= amount;
+    return context->fuel > 0 || context_fuel_exhausted(context);
+}
+
+static inline bool context_is_running(struct ExecutionContext* context)
+{
+    return context->state == EXECUTION_CONTEXT_STATE_RUNNING;
+}
+
+#pragma endregion --- CONTEXT FUEL ---
 
 #pragma region --- CONTEXT STACK ---
 
@@ -134,9 +495,15 @@ struct ExecutionContextStackValue context_stack_get_value_at_index(struct Execut
 struct ExecutionContextStackValue context_stack_get_last_value(struct ExecutionContext* context);
 void context_stack_reset_value_at_index(struct ExecutionContext* context, int index, struct ExecutionContextStackValue value);
 struct ExecutionContextStackValue context_stack_unset_value_at_index(struct ExecutionContext* context, int index);
+void context_stack_value_ref(struct ExecutionContextStackValue value);
+void context_stack_own_value_at_index(struct ExecutionContext* context, int index);
+void context_stack_own_borrowed_values(struct ExecutionContext* context);
+void context_stack_move_value_at_index(struct ExecutionContext* context, int index, struct ExecutionContextStackValue value);
 void context_stack_set_value_at_index(struct ExecutionContext* context, int index, struct ExecutionContextStackValue value);
 
 int context_stack_push_value(struct ExecutionContext* context, struct ExecutionContextStackValue value);
+int context_stack_push_borrowed_value(struct ExecutionContext* context, struct ExecutionContextStackValue value);
+int context_stack_push_struct_instance(struct ExecutionContext* context, struct ExecutionContextStructDefinition* definition, uint8_t* data);
 int context_stack_pop_value(struct ExecutionContext* context);
 
 struct ExecutionContextStackIterator context_stack_iterate(struct ExecutionContext* context);
@@ -161,6 +528,7 @@ struct ExecutionContextVariable* context_scope_add_variable(
     int stack_index
 );
 
+int context_scope_get_variables_end_stack_index(struct ExecutionContext* context);
 struct ExecutionContextStackValue context_scope_get_last_value_on_stack_in_scope(struct ExecutionContext* context);
 
 #pragma endregion --- CONTEXT SCOPE ---
@@ -194,6 +562,8 @@ struct ExecutionContextVariable* context_add_global_variable(
 
 struct ExecutionContextVariable* context_lookup_variable(struct ExecutionContext* context, const char* name);
 
+struct ExecutionContextTypeInfo context_get_value_type(struct ExecutionContextTypeInfo type_info);
+struct ExecutionContextTypeInfo context_parse_array_type(struct ExecutionContext* context, struct ExecutionContextTypeInfo element_type);
 struct ExecutionContextTypeInfo context_get_type_from_identifier(
     struct ExecutionContext* context,
     const char* identifier, 
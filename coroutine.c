@@ -0,0 +1,128 @@
+#include "coroutine.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "executor.h"
+#include "object.h"
+#include "debug.h"
+
+#pragma region --- COROUTINE ---
+
+void coroutine_entry(unsigned int pointer_low, unsigned int pointer_high)
+{
+    // makecontext only passes int arguments, pointer is split in two halves
+    struct ExecutionCoroutine* coroutine = (struct ExecutionCoroutine*)(((uintptr_t)pointer_high << 32) | (uintptr_t)pointer_low);
+
+    exec_context_run(&coroutine->context);
+
+    // returning switches back to caller_ucontext through uc_link
+}
+
+struct ExecutionCoroutine* exec_coroutine_create(struct ExecutionRegistry* registry, const char* code, size_t stack_size)
+{
+    struct ExecutionScript* script = exec_script_create(registry, code);
+    struct ExecutionCoroutine* coroutine = exec_coroutine_create_script(script, stack_size);
+
+    object_deref(script);
+
+    return coroutine;
+}
+
+struct ExecutionCoroutine* exec_coroutine_create_script(struct ExecutionScript* script, size_t stack_size)
+{
+    struct ExecutionCoroutine* coroutine = malloc(sizeof(struct ExecutionCoroutine));
+
+    if (!coroutine)
+    {
+        debug("ERR!: Cannot allocate coroutine\n");
+        return NULL;
+    }
+
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    stack_size = stack_size > 0 ? stack_size : COROUTINE_DEFAULT_STACK_SIZE;
+    coroutine->stack_size = (stack_size + page_size - 1) & ~(page_size - 1);
+    coroutine->started = false;
+
+    uint8_t* mapping = mmap(NULL, coroutine->stack_size + page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+
+    if (mapping == MAP_FAILED || mprotect(mapping, page_size, PROT_NONE) != 0)
+    {
+        debug("ERR!: Cannot allocate coroutine stack (size: %zu)\n", coroutine->stack_size);
+
+        if (mapping != MAP_FAILED)
+        {
+            munmap(mapping, coroutine->stack_size + page_size);
+        }
+
+        free(coroutine);
+        return NULL;
+    }
+
+    // Stack grows down towards the guard page
+    coroutine->stack = mapping + page_size;
+
+    exec_context_init_script(&coroutine->context, script);
+    coroutine->context.coroutine = coroutine;
+
+    return coroutine;
+}
+
+void exec_coroutine_destroy(struct ExecutionCoroutine* coroutine)
+{
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    exec_context_release(&coroutine->context);
+    munmap((uint8_t*)coroutine->stack - page_size, coroutine->stack_size + page_size);
+    free(coroutine);
+}
+
+uint8_t exec_coroutine_resume(struct ExecutionCoroutine* coroutine)
+{
+    struct ExecutionContext* context = &coroutine->context;
+
+    if (!coroutine->started)
+    {
+        coroutine->started = true;
+
+        getcontext(&coroutine->coroutine_ucontext);
+        coroutine->coroutine_ucontext.uc_stack.ss_sp = coroutine->stack;
+        coroutine->coroutine_ucontext.uc_stack.ss_size = coroutine->stack_size;
+        coroutine->coroutine_ucontext.uc_link = &coroutine->caller_ucontext;
+
+        uintptr_t pointer = (uintptr_t)coroutine;
+
+        makecontext(
+            &coroutine->coroutine_ucontext, 
+            (void (*)(void))&coroutine_entry, 
+            2, 
+            (unsigned int)(pointer & 0xffffffff), 
+            (unsigned int)(pointer >> 32)
+        );
+    }
+    else if (context->state == EXECUTION_CONTEXT_STATE_SUSPENDED)
+    {
+        context->state = EXECUTION_CONTEXT_STATE_RUNNING;
+    }
+    else 
+    {
+        // Already finished or aborted
+        return context->state;
+    }
+
+    swapcontext(&coroutine->caller_ucontext, &coroutine->coroutine_ucontext);
+
+    return context->state;
+}
+
+void exec_coroutine_yield(struct ExecutionCoroutine* coroutine)
+{
+    coroutine->context.state = EXECUTION_CONTEXT_STATE_SUSPENDED;
+
+    swapcontext(&coroutine->coroutine_ucontext, &coroutine->caller_ucontext);
+}
+
+#pragma endregion --- COROUTINE ---
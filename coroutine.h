@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <ucontext.h>
+
+#include "context.h"
+
+#pragma region --- COROUTINE ---
+
+// Pages of the native stack are only committed when the script reaches them,
+// a guard page below the stack turns an overflow into a fault
+#define COROUTINE_DEFAULT_STACK_SIZE (64 * 1024)
+
+// Script invocation running on its own native stack, so it can be suspended 
+// in the middle of execution (inside a native call or fuel hook) and resumed 
+// later by the host with all interpreter stack and scopes intact
+struct ExecutionCoroutine
+{
+    struct ExecutionContext context;
+    ucontext_t coroutine_ucontext;
+    ucontext_t caller_ucontext;
+    void* stack;
+    size_t stack_size;
+    bool started;
+};
+
+// Stack size 0 uses COROUTINE_DEFAULT_STACK_SIZE, other sizes are rounded up to pages
+struct ExecutionCoroutine* exec_coroutine_create(struct ExecutionRegistry* registry, const char* code, size_t stack_size);
+// Coroutines running the same code share the analyzed script
+struct ExecutionCoroutine* exec_coroutine_create_script(struct ExecutionScript* script, size_t stack_size);
+void exec_coroutine_destroy(struct ExecutionCoroutine* coroutine);
+
+// Runs the coroutine until it suspends or finishes, returns context state.
+// Has to be called on the thread which created the coroutine.
+uint8_t exec_coroutine_resume(struct ExecutionCoroutine* coroutine);
+void exec_coroutine_yield(struct ExecutionCoroutine* coroutine);
+
+#pragma endregion --- COROUTINE ---
@@ -8,6 +8,10 @@ const char* stack_type_names[] =
     "STACK_TYPE_TYPEDEF",
     "STACK_TYPE_STRUCT",
     "STACK_TYPE_OBJECT",
+    "STACK_TYPE_ARRAY",
+    "STACK_TYPE_COLUMNS",
+    "NATIVE_TYPE_STRING",
+    "STACK_TYPE_MAP",
     "NATIVE_TYPE_PTR",
     "NATIVE_TYPE_NATIVE_FUNCTION",
     "NATIVE_TYPE_I8",
@@ -22,7 +26,6 @@ const char* stack_type_names[] =
     "NATIVE_TYPE_U64",
     "NATIVE_TYPE_DOUBLE",
     "NATIVE_TYPE_VOID",
-    "NATIVE_TYPE_STRING",
     "STACK_TYPE_STRUCT_INSTANCE",
     "STACK_TYPE_STRUCT_END",
     "STACK_TYPE_DYNAMIC"
@@ -32,7 +35,7 @@ const char* get_stack_type_name(int type)
 {
     type = type & 0x7f;
 
-    if (type < 0 || type >= 23) 
+    if (type < 0 || type >= 26) 
     {
         return "invalid_type";
     }
@@ -2,6 +2,25 @@
 
 #define MAX_IDENTIFIER_LENGTH 32
 
+// When enabled struct fields are laid out from the largest alignment to the smallest,
+// declaration order is kept in field lists, only offsets are affected
+#define STRUCT_LAYOUT_REORDER_FIELDS 1
+
+// When enabled array built-ins use SSE2/AVX2 kernels picked at runtime for the 
+// running CPU, otherwise only the scalar loops are used
+#define ARRAY_SIMD_KERNELS 1
+
+// When enabled map lookups compare a group of control bytes with one SSE2
+// instruction, otherwise a byte loop is used
+#define MAP_SIMD_PROBING 1
+
+// When enabled hot function literals are compiled, to x86-64 machine code on 
+// Linux and to call-threaded code on other targets
+#define JIT_ENABLED 1
+
+// When enabled the JIT always uses call-threaded code, also on x86-64 Linux
+#define JIT_THREADED_ONLY 0
+
 enum 
 {
     // not sized because it will acquire size from incoming type,
@@ -13,6 +32,10 @@ enum
     NATIVE_TYPE_TYPEDEF,
     STACK_TYPE_STRUCT,
     STACK_TYPE_OBJECT,
+    STACK_TYPE_ARRAY,
+    STACK_TYPE_COLUMNS,
+    NATIVE_TYPE_STRING,
+    STACK_TYPE_MAP,
     NATIVE_TYPE_PTR,
     NATIVE_TYPE_NATIVE_FUNCTION,
 
@@ -37,7 +60,6 @@ enum
     
     // ???
     NATIVE_TYPE_VOID,
-    NATIVE_TYPE_STRING,
 
     // size depends on the size of the structure
     STACK_TYPE_STRUCT_INSTANCE,
@@ -0,0 +1,216 @@
+#include "escape.h"
+
+#include <ctype.h>
+#include <string.h>
+
+#include "defs.h"
+#include "debug.h"
+#include "parser.h"
+
+#pragma region --- ESCAPE ANALYSIS ---
+
+int escape_skip_spaces(const char* code, int position, int end)
+{
+    while (position < end && isspace(code[position]))
+    {
+        position++;
+    }
+
+    return position;
+}
+
+int escape_skip_comment(const char* code, int position, int end)
+{
+    if (position + 1 < end && code[position] == '/' && code[position + 1] == '/')
+    {
+        while (position < end && code[position] != '\n')
+        {
+            position++;
+        }
+    }
+
+    return position;
+}
+
+int escape_read_identifier(const char* code, int position, int end, char* buffer)
+{
+    // same rules as parse_identifier, but works on a range without moving the context
+    int length = 0;
+
+    while (position < end && parse_is_identifier_char(code[position]) && length < MAX_IDENTIFIER_LENGTH - 1)
+    {
+        buffer[length++] = code[position++];
+    }
+
+    buffer[length] = 0;
+
+    return position;
+}
+
+bool escape_variable_escapes(const char* code, const char* name, int start, int end)
+{
+    // Any use of the variable other than 'name.field' can copy the reference
+    // somewhere (argument, return value, assignment), so it is treated as an escape
+    char identifier[MAX_IDENTIFIER_LENGTH];
+    char previous = 0;
+    int position = start;
+
+    while (position < end)
+    {
+        position = escape_skip_comment(code, position, end);
+
+        if (position >= end)
+        {
+            break;
+        }
+
+        char current = code[position];
+
+        if (!parse_is_identifier_start(current))
+        {
+            if (!isspace(current))
+            {
+                previous = current;
+            }
+
+            position++;
+            continue;
+        }
+
+        position = escape_read_identifier(code, position, end, identifier);
+
+        // identifier after '.' is a field name, not a variable
+        if (previous != '.' && strcmp(identifier, name) == 0)
+        {
+            int next = escape_skip_spaces(code, position, end);
+
+            if (next >= end || code[next] != '.')
+            {
+                return true;
+            }
+        }
+
+        previous = 'a';
+    }
+
+    return false;
+}
+
+void escape_add_stack_site(struct ExecutionContextEscapeInfo* escape, int position)
+{
+    for (int i = 0; i < escape->stack_site_count; i++)
+    {
+        if (escape->stack_sites[i] == position)
+        {
+            return;
+        }
+    }
+
+    if (escape->stack_site_count < MAX_ESCAPE_STACK_SITES)
+    {
+        escape->stack_sites[escape->stack_site_count++] = position;
+    }
+}
+
+void exec_escape_analyze_function(struct ExecutionContext* context, int function_position, int body_start, int body_end)
+{
+    struct ExecutionContextEscapeInfo* escape = &context->escape;
+
+    for (int i = 0; i < escape->analyzed_function_count; i++)
+    {
+        if (escape->analyzed_functions[i] == function_position)
+        {
+            return;
+        }
+    }
+
+    if (escape->analyzed_function_count >= MAX_ESCAPE_ANALYZED_FUNCTIONS)
+    {
+        // Not analyzed functions keep all objects on the heap
+        return;
+    }
+
+    escape->analyzed_functions[escape->analyzed_function_count++] = function_position;
+
+    const char* code = context->code;
+    char identifier[MAX_IDENTIFIER_LENGTH];
+    char name[MAX_IDENTIFIER_LENGTH];
+    int position = body_start;
+
+    while (position < body_end)
+    {
+        position = escape_skip_comment(code, position, body_end);
+
+        if (position >= body_end)
+        {
+            break;
+        }
+
+        if (!parse_is_identifier_start(code[position]))
+        {
+            position++;
+            continue;
+        }
+
+        position = escape_read_identifier(code, position, body_end, identifier);
+
+        if (strcmp(identifier, "let") != 0 && strcmp(identifier, "var") != 0)
+        {
+            continue;
+        }
+
+        // Looking for: let <name> = new ...
+        int next = escape_skip_spaces(code, position, body_end);
+
+        if (next >= body_end || !parse_is_identifier_start(code[next]))
+        {
+            continue;
+        }
+
+        next = escape_read_identifier(code, next, body_end, name);
+        next = escape_skip_spaces(code, next, body_end);
+
+        if (next >= body_end || code[next] != '=')
+        {
+            continue;
+        }
+
+        next = escape_skip_spaces(code, next + 1, body_end);
+
+        int site_position = next;
+        next = escape_read_identifier(code, next, body_end, identifier);
+
+        if (strcmp(identifier, "new") != 0)
+        {
+            continue;
+        }
+
+        if (!escape_variable_escapes(code, name, next, body_end))
+        {
+            #ifdef TOKEN_DEBUG
+                debug("Allocation of '%s' at %d does not escape, it will be stack allocated\n", name, site_position);
+            #endif
+
+            escape_add_stack_site(escape, site_position);
+        }
+
+        position = next;
+    }
+}
+
+bool exec_escape_is_stack_site(struct ExecutionContext* context, int position)
+{
+    struct ExecutionContextEscapeInfo* escape = &context->escape;
+
+    for (int i = 0; i < escape->stack_site_count; i++)
+    {
+        if (escape->stack_sites[i] == position)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#pragma endregion --- ESCAPE ANALYSIS ---
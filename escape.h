@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "context.h"
+
+#pragma region --- ESCAPE ANALYSIS ---
+
+// Scans body of a function literal once, when it is parsed for the first time.
+// Allocation sites 'let x = new X { ... }' whose variable is only ever used for 
+// field access ('x.field') cannot leave the call, so they are recorded as stack sites.
+void exec_escape_analyze_function(struct ExecutionContext* context, int function_position, int body_start, int body_end);
+
+// True when 'new' at the given code position was proven not to escape its function
+bool exec_escape_is_stack_site(struct ExecutionContext* context, int position);
+
+#pragma endregion --- ESCAPE ANALYSIS ---
@@ -6,10 +6,30 @@
 #include "executor.h"
 #include "context.h"
 #include "parser.h"
+#include "scheduler.h"
+#include "escape.h"
+#include "infer.h"
+#include "fold.h"
+#include "inline.h"
+#include "array.h"
+#include "columns.h"
+#include "str.h"
+#include "map.h"
+#include "jit.h"
+#include "regvm.h"
 #include "debug.h"
 
+enum ExecExpressionFlags
+{
+    EXEC_EXPRESSION_FLAG_NONE = 0x0,
+    // ',' ends the expression instead of pushing next value, used by lists parsed item by item
+    EXEC_EXPRESSION_FLAG_STOP_AT_COMMA = 0x1,
+};
+
 void exec_expression(struct ExecutionContext* context);
+void exec_expression_with_flags(struct ExecutionContext* context, uint8_t flags);
 void exec_call_cleanup(struct ExecutionContext* context, int frame_start_stack_index, int args_stack_size);
+struct ExecutionContextIdentifierResult exec_identifier(struct ExecutionContext* context, char* identifier, int max_len);
 
 #pragma region --- Block ---
 
@@ -23,9 +43,8 @@ void exec_block(struct ExecutionContext* context)
 
     int block_stack_index = context->stack_index;
     int block_stack_variables = context->stack_variables;
-    struct ExecutionContextScope* scope = context_get_scope(context);
 
-    while (context->position < context->code_len)
+    while (context->position < context->code_len && context_is_running(context))
     {
         int stack_index = context->stack_index;
 
@@ -37,22 +56,28 @@ void exec_block(struct ExecutionContext* context)
         // getchar();
 #endif
 
-        exec_expression(context);
-
         context_skip_spaces(context);
-        current = context->code[context->position];
 
-        if (current == ';')
+        // Statements without effects found before execution leave nothing on the stack
+        if (!exec_fold_skip_statement(context))
         {
-            context->position++;
+            exec_expression(context);
 
-            struct ExecutionContextStackIterator iterator = context_stack_iterate(context);
+            context_skip_spaces(context);
+            current = context->code[context->position];
 
-            // Do a cleanup from last statement
-            while(context->stack_index > scope->min_stack_index + scope->variable_count)
+            if (current == ';')
             {
-                context_stack_pop_value(context);
-            } 
+                context->position++;
+
+                struct ExecutionContextStackIterator iterator = context_stack_iterate(context);
+
+                // Do a cleanup from last statement
+                while(context->stack_index > context_scope_get_variables_end_stack_index(context))
+                {
+                    context_stack_pop_value(context);
+                } 
+            }
         }
 
         context_skip_spaces(context);
@@ -70,7 +95,7 @@ void exec_block(struct ExecutionContext* context)
     }
 
     // Do a block cleanup
-    exec_call_cleanup(context, block_stack_index, (scope->min_stack_index + scope->variable_count) - block_stack_index);
+    exec_call_cleanup(context, block_stack_index, context_scope_get_variables_end_stack_index(context) - block_stack_index);
 
     // context->stack_index = block_stack_index;
     context->stack_variables = block_stack_variables;
@@ -129,7 +154,8 @@ void exec_number(struct ExecutionContext* context)
 
     number[index] = 0;
     
-    uint64_t value;
+    uint64_t value = 0;
+    uint8_t type = NATIVE_TYPE_I32;
     double double_value;
     float float_value;
 
@@ -141,19 +167,24 @@ void exec_number(struct ExecutionContext* context)
     case 0x1:
         double_value = atof(number);
         value = *(uint64_t*)&double_value;
+        type = NATIVE_TYPE_DOUBLE;
         break;
     case 0x3:
         float_value = (float)atof(number);
-        value = *(uint64_t*)&float_value;
+        memcpy(&value, &float_value, sizeof(float_value));
+        type = NATIVE_TYPE_FLOAT;
         break;
     case 0x4:
         value = (int64_t)atoll(number);
+        type = NATIVE_TYPE_I64;
         break;
     case 0x8:
         value = (uint32_t)atoll(number);
+        type = NATIVE_TYPE_U32;
         break;
-    case 0x12:
+    case 0xC:
         value = (uint64_t)atoll(number);
+        type = NATIVE_TYPE_U64;
         break;
     default:
         break;
@@ -169,7 +200,7 @@ switch (flags)
     case 0x0:
     case 0x4:
     case 0x8:
-    case 0x12:
+    case 0xC:
         debug("Push number '%s' (flags: %d, value: %d) to stack\n", number, flags, value);
     default:
         break;
@@ -178,7 +209,73 @@ switch (flags)
 
     context_stack_push_value(
         context, 
-        (struct ExecutionContextStackValue) { .ptr = &value, .type = NATIVE_TYPE_I32, .size = get_size_of_native_type(NATIVE_TYPE_I32) }
+        (struct ExecutionContextStackValue) { .ptr = &value, .type = type, .size = get_size_of_native_type(type) }
+    );
+}
+
+void exec_string(struct ExecutionContext* context)
+{
+    // "text" literal with \n, \t, \" and \\ escapes. Short literals are packed into 
+    // the slot and longer ones are interned, evaluating a literal again does not allocate.
+    int start = ++context->position;
+    int length = 0;
+    bool escaped = false;
+
+    while (context->position < context->code_len && context->code[context->position] != '"')
+    {
+        if (context->code[context->position] == '\\' && context->position + 1 < context->code_len)
+        {
+            context->position++;
+            escaped = true;
+        }
+
+        context->position++;
+        length++;
+    }
+
+    if (context->position >= context->code_len)
+    {
+        debug("ERR!: String literal is missing closing '\"'\n");
+        context_abort(context);
+        return;
+    }
+
+    const char* data = &context->code[start];
+    char* decoded = NULL;
+
+    if (escaped)
+    {
+        decoded = malloc(length);
+
+        for (int i = start, j = 0; i < context->position; i++, j++)
+        {
+            char current = context->code[i];
+
+            if (current == '\\')
+            {
+                current = context->code[++i];
+                current = current == 'n' ? '\n' : current == 't' ? '\t' : current;
+            }
+
+            decoded[j] = current;
+        }
+
+        data = decoded;
+    }
+
+    context->position++;
+
+    uint64_t string = string_intern_data(data, length);
+
+#ifdef TOKEN_DEBUG
+    debug("Push string '%.*s' to stack\n", length, data);
+#endif
+
+    free(decoded);
+
+    context_stack_push_value(
+        context, 
+        (struct ExecutionContextStackValue) { .ptr = &string, .type = NATIVE_TYPE_STRING, .size = get_size_of_native_type(NATIVE_TYPE_STRING) }
     );
 }
 
@@ -234,6 +331,7 @@ void exec_function(
     context_skip_spaces(context);
 
     current = context->code[context->position];
+    int body_start = context->position;
 
     if (current == '{')
     {
@@ -246,6 +344,13 @@ void exec_function(
         while (nested > 0)
         {
             current = context->code[context->position];
+
+            if (current == '"')
+            {
+                context_skip_string(context);
+                continue;
+            }
+
             context->position++;
 
             if (current == '{')
@@ -263,10 +368,19 @@ void exec_function(
         while (current != ';' && !context_eof(context))
         {
             current = context->code[context->position];
+
+            if (current == '"')
+            {
+                context_skip_string(context);
+                continue;
+            }
+
             context->position++;
         }
     }
 
+    exec_escape_analyze_function(context, code_start, body_start, context->position);
+
     context_stack_push_value(
         context,
         (struct ExecutionContextStackValue) { .ptr = &code_start, .type = NATIVE_TYPE_FUNCTION, .size = get_size_of_native_type(NATIVE_TYPE_FUNCTION) }
@@ -319,6 +433,8 @@ void exec_struct_field(struct ExecutionContext* context, struct ExecutionContext
         context_stack_pop_value(context);
     }
 
+    type_info = context_parse_array_type(context, type_info);
+
     char identifier[MAX_IDENTIFIER_LENGTH];
     context_skip_spaces(context);
     parse_identifier(context, identifier, MAX_IDENTIFIER_LENGTH);
@@ -336,16 +452,15 @@ void exec_struct_field(struct ExecutionContext* context, struct ExecutionContext
         exec_function(context, type_info);
 
         field_definition.type = (struct ExecutionContextTypeInfo) { .native = NATIVE_TYPE_FUNCTION, .complex = NULL };
-        field_definition.offset = definition->static_size;
-        definition->static_size += get_size_of_type(field_definition.type);
+        // offset is assigned by the layout after all fields are parsed
+        field_definition.offset = 0;
 
         context_struct_definition_field_list_add(&definition->static_fields, field_definition);
     }
     else
     {
-        field_definition.type = type_info;
-        field_definition.offset = definition->size;
-        definition->size += get_size_of_type(type_info);
+        field_definition.type = context_get_value_type(type_info);
+        field_definition.offset = 0;
 
         context_struct_definition_field_list_add(&definition->fields, field_definition);
     }
@@ -370,14 +485,15 @@ void exec_struct(struct ExecutionContext* context)
     context_skip_spaces(context);
     current = context->code[context->position];
 
-    struct ExecutionContextStructDefinition* definition = object_create(sizeof(struct ExecutionContextStructDefinition));
+    struct ExecutionContextStructDefinition* definition = object_create_with_free(sizeof(struct ExecutionContextStructDefinition), &context_struct_definition_free);
     definition->flags = 0;
     definition->size = 0;
+    definition->alignment = 1;
     definition->static_size = 0;
-    definition->fields.capacity = 8;
-    definition->fields.count = 0;
-    definition->static_fields.capacity = 8;
-    definition->static_fields.count = 0;
+    definition->static_data = NULL;
+    definition->reference_count = 0;
+    definition->fields = (struct ExecutionContextStructDefinitionFieldList) { 0 };
+    definition->static_fields = (struct ExecutionContextStructDefinitionFieldList) { 0 };
 
     if (current != '{')
     {
@@ -414,8 +530,20 @@ void exec_struct(struct ExecutionContext* context)
         }
         while (current == ';');
 
+        int static_alignment;
+
+        definition->size = context_struct_definition_layout(&definition->fields, STRUCT_LAYOUT_REORDER_FIELDS, &definition->alignment);
+        definition->static_size = context_struct_definition_layout(&definition->static_fields, STRUCT_LAYOUT_REORDER_FIELDS, &static_alignment);
+        context_struct_definition_build_reference_map(definition);
         definition->static_data = malloc(definition->static_size);
-        memcpy(definition->static_data, &context->stack[start_stack_pointer], definition->static_size);
+
+        // Static values were pushed one per stack slot in declaration order
+        for (int i = 0; i < definition->static_fields.count; i++)
+        {
+            struct ExecutionContextStructFieldDefinition* field = &definition->static_fields.data[i];
+            memcpy(&definition->static_data[field->offset], &context->stack[start_stack_pointer + i], get_size_of_type(field->type));
+        }
+
         context->stack_index = start_stack_pointer;
 
         if (current == '}')
@@ -446,196 +574,965 @@ void exec_struct(struct ExecutionContext* context)
 #endif
 }
 
-#pragma endregion Struct literal
-#pragma endregion --- Literals ---
-
-#pragma region --- Access ---
-#pragma region Variables
-
-void exec_access_variable(struct ExecutionContext* context, struct ExecutionContextVariable* variable) 
+bool exec_struct_field_store(struct ExecutionContextStructFieldDefinition* field, uint8_t* field_data, struct ExecutionContextStackValue value)
 {
-    context_variable_push_into_stack(context, variable);
-}
+    // Moves the value into the field, previous field content is destructed.
+    // On success the value slots have to be dropped without unsetting them.
+    int field_size = get_size_of_type(field->type);
 
-void exec_assignment(struct ExecutionContext* context, struct ExecutionContextVariable* variable) 
-{
-    struct ExecutionContextStackValue value = context_stack_get_last_value(context);
+    if (field->type.native == STACK_TYPE_STRUCT_INSTANCE)
+    {
+        if (value.type != STACK_TYPE_STRUCT_INSTANCE || *(struct ExecutionContextStructDefinition**)value.ptr != field->type.complex)
+        {
+            return false;
+        }
 
-#ifdef TOKEN_DEBUG
-    debug("Assign value '[%s] %d' to '%s'\n", get_stack_type_name(value.type), *value.ptr, variable->name);
-#endif
+        destruct_struct(field->type.complex, field_data);
+        memcpy(field_data, value.ptr + 1, field_size);
 
-    context_variable_set_value(context, variable, value);
-    
-    context_stack_pop_value(context);
-}
+        // Nested instance is stored without its definition, drop the reference of the temporary
+        object_deref(field->type.complex);
 
-void exec_variable_declaration(struct ExecutionContext* context, const char* identifier, struct ExecutionContextTypeInfo declaration_type)
-{
-    context_skip_spaces(context);
+        return true;
+    }
 
-    char current = context->code[context->position];
+    if (value.type != field->type.native && !(check_type_is_integer(value.type) && check_type_is_integer(field->type.native)))
+    {
+        return false;
+    }
 
-    if (current != '=')
+    if (field->type.native == STACK_TYPE_ARRAY && !array_check_element_type(value, field->type.complex->native_type))
     {
-        debug("ERR!: Expected '=' for '%s' variable declaration.\n", identifier);
+        return false;
     }
-    else 
+
+    if (field->type.native == STACK_TYPE_COLUMNS && !columns_check_definition(value, field->type.complex))
     {
-        context->position++;
+        return false;
     }
 
-    exec_expression(context);
+    if (check_type_is_reference(field->type.native))
+    {
+        object_deref(*(void**)field_data);
+    }
 
-    struct ExecutionContextStackValue value = context_stack_get_last_value(context);
+    // Integers are converted by keeping the low bytes
+    memcpy(field_data, value.ptr, field_size);
 
-    if (value.type == STACK_TYPE_STRUCT_INSTANCE)
-    {
+    return true;
+}
 
-    }
+void exec_struct_instance(struct ExecutionContext* context)
+{
+    // Instance is constructed in place of the struct value on top of the stack,
+    // the instance takes over the reference to the definition held by that slot.
+    // Field values are moved into the instance, declaration moves the whole instance
+    // into the variable, so nothing is copied on the way.
+    int instance_stack_index = context->stack_index - 1;
+    context_stack_own_value_at_index(context, instance_stack_index);
 
-    context->stack_index -= value.size;
+    struct ExecutionContextStructDefinition* definition = *(struct ExecutionContextStructDefinition**)&context->stack[instance_stack_index];
+    int stack_size = context_struct_instance_stack_size(definition);
+    uint8_t* data = (uint8_t*)&context->stack[instance_stack_index + 1];
 
-    struct ExecutionContextVariable* variable = context_add_variable(
-        context, 
-        context_get_scope(context), 
-        identifier, 
-        declaration_type.native, 
-        value.size * 8,
-        true
-    );
+    memset(data, 0, (stack_size - 1) * sizeof(context->stack[0]));
+    context->stack_type[instance_stack_index] = STACK_TYPE_STRUCT_INSTANCE;
 
-    if (!variable)
+    for (int i = 1; i < stack_size; i++)
     {
-        debug("ERR!: Cannot add local variable '%s'.\n", identifier);
-        return;
+        context->stack_type[instance_stack_index + i] = STACK_TYPE_STRUCT_END;
     }
 
-    context_variable_set_value(context, variable, value);
+    context->stack_index = instance_stack_index + stack_size;
 
 #ifdef TOKEN_DEBUG
-    debug("Declared variable '%s' with value '[%s] %d'\n", variable->name, get_stack_type_name(value.type), context->stack[context->stack_index - 1]);
+    debug("Parsing struct instance (size: %d)\n", definition->size);
 #endif
 
-}
+    context->position++;
+    context_skip_spaces(context);
+    char current = context->code[context->position];
 
-#pragma endregion Variables
+    while (current != '}' && context->position < context->code_len && context_is_running(context))
+    {
+        char identifier[MAX_IDENTIFIER_LENGTH];
+        parse_identifier(context, identifier, MAX_IDENTIFIER_LENGTH);
+        context_skip_spaces(context);
 
-#pragma region Struct fields
+        struct ExecutionContextStructFieldDefinition* field = 
+            context_struct_definition_field_list_find(&definition->fields, identifier);
 
-struct ExecutionContextIdentifierResult exec_field_access(struct ExecutionContext* context)
-{
-    struct ExecutionContextStackValue value = context_stack_get_last_value(context);
-    struct ExecutionContextStructDefinitionFieldList* fields = NULL;
-    uint8_t* data;
+        if (context->code[context->position] != ':')
+        {
+            debug("ERR!: Expected ':' after field '%s'\n", identifier);
+            return;
+        }
 
-    if (value.type == STACK_TYPE_STRUCT)
-    {
-        struct ExecutionContextStructDefinition* definition = *(struct ExecutionContextStructDefinition**)value.ptr;
-        fields = &definition->static_fields;
-        data = definition->static_data;
+        context->position++;
+
+        exec_expression_with_flags(context, EXEC_EXPRESSION_FLAG_STOP_AT_COMMA);
+
+        if (!context_is_running(context))
+        {
+            return;
+        }
+
+        struct ExecutionContextStackValue value = context_stack_get_last_value(context);
+        context_stack_own_value_at_index(context, context->stack_index - value.size);
+
+        if (field && exec_struct_field_store(field, data + field->offset, value))
+        {
+            context->stack_index -= value.size;
+        }
+        else 
+        {
+            debug("ERR!: Cannot initialize field '%s' with value of type %s\n", identifier, get_stack_type_name(value.type));
+            context_stack_pop_value(context);
+        }
+
+        context_skip_spaces(context);
+        current = context->code[context->position];
+
+        if (current == ',')
+        {
+            context->position++;
+            context_skip_spaces(context);
+            current = context->code[context->position];
+        }
     }
-    else if (value.type == STACK_TYPE_STRUCT_INSTANCE)
-    {
-        // TODO: ???
 
-        // struct ExecutionContextStructDefinition* definition = *(struct ExecutionContextStructDefinition**)value.ptr;
-        // fields = &definition->fields;
-        // data = ((uint8_t*)value.ptr) + sizeof(struct ExecutionContextStructDefinition*);
+    if (current == '}')
+    {
+        context->position++;
     }
-    else if (value.type == STACK_TYPE_OBJECT)
+    else 
     {
-        uint8_t* heap_data = (uint8_t*)value.ptr;
-        struct ExecutionContextStructDefinition* definition = *(struct ExecutionContextStructDefinition**)heap_data;
-        fields = &definition->fields;
-        data = heap_data + sizeof(struct ExecutionContextStructDefinition*);
+        debug("ERR!: Syntax error missing '}'\n");
     }
+}
+
+void exec_new(struct ExecutionContext* context, int site_position)
+{
+    // 'new X { ... }' moves a constructed instance into a reference counted heap object.
+    // Sites which escape analysis proved to stay inside their call keep the instance 
+    // on the stack, variable holding it is only used for field access so it behaves the same
+    context_skip_spaces(context);
 
     char identifier[MAX_IDENTIFIER_LENGTH];
-    char current = context->code[context->position];
+    exec_identifier(context, identifier, MAX_IDENTIFIER_LENGTH);
 
-    if (current == '.') 
+    struct ExecutionContextStackValue struct_value = context_stack_get_last_value(context);
+    context_skip_spaces(context);
+
+    if (struct_value.type != STACK_TYPE_STRUCT || context->code[context->position] != '{')
     {
-        context->position++;
+        debug("ERR!: Expected struct construction after 'new'\n");
+        context_abort(context);
+        return;
     }
 
-    context_skip_spaces(context);
+    exec_struct_instance(context);
 
-    int identifier_length = parse_identifier(context, identifier, MAX_IDENTIFIER_LENGTH);
+    if (!context_is_running(context) || exec_escape_is_stack_site(context, site_position))
+    {
+        return;
+    }
 
-    struct ExecutionContextStructFieldDefinition* field = NULL;
+    struct ExecutionContextStackValue value = context_stack_get_last_value(context);
+    struct ExecutionContextStructDefinition* definition = *(struct ExecutionContextStructDefinition**)value.ptr;
 
-    // TODO: implement getting field form fields list
+    // Definition and field references are moved together with the data
+    uint8_t* object = object_create_traced(sizeof(definition) + definition->size, &destruct_object, &trace_object);
+    memcpy(object, value.ptr, sizeof(definition) + definition->size);
 
-    for (int i = 0; i < fields->count; i++)
-    {
-        if (strncmp(fields->data[i].name, identifier, identifier_length) == 0)
-        {
-            field = &fields->data[i];
-            break;
-        }
-    }
+    context->stack_index -= value.size;
 
-    uint8_t* field_data = data + field->offset;
+    uint64_t object_value = (uint64_t)object;
 
     context_stack_push_value(
-        context,
-        (struct ExecutionContextStackValue) { .ptr = (uint64_t*)field_data, .type = field->type.native, .size = get_size_of_type(field->type) }
+        context, 
+        (struct ExecutionContextStackValue) { .ptr = &object_value, .type = STACK_TYPE_OBJECT, .size = get_size_of_native_type(STACK_TYPE_OBJECT) }
     );
-
-    if (field->type.native == STACK_TYPE_STRUCT)
-    {
-        return (struct ExecutionContextIdentifierResult) 
-        { 
-            .data_type = EXECUTION_CONTEXT_IDENTIFIER_RESULT_TYPE,
-            .type_data = field->type
-        };
-    }
-
-    return (struct ExecutionContextIdentifierResult) { .data_type = EXECUTION_CONTEXT_IDENTIFIER_RESULT_VALUE };
 }
 
-#pragma endregion Struct fields
-#pragma endregion --- Access ---
-
-#pragma region --- Operators ---
+#pragma endregion Struct literal
 
-#pragma region Call
+#pragma region Array literal
 
-int exec_call_args(struct ExecutionContext* context, int start_stack_index) 
+void exec_array_new(struct ExecutionContext* context, struct ExecutionContextTypeInfo element_type)
 {
-    // Parsing an expression here, because ',' operator pushes all expressions 
-    // into a stack, which means this will populate arguments for this call
-    exec_expression(context);
+    // 'T[length]' allocates a zeroed array, element type is not needed on the stack.
+    // For struct types the element type is a borrowed struct value.
+    context_stack_pop_value(context);
+    context->position++;
 
-    char current = context->code[context->position];
+    int length_stack_index = context->stack_index;
 
-    // We should be at ')', if not there is something wrong with syntax
-    if (current == ')')
+    exec_expression(context);
+
+    if (!context_is_running(context))
     {
-        context->position++;
+        return;
     }
-    else 
+
+    struct ExecutionContextStackValue value = context_stack_get_last_value(context);
+    int64_t length;
+
+    if (context->code[context->position] != ']' 
+        || context->stack_index == length_stack_index 
+        || !array_index_from_value(value, &length) 
+        || length < 0 || length > UINT32_MAX)
     {
-        debug("ERR!: Syntax error missing ')'\n");
-        // FIXME: should panic
-        return 0;
+        debug("ERR!: Array length has to be a non negative integer followed by ']'\n");
+        exec_call_cleanup(context, length_stack_index, context->stack_index - length_stack_index);
+        context_abort(context);
+        return;
     }
 
-    // Provided args size pushed to the stack can be calculated
-    int args_stack_size = context->stack_index - start_stack_index;
-
-    return args_stack_size;
-}
+    context->position++;
+    context_stack_pop_value(context);
 
-void exec_call_cleanup(struct ExecutionContext* context, int frame_start_stack_index, int args_stack_size) 
-{
-    struct ExecutionContextStackIterator iterator = context_stack_iterate(context);
+    if (element_type.native == STACK_TYPE_STRUCT)
+    {
+        // Struct type allocates the records column-wise
+        uint64_t columns = (uint64_t)columns_create(element_type.complex, length);
 
-    int return_count = 0;
-    int frame_args_end_stack_index = frame_start_stack_index + args_stack_size;
+        if (!columns)
+        {
+            context_abort(context);
+            return;
+        }
 
-    while(iterator.stack_index != frame_args_end_stack_index)
+        context_stack_push_value(
+            context, 
+            (struct ExecutionContextStackValue) { .ptr = &columns, .type = STACK_TYPE_COLUMNS, .size = get_size_of_native_type(STACK_TYPE_COLUMNS) }
+        );
+        return;
+    }
+
+    uint64_t array = (uint64_t)array_create(element_type.native, length);
+
+    context_stack_push_value(
+        context, 
+        (struct ExecutionContextStackValue) { .ptr = &array, .type = STACK_TYPE_ARRAY, .size = get_size_of_native_type(STACK_TYPE_ARRAY) }
+    );
+}
+
+#pragma endregion Array literal
+
+#pragma region Map literal
+
+void exec_map_new(struct ExecutionContext* context)
+{
+    // 'map { key: value, ... }' creates a map, map type is not needed on the stack.
+    // Map stays on the stack while entries are evaluated.
+    context_stack_pop_value(context);
+    context->position++;
+
+    uint64_t map_value = (uint64_t)map_create();
+    struct ExecutionMap* map = (struct ExecutionMap*)map_value;
+    int map_stack_index = context_stack_push_value(
+        context, 
+        (struct ExecutionContextStackValue) { .ptr = &map_value, .type = STACK_TYPE_MAP, .size = get_size_of_native_type(STACK_TYPE_MAP) }
+    );
+
+    context_skip_spaces(context);
+    char current = context->code[context->position];
+
+    while (current != '}' && context->position < context->code_len)
+    {
+        int entry_stack_index = context->stack_index;
+
+        exec_expression(context);
+
+        if (!context_is_running(context))
+        {
+            return;
+        }
+
+        if (context->code[context->position] != ':' || context->stack_index == entry_stack_index)
+        {
+            debug("ERR!: Expected ':' after map key\n");
+            exec_call_cleanup(context, map_stack_index, context->stack_index - map_stack_index);
+            context_abort(context);
+            return;
+        }
+
+        context->position++;
+
+        int value_stack_index = context->stack_index;
+
+        exec_expression_with_flags(context, EXEC_EXPRESSION_FLAG_STOP_AT_COMMA);
+
+        if (!context_is_running(context))
+        {
+            return;
+        }
+
+        struct ExecutionContextStackValue key_value = context_stack_get_value_at_index(context, entry_stack_index);
+        struct ExecutionContextStackValue value = context_stack_get_last_value(context);
+        uint8_t key_type;
+        uint64_t key;
+
+        if (context->stack_index == value_stack_index 
+            || !map_key_from_value(key_value, &key_type, &key) 
+            || !map_store(map, key_type, key, value))
+        {
+            debug("ERR!: Cannot add map entry (key: %s, value: %s)\n", get_stack_type_name(key_value.type), get_stack_type_name(value.type));
+            exec_call_cleanup(context, map_stack_index, context->stack_index - map_stack_index);
+            context_abort(context);
+            return;
+        }
+
+        exec_call_cleanup(context, entry_stack_index, context->stack_index - entry_stack_index);
+
+        context_skip_spaces(context);
+        current = context->code[context->position];
+
+        if (current == ',')
+        {
+            context->position++;
+            context_skip_spaces(context);
+            current = context->code[context->position];
+        }
+    }
+
+    if (current == '}')
+    {
+        context->position++;
+    }
+    else 
+    {
+        debug("ERR!: Syntax error missing '}'\n");
+    }
+}
+
+#pragma endregion Map literal
+#pragma endregion --- Literals ---
+
+#pragma region --- Access ---
+#pragma region Variables
+
+void exec_access_variable(struct ExecutionContext* context, struct ExecutionContextVariable* variable) 
+{
+    context_variable_push_into_stack(context, variable);
+}
+
+bool exec_check_expression_value(struct ExecutionContext* context, int stack_index)
+{
+    // Call of a function which returns nothing leaves no value to store
+    if (context_is_running(context) && context->stack_index == stack_index)
+    {
+        debug("ERR!: Expression has no value\n");
+        context_abort(context);
+        return false;
+    }
+
+    return true;
+}
+
+void exec_assignment(struct ExecutionContext* context, struct ExecutionContextVariable* variable, bool typed) 
+{
+    struct ExecutionContextStackValue value = context_stack_get_last_value(context);
+
+#ifdef TOKEN_DEBUG
+    debug("Assign value '[%s] %d' to '%s'\n", get_stack_type_name(value.type), *value.ptr, variable->name);
+#endif
+
+    if (variable->flags & VARIABLE_FLAG_CONST)
+    {
+        debug("ERR!: Cannot assign to constant '%s'\n", variable->name);
+        context_stack_pop_value(context);
+        return;
+    }
+
+    if (typed && context_is_running(context) && !check_type_is_reference(value.type) && value.type != STACK_TYPE_STRUCT_INSTANCE)
+    {
+        // Type inference proved the value has the variable type, scalar is stored in place.
+        // Aborted expression can leave anything on the stack, so it goes through the checks
+        context->stack[variable->stack_index] = *value.ptr;
+        context->stack_flags[variable->stack_index] = STACK_FLAG_NONE;
+        context->stack_index -= value.size;
+        return;
+    }
+
+    struct ExecutionContextStackValue current_value = context_variable_get_value(context, variable);
+
+    if (!check_type_is_assignable_to(current_value.type, value.type) 
+        || current_value.size != value.size
+        || (value.type == STACK_TYPE_STRUCT_INSTANCE && *(void**)current_value.ptr != *(void**)value.ptr)
+        || (value.type == STACK_TYPE_ARRAY && current_value.type == STACK_TYPE_ARRAY && *(void**)current_value.ptr 
+            && !array_check_element_type(value, (*(struct ExecutionArray**)current_value.ptr)->element_type))
+        || (value.type == STACK_TYPE_COLUMNS && current_value.type == STACK_TYPE_COLUMNS && *(void**)current_value.ptr 
+            && !columns_check_definition(value, (*(struct ExecutionColumns**)current_value.ptr)->definition)))
+    {
+        debug("ERR!: Cannot assign to variable, types are incorrect (to: %s, from: %s)\n", get_stack_type_name(current_value.type), get_stack_type_name(value.type));
+        context_stack_pop_value(context);
+        return;
+    }
+
+    if (check_type_is_reference(current_value.type) || current_value.type == STACK_TYPE_STRUCT_INSTANCE)
+    {
+        context_stack_own_borrowed_values(context);
+    }
+
+    // Assigned value is a temporary that dies right after, move it instead of copying
+    context_stack_unset_value_at_index(context, variable->stack_index);
+    context_stack_move_value_at_index(context, variable->stack_index, value);
+
+    context->stack_index -= value.size;
+}
+
+void exec_field_assignment(
+    struct ExecutionContext* context, 
+    struct ExecutionContextVariable* variable, 
+    struct ExecutionContextStructFieldDefinition* field
+) {
+    struct ExecutionContextStackValue value = context_stack_get_last_value(context);
+    struct ExecutionContextStackValue instance = context_variable_get_value(context, variable);
+    // instance data follows the definition pointer, on the stack or in the heap object
+    uint8_t* instance_data = instance.type == STACK_TYPE_OBJECT 
+        ? *(uint8_t**)instance.ptr + sizeof(struct ExecutionContextStructDefinition*)
+        : (uint8_t*)(instance.ptr + 1);
+    uint8_t* field_data = instance_data + field->offset;
+
+    if ((variable->flags & VARIABLE_FLAG_CONST) && instance.type == STACK_TYPE_STRUCT_INSTANCE)
+    {
+        // Instance is stored by value, so its fields are part of the constant
+        debug("ERR!: Cannot assign to field '%s' of constant '%s'\n", field->name, variable->name);
+        context_stack_pop_value(context);
+        return;
+    }
+
+    if (check_type_is_reference(field->type.native) || field->type.native == STACK_TYPE_STRUCT_INSTANCE)
+    {
+        // Previous field content is released, borrowed copies of the instance could point to it
+        context_stack_own_borrowed_values(context);
+    }
+
+    context_stack_own_value_at_index(context, context->stack_index - value.size);
+
+#ifdef TOKEN_DEBUG
+    debug("Assign value '[%s] %d' to '%s.%s'\n", get_stack_type_name(value.type), *value.ptr, variable->name, field->name);
+#endif
+
+    if (!exec_struct_field_store(field, field_data, value))
+    {
+        debug("ERR!: Cannot assign to field '%s', types are incorrect (to: %s, from: %s)\n", field->name, get_stack_type_name(field->type.native), get_stack_type_name(value.type));
+        context_stack_pop_value(context);
+        return;
+    }
+
+    if (instance.type == STACK_TYPE_OBJECT && object_is_shared(*(void**)instance.ptr))
+    {
+        // Other threads can reach the stored value through the object
+        object_share_references(*(void**)instance.ptr);
+    }
+
+    context->stack_index -= value.size;
+}
+
+void exec_variable_declaration(struct ExecutionContext* context, const char* identifier, struct ExecutionContextTypeInfo declaration_type)
+{
+    context_skip_spaces(context);
+
+    char current = context->code[context->position];
+
+    if (current != '=')
+    {
+        debug("ERR!: Expected '=' for '%s' variable declaration.\n", identifier);
+    }
+    else 
+    {
+        context->position++;
+    }
+
+    int value_stack_index = context->stack_index;
+
+    exec_expression(context);
+
+    if (!exec_check_expression_value(context, value_stack_index) || !context_is_running(context))
+    {
+        return;
+    }
+
+    struct ExecutionContextStackValue value = context_stack_get_last_value(context);
+
+    if (declaration_type.native == STACK_TYPE_STRUCT_INSTANCE 
+        && (value.type != STACK_TYPE_STRUCT_INSTANCE || *(void**)value.ptr != declaration_type.complex))
+    {
+        debug("ERR!: Cannot declare '%s', value is not an instance of declared struct.\n", identifier);
+        return;
+    }
+
+    if (declaration_type.native == STACK_TYPE_ARRAY && !array_check_element_type(value, declaration_type.complex->native_type))
+    {
+        debug("ERR!: Cannot declare '%s', value is not an array of declared type.\n", identifier);
+        return;
+    }
+
+    if (declaration_type.native == STACK_TYPE_COLUMNS && !columns_check_definition(value, declaration_type.complex))
+    {
+        debug("ERR!: Cannot declare '%s', value is not a column collection of declared struct.\n", identifier);
+        return;
+    }
+
+    context->stack_index -= value.size;
+
+    struct ExecutionContextVariable* variable = context_add_variable(
+        context, 
+        context_get_scope(context), 
+        identifier, 
+        declaration_type.native, 
+        value.size * sizeof(context->stack[0]),
+        true
+    );
+
+    if (!variable)
+    {
+        debug("ERR!: Cannot add local variable '%s'.\n", identifier);
+        context->stack_index += value.size;
+        return;
+    }
+
+    // Value was evaluated right where the variable lives, so it is moved in place
+    // instead of being copied and destructed
+    context_stack_move_value_at_index(context, variable->stack_index, value);
+    variable->flags = declaration_type.is_const ? VARIABLE_FLAG_CONST : VARIABLE_FLAG_NONE;
+
+#ifdef TOKEN_DEBUG
+    debug("Declared variable '%s' with value '[%s] %d'\n", variable->name, get_stack_type_name(value.type), context->stack[context->stack_index - 1]);
+#endif
+
+}
+
+#pragma endregion Variables
+
+#pragma region Struct fields
+
+struct ExecutionContextIdentifierResult exec_field_access(struct ExecutionContext* context, struct ExecutionContextIdentifierResult accessed)
+{
+    struct ExecutionContextStackValue value = context_stack_get_last_value(context);
+    struct ExecutionContextStructDefinitionFieldList* fields = NULL;
+    uint8_t* data;
+
+    if (value.type == STACK_TYPE_STRUCT)
+    {
+        struct ExecutionContextStructDefinition* definition = *(struct ExecutionContextStructDefinition**)value.ptr;
+        fields = &definition->static_fields;
+        data = definition->static_data;
+    }
+    else if (value.type == STACK_TYPE_STRUCT_INSTANCE)
+    {
+        struct ExecutionContextStructDefinition* definition = *(struct ExecutionContextStructDefinition**)value.ptr;
+        fields = &definition->fields;
+        data = ((uint8_t*)value.ptr) + sizeof(struct ExecutionContextStructDefinition*);
+    }
+    else if (value.type == STACK_TYPE_OBJECT)
+    {
+        uint8_t* heap_data = *(uint8_t**)value.ptr;
+        struct ExecutionContextStructDefinition* definition = *(struct ExecutionContextStructDefinition**)heap_data;
+        fields = &definition->fields;
+        data = heap_data + sizeof(struct ExecutionContextStructDefinition*);
+    }
+
+    char identifier[MAX_IDENTIFIER_LENGTH];
+    char current = context->code[context->position];
+
+    if (current == '.') 
+    {
+        context->position++;
+    }
+
+    context_skip_spaces(context);
+
+    parse_identifier(context, identifier, MAX_IDENTIFIER_LENGTH);
+
+    struct ExecutionContextStructFieldDefinition* field = 
+        fields ? context_struct_definition_field_list_find(fields, identifier) : NULL;
+
+    if (!field)
+    {
+        debug("ERR!: Field '%s' does not exist\n", identifier);
+        return (struct ExecutionContextIdentifierResult) { .data_type = EXECUTION_CONTEXT_IDENTIFIER_RESULT_ERROR };
+    }
+
+    uint8_t* field_data = data + field->offset;
+    int object_stack_index = context->stack_index - value.size;
+    int field_size = get_size_of_type(field->type);
+
+    if (field->type.native == STACK_TYPE_STRUCT_INSTANCE)
+    {
+        // Nested instance is stored without definition, it is rebuilt on the stack
+        context_stack_push_struct_instance(context, field->type.complex, field_data);
+    }
+    else 
+    {
+        uint64_t field_value = 0;
+
+        // Field can be smaller than a stack slot and be last in the data,
+        // copy only its bytes instead of reading the whole slot
+        memcpy(&field_value, field_data, field_size);
+
+        context_stack_push_value(
+            context,
+            (struct ExecutionContextStackValue) { .ptr = &field_value, .type = field->type.native, .size = field_size }
+        );
+    }
+
+    // Field value replaces accessed object on the stack
+    exec_call_cleanup(context, object_stack_index, value.size);
+
+    if ((value.type == STACK_TYPE_STRUCT_INSTANCE || value.type == STACK_TYPE_OBJECT) && accessed.data_type == EXECUTION_CONTEXT_IDENTIFIER_RESULT_VARIABLE)
+    {
+        return (struct ExecutionContextIdentifierResult) 
+        { 
+            .data_type = EXECUTION_CONTEXT_IDENTIFIER_RESULT_FIELD,
+            .field_data = { .variable = accessed.variable_data, .field = field }
+        };
+    }
+
+    if (field->type.native == STACK_TYPE_STRUCT)
+    {
+        return (struct ExecutionContextIdentifierResult) 
+        { 
+            .data_type = EXECUTION_CONTEXT_IDENTIFIER_RESULT_TYPE,
+            .type_data = field->type
+        };
+    }
+
+    return (struct ExecutionContextIdentifierResult) { .data_type = EXECUTION_CONTEXT_IDENTIFIER_RESULT_VALUE };
+}
+
+#pragma endregion Struct fields
+
+#pragma region Array elements
+
+void exec_array_element(
+    struct ExecutionContext* context, 
+    struct ExecutionArray* array, 
+    int64_t index, 
+    int collection_stack_index, 
+    int consumed_size
+) {
+    // Element replaces the collection and the index on the stack, 'a[i] = v' 
+    // stores the value into the element instead
+    uint64_t element;
+
+    if (context->code[context->position] == '=')
+    {
+        context->position++;
+        exec_expression(context);
+
+        if (!context_is_running(context))
+        {
+            return;
+        }
+
+        struct ExecutionContextStackValue value = context_stack_get_last_value(context);
+
+        if (!array_store(array, index, value))
+        {
+            debug("ERR!: Cannot store to array element %lld (length: %u, to: %s, from: %s)\n", 
+                (long long)index, array ? array->length : 0, get_stack_type_name(array ? array->element_type : 0), get_stack_type_name(value.type));
+            context_abort(context);
+        }
+
+        exec_call_cleanup(context, collection_stack_index, context->stack_index - collection_stack_index);
+        return;
+    }
+
+    if (!array_load(array, index, &element))
+    {
+        debug("ERR!: Array index %lld is out of bounds (length: %u)\n", (long long)index, array ? array->length : 0);
+        exec_call_cleanup(context, collection_stack_index, context->stack_index - collection_stack_index);
+        context_abort(context);
+        return;
+    }
+
+    context_stack_push_value(
+        context,
+        (struct ExecutionContextStackValue) { .ptr = &element, .type = array->element_type, .size = array->element_size }
+    );
+
+    exec_call_cleanup(context, collection_stack_index, consumed_size);
+}
+
+void exec_columns_element(
+    struct ExecutionContext* context, 
+    struct ExecutionColumns* columns, 
+    int64_t index, 
+    int collection_stack_index, 
+    int consumed_size
+) {
+    if (context->code[context->position] == '.')
+    {
+        // 'c[i].field' goes straight to the column of the field, other fields 
+        // of the record are not touched
+        char identifier[MAX_IDENTIFIER_LENGTH];
+
+        context->position++;
+        context_skip_spaces(context);
+        parse_identifier(context, identifier, MAX_IDENTIFIER_LENGTH);
+        context_skip_spaces(context);
+
+        struct ExecutionArray* column = columns ? columns_get_column(columns, identifier) : NULL;
+
+        if (!column)
+        {
+            debug("ERR!: Field '%s' does not exist\n", identifier);
+            exec_call_cleanup(context, collection_stack_index, context->stack_index - collection_stack_index);
+            context_abort(context);
+            return;
+        }
+
+        exec_array_element(context, column, index, collection_stack_index, consumed_size);
+        return;
+    }
+
+    if (context->code[context->position] == '=')
+    {
+        // Instance is scattered into the columns
+        context->position++;
+        exec_expression(context);
+
+        if (!context_is_running(context))
+        {
+            return;
+        }
+
+        struct ExecutionContextStackValue value = context_stack_get_last_value(context);
+
+        if (value.type != STACK_TYPE_STRUCT_INSTANCE 
+            || !columns 
+            || *(struct ExecutionContextStructDefinition**)value.ptr != columns->definition
+            || !columns_store(columns, index, (uint8_t*)(value.ptr + 1)))
+        {
+            debug("ERR!: Cannot store to record %lld (length: %u, from: %s)\n", 
+                (long long)index, columns ? columns->length : 0, get_stack_type_name(value.type));
+            context_abort(context);
+        }
+
+        exec_call_cleanup(context, collection_stack_index, context->stack_index - collection_stack_index);
+        return;
+    }
+
+    // Whole record is gathered into an instance
+    uint8_t record[columns ? columns->definition->size : 1];
+
+    if (!columns || !columns_load(columns, index, memset(record, 0, sizeof(record))))
+    {
+        debug("ERR!: Record index %lld is out of bounds (length: %u)\n", (long long)index, columns ? columns->length : 0);
+        exec_call_cleanup(context, collection_stack_index, context->stack_index - collection_stack_index);
+        context_abort(context);
+        return;
+    }
+
+    context_stack_push_struct_instance(context, columns->definition, record);
+    exec_call_cleanup(context, collection_stack_index, consumed_size);
+}
+
+void exec_array_index(struct ExecutionContext* context)
+{
+    // 'a[i]' on an array or a column collection, collection pointer is read before
+    // the index expression moves the stack
+    struct ExecutionContextStackValue collection_value = context_stack_get_last_value(context);
+    uint8_t collection_type = collection_value.type;
+    void* collection = *(void**)collection_value.ptr;
+    int collection_stack_index = context->stack_index - collection_value.size;
+
+    context->position++;
+    exec_expression(context);
+
+    if (!context_is_running(context))
+    {
+        return;
+    }
+
+    struct ExecutionContextStackValue index_value = context_stack_get_last_value(context);
+    int64_t index;
+
+    if (context->code[context->position] != ']' 
+        || context->stack_index == collection_stack_index + collection_value.size 
+        || !array_index_from_value(index_value, &index))
+    {
+        debug("ERR!: Array index has to be an integer followed by ']'\n");
+        exec_call_cleanup(context, collection_stack_index, context->stack_index - collection_stack_index);
+        context_abort(context);
+        return;
+    }
+
+    context->position++;
+    context_skip_spaces(context);
+
+    int consumed_size = collection_value.size + index_value.size;
+
+    if (collection_type == STACK_TYPE_COLUMNS)
+    {
+        exec_columns_element(context, collection, index, collection_stack_index, consumed_size);
+    }
+    else
+    {
+        exec_array_element(context, collection, index, collection_stack_index, consumed_size);
+    }
+}
+
+void exec_columns_field(struct ExecutionContext* context)
+{
+    // 'c.field' replaces the collection by the column of the field, it is a regular 
+    // array, so built-ins scan the field in one contiguous pass
+    struct ExecutionContextStackValue value = context_stack_get_last_value(context);
+    struct ExecutionColumns* columns = *(struct ExecutionColumns**)value.ptr;
+    int collection_stack_index = context->stack_index - value.size;
+    char identifier[MAX_IDENTIFIER_LENGTH];
+
+    context->position++;
+    context_skip_spaces(context);
+    parse_identifier(context, identifier, MAX_IDENTIFIER_LENGTH);
+
+    uint64_t column = (uint64_t)(columns ? columns_get_column(columns, identifier) : NULL);
+
+    if (!column)
+    {
+        debug("ERR!: Field '%s' does not exist\n", identifier);
+        exec_call_cleanup(context, collection_stack_index, value.size);
+        context_abort(context);
+        return;
+    }
+
+    context_stack_push_value(
+        context, 
+        (struct ExecutionContextStackValue) { .ptr = &column, .type = STACK_TYPE_ARRAY, .size = get_size_of_native_type(STACK_TYPE_ARRAY) }
+    );
+
+    exec_call_cleanup(context, collection_stack_index, value.size);
+}
+
+#pragma endregion Array elements
+
+#pragma region Map elements
+
+void exec_map_index(struct ExecutionContext* context)
+{
+    // 'm[key]' replaces the map on the stack by the value of the key, 'm[key] = v' 
+    // inserts or replaces the value instead
+    struct ExecutionContextStackValue map_value = context_stack_get_last_value(context);
+    struct ExecutionMap* map = *(struct ExecutionMap**)map_value.ptr;
+    int map_stack_index = context->stack_index - map_value.size;
+
+    context->position++;
+    exec_expression(context);
+
+    if (!context_is_running(context))
+    {
+        return;
+    }
+
+    struct ExecutionContextStackValue key_value = context_stack_get_last_value(context);
+    uint8_t key_type;
+    uint64_t key;
+
+    if (context->code[context->position] != ']' 
+        || context->stack_index == map_stack_index + map_value.size 
+        || !map_key_from_value(key_value, &key_type, &key))
+    {
+        debug("ERR!: Map key has to be an integer or a string followed by ']'\n");
+        exec_call_cleanup(context, map_stack_index, context->stack_index - map_stack_index);
+        context_abort(context);
+        return;
+    }
+
+    context->position++;
+    context_skip_spaces(context);
+
+    if (context->code[context->position] == '=')
+    {
+        int value_stack_index = context->stack_index;
+
+        context->position++;
+        exec_expression(context);
+
+        if (!context_is_running(context))
+        {
+            return;
+        }
+
+        struct ExecutionContextStackValue value = context_stack_get_last_value(context);
+
+        if (context->stack_index == value_stack_index || !map || !map_store(map, key_type, key, value))
+        {
+            debug("ERR!: Cannot store value of type %s to map\n", get_stack_type_name(value.type));
+            context_abort(context);
+        }
+
+        exec_call_cleanup(context, map_stack_index, context->stack_index - map_stack_index);
+        return;
+    }
+
+    struct ExecutionMapEntry* entry = map ? map_find(map, key_type, key) : NULL;
+
+    if (!entry)
+    {
+        debug("ERR!: Key of type %s is not in the map\n", get_stack_type_name(key_value.type));
+        exec_call_cleanup(context, map_stack_index, context->stack_index - map_stack_index);
+        context_abort(context);
+        return;
+    }
+
+    map_push_value(context, entry);
+
+    // Value replaces the map and the key on the stack
+    exec_call_cleanup(context, map_stack_index, map_value.size + key_value.size);
+}
+
+#pragma endregion Map elements
+#pragma endregion --- Access ---
+
+#pragma region --- Operators ---
+
+#pragma region Call
+
+int exec_call_args(struct ExecutionContext* context, int start_stack_index) 
+{
+    // Parsing an expression here, because ',' operator pushes all expressions 
+    // into a stack, which means this will populate arguments for this call
+    exec_expression(context);
+
+    if (!context_is_running(context))
+    {
+        // Execution was aborted while evaluating args, report what was pushed 
+        // so the caller can cleanup the frame
+        return context->stack_index - start_stack_index;
+    }
+
+    char current = context->code[context->position];
+
+    // We should be at ')', if not there is something wrong with syntax
+    if (current == ')')
+    {
+        context->position++;
+    }
+    else 
+    {
+        debug("ERR!: Syntax error missing ')'\n");
+        // FIXME: should panic
+        return 0;
+    }
+
+    // Provided args size pushed to the stack can be calculated
+    int args_stack_size = context->stack_index - start_stack_index;
+
+    return args_stack_size;
+}
+
+void exec_call_cleanup(struct ExecutionContext* context, int frame_start_stack_index, int args_stack_size) 
+{
+    struct ExecutionContextStackIterator iterator = context_stack_iterate(context);
+
+    int return_count = 0;
+    int frame_args_end_stack_index = frame_start_stack_index + args_stack_size;
+
+    while(iterator.stack_index != frame_args_end_stack_index)
     {
         // bypass returned values
         context_stack_iterator_next(context, &iterator);
@@ -644,6 +1541,15 @@ void exec_call_cleanup(struct ExecutionContext* context, int frame_start_stack_i
 
     int return_size = context->stack_index - iterator.stack_index;
 
+    struct ExecutionContextStackIterator returned_iterator = context_stack_iterate(context);
+
+    while(returned_iterator.stack_index != iterator.stack_index)
+    {
+        // Returned values can be borrowed from variables destructed below
+        context_stack_iterator_next(context, &returned_iterator);
+        context_stack_own_value_at_index(context, returned_iterator.stack_index);
+    }
+
     #ifdef TOKEN_DEBUG
     debug("Returned values %d, overall size: %d byte(s)\n", return_count, return_size * 8);
     #endif
@@ -655,7 +1561,9 @@ void exec_call_cleanup(struct ExecutionContext* context, int frame_start_stack_i
         context_stack_unset_value_at_index(context, iterator.stack_index);
     }
 
-    memmove(&context->stack[frame_start_stack_index], &context->stack[frame_args_end_stack_index], return_size);
+    memmove(&context->stack[frame_start_stack_index], &context->stack[frame_args_end_stack_index], return_size * sizeof(context->stack[0]));
+    memmove(&context->stack_type[frame_start_stack_index], &context->stack_type[frame_args_end_stack_index], return_size * sizeof(context->stack_type[0]));
+    memmove(&context->stack_flags[frame_start_stack_index], &context->stack_flags[frame_args_end_stack_index], return_size * sizeof(context->stack_flags[0]));
     context->stack_index = frame_start_stack_index + return_size;
 
     #ifdef TOKEN_DEBUG
@@ -694,46 +1602,34 @@ void exec_call_native_function(struct ExecutionContextStackValue stack_value, st
         debug("Calling %p with %d arguments\n", func, args_count);
     #endif
 
-    func(context);
-
-    exec_call_cleanup(context, frame_start_stack_index, args_count);
-}
-
-void exec_call_function(struct ExecutionContextStackValue stack_value, struct ExecutionContext* context)
-{
-#ifdef TOKEN_DEBUG
-    debug("Calling function at position: %d\n", *stack_value.ptr);
-#endif
-
-    if (stack_value.type != NATIVE_TYPE_FUNCTION)
+    if (context_is_running(context))
     {
-        debug("ERR!: Value is not a function\n");
-        return;
-    }
-
-    // Stack value contains start text position for the function, currently
-    // it should point to place directly after '(' character
-    int func_position = *stack_value.ptr;
-    // Save start stack index for later, we need to restore it after
-    // function call is done 
-    int frame_start_stack_index = context->stack_index;
-
-    #ifdef TOKEN_DEBUG
-        debug("Prepare to call %p\n", func_position);
-    #endif
+        // Natives read their arguments starting from this index
+        int native_frame_stack_index = context->native_frame_stack_index;
+        context->native_frame_stack_index = frame_start_stack_index;
 
-    // Create new scope to which we will push args values
-    struct ExecutionContextScope* scope = context_push_scope(context);
+        func(context);
 
-    // Read argument values and push them to the stack from call expression
-    int args_stack_size = exec_call_args(context, frame_start_stack_index);
+        if (context->state == EXECUTION_CONTEXT_STATE_SUSPENDED)
+        {
+            // Native is waiting for the host, it pushes the result before resuming
+            context_yield(context);
+        }
 
-    #ifdef TOKEN_DEBUG
-        debug("Parsed call args, jumping to the function code %p\n", func_position);
-    #endif
+        context->native_frame_stack_index = native_frame_stack_index;
+    }
 
-    int return_position = context->position;
+    // Called function value is right below the args, remove it together with them
+    exec_call_cleanup(context, frame_start_stack_index - 1, args_count + 1);
+}
 
+void exec_function_body(
+    struct ExecutionContext* context, 
+    struct ExecutionContextScope* scope, 
+    int func_position, 
+    int frame_start_stack_index, 
+    int args_stack_size
+) {
     // Jump to function code
     context->position = func_position;
     context_skip_spaces(context);
@@ -760,6 +1656,8 @@ void exec_call_function(struct ExecutionContextStackValue stack_value, struct Ex
                 context_stack_pop_value(context);
             }
 
+            type_info = context_get_value_type(context_parse_array_type(context, type_info));
+
             // Read the name of the variable
             context_skip_spaces(context);
             parse_identifier(context, identifier, MAX_IDENTIFIER_LENGTH);
@@ -770,8 +1668,10 @@ void exec_call_function(struct ExecutionContextStackValue stack_value, struct Ex
             // Move stack back to frame start, so we can assign pushed values to variables
             context->stack_index = frame_start_stack_index + index;
 
-            // Get pushed value at current index which will be assigned to variable
+            // Get pushed value at current index which will be assigned to variable,
+            // argument becomes a variable so it has to own its references
             struct ExecutionContextStackValue arg_stack_value = context_stack_get_value_at_index(context, frame_start_stack_index + index);
+            context_stack_own_value_at_index(context, frame_start_stack_index + index);
             index += arg_stack_value.size;
 
             // Override values on stack so we create new variables without extra value copy,
@@ -781,10 +1681,24 @@ void exec_call_function(struct ExecutionContextStackValue stack_value, struct Ex
                 scope, 
                 identifier, 
                 type_info.native, 
-                arg_stack_value.size, 
+                arg_stack_value.size * sizeof(context->stack[0]), 
                 true
             );
 
+            if (!variable)
+            {
+                debug("ERR!: Argument for parameter %s cannot be assigned\n", identifier);
+                context->stack_index = current_stack_index;
+                context_abort(context);
+                return;
+            }
+
+            if (type_info.native == STACK_TYPE_ACQUIRE || (type_info.native & STACK_TYPE_DYNAMIC))
+            {
+                // Untyped parameters take the type of the argument, same as declarations
+                context->stack_type[variable->stack_index] = arg_stack_value.type;
+            }
+
             context->stack_index = current_stack_index;
 
             current = context->code[context->position];
@@ -797,42 +1711,115 @@ void exec_call_function(struct ExecutionContextStackValue stack_value, struct Ex
             context->position++;
         }
 
-        if (current == ')')
-        {
-            context->position++;
-        }
-        else 
+        if (index != args_stack_size || current != ')')
         {
-            debug("ERR!: Syntax error missing ')'\n");
-            // FIXME: should panic
+            // Parameters left without an argument or arguments left without a parameter
+            debug("ERR!: Arguments do not match parameters of the called function\n");
+            context_abort(context);
             return;
         }
+
+        context->position++;
+    }
+    else if (args_stack_size != 0)
+    {
+        debug("ERR!: Arguments do not match parameters of the called function\n");
+        context_abort(context);
+        return;
     }
     else 
     {
-        context->position++;
+        context->position++;
+    }
+
+    context_skip_spaces(context);
+
+    current = context->code[context->position];
+
+    if (current == '=')
+    {
+        context->position++;
+    }
+
+    current = context->code[context->position];
+
+    if (current == '>')
+    {
+        context->position++;
+    }
+
+    exec_expression(context);
+}
+
+void exec_call_function(struct ExecutionContextStackValue stack_value, struct ExecutionContext* context)
+{
+#ifdef TOKEN_DEBUG
+    debug("Calling function at position: %d\n", *stack_value.ptr);
+#endif
+
+    if (stack_value.type != NATIVE_TYPE_FUNCTION)
+    {
+        debug("ERR!: Value is not a function\n");
+        return;
     }
 
-    context_skip_spaces(context);
+    // Stack value contains start text position for the function, currently
+    // it should point to place directly after '(' character
+    int func_position = *stack_value.ptr;
+    // Save start stack index for later, we need to restore it after
+    // function call is done 
+    int frame_start_stack_index = context->stack_index;
 
-    current = context->code[context->position];
+    #ifdef TOKEN_DEBUG
+        debug("Prepare to call %p\n", func_position);
+    #endif
 
-    if (current == '=')
+    // Read argument values and push them to the stack from call expression,
+    // they are evaluated in the scope of the caller
+    int args_stack_size = exec_call_args(context, frame_start_stack_index);
+
+    // Create new scope to which args values will be assigned
+    struct ExecutionContextScope* scope = context_push_scope(context);
+    scope->min_stack_index = frame_start_stack_index;
+
+    #ifdef TOKEN_DEBUG
+        debug("Parsed call args, jumping to the function code %p\n", func_position);
+    #endif
+
+    int return_position = context->position;
+
+    // Hot functions run compiled code, register engine takes the same frame
+    if (!jit_try_call(context, func_position, frame_start_stack_index, args_stack_size)
+        && !regvm_try_call(context, func_position, frame_start_stack_index, args_stack_size))
     {
-        context->position++;
+        exec_function_body(context, scope, func_position, frame_start_stack_index, args_stack_size);
     }
 
-    current = context->code[context->position];
+    context->position = return_position;
+    
+    // Called function value is right below the args, remove it together with them
+    exec_call_cleanup(context, frame_start_stack_index - 1, args_stack_size + 1);
+    context_pop_scope(context);
+}
 
-    if (current == '>')
+void exec_invoke_function(struct ExecutionContext* context, int func_position, int frame_start_stack_index)
+{
+    // Same as exec_call_function, but args were already pushed to the stack 
+    // by the host starting at frame_start_stack_index
+    int args_stack_size = context->stack_index - frame_start_stack_index;
+    int return_position = context->position;
+
+    struct ExecutionContextScope* scope = context_push_scope(context);
+    scope->min_stack_index = frame_start_stack_index;
+
+    if (!jit_try_call(context, func_position, frame_start_stack_index, args_stack_size)
+        && !regvm_try_call(context, func_position, frame_start_stack_index, args_stack_size))
     {
-        context->position++;
+        exec_function_body(context, scope, func_position, frame_start_stack_index, args_stack_size);
     }
 
-    exec_expression(context);
-
     context->position = return_position;
-    
+
     exec_call_cleanup(context, frame_start_stack_index, args_stack_size);
     context_pop_scope(context);
 }
@@ -841,6 +1828,11 @@ void exec_call(struct ExecutionContext* context)
 {
     struct ExecutionContextStackValue stack_value = context_stack_get_last_value(context);
 
+    if (!context_consume_fuel(context, FUEL_COST_CALL))
+    {
+        return;
+    }
+
     if (stack_value.type == NATIVE_TYPE_NATIVE_FUNCTION)
     {
         exec_call_native_function(stack_value, context);
@@ -855,12 +1847,42 @@ void exec_call(struct ExecutionContext* context)
     }
 }
 
+bool exec_inlined_call(struct ExecutionContext* context)
+{
+    if (context->script->inlining.call_count == 0)
+    {
+        return false;
+    }
+
+    struct ExecutionContextInlinedCall* call = exec_inline_find_call(context, context->position);
+
+    if (!call)
+    {
+        return false;
+    }
+
+#ifdef TOKEN_DEBUG
+    debug("Inlined call at %d, body at %d\n", call->start_position, call->body_position);
+#endif
+
+    // Body only reads names which resolve the same at the call site, its values stay
+    // on the stack as if it was written in place of the call
+    int end_position = call->end_position;
+
+    context->position = call->body_position;
+    exec_expression(context);
+    context->position = end_position;
+
+    return true;
+}
+
 #pragma endregion Call
 
 #pragma endregion --- Operators ---
 
 struct ExecutionContextIdentifierResult exec_identifier(struct ExecutionContext* context, char* identifier, int max_len)
 {
+    int identifier_position = context->position;
     int identifier_length = parse_identifier(context, identifier, max_len);
 
     // Check if identifier is a keyword
@@ -871,6 +1893,12 @@ struct ExecutionContextIdentifierResult exec_identifier(struct ExecutionContext*
         return (struct ExecutionContextIdentifierResult) { .data_type = EXECUTION_CONTEXT_IDENTIFIER_RESULT_HANDLED };
     }
 
+    if (identifier_length == 3 && strncmp(identifier, "new", identifier_length) == 0)
+    {
+        exec_new(context, identifier_position);
+        return (struct ExecutionContextIdentifierResult) { .data_type = EXECUTION_CONTEXT_IDENTIFIER_RESULT_VALUE };
+    }
+
     // If not a keyword the try to get type from it
 
     // context_get_type_from_identifier searcher for variable and we can remember the search
@@ -913,6 +1941,11 @@ struct ExecutionContextIdentifierResult exec_identifier(struct ExecutionContext*
 }
 
 void exec_expression(struct ExecutionContext* context)
+{
+    exec_expression_with_flags(context, EXEC_EXPRESSION_FLAG_NONE);
+}
+
+void exec_expression_with_flags(struct ExecutionContext* context, uint8_t flags)
 {
     char current;
     char last_expression = 0;
@@ -927,6 +1960,11 @@ void exec_expression(struct ExecutionContext* context)
 
     while (context->position < context->code_len)
     {
+        if (!context_consume_fuel(context, FUEL_COST_OPERATION))
+        {
+            break;
+        }
+
         context_skip_spaces(context);
         current = context->code[context->position];
 
@@ -936,7 +1974,7 @@ void exec_expression(struct ExecutionContext* context)
             debug("TOKEN: %c\n", current);
         #endif
 
-        if (isalpha(current)) 
+        if (parse_is_identifier_start(current)) 
         {
             char identifier[MAX_IDENTIFIER_LENGTH];
 
@@ -965,7 +2003,15 @@ void exec_expression(struct ExecutionContext* context)
                 if (last_stack_value.type == NATIVE_TYPE_TYPEDEF || last_stack_value.type == STACK_TYPE_STRUCT)
                 {
                     struct ExecutionContextStructDefinition* def = (struct ExecutionContextStructDefinition*)*last_stack_value.ptr;
-                    exec_variable_declaration(context, identifier, (struct ExecutionContextTypeInfo) { .native = last_stack_value.type, .complex = def });
+                    struct ExecutionContextTypeInfo declaration_type = last_stack_value.type == STACK_TYPE_STRUCT
+                        ? (struct ExecutionContextTypeInfo) { .native = STACK_TYPE_STRUCT_INSTANCE, .complex = def }
+                        : (struct ExecutionContextTypeInfo) { .native = def->native_type, .complex = def };
+
+                    // Type is only needed for the declaration, it cannot stay below the variable.
+                    // Struct definition is still referenced by the variable it was declared with
+                    context_stack_pop_value(context);
+
+                    exec_variable_declaration(context, identifier, declaration_type);
                 }
                 else 
                 {
@@ -979,6 +2025,12 @@ void exec_expression(struct ExecutionContext* context)
                 continue;
             }        
 
+            if (exec_fold_expression(context) || exec_inlined_call(context))
+            {
+                last_identifier_result.data_type = EXECUTION_CONTEXT_IDENTIFIER_RESULT_VALUE;
+                continue;
+            }
+
             last_identifier_result = exec_identifier(context, identifier, MAX_IDENTIFIER_LENGTH);
 
             #ifdef TOKEN_DEBUG
@@ -988,21 +2040,30 @@ void exec_expression(struct ExecutionContext* context)
             if (last_identifier_result.data_type >= EXECUTION_CONTEXT_IDENTIFIER_RESULT_ERROR)
             {
                 debug("ERR!: Identifier %s is not known identifier\n", identifier);
+                context_abort(context);
                 return;
             }
 
             continue;
         }
+        else if (current == '"')
+        {
+            exec_string(context);
+        }
         else if (isdigit(current) || current == '.')
         {
             if (current == '.')
             {
                 if (last_stack_value.type == STACK_TYPE_STRUCT || last_stack_value.type == STACK_TYPE_STRUCT_INSTANCE || last_stack_value.type == STACK_TYPE_OBJECT)
                 {
-                    last_identifier_result = exec_field_access(context);
+                    last_identifier_result = exec_field_access(context, last_identifier_result);
 
                     continue;
                 }
+                else if (last_stack_value.type == STACK_TYPE_COLUMNS)
+                {
+                    exec_columns_field(context);
+                }
                 else 
                 {
                     exec_number(context);
@@ -1024,9 +2085,29 @@ void exec_expression(struct ExecutionContext* context)
             if (last_identifier_result.data_type == EXECUTION_CONTEXT_IDENTIFIER_RESULT_VARIABLE)
             {
                 // Last identifier was variable, so this is variable assignment
+                bool typed = exec_infer_is_typed_assignment(context, context->position);
+                int value_stack_index = context->stack_index;
+
+                context->position++;
+                exec_expression(context);
+
+                if (exec_check_expression_value(context, value_stack_index))
+                {
+                    exec_assignment(context, last_identifier_result.variable_data, typed);
+                }
+            }
+            else if (last_identifier_result.data_type == EXECUTION_CONTEXT_IDENTIFIER_RESULT_FIELD)
+            {
+                // Field of a struct instance variable is assigned in place
+                int value_stack_index = context->stack_index;
+
                 context->position++;
                 exec_expression(context);
-                exec_assignment(context, last_identifier_result.variable_data);
+
+                if (exec_check_expression_value(context, value_stack_index))
+                {
+                    exec_field_assignment(context, last_identifier_result.field_data.variable, last_identifier_result.field_data.field);
+                }
             }
         }
         else if (current == ';')
@@ -1035,6 +2116,11 @@ void exec_expression(struct ExecutionContext* context)
         }
         else if (current == ',')
         {
+            if (flags & EXEC_EXPRESSION_FLAG_STOP_AT_COMMA)
+            {
+                break;
+            }
+
             context->position++;
         }
         else if (current == '(')
@@ -1042,7 +2128,9 @@ void exec_expression(struct ExecutionContext* context)
             if (last_stack_value.type == STACK_TYPE_STRUCT || last_stack_value.type == NATIVE_TYPE_TYPEDEF)
             {
                 // Last stack value is a type defintion, so this is now
-                // a function declaration
+                // a function declaration, return type is not needed on the stack
+                context_stack_pop_value(context);
+
                 exec_function(
                     context, 
                     last_identifier_result.type_data 
@@ -1073,18 +2161,72 @@ void exec_expression(struct ExecutionContext* context)
         {
             if (last_identifier_result.data_type == EXECUTION_CONTEXT_IDENTIFIER_RESULT_TYPE)
             {
-                // Last expression was identifier representing a type, so this is now
-                // a bound function declaration
-                exec_bound_function(
-                    context, 
-                    last_identifier_result.type_data
-                );
+                struct ExecutionContextTypeInfo array_type = context_parse_array_type(context, last_identifier_result.type_data);
+                int bracket_position = context->position;
+
+                context->position++;
+                context_skip_spaces(context);
+
+                bool empty_brackets = context->code[context->position] == ']';
+                context->position = bracket_position;
+
+                if (array_type.native == STACK_TYPE_ARRAY || array_type.native == STACK_TYPE_COLUMNS)
+                {
+                    // 'T[] name' is a declaration of an array variable, next identifier 
+                    // is handled as a declaration with the array type
+                    context_stack_pop_value(context);
+                    last_identifier_result.type_data = array_type;
+
+                    continue;
+                }
+                else if (!empty_brackets 
+                    && (check_type_is_numeric(last_identifier_result.type_data.native) 
+                        || last_identifier_result.type_data.native == STACK_TYPE_STRUCT))
+                {
+                    exec_array_new(context, last_identifier_result.type_data);
+                }
+                else
+                {
+                    // Last expression was identifier representing a type, so this is now
+                    // a bound function declaration
+                    exec_bound_function(
+                        context, 
+                        last_identifier_result.type_data
+                    );
+                }
+            }
+            else if (last_stack_value.type == STACK_TYPE_ARRAY || last_stack_value.type == STACK_TYPE_COLUMNS)
+            {
+                exec_array_index(context);
+            }
+            else if (last_stack_value.type == STACK_TYPE_MAP)
+            {
+                exec_map_index(context);
             }
         }
+        else if (current == ']' || current == ':')
+        {
+            // ':' ends a map literal key
+            break;
+        }
         else if (current == '{')
         {
-            context->position++;
-            exec_block(context);
+            if (last_stack_value.type == STACK_TYPE_STRUCT)
+            {
+                // Struct value followed by a block is an instance construction
+                exec_struct_instance(context);
+            }
+            else if (last_stack_value.type == NATIVE_TYPE_TYPEDEF 
+                && last_identifier_result.data_type == EXECUTION_CONTEXT_IDENTIFIER_RESULT_TYPE
+                && last_identifier_result.type_data.native == STACK_TYPE_MAP)
+            {
+                exec_map_new(context);
+            }
+            else 
+            {
+                context->position++;
+                exec_block(context);
+            }
         }
         else if (current == '}')
         {
@@ -1115,6 +2257,25 @@ void fts_print(struct ExecutionContext* context)
     {
         debug("%d\n", context->stack[context->stack_index - 1]);
     }
+    else if (value.type == NATIVE_TYPE_I64) 
+    {
+        debug("%lld\n", (long long)*(int64_t*)value.ptr);
+    }
+    else if (value.type == NATIVE_TYPE_FLOAT) 
+    {
+        debug("%g\n", *(float*)value.ptr);
+    }
+    else if (value.type == NATIVE_TYPE_DOUBLE) 
+    {
+        debug("%g\n", *(double*)value.ptr);
+    }
+    else if (value.type == NATIVE_TYPE_STRING) 
+    {
+        uint32_t length;
+        const char* data = string_get_data(value.ptr, &length);
+
+        debug("%.*s\n", length, data);
+    }
     else 
     {
         debug("Invalid type\n");
@@ -1130,7 +2291,11 @@ void fts_add(struct ExecutionContext* context)
     // first parameter
     struct ExecutionContextStackValue value = context_stack_iterator_next(context, &iterator);
 
-    if (value.type == NATIVE_TYPE_I32 && value2.type == NATIVE_TYPE_I32) 
+    if (value.type == STACK_TYPE_ARRAY)
+    {
+        fts_array_add(context);
+    }
+    else if (value.type == NATIVE_TYPE_I32 && value2.type == NATIVE_TYPE_I32) 
     {
         int32_t result = *(int32_t*)value.ptr + *(int32_t*)value2.ptr;
         uint64_t value = result;
@@ -1144,208 +2309,525 @@ void fts_add(struct ExecutionContext* context)
 
 #pragma endregion --- SCRIPT FUNCTIONS ---
 
-void context_native_types_default_initialize(struct ExecutionContext* context)
+void registry_native_types_default_initialize(struct ExecutionRegistry* registry)
 {
-    context->native_types[NATIVE_TYPE_TYPEDEF] = (struct ExecutionContextStructDefinition) {
+    registry->native_types[NATIVE_TYPE_TYPEDEF] = (struct ExecutionContextStructDefinition) {
         .fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .static_fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .flags = EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_NATIVE,
         .size = sizeof(void*),
+        .alignment = sizeof(void*),
         .static_size = 0,
         .static_data = NULL,
         .native_type = NATIVE_TYPE_TYPEDEF
     };
 
-    context->native_types[STACK_TYPE_STRUCT] = (struct ExecutionContextStructDefinition) {
+    registry->native_types[STACK_TYPE_STRUCT] = (struct ExecutionContextStructDefinition) {
+        .fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
+        .static_fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
+        .flags = EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_NATIVE | EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_NEEDS_DESTRUCTOR,
+        .size = sizeof(void*),
+        .alignment = sizeof(void*),
+        .static_size = 0,
+        .static_data = NULL,
+        .native_type = STACK_TYPE_STRUCT,
+        .reference_count = 1,
+        .reference_offsets = { 0 }
+    };
+
+    registry->native_types[STACK_TYPE_OBJECT] = (struct ExecutionContextStructDefinition) {
+        .fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
+        .static_fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
+        .flags = EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_NATIVE | EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_NEEDS_DESTRUCTOR,
+        .size = sizeof(void*),
+        .alignment = sizeof(void*),
+        .static_size = 0,
+        .static_data = NULL,
+        .native_type = STACK_TYPE_OBJECT,
+        .reference_count = 1,
+        .reference_offsets = { 0 }
+    };
+
+    registry->native_types[STACK_TYPE_ARRAY] = (struct ExecutionContextStructDefinition) {
+        .fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
+        .static_fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
+        .flags = EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_NATIVE | EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_NEEDS_DESTRUCTOR,
+        .size = sizeof(void*),
+        .alignment = sizeof(void*),
+        .static_size = 0,
+        .static_data = NULL,
+        .native_type = STACK_TYPE_ARRAY,
+        .reference_count = 1,
+        .reference_offsets = { 0 }
+    };
+
+    registry->native_types[NATIVE_TYPE_STRING] = (struct ExecutionContextStructDefinition) {
         .fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .static_fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .flags = EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_NATIVE | EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_NEEDS_DESTRUCTOR,
         .size = sizeof(void*),
+        .alignment = sizeof(void*),
         .static_size = 0,
         .static_data = NULL,
-        .native_type = STACK_TYPE_STRUCT
+        .native_type = NATIVE_TYPE_STRING,
+        .reference_count = 1,
+        .reference_offsets = { 0 }
     };
 
-    context->native_types[STACK_TYPE_OBJECT] = (struct ExecutionContextStructDefinition) {
+    registry->native_types[STACK_TYPE_MAP] = (struct ExecutionContextStructDefinition) {
         .fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .static_fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .flags = EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_NATIVE | EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_NEEDS_DESTRUCTOR,
         .size = sizeof(void*),
+        .alignment = sizeof(void*),
         .static_size = 0,
         .static_data = NULL,
-        .native_type = STACK_TYPE_OBJECT
+        .native_type = STACK_TYPE_MAP,
+        .reference_count = 1,
+        .reference_offsets = { 0 }
     };
 
-    context->native_types[NATIVE_TYPE_PTR] = (struct ExecutionContextStructDefinition) {
+    registry->native_types[NATIVE_TYPE_PTR] = (struct ExecutionContextStructDefinition) {
         .fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .static_fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .flags = EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_NATIVE,
         .size = sizeof(void*),
+        .alignment = sizeof(void*),
         .static_size = 0,
         .static_data = NULL,
         .native_type = NATIVE_TYPE_PTR
     };
 
-    context->native_types[NATIVE_TYPE_NATIVE_FUNCTION] = (struct ExecutionContextStructDefinition) {
+    registry->native_types[NATIVE_TYPE_NATIVE_FUNCTION] = (struct ExecutionContextStructDefinition) {
         .fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .static_fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .flags = EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_NATIVE,
         .size = sizeof(void*),
+        .alignment = sizeof(void*),
         .static_size = 0,
         .static_data = NULL,
         .native_type = NATIVE_TYPE_NATIVE_FUNCTION
     };
 
-    context->native_types[NATIVE_TYPE_I8] = (struct ExecutionContextStructDefinition) {
+    registry->native_types[NATIVE_TYPE_I8] = (struct ExecutionContextStructDefinition) {
         .fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .static_fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .flags = EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_NATIVE,
         .size = 1,
+        .alignment = 1,
         .static_size = 0,
         .static_data = NULL,
         .native_type = NATIVE_TYPE_I8
     };
 
-    context->native_types[NATIVE_TYPE_U8] = (struct ExecutionContextStructDefinition) {
+    registry->native_types[NATIVE_TYPE_U8] = (struct ExecutionContextStructDefinition) {
         .fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .static_fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .flags = EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_NATIVE,
         .size = 1,
+        .alignment = 1,
         .static_size = 0,
         .static_data = NULL,
         .native_type = NATIVE_TYPE_U8
     };
 
-    context->native_types[NATIVE_TYPE_I16] = (struct ExecutionContextStructDefinition) {
+    registry->native_types[NATIVE_TYPE_I16] = (struct ExecutionContextStructDefinition) {
         .fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .static_fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .flags = EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_NATIVE,
         .size = 2,
+        .alignment = 2,
         .static_size = 0,
         .static_data = NULL,
         .native_type = NATIVE_TYPE_I16
     };
 
-    context->native_types[NATIVE_TYPE_U16] = (struct ExecutionContextStructDefinition) {
+    registry->native_types[NATIVE_TYPE_U16] = (struct ExecutionContextStructDefinition) {
         .fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .static_fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .flags = EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_NATIVE,
         .size = 2,
+        .alignment = 2,
         .static_size = 0,
         .static_data = NULL,
         .native_type = NATIVE_TYPE_U16
     };
 
-    context->native_types[NATIVE_TYPE_I32] = (struct ExecutionContextStructDefinition) {
+    registry->native_types[NATIVE_TYPE_I32] = (struct ExecutionContextStructDefinition) {
         .fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .static_fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .flags = EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_NATIVE,
         .size = 4,
+        .alignment = 4,
         .static_size = 0,
         .static_data = NULL,
         .native_type = NATIVE_TYPE_I32
     };
 
-    context->native_types[NATIVE_TYPE_U32] = (struct ExecutionContextStructDefinition) {
+    registry->native_types[NATIVE_TYPE_U32] = (struct ExecutionContextStructDefinition) {
         .fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .static_fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .flags = EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_NATIVE,
         .size = 4,
+        .alignment = 4,
         .static_size = 0,
         .static_data = NULL,
         .native_type = NATIVE_TYPE_U32
     };
 
-    context->native_types[NATIVE_TYPE_FLOAT] = (struct ExecutionContextStructDefinition) {
+    registry->native_types[NATIVE_TYPE_FLOAT] = (struct ExecutionContextStructDefinition) {
         .fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .static_fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .flags = EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_NATIVE,
         .size = 4,
+        .alignment = 4,
         .static_size = 0,
         .static_data = NULL,
         .native_type = NATIVE_TYPE_FLOAT
     };
 
-    context->native_types[NATIVE_TYPE_FUNCTION] = (struct ExecutionContextStructDefinition) {
+    registry->native_types[NATIVE_TYPE_FUNCTION] = (struct ExecutionContextStructDefinition) {
         .fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .static_fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .flags = EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_NATIVE,
         .size = 4,
+        .alignment = 4,
         .static_size = 0,
         .static_data = NULL,
         .native_type = NATIVE_TYPE_FUNCTION
     };
 
-    context->native_types[NATIVE_TYPE_I64] = (struct ExecutionContextStructDefinition) {
+    registry->native_types[NATIVE_TYPE_I64] = (struct ExecutionContextStructDefinition) {
         .fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .static_fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .flags = EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_NATIVE,
         .size = 8,
+        .alignment = 8,
         .static_size = 0,
         .static_data = NULL,
         .native_type = NATIVE_TYPE_I64
     };
 
-    context->native_types[NATIVE_TYPE_U64] = (struct ExecutionContextStructDefinition) {
+    registry->native_types[NATIVE_TYPE_U64] = (struct ExecutionContextStructDefinition) {
         .fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .static_fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .flags = EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_NATIVE,
         .size = 8,
+        .alignment = 8,
         .static_size = 0,
         .static_data = NULL,
         .native_type = NATIVE_TYPE_U64
     };
 
-    context->native_types[NATIVE_TYPE_DOUBLE] = (struct ExecutionContextStructDefinition) {
+    registry->native_types[NATIVE_TYPE_DOUBLE] = (struct ExecutionContextStructDefinition) {
         .fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .static_fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .flags = EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_NATIVE,
         .size = 8,
+        .alignment = 8,
         .static_size = 0,
         .static_data = NULL,
         .native_type = NATIVE_TYPE_DOUBLE
     };
 
-    context->native_types[NATIVE_TYPE_VOID] = (struct ExecutionContextStructDefinition) {
+    registry->native_types[NATIVE_TYPE_VOID] = (struct ExecutionContextStructDefinition) {
         .fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .static_fields = (struct ExecutionContextStructDefinitionFieldList) { .capacity = 0, .count = 0 },
         .flags = EXECUTION_CONTEXT_STRUCT_DEFINITION_FLAG_IS_NATIVE,
         .size = 0,
+        .alignment = 1,
         .static_size = 0,
         .static_data = NULL,
         .native_type = NATIVE_TYPE_VOID
     };
 }
 
+void exec_registry_init(struct ExecutionRegistry* registry)
+{
+    registry->function_count = 0;
+
+    registry_native_types_default_initialize(registry);
+
+    exec_registry_add_function(registry, "print", &fts_print);
+    exec_registry_add_pure_function(registry, "add", &fts_add);
+    exec_registry_add_function(registry, "spawn", &fts_spawn);
+    exec_registry_add_function(registry, "join", &fts_join);
+
+    array_kernels_init();
+    exec_registry_add_pure_function(registry, "len", &fts_len);
+    exec_registry_add_pure_function(registry, "sum", &fts_sum);
+    exec_registry_add_pure_function(registry, "min", &fts_min);
+    exec_registry_add_pure_function(registry, "max", &fts_max);
+    exec_registry_add_pure_function(registry, "dot", &fts_dot);
+    exec_registry_add_function(registry, "scale", &fts_scale);
+    exec_registry_add_pure_function(registry, "less", &fts_less);
+    exec_registry_add_pure_function(registry, "greater", &fts_greater);
+    exec_registry_add_pure_function(registry, "equal", &fts_equal);
+    exec_registry_add_pure_function(registry, "count", &fts_count);
+    exec_registry_add_pure_function(registry, "concat", &fts_concat);
+    exec_registry_add_pure_function(registry, "substr", &fts_substr);
+    exec_registry_add_pure_function(registry, "find", &fts_find);
+    exec_registry_add_function(registry, "intern", &fts_intern);
+    exec_registry_add_function(registry, "has", &fts_has);
+    exec_registry_add_function(registry, "get", &fts_get);
+    exec_registry_add_function(registry, "remove", &fts_remove);
+}
+
+bool exec_registry_add_function(struct ExecutionRegistry* registry, const char* name, void (*func)(struct ExecutionContext* context))
+{
+    if (registry->function_count >= MAX_REGISTRY_FUNCTIONS)
+    {
+        debug("ERR!: Cannot register native function '%s', registry is full.\n", name);
+        return false;
+    }
+
+    struct ExecutionRegistryFunction* function = &registry->functions[registry->function_count++];
+    strncpy(function->name, name, MAX_IDENTIFIER_LENGTH - 1);
+    function->name[MAX_IDENTIFIER_LENGTH - 1] = 0;
+    function->func = func;
+    function->flags = REGISTRY_FUNCTION_FLAG_NONE;
+
+    return true;
+}
+
+bool exec_registry_add_pure_function(struct ExecutionRegistry* registry, const char* name, void (*func)(struct ExecutionContext* context))
+{
+    if (!exec_registry_add_function(registry, name, func))
+    {
+        return false;
+    }
+
+    registry->functions[registry->function_count - 1].flags |= REGISTRY_FUNCTION_FLAG_PURE;
+
+    return true;
+}
+
+struct ExecutionScript* exec_script_create(struct ExecutionRegistry* registry, const char* code)
+{
+    // Reference of the caller
+    struct ExecutionScript* script = object_ref(object_create(sizeof(struct ExecutionScript)));
+    struct ExecutionContext* context = malloc(sizeof(struct ExecutionContext));
+
+    script->code = code;
+    script->code_len = strlen(code);
+    script->registry = registry;
+    script->inference.typed_assignment_count = 0;
+    script->inference.error_count = 0;
+    script->fold.expression_count = 0;
+    script->fold.dead_statement_count = 0;
+    script->inlining.call_count = 0;
+
+    if (context)
+    {
+        // Analysis evaluates pure natives on a context of its own, this is the
+        // only time the script is written
+        exec_context_init_script(context, script);
+        exec_infer_script(context);
+        exec_context_release(context);
+        free(context);
+    }
+
+    // Contexts on other threads take references too
+    return object_share(script);
+}
+
+void exec_context_init(struct ExecutionContext* context, struct ExecutionRegistry* registry, const char* code)
+{
+    struct ExecutionScript* script = exec_script_create(registry, code);
+
+    exec_context_init_script(context, script);
+    object_deref(script);
+}
+
+void exec_context_init_script(struct ExecutionContext* context, struct ExecutionScript* script)
+{
+    struct ExecutionRegistry* registry = script->registry;
+
+    context->code = script->code;
+    context->code_len = script->code_len;
+    context->script = object_ref(script);
+    context->scope_index = 0;
+    context->position = 0;
+    context->stack_index = 0;
+    context->stack_variables = 0;
+    context->native_frame_stack_index = 0;
+    context->global_scope = &context->scopes[0];
+    context->state = EXECUTION_CONTEXT_STATE_RUNNING;
+    context->scheduler = NULL;
+    context->tasks = NULL;
+    context->last_task_id = 0;
+    context->coroutine = NULL;
+    context->loop = NULL;
+    context->user_data = NULL;
+    context->escape.analyzed_function_count = 0;
+    context->escape.stack_site_count = 0;
+    context->jit.function_count = 0;
+    context->engine = EXECUTION_ENGINE_STACK;
+    context->registers = NULL;
+    memset(context->stack_flags, 0, sizeof(context->stack_flags));
+
+    // Unlimited by default, host can set a budget with context_set_fuel
+    context_set_fuel(context, INT64_MAX, NULL, NULL);
+
+    // Registry is shared, context only keeps pointers into it
+    context->registry = registry;
+    context->native_types = registry->native_types;
+
+    context_scope_init(context);
+
+    for (int i = 0; i < registry->function_count; i++)
+    {
+        uint64_t func_value = (uint64_t)registry->functions[i].func;
+
+        context_variable_set_value(
+            context, 
+            context_add_global_variable(context, registry->functions[i].name, NATIVE_TYPE_NATIVE_FUNCTION, 1), 
+            (struct ExecutionContextStackValue) { .ptr = &func_value, .type = NATIVE_TYPE_NATIVE_FUNCTION, .size = get_size_of_native_type(NATIVE_TYPE_NATIVE_FUNCTION) }
+        );
+    }
+}
+
+void exec_context_release(struct ExecutionContext* context)
+{
+    // Tasks which were not joined can still be running
+    exec_scheduler_release_tasks(context);
+
+    // Values left on the stack own their references, borrowed ones are skipped
+    while (context->stack_index > 0)
+    {
+        context_stack_pop_value(context);
+    }
+
+    context->scope_index = 0;
+
+    free(context->registers);
+    context->registers = NULL;
+
+    object_deref(context->script);
+    context->script = NULL;
+
+    // Tasks released values passed to them on other threads, counts of this thread are merged
+    object_merge_queued();
+}
+
+void exec_context_init_child(struct ExecutionContext* context, struct ExecutionContext* parent)
+{
+    context->code = parent->code;
+    context->code_len = parent->code_len;
+    context->position = parent->position;
+    context->scope_index = 0;
+    context->native_frame_stack_index = 0;
+    context->global_scope = &context->scopes[0];
+    context->state = EXECUTION_CONTEXT_STATE_RUNNING;
+    context->registry = parent->registry;
+    context->native_types = parent->native_types;
+    context->scheduler = parent->scheduler;
+    context->tasks = NULL;
+    context->last_task_id = 0;
+    context->coroutine = NULL;
+    context->loop = NULL;
+    context->user_data = parent->user_data;
+
+    // Same code, so escape analysis results stay valid
+    context->script = object_ref(parent->script);
+    context->escape = parent->escape;
+    // Compiled code lives in the global code arena, so it can be shared as well
+    context->jit = parent->jit;
+    context->engine = parent->engine;
+    context->registers = NULL;
+
+    if (parent->registers)
+    {
+        // Instructions are rewritten while they run, so each thread needs its own copy
+        context->registers = malloc(sizeof(struct ExecutionContextRegisterInfo));
+
+        if (context->registers)
+        {
+            memcpy(context->registers, parent->registers, sizeof(struct ExecutionContextRegisterInfo));
+        }
+    }
+
+    // Child gets what is left of the parent budget, but it cannot yield to the host
+    context_set_fuel(context, parent->fuel, NULL, NULL);
+
+    // Globals are copied as a snapshot, child can only read them. Child holds its own
+    // references, parent can reassign a global while the task still runs.
+    int globals_stack_index = parent->scope_index > 0 ? parent->scopes[1].min_stack_index : parent->stack_index;
+
+    context->scopes[0] = *parent->global_scope;
+    context->scopes[0].variables = context->global_variables;
+    context->stack_index = globals_stack_index;
+    context->stack_variables = context->scopes[0].variable_count;
+
+    memcpy(context->global_variables, parent->global_scope->variables, context->scopes[0].variable_count * sizeof(context->global_variables[0]));
+    memcpy(context->stack, parent->stack, globals_stack_index * sizeof(context->stack[0]));
+    memcpy(context->stack_type, parent->stack_type, globals_stack_index * sizeof(context->stack_type[0]));
+    memset(context->stack_flags, 0, sizeof(context->stack_flags));
+
+    int index = 0;
+
+    while (index < globals_stack_index)
+    {
+        struct ExecutionContextStackValue value = context_stack_get_value_at_index(context, index);
+
+        // Child can take and release references to globals from other thread
+        exec_share_value(value);
+        context_stack_value_ref(value);
+
+        index += value.size;
+    }
+}
+
+void exec_share_visit(void* child, void* data)
+{
+    (void)data;
+    object_share(child);
+}
+
+void exec_share_value(struct ExecutionContextStackValue value)
+{
+    // Objects the value references can be reached from other threads afterwards
+    if (check_type_is_reference(value.type))
+    {
+        object_share(*(void**)value.ptr);
+    }
+    else if (value.type == STACK_TYPE_STRUCT_INSTANCE)
+    {
+        struct ExecutionContextStructDefinition* definition = *(struct ExecutionContextStructDefinition**)value.ptr;
+
+        object_share(definition);
+        trace_field_list(&definition->fields, (uint8_t*)(value.ptr + 1), &exec_share_visit, NULL);
+    }
+}
+
+uint8_t exec_context_run(struct ExecutionContext* context)
+{
+    if (context->script->inference.error_count > 0)
+    {
+        debug("ERR!: Script has %d type errors, it is not executed\n", context->script->inference.error_count);
+        context_abort(context);
+        return context->state;
+    }
+
+    exec_block(context);
+
+    if (context_is_running(context))
+    {
+        context->state = EXECUTION_CONTEXT_STATE_FINISHED;
+    }
+
+    return context->state;
+}
+
 void exec(const char* code)
 {
+    struct ExecutionRegistry registry;
     struct ExecutionContext context;
-    context.code = code;
-    context.code_len = strlen(code);
-    context.scope_index = 0;
-    context.position = 0;
-    context.stack_index = 0;
-    context.stack_variables = 0;
-    context.global_scope = &context.scopes[0];
-
-    context_native_types_default_initialize(&context);
-    context_scope_init(&context);
-
-    uint64_t fts_print_value = (uint64_t)&fts_print;
-
-    context_variable_set_value(
-        &context, 
-        context_add_global_variable(&context, "print", NATIVE_TYPE_NATIVE_FUNCTION, 1), 
-        (struct ExecutionContextStackValue) { .ptr = &fts_print_value, .type = NATIVE_TYPE_NATIVE_FUNCTION, .size = get_size_of_native_type(NATIVE_TYPE_NATIVE_FUNCTION) }
-    );
-    
-    uint64_t fts_add_value = (uint64_t)&fts_add;
 
-    context_variable_set_value(
-        &context, 
-        context_add_global_variable(&context, "add", NATIVE_TYPE_NATIVE_FUNCTION, 1), 
-        (struct ExecutionContextStackValue) { .ptr = &fts_add_value, .type = NATIVE_TYPE_NATIVE_FUNCTION, .size = get_size_of_native_type(NATIVE_TYPE_NATIVE_FUNCTION) }
-    );
+    exec_registry_init(&registry);
+    exec_context_init(&context, &registry, code);
+    exec_context_run(&context);
+    exec_context_release(&context);
 
-    exec_block(&context);
+    object_collect_cycles();
 }
\ No newline at end of file
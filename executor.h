@@ -1 +1,29 @@
-void exec(const char* code);
\ No newline at end of file
+#pragma once
+
+#include "context.h"
+
+void exec_registry_init(struct ExecutionRegistry* registry);
+bool exec_registry_add_function(struct ExecutionRegistry* registry, const char* name, void (*func)(struct ExecutionContext* context));
+// Same as exec_registry_add_function, for natives which do not change anything besides
+// pushing their result, see REGISTRY_FUNCTION_FLAG_PURE
+bool exec_registry_add_pure_function(struct ExecutionRegistry* registry, const char* name, void (*func)(struct ExecutionContext* context));
+
+// Analyzes the code once, the script can then initialize any number of contexts.
+// Code and registry have to outlive the script.
+struct ExecutionScript* exec_script_create(struct ExecutionRegistry* registry, const char* code);
+
+// Same as exec_context_init_script with a script created for the code
+void exec_context_init(struct ExecutionContext* context, struct ExecutionRegistry* registry, const char* code);
+void exec_context_init_script(struct ExecutionContext* context, struct ExecutionScript* script);
+// Child holds its own references to a snapshot of parent globals, see exec_share_value
+void exec_context_init_child(struct ExecutionContext* context, struct ExecutionContext* parent);
+// Shares objects referenced by the value before it is handed to other thread
+void exec_share_value(struct ExecutionContextStackValue value);
+// Drops what the context references, it can be initialized again afterwards
+void exec_context_release(struct ExecutionContext* context);
+uint8_t exec_context_run(struct ExecutionContext* context);
+void exec_invoke_function(struct ExecutionContext* context, int func_position, int frame_start_stack_index);
+void exec(const char* code);
+
+// add(a, b) on two i32 values or two arrays, compiled code checks that 'add' still calls it
+void fts_add(struct ExecutionContext* context);
\ No newline at end of file
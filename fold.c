@@ -0,0 +1,245 @@
+#include "fold.h"
+
+#include <string.h>
+
+#include "defs.h"
+#include "debug.h"
+
+#pragma region --- CONSTANT FOLDING ---
+
+bool fold_call_native(
+    struct ExecutionContext* context,
+    void (*func)(struct ExecutionContext* context),
+    const struct ExecutionInferValue* args,
+    int arg_count,
+    struct ExecutionInferValue* result
+) {
+    // Same frame as exec_call_native_function, on top of whatever the context holds
+    int frame_start_stack_index = context->stack_index;
+    int native_frame_stack_index = context->native_frame_stack_index;
+    uint8_t state = context->state;
+    int64_t fuel = context->fuel;
+
+    for (int i = 0; i < arg_count; i++)
+    {
+        uint64_t value = args[i].value;
+
+        context_stack_push_value(
+            context,
+            (struct ExecutionContextStackValue) { .ptr = &value, .type = args[i].type, .size = get_size_of_native_type(args[i].type) }
+        );
+    }
+
+    context->native_frame_stack_index = frame_start_stack_index;
+    func(context);
+    context->native_frame_stack_index = native_frame_stack_index;
+
+    int result_index = context->stack_index - 1;
+    bool folded = context->state == state
+        && result_index == frame_start_stack_index + arg_count
+        && check_type_is_numeric(context->stack_type[result_index]);
+
+    if (folded)
+    {
+        result->type = context->stack_type[result_index];
+        result->value = context->stack[result_index];
+        result->constant = true;
+    }
+
+    while (context->stack_index > frame_start_stack_index)
+    {
+        context_stack_pop_value(context);
+    }
+
+    context->stack_index = frame_start_stack_index;
+    context->state = state;
+    context->fuel = fuel;
+
+    return folded;
+}
+
+void fold_add_expression(struct ExecutionContext* context, int start_position, int end_position, struct ExecutionInferValue value)
+{
+    struct ExecutionContextFoldInfo* fold = &context->script->fold;
+
+    if (fold->expression_count >= MAX_FOLDED_EXPRESSIONS)
+    {
+        // Not recorded expressions are evaluated at runtime
+        return;
+    }
+
+    int index = fold->expression_count;
+
+    while (index > 0 && fold->expressions[index - 1].start_position > start_position)
+    {
+        index--;
+    }
+
+    memmove(&fold->expressions[index + 1], &fold->expressions[index], (fold->expression_count - index) * sizeof(fold->expressions[0]));
+    fold->expressions[index] = (struct ExecutionContextFoldedExpression) {
+        .start_position = start_position,
+        .end_position = end_position,
+        .type = value.type,
+        .value = value.value,
+    };
+    fold->expression_count++;
+}
+
+void fold_add_dead_statement(struct ExecutionContext* context, int start_position, int end_position)
+{
+    struct ExecutionContextFoldInfo* fold = &context->script->fold;
+
+    if (fold->dead_statement_count >= MAX_DEAD_STATEMENTS)
+    {
+        return;
+    }
+
+    int index = fold->dead_statement_count;
+
+    while (index > 0 && fold->dead_statements[index - 1].start_position > start_position)
+    {
+        index--;
+    }
+
+    memmove(&fold->dead_statements[index + 1], &fold->dead_statements[index], (fold->dead_statement_count - index) * sizeof(fold->dead_statements[0]));
+    fold->dead_statements[index] = (struct ExecutionContextDeadStatement) { .start_position = start_position, .end_position = end_position };
+    fold->dead_statement_count++;
+}
+
+bool fold_is_removed(struct ExecutionContext* context, int position)
+{
+    struct ExecutionContextFoldInfo* fold = &context->script->fold;
+
+    for (int i = 0; i < fold->expression_count; i++)
+    {
+        if (position >= fold->expressions[i].start_position && position < fold->expressions[i].end_position)
+        {
+            return true;
+        }
+    }
+
+    for (int i = 0; i < fold->dead_statement_count; i++)
+    {
+        if (position >= fold->dead_statements[i].start_position && position < fold->dead_statements[i].end_position)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int fold_find_expression(struct ExecutionContextFoldInfo* fold, int position)
+{
+    int low = 0;
+    int high = fold->expression_count - 1;
+
+    while (low <= high)
+    {
+        int middle = (low + high) / 2;
+        int start_position = fold->expressions[middle].start_position;
+
+        if (start_position == position)
+        {
+            return middle;
+        }
+
+        if (start_position < position)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+
+    return -1;
+}
+
+int fold_find_dead_statement(struct ExecutionContextFoldInfo* fold, int position)
+{
+    int low = 0;
+    int high = fold->dead_statement_count - 1;
+
+    while (low <= high)
+    {
+        int middle = (low + high) / 2;
+        int start_position = fold->dead_statements[middle].start_position;
+
+        if (start_position == position)
+        {
+            return middle;
+        }
+
+        if (start_position < position)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+
+    return -1;
+}
+
+bool exec_fold_expression(struct ExecutionContext* context)
+{
+    struct ExecutionContextFoldInfo* fold = &context->script->fold;
+
+    if (fold->expression_count == 0)
+    {
+        return false;
+    }
+
+    int index = fold_find_expression(fold, context->position);
+
+    if (index < 0)
+    {
+        return false;
+    }
+
+    struct ExecutionContextFoldedExpression* expression = &fold->expressions[index];
+    uint64_t value = expression->value;
+
+#ifdef TOKEN_DEBUG
+    debug("Folded expression at %d: '[%s] %d'\n", context->position, get_stack_type_name(expression->type), (int)value);
+#endif
+
+    context_stack_push_value(
+        context,
+        (struct ExecutionContextStackValue) { .ptr = &value, .type = expression->type, .size = get_size_of_native_type(expression->type) }
+    );
+    context->position = expression->end_position;
+
+    return true;
+}
+
+bool exec_fold_skip_statement(struct ExecutionContext* context)
+{
+    struct ExecutionContextFoldInfo* fold = &context->script->fold;
+
+    if (fold->dead_statement_count == 0)
+    {
+        return false;
+    }
+
+    int index = fold_find_dead_statement(fold, context->position);
+
+    if (index < 0)
+    {
+        return false;
+    }
+
+#ifdef TOKEN_DEBUG
+    debug("Skipped dead statement at %d\n", context->position);
+#endif
+
+    context->position = fold->dead_statements[index].end_position;
+
+    return true;
+}
+
+#pragma endregion --- CONSTANT FOLDING ---
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "context.h"
+#include "infer.h"
+
+#pragma region --- CONSTANT FOLDING ---
+
+#define MAX_FOLD_ARGS 8
+
+// Calls a pure native with constant arguments on the context stack before execution,
+// returns true when it pushed exactly one numeric value, which is stored in 'result'
+bool fold_call_native(
+    struct ExecutionContext* context, 
+    void (*func)(struct ExecutionContext* context), 
+    const struct ExecutionInferValue* args, 
+    int arg_count, 
+    struct ExecutionInferValue* result
+);
+
+// Records a constant expression of the code range, calls of pure natives with constant
+// arguments and reads of 'const' variables
+void fold_add_expression(struct ExecutionContext* context, int start_position, int end_position, struct ExecutionInferValue value);
+
+// Records a statement which can be skipped: pure expression whose value is dropped,
+// or declaration of a constant which is never read at runtime
+void fold_add_dead_statement(struct ExecutionContext* context, int start_position, int end_position);
+
+// True when the position is inside a folded expression or a dead statement
+bool fold_is_removed(struct ExecutionContext* context, int position);
+
+// Pushes the value of the expression folded at the current position and moves after it
+bool exec_fold_expression(struct ExecutionContext* context);
+
+// Moves after the statement starting at the current position when it is dead
+bool exec_fold_skip_statement(struct ExecutionContext* context);
+
+#pragma endregion --- CONSTANT FOLDING ---
@@ -0,0 +1,1248 @@
+#include "infer.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defs.h"
+#include "debug.h"
+#include "parser.h"
+#include "executor.h"
+#include "fold.h"
+#include "inline.h"
+
+#pragma region --- TYPE INFERENCE ---
+
+int infer_tokenize(const char* code, int code_len, struct ExecutionInferToken* tokens)
+{
+    int count = 0;
+    int position = 0;
+
+    while (position < code_len)
+    {
+        char current = code[position];
+
+        if (isspace(current))
+        {
+            position++;
+            continue;
+        }
+
+        if (current == '/' && position + 1 < code_len && code[position + 1] == '/')
+        {
+            while (position < code_len && code[position] != '\n')
+            {
+                position++;
+            }
+
+            continue;
+        }
+
+        struct ExecutionInferToken* token = &tokens[count++];
+        token->position = position;
+        token->type = INFER_TYPE_UNKNOWN;
+        token->value = 0;
+        token->match = -1;
+
+        if (parse_is_identifier_start(current))
+        {
+            // same rules as parse_identifier
+            token->kind = INFER_TOKEN_IDENTIFIER;
+
+            while (position < code_len && parse_is_identifier_char(code[position]))
+            {
+                position++;
+            }
+        }
+        else if (isdigit(current))
+        {
+            // same suffixes and conversions as exec_number
+            char number[32];
+            int length = 0;
+            int flags = 0;
+            token->kind = INFER_TOKEN_NUMBER;
+
+            while (position < code_len && (isdigit(code[position]) || code[position] == '.'))
+            {
+                flags |= code[position] == '.' ? 0x1 : 0;
+
+                if (length < (int)sizeof(number) - 1)
+                {
+                    number[length++] = code[position];
+                }
+
+                position++;
+            }
+
+            number[length] = 0;
+
+            if (position < code_len && code[position] == 'f') { flags |= 0x2; position++; }
+            if (position < code_len && code[position] == 'l') { flags |= 0x4; position++; }
+            if (position < code_len && code[position] == 'u') { flags |= 0x8; position++; }
+
+            double double_value = atof(number);
+            float float_value = (float)double_value;
+
+            switch (flags)
+            {
+            case 0x0: 
+                token->type = NATIVE_TYPE_I32; 
+                token->value = (int32_t)atoll(number); 
+                break;
+            case 0x1: 
+                token->type = NATIVE_TYPE_DOUBLE; 
+                memcpy(&token->value, &double_value, sizeof(double_value)); 
+                break;
+            case 0x3: 
+                token->type = NATIVE_TYPE_FLOAT; 
+                memcpy(&token->value, &float_value, sizeof(float_value)); 
+                break;
+            case 0x4: 
+                token->type = NATIVE_TYPE_I64; 
+                token->value = (int64_t)atoll(number); 
+                break;
+            case 0x8: 
+                token->type = NATIVE_TYPE_U32; 
+                token->value = (uint32_t)atoll(number); 
+                break;
+            case 0xC: 
+                token->type = NATIVE_TYPE_U64; 
+                token->value = (uint64_t)atoll(number); 
+                break;
+            default: 
+                // unsupported combinations are i32 zero
+                token->type = NATIVE_TYPE_I32; 
+                break;
+            }
+        }
+        else if (current == '"')
+        {
+            token->kind = INFER_TOKEN_STRING;
+            token->type = NATIVE_TYPE_STRING;
+
+            for (position++; position < code_len && code[position] != '"'; position++)
+            {
+                if (code[position] == '\\')
+                {
+                    position++;
+                }
+            }
+
+            position++;
+        }
+        else
+        {
+            token->kind = INFER_TOKEN_SYMBOL;
+            position++;
+        }
+
+        token->length = (position < code_len ? position : code_len) - token->position;
+    }
+
+    return count;
+}
+
+void infer_match_brackets(struct ExecutionInferState* state, const char* code)
+{
+    // Unbalanced brackets stay without a match
+    int* open = malloc(sizeof(int) * (state->token_count + 1));
+    int depth = 0;
+
+    if (!open)
+    {
+        state->failed = true;
+        return;
+    }
+
+    for (int i = 0; i < state->token_count; i++)
+    {
+        struct ExecutionInferToken* token = &state->tokens[i];
+
+        if (token->kind != INFER_TOKEN_SYMBOL)
+        {
+            continue;
+        }
+
+        char symbol = code[token->position];
+
+        if (symbol == '(' || symbol == '{')
+        {
+            open[depth++] = i;
+        }
+        else if ((symbol == ')' || symbol == '}') && depth > 0 && code[state->tokens[open[depth - 1]].position] == (symbol == ')' ? '(' : '{'))
+        {
+            depth--;
+            token->match = open[depth];
+            state->tokens[open[depth]].match = i;
+        }
+    }
+
+    free(open);
+}
+
+bool infer_is_symbol(struct ExecutionInferState* state, int index, char symbol)
+{
+    return index >= 0 && index < state->token_count
+        && state->tokens[index].kind == INFER_TOKEN_SYMBOL
+        && state->context->code[state->tokens[index].position] == symbol;
+}
+
+bool infer_is_statement_start(struct ExecutionInferState* state, int index)
+{
+    return index == 0 || infer_is_symbol(state, index - 1, ';')
+        || infer_is_symbol(state, index - 1, '{') || infer_is_symbol(state, index - 1, '}');
+}
+
+bool infer_is_identifier(struct ExecutionInferState* state, int index, const char* name)
+{
+    if (index < 0 || index >= state->token_count || state->tokens[index].kind != INFER_TOKEN_IDENTIFIER)
+    {
+        return false;
+    }
+
+    struct ExecutionInferToken* token = &state->tokens[index];
+
+    return !name || ((int)strlen(name) == token->length && strncmp(&state->context->code[token->position], name, token->length) == 0);
+}
+
+void infer_token_name(struct ExecutionInferState* state, int index, char* buffer)
+{
+    struct ExecutionInferToken* token = &state->tokens[index];
+    int length = token->length < MAX_IDENTIFIER_LENGTH - 1 ? token->length : MAX_IDENTIFIER_LENGTH - 1;
+
+    memcpy(buffer, &state->context->code[token->position], length);
+    buffer[length] = 0;
+}
+
+uint8_t infer_declared_type(struct ExecutionInferState* state, int index)
+{
+    // Scalar types of context_get_type_from_identifier, 'let', 'const' and 'var' are returned as is
+    static const struct { const char* name; uint8_t type; } types[] = {
+        { "let", STACK_TYPE_ACQUIRE }, { "const", STACK_TYPE_ACQUIRE }, { "var", STACK_TYPE_DYNAMIC },
+        { "i8", NATIVE_TYPE_I8 }, { "u8", NATIVE_TYPE_U8 }, { "i16", NATIVE_TYPE_I16 }, { "u16", NATIVE_TYPE_U16 },
+        { "i32", NATIVE_TYPE_I32 }, { "u32", NATIVE_TYPE_U32 }, { "i64", NATIVE_TYPE_I64 }, { "u64", NATIVE_TYPE_U64 },
+        { "f32", NATIVE_TYPE_FLOAT }, { "f64", NATIVE_TYPE_DOUBLE }, { "string", NATIVE_TYPE_STRING },
+    };
+
+    for (int i = 0; i < (int)(sizeof(types) / sizeof(types[0])); i++)
+    {
+        if (infer_is_identifier(state, index, types[i].name))
+        {
+            return types[i].type;
+        }
+    }
+
+    return INFER_TYPE_UNKNOWN;
+}
+
+int infer_function_scope(struct ExecutionInferState* state)
+{
+    for (int i = state->block_depth - 1; i >= 0; i--)
+    {
+        if (state->block_kinds[i] == INFER_BLOCK_FUNCTION)
+        {
+            return state->blocks[i];
+        }
+    }
+
+    return -1;
+}
+
+bool infer_is_visible(struct ExecutionInferState* state, struct ExecutionInferVariable* variable)
+{
+    // Value of a global is known in a function body only when the global is declared before
+    // the function, calls cannot happen earlier
+    for (int i = 0; i < state->block_depth && variable->scope == -1; i++)
+    {
+        if (state->block_kinds[i] == INFER_BLOCK_FUNCTION)
+        {
+            return variable->declared_at < state->blocks[i];
+        }
+    }
+
+    return true;
+}
+
+struct ExecutionInferVariable* infer_find_variable(struct ExecutionInferState* state, int scope, const char* name)
+{
+    for (int i = 0; i < state->variable_count; i++)
+    {
+        if (state->variables[i].scope == scope && strcmp(state->variables[i].name, name) == 0)
+        {
+            return &state->variables[i];
+        }
+    }
+
+    return NULL;
+}
+
+struct ExecutionInferVariable* infer_lookup_variable(struct ExecutionInferState* state, int index)
+{
+    // Same order as context_lookup_variable: function scope, then globals. Scripts have no
+    // loops, so a local shadows the global only after its declaration. Function bodies
+    // can run after any global declaration, global code only after the earlier ones.
+    char name[MAX_IDENTIFIER_LENGTH];
+    int scope = infer_function_scope(state);
+
+    infer_token_name(state, index, name);
+
+    if (scope >= 0)
+    {
+        struct ExecutionInferVariable* local = infer_find_variable(state, scope, name);
+
+        if (local && local->declared_at < index)
+        {
+            return local;
+        }
+    }
+
+    struct ExecutionInferVariable* global = infer_find_variable(state, -1, name);
+
+    if (global && (scope >= 0 || global->declared_at < index))
+    {
+        return global;
+    }
+
+    return NULL;
+}
+
+void infer_declare_variable(
+    struct ExecutionInferState* state, 
+    int scope, 
+    int index, 
+    struct ExecutionInferValue value, 
+    bool is_const, 
+    int statement_end
+) {
+    char name[MAX_IDENTIFIER_LENGTH];
+    infer_token_name(state, index, name);
+
+    struct ExecutionInferVariable* variable = infer_find_variable(state, scope, name);
+
+    if (variable)
+    {
+        // Types and values only ever become unknown, so repeating the scan ends
+        if (variable->type != value.type && variable->type != INFER_TYPE_UNKNOWN)
+        {
+            variable->type = INFER_TYPE_UNKNOWN;
+            state->changed = true;
+        }
+
+        if (variable->constant && (!is_const || !value.constant || variable->value != value.value || variable->declared_at != index))
+        {
+            variable->constant = false;
+            state->changed = true;
+        }
+
+        return;
+    }
+
+    if (state->variable_count >= MAX_INFER_VARIABLES)
+    {
+        state->failed = true;
+        return;
+    }
+
+    variable = &state->variables[state->variable_count++];
+    strcpy(variable->name, name);
+    variable->scope = scope;
+    variable->declared_at = index;
+    variable->type = value.type;
+    variable->is_const = is_const;
+    variable->constant = is_const && value.constant;
+    variable->value = value.value;
+    variable->statement_end = statement_end;
+    variable->value_at = -1;
+    state->changed = true;
+
+    // Declaring a name which already resolves fails at runtime, so a local named like
+    // a global can be either of them
+    for (int i = 0; i < state->variable_count - 1; i++)
+    {
+        struct ExecutionInferVariable* other = &state->variables[i];
+
+        if ((other->scope == -1) != (scope == -1) && strcmp(other->name, name) == 0)
+        {
+            other->type = INFER_TYPE_UNKNOWN;
+            other->constant = false;
+            variable->type = INFER_TYPE_UNKNOWN;
+            variable->constant = false;
+        }
+    }
+}
+
+bool infer_name_is_replaced(struct ExecutionInferState* state, int name_index)
+{
+    // Any declaration or assignment of the name, including parameters, replaces the native
+    for (int i = 0; i < state->token_count; i++)
+    {
+        struct ExecutionInferToken* token = &state->tokens[i];
+
+        if (token->kind != INFER_TOKEN_IDENTIFIER || token->length != state->tokens[name_index].length
+            || strncmp(&state->context->code[token->position], &state->context->code[state->tokens[name_index].position], token->length) != 0)
+        {
+            continue;
+        }
+
+        if ((infer_is_symbol(state, i + 1, '=') && !infer_is_symbol(state, i + 2, '='))
+            || infer_is_identifier(state, i - 1, NULL) || infer_is_symbol(state, i - 1, ']'))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+struct ExecutionRegistryFunction* infer_native(struct ExecutionInferState* state, int index)
+{
+    // Natives are globals of every context, the name refers to the native as long as
+    // the script does not declare or assign it anywhere
+    struct ExecutionRegistry* registry = state->context->registry;
+
+    for (int i = 0; i < registry->function_count; i++)
+    {
+        if (!infer_is_identifier(state, index, registry->functions[i].name))
+        {
+            continue;
+        }
+
+        if (state->native_states[i] == INFER_NATIVE_UNCHECKED)
+        {
+            state->native_states[i] = infer_name_is_replaced(state, index) ? INFER_NATIVE_REPLACED : INFER_NATIVE_KEPT;
+        }
+
+        return state->native_states[i] == INFER_NATIVE_KEPT ? &registry->functions[i] : NULL;
+    }
+
+    return NULL;
+}
+
+struct ExecutionInferValue infer_expression(struct ExecutionInferState* state, int index, int* end);
+
+struct ExecutionInferValue infer_call(struct ExecutionInferState* state, int index, int* end)
+{
+    struct ExecutionInferValue result = { .type = INFER_TYPE_UNKNOWN };
+    struct ExecutionInferValue args[MAX_FOLD_ARGS];
+    struct ExecutionRegistryFunction* native = infer_native(state, index);
+    int arg_count = 0;
+    int position = index + 2;
+    bool constant = true;
+    bool pure = native && (native->flags & REGISTRY_FUNCTION_FLAG_PURE);
+
+    if (!native)
+    {
+        return result;
+    }
+
+    while (!infer_is_symbol(state, position, ')'))
+    {
+        int arg_end;
+
+        if (arg_count >= MAX_FOLD_ARGS)
+        {
+            return result;
+        }
+
+        args[arg_count] = infer_expression(state, position, &arg_end);
+
+        if (arg_end < 0 || !(infer_is_symbol(state, arg_end, ',') || infer_is_symbol(state, arg_end, ')')))
+        {
+            return result;
+        }
+
+        constant = constant && args[arg_count].constant;
+        pure = pure && args[arg_count].pure;
+        arg_count++;
+        position = infer_is_symbol(state, arg_end, ',') ? arg_end + 1 : arg_end;
+    }
+
+    *end = position + 1;
+
+    if (pure && constant && fold_call_native(state->context, native->func, args, arg_count, &result))
+    {
+        result.pure = true;
+        return result;
+    }
+
+    if (native->func == &fts_add && arg_count == 2 && args[0].type == NATIVE_TYPE_I32 && args[1].type == NATIVE_TYPE_I32)
+    {
+        // other operand types are arrays or push nothing, see fts_add
+        result.type = NATIVE_TYPE_I32;
+    }
+
+    result.pure = pure;
+
+    return result;
+}
+
+struct ExecutionInferValue infer_expression(struct ExecutionInferState* state, int index, int* end)
+{
+    // Resolves literals, variables and native calls, 'end' is set to the token after
+    // the expression or -1 when it is something else
+    struct ExecutionInferValue result = { .type = INFER_TYPE_UNKNOWN };
+    *end = -1;
+
+    if (index >= state->token_count)
+    {
+        return result;
+    }
+
+    struct ExecutionInferToken* token = &state->tokens[index];
+
+    if (token->kind == INFER_TOKEN_NUMBER || token->kind == INFER_TOKEN_STRING)
+    {
+        *end = index + 1;
+
+        return (struct ExecutionInferValue) { 
+            .type = token->type, 
+            .constant = token->kind == INFER_TOKEN_NUMBER, 
+            .pure = true, 
+            .value = token->value 
+        };
+    }
+
+    if (token->kind != INFER_TOKEN_IDENTIFIER)
+    {
+        return result;
+    }
+
+    if (infer_is_symbol(state, index + 1, '('))
+    {
+        return infer_call(state, index, end);
+    }
+
+    if (infer_is_symbol(state, index + 1, '.') || infer_is_symbol(state, index + 1, '[') || infer_is_symbol(state, index + 1, '{'))
+    {
+        return result;
+    }
+
+    struct ExecutionInferVariable* variable = infer_lookup_variable(state, index);
+
+    *end = index + 1;
+
+    if (!variable)
+    {
+        // reading an undefined name is an error at runtime
+        return result;
+    }
+
+    return (struct ExecutionInferValue) {
+        .type = variable->type,
+        .constant = variable->constant && infer_is_visible(state, variable),
+        .pure = true,
+        .value = variable->value,
+    };
+}
+
+struct ExecutionInferValue infer_statement_value(struct ExecutionInferState* state, int index, int* end)
+{
+    // Only values which are the whole rest of the statement are resolved
+    struct ExecutionInferValue value = infer_expression(state, index, end);
+
+    if (*end < 0 || !infer_is_symbol(state, *end, ';'))
+    {
+        *end = -1;
+        return (struct ExecutionInferValue) { .type = INFER_TYPE_UNKNOWN };
+    }
+
+    return value;
+}
+
+void infer_declaration(struct ExecutionInferState* state, int type_index, int name_index, int assign_index, bool check)
+{
+    int end;
+    bool is_const = infer_is_identifier(state, type_index, "const");
+    uint8_t declared_type = infer_declared_type(state, type_index);
+    struct ExecutionInferValue value = infer_statement_value(state, assign_index + 1, &end);
+    struct ExecutionInferValue variable_value = { .type = INFER_TYPE_UNKNOWN };
+
+    if (name_index != type_index + 1)
+    {
+        // 'T[] name', arrays and columns are checked when they are stored
+        declared_type = INFER_TYPE_UNKNOWN;
+    }
+
+    if (declared_type == STACK_TYPE_ACQUIRE)
+    {
+        variable_value = value;
+    }
+    else if (declared_type != STACK_TYPE_DYNAMIC && declared_type != INFER_TYPE_UNKNOWN)
+    {
+        variable_value.type = declared_type;
+
+        if (check && value.type != INFER_TYPE_UNKNOWN && value.type != declared_type)
+        {
+            char name[MAX_IDENTIFIER_LENGTH];
+            infer_token_name(state, name_index, name);
+
+            debug("ERR!: Cannot declare '%s' of type %s with a value of type %s\n", name, get_stack_type_name(declared_type), get_stack_type_name(value.type));
+            state->context->script->inference.error_count++;
+        }
+    }
+
+    if (!check)
+    {
+        int scope = infer_function_scope(state);
+        infer_declare_variable(state, scope, name_index, variable_value, is_const, end);
+
+        char name[MAX_IDENTIFIER_LENGTH];
+        infer_token_name(state, name_index, name);
+        struct ExecutionInferVariable* variable = infer_find_variable(state, scope, name);
+
+        if (variable && variable->declared_at == name_index)
+        {
+            variable->value_at = assign_index + 1;
+        }
+    }
+}
+
+void infer_assignment(struct ExecutionInferState* state, int name_index, int assign_index)
+{
+    int end;
+    struct ExecutionInferVariable* variable = infer_lookup_variable(state, name_index);
+    uint8_t value_type = infer_statement_value(state, assign_index + 1, &end).type;
+    struct ExecutionContextInferenceInfo* inference = &state->context->script->inference;
+
+    if (variable && variable->is_const)
+    {
+        debug("ERR!: Cannot assign to constant '%s'\n", variable->name);
+        inference->error_count++;
+        return;
+    }
+
+    if (!variable || variable->type == INFER_TYPE_UNKNOWN || value_type == INFER_TYPE_UNKNOWN)
+    {
+        return;
+    }
+
+    if (variable->type != value_type)
+    {
+        debug("ERR!: Cannot assign value of type %s to '%s' of type %s\n", get_stack_type_name(value_type), variable->name, get_stack_type_name(variable->type));
+        inference->error_count++;
+    }
+    else if (inference->typed_assignment_count < MAX_TYPED_ASSIGNMENTS)
+    {
+        // scan goes forward, so positions stay ascending
+        inference->typed_assignments[inference->typed_assignment_count++] = state->tokens[assign_index].position;
+    }
+}
+
+int infer_fold(struct ExecutionInferState* state, int index, bool statement_start)
+{
+    // Returns the last token which was handled
+    struct ExecutionContext* context = state->context;
+    int end;
+
+    if (infer_is_symbol(state, index + 1, ':'))
+    {
+        // field name of an instance or map literal
+        return index;
+    }
+
+    struct ExecutionInferValue value = infer_expression(state, index, &end);
+
+    if (end < 0)
+    {
+        return index;
+    }
+
+    if (statement_start && value.pure && infer_is_symbol(state, end, ';'))
+    {
+        fold_add_dead_statement(context, state->tokens[index].position, state->tokens[end].position + 1);
+        return end;
+    }
+
+    if (value.constant)
+    {
+        struct ExecutionInferToken* last = &state->tokens[end - 1];
+
+        fold_add_expression(context, state->tokens[index].position, last->position + last->length, value);
+        return end - 1;
+    }
+
+    return index;
+}
+
+bool infer_same_name(struct ExecutionInferState* state, int a, int b)
+{
+    struct ExecutionInferToken* first = &state->tokens[a];
+    struct ExecutionInferToken* second = &state->tokens[b];
+
+    return first->length == second->length
+        && strncmp(&state->context->code[first->position], &state->context->code[second->position], first->length) == 0;
+}
+
+bool infer_is_bound_once(struct ExecutionInferState* state, int name_index)
+{
+    // Only the declaration binds the name, same rules as infer_name_is_replaced
+    int bindings = 0;
+
+    for (int i = 0; i < state->token_count && bindings <= 1; i++)
+    {
+        if (!infer_is_identifier(state, i, NULL) || !infer_same_name(state, i, name_index))
+        {
+            continue;
+        }
+
+        if ((infer_is_symbol(state, i + 1, '=') && !infer_is_symbol(state, i + 2, '=') && !infer_is_symbol(state, i + 2, '>'))
+            || (infer_is_identifier(state, i - 1, NULL) && !infer_is_identifier(state, i - 1, "new")) 
+            || infer_is_symbol(state, i - 1, ']'))
+        {
+            bindings++;
+        }
+    }
+
+    return bindings == 1;
+}
+
+int infer_function_value(struct ExecutionInferState* state, int index)
+{
+    // 'T(...) => { ... };' as the whole value, returns '(' of the parameters or -1
+    if (!infer_is_identifier(state, index, NULL) || !infer_is_symbol(state, index + 1, '(') || state->tokens[index + 1].match < 0)
+    {
+        return -1;
+    }
+
+    int body = state->tokens[index + 1].match + 1;
+    body += infer_is_symbol(state, body, '=') && infer_is_symbol(state, body + 1, '>') ? 2 : 0;
+
+    if (!infer_is_symbol(state, body, '{') || !infer_is_symbol(state, state->tokens[body].match + 1, ';'))
+    {
+        return -1;
+    }
+
+    return index + 1;
+}
+
+int infer_struct_method(struct ExecutionInferState* state, int index, int method_index)
+{
+    // 'struct { ... T name(...) => { ... } ... }', returns '(' of the parameters or -1
+    int open = infer_is_symbol(state, index + 1, '{') ? index + 1 : index + 2;
+
+    if (!infer_is_identifier(state, index, "struct") || !infer_is_symbol(state, open, '{') || state->tokens[open].match < 0)
+    {
+        return -1;
+    }
+
+    for (int i = open + 1; i < state->tokens[open].match; i++)
+    {
+        if ((infer_is_symbol(state, i, '(') || infer_is_symbol(state, i, '{')) && state->tokens[i].match > i)
+        {
+            i = state->tokens[i].match;
+            continue;
+        }
+
+        if (infer_is_identifier(state, i, NULL) && infer_is_identifier(state, i + 1, NULL) 
+            && infer_same_name(state, i + 1, method_index) && infer_is_symbol(state, i + 2, '('))
+        {
+            return i + 2;
+        }
+    }
+
+    return -1;
+}
+
+int infer_inline_body(struct ExecutionInferState* state, int params, int name_index)
+{
+    // Body of a callee without parameters which is a single small expression and reads
+    // only globals, so it means the same at any call site. Returns '{' of the body or -1.
+    int body = params + 2;
+    body += infer_is_symbol(state, body, '=') && infer_is_symbol(state, body + 1, '>') ? 2 : 0;
+
+    if (state->tokens[params].match != params + 1 || !infer_is_symbol(state, body, '{'))
+    {
+        return -1;
+    }
+
+    int end = state->tokens[body].match;
+
+    if (end <= body + 1 || end - body - 1 > MAX_INLINE_BODY_TOKENS || state->tokens[body + 1].kind == INFER_TOKEN_SYMBOL)
+    {
+        return -1;
+    }
+
+    for (int i = body + 1; i < end; i++)
+    {
+        if (infer_is_symbol(state, i, ';') || infer_is_symbol(state, i, '='))
+        {
+            // statements, declarations, assignments and function literals
+            return -1;
+        }
+
+        if (!infer_is_identifier(state, i, NULL))
+        {
+            continue;
+        }
+
+        if (infer_same_name(state, i, name_index)
+            || (infer_is_identifier(state, i + 1, NULL) && !infer_is_identifier(state, i, "new")))
+        {
+            // recursion or a declaration
+            return -1;
+        }
+
+        if (infer_is_symbol(state, i - 1, '.') || infer_is_symbol(state, i + 1, ':'))
+        {
+            continue;
+        }
+
+        char name[MAX_IDENTIFIER_LENGTH];
+        infer_token_name(state, i, name);
+
+        for (int j = 0; j < state->variable_count; j++)
+        {
+            if (state->variables[j].scope != -1 && strcmp(state->variables[j].name, name) == 0)
+            {
+                // a local or parameter of the name can shadow the global at some call site
+                return -1;
+            }
+        }
+    }
+
+    return body;
+}
+
+int infer_inline(struct ExecutionInferState* state, int index)
+{
+    // 'f()' of a function and 'S.name()' of a static method of a struct, both bound to
+    // a global once. Returns the last token which was handled.
+    struct ExecutionInferVariable* variable = infer_lookup_variable(state, index);
+    int name_index = index;
+    int call = index + 1;
+    int params;
+
+    if (!variable || variable->scope != -1 || variable->value_at < 0 
+        || !infer_is_visible(state, variable) || !infer_is_bound_once(state, index))
+    {
+        return index;
+    }
+
+    if (infer_is_symbol(state, index + 1, '.') && infer_is_identifier(state, index + 2, NULL))
+    {
+        name_index = index + 2;
+        call = index + 3;
+        params = infer_struct_method(state, variable->value_at, name_index);
+    }
+    else
+    {
+        params = infer_function_value(state, variable->value_at);
+    }
+
+    if (params < 0 || !infer_is_symbol(state, call, '(') || state->tokens[call].match != call + 1)
+    {
+        return index;
+    }
+
+    int body = infer_inline_body(state, params, name_index);
+
+    if (body < 0)
+    {
+        return index;
+    }
+
+    inline_add_call(state->context, state->tokens[index].position, state->tokens[call + 1].position + 1, state->tokens[body].position + 1);
+
+    return call + 1;
+}
+
+int infer_expression_end(struct ExecutionInferState* state, int index)
+{
+    // First ';', ',' or closing bracket outside of nested brackets
+    for (int i = index; i < state->token_count; i++)
+    {
+        if (infer_is_symbol(state, i, '(') || infer_is_symbol(state, i, '{'))
+        {
+            if (state->tokens[i].match < 0)
+            {
+                return state->token_count;
+            }
+
+            i = state->tokens[i].match;
+        }
+        else if (infer_is_symbol(state, i, ';') || infer_is_symbol(state, i, ',') 
+            || infer_is_symbol(state, i, ')') || infer_is_symbol(state, i, '}'))
+        {
+            return i;
+        }
+    }
+
+    return state->token_count;
+}
+
+void infer_check_call(struct ExecutionInferState* state, int index)
+{
+    // 'f(...)' of a function bound to a global once, arguments are bound to its
+    // parameters the same way as in exec_function_body
+    struct ExecutionInferVariable* variable = infer_lookup_variable(state, index);
+    int call = index + 1;
+
+    if (!variable || variable->scope != -1 || variable->value_at < 0 || !infer_is_symbol(state, call, '(')
+        || state->tokens[call].match < 0 || !infer_is_visible(state, variable) || !infer_is_bound_once(state, index))
+    {
+        return;
+    }
+
+    int params = infer_function_value(state, variable->value_at);
+
+    if (params < 0)
+    {
+        return;
+    }
+
+    int param = params + 1;
+    int param_count = 0;
+    int arg = call + 1;
+    int arg_count = 0;
+    bool known = true;
+
+    while (arg < state->tokens[call].match)
+    {
+        int end;
+        int arg_end = infer_expression_end(state, arg);
+        struct ExecutionInferValue value = infer_expression(state, arg, &end);
+        uint8_t param_type = INFER_TYPE_UNKNOWN;
+
+        if (end != arg_end || value.type == INFER_TYPE_UNKNOWN)
+        {
+            // call or operator can push any number of values
+            value.type = INFER_TYPE_UNKNOWN;
+            known = false;
+        }
+
+        if (param < state->tokens[params].match)
+        {
+            int param_end = infer_expression_end(state, param);
+
+            if (param_end == param + 2)
+            {
+                // 'type name', 'let', 'var' and struct parameters take any argument
+                param_type = infer_declared_type(state, param);
+                param_type = param_type == STACK_TYPE_DYNAMIC ? INFER_TYPE_UNKNOWN : param_type;
+            }
+
+            param = param_end + 1;
+            param_count++;
+        }
+
+        if (value.type != INFER_TYPE_UNKNOWN && param_type != INFER_TYPE_UNKNOWN && value.type != param_type)
+        {
+            debug("ERR!: Cannot pass a value of type %s to parameter %d of '%s' of type %s\n",
+                get_stack_type_name(value.type), arg_count + 1, variable->name, get_stack_type_name(param_type));
+            state->context->script->inference.error_count++;
+        }
+
+        arg = arg_end + 1;
+        arg_count++;
+    }
+
+    while (param < state->tokens[params].match)
+    {
+        param = infer_expression_end(state, param) + 1;
+        param_count++;
+    }
+
+    if (known && arg_count != param_count)
+    {
+        debug("ERR!: '%s' takes %d arguments, %d given\n", variable->name, param_count, arg_count);
+        state->context->script->inference.error_count++;
+    }
+}
+
+int infer_function_literal(struct ExecutionInferState* state, int index)
+{
+    // '(...) => {' or '(...) {' starts a function with a block body, its parameters
+    // are declared in the scope of the body. Returns ')' of the parameters, or -1
+    // when the parentheses are not a function literal.
+    int close = state->tokens[index].match;
+
+    if (close < 0)
+    {
+        return -1;
+    }
+
+    int body = close + 1;
+    bool arrow = infer_is_symbol(state, body, '=') && infer_is_symbol(state, body + 1, '>');
+
+    if (arrow)
+    {
+        body += 2;
+    }
+
+    if (infer_is_symbol(state, body, '{'))
+    {
+        state->pending_body = body;
+        state->pending_params = index;
+        return close;
+    }
+
+    if (arrow)
+    {
+        // Expression body has no scope of its own here, it is left out
+        state->skip_end = infer_expression_end(state, body);
+        return close;
+    }
+
+    return -1;
+}
+
+void infer_declare_params(struct ExecutionInferState* state, int scope)
+{
+    // Parameters are 'type name' pairs, anything else than a scalar type is unknown
+    int start = state->pending_params + 1;
+    int close = state->tokens[state->pending_params].match;
+
+    for (int i = start; i <= close; i++)
+    {
+        if (!infer_is_symbol(state, i, ',') && i != close)
+        {
+            continue;
+        }
+
+        int name_index = i - 1;
+
+        if (name_index >= start && infer_is_identifier(state, name_index, NULL))
+        {
+            struct ExecutionInferValue value = { .type = name_index - 1 == start ? infer_declared_type(state, start) : INFER_TYPE_UNKNOWN };
+
+            if (value.type == STACK_TYPE_DYNAMIC)
+            {
+                value.type = INFER_TYPE_UNKNOWN;
+            }
+
+            infer_declare_variable(state, scope, name_index, value, false, -1);
+        }
+
+        start = i + 1;
+    }
+}
+
+void infer_open_block(struct ExecutionInferState* state, int index)
+{
+    if (state->block_depth >= MAX_INFER_BLOCK_DEPTH)
+    {
+        state->failed = true;
+        return;
+    }
+
+    uint8_t kind = INFER_BLOCK_OTHER;
+
+    if (index == state->pending_body)
+    {
+        kind = INFER_BLOCK_FUNCTION;
+    }
+    else if (infer_is_identifier(state, index - 1, "struct") || infer_is_identifier(state, index - 2, "struct"))
+    {
+        kind = INFER_BLOCK_STRUCT;
+    }
+
+    state->blocks[state->block_depth] = index;
+    state->block_kinds[state->block_depth] = kind;
+    state->block_depth++;
+
+    if (kind == INFER_BLOCK_FUNCTION)
+    {
+        state->pending_body = -1;
+        infer_declare_params(state, index);
+    }
+}
+
+void infer_scan(struct ExecutionInferState* state, bool check)
+{
+    state->block_depth = 0;
+    state->pending_body = -1;
+    state->skip_end = -1;
+    state->changed = false;
+
+    for (int i = 0; i < state->token_count && !state->failed; i++)
+    {
+        if (i < state->skip_end)
+        {
+            continue;
+        }
+
+        if (infer_is_symbol(state, i, '('))
+        {
+            // parameter names are not expressions
+            int close = infer_function_literal(state, i);
+
+            i = close >= 0 ? close : i;
+            continue;
+        }
+
+        if (infer_is_symbol(state, i, '{'))
+        {
+            infer_open_block(state, i);
+            continue;
+        }
+
+        if (infer_is_symbol(state, i, '}'))
+        {
+            state->block_depth -= state->block_depth > 0 ? 1 : 0;
+            continue;
+        }
+
+        bool in_struct = state->block_depth > 0 && state->block_kinds[state->block_depth - 1] == INFER_BLOCK_STRUCT;
+
+        if (!infer_is_identifier(state, i, NULL) || in_struct || infer_is_symbol(state, i - 1, '.'))
+        {
+            continue;
+        }
+
+        // 'type name = ...' or 'type[] name = ...', but not '==' or '=>'
+        int name_index = infer_is_symbol(state, i + 1, '[') && infer_is_symbol(state, i + 2, ']') ? i + 3 : i + 1;
+        int assign_index = name_index + 1;
+        bool is_assign = infer_is_symbol(state, assign_index, '=')
+            && !infer_is_symbol(state, assign_index + 1, '=') && !infer_is_symbol(state, assign_index + 1, '>');
+
+        if (infer_is_identifier(state, name_index, NULL) && is_assign)
+        {
+            infer_declaration(state, i, name_index, assign_index, check);
+            i = assign_index;
+            continue;
+        }
+
+        // 'name = ...' at the start of a statement
+        bool statement_start = infer_is_statement_start(state, i);
+
+        if (statement_start && infer_is_symbol(state, i + 1, '=')
+            && !infer_is_symbol(state, i + 2, '=') && !infer_is_symbol(state, i + 2, '>'))
+        {
+            if (check)
+            {
+                infer_assignment(state, i, i + 1);
+            }
+
+            i++;
+            continue;
+        }
+
+        if (check)
+        {
+            infer_check_call(state, i);
+
+            int handled = infer_fold(state, i, statement_start);
+            i = handled == i ? infer_inline(state, i) : handled;
+        }
+    }
+}
+
+void infer_remove_unused_constants(struct ExecutionInferState* state)
+{
+    // Declaration of a constant is dead when every read of its name was folded
+    for (int i = 0; i < state->variable_count; i++)
+    {
+        struct ExecutionInferVariable* variable = &state->variables[i];
+        int type_index = variable->declared_at - 1;
+        bool used = false;
+
+        if (!variable->constant || variable->statement_end < 0 || !infer_is_statement_start(state, type_index))
+        {
+            continue;
+        }
+
+        for (int j = 0; j < state->token_count && !used; j++)
+        {
+            used = j != variable->declared_at && !infer_is_symbol(state, j - 1, '.') 
+                && infer_is_identifier(state, j, variable->name) 
+                && !fold_is_removed(state->context, state->tokens[j].position);
+        }
+
+        if (!used)
+        {
+            fold_add_dead_statement(state->context, state->tokens[type_index].position, state->tokens[variable->statement_end].position + 1);
+        }
+    }
+}
+
+void exec_infer_script(struct ExecutionContext* context)
+{
+    struct ExecutionContextInferenceInfo* inference = &context->script->inference;
+
+    inference->typed_assignment_count = 0;
+    inference->error_count = 0;
+    context->script->fold.expression_count = 0;
+    context->script->fold.dead_statement_count = 0;
+    context->script->inlining.call_count = 0;
+
+    struct ExecutionInferState* state = malloc(sizeof(struct ExecutionInferState));
+    struct ExecutionInferToken* tokens = malloc(sizeof(struct ExecutionInferToken) * (context->code_len + 1));
+
+    if (!state || !tokens)
+    {
+        // Nothing is proven, every assignment stays checked at runtime
+        free(state);
+        free(tokens);
+        return;
+    }
+
+    state->context = context;
+    state->tokens = tokens;
+    state->token_count = infer_tokenize(context->code, context->code_len, tokens);
+    state->variable_count = 0;
+    state->failed = false;
+    memset(state->native_states, INFER_NATIVE_UNCHECKED, sizeof(state->native_states));
+    infer_match_brackets(state, context->code);
+
+    // Declarations are collected until their types settle, a function body can
+    // read globals declared after it
+    do
+    {
+        infer_scan(state, false);
+    }
+    while (state->changed && !state->failed);
+
+    if (!state->failed)
+    {
+        infer_scan(state, true);
+        infer_remove_unused_constants(state);
+    }
+
+    if (state->failed)
+    {
+        inference->typed_assignment_count = 0;
+        inference->error_count = 0;
+        context->script->fold.expression_count = 0;
+        context->script->fold.dead_statement_count = 0;
+        context->script->inlining.call_count = 0;
+    }
+
+#ifdef TOKEN_DEBUG
+    debug("Type inference: %d variables, %d typed assignments, %d errors, %d folded expressions, %d dead statements, %d inlined calls\n", 
+        state->variable_count, inference->typed_assignment_count, inference->error_count, context->script->fold.expression_count, 
+        context->script->fold.dead_statement_count, context->script->inlining.call_count);
+#endif
+
+    free(tokens);
+    free(state);
+}
+
+bool exec_infer_is_typed_assignment(struct ExecutionContext* context, int position)
+{
+    struct ExecutionContextInferenceInfo* inference = &context->script->inference;
+    int low = 0;
+    int high = inference->typed_assignment_count - 1;
+
+    while (low <= high)
+    {
+        int middle = (low + high) / 2;
+
+        if (inference->typed_assignments[middle] == position)
+        {
+            return true;
+        }
+
+        if (inference->typed_assignments[middle] < position)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+
+    return false;
+}
+
+#pragma endregion --- TYPE INFERENCE ---
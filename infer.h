@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "context.h"
+
+#pragma region --- TYPE INFERENCE ---
+
+#define MAX_INFER_VARIABLES 256
+#define MAX_INFER_BLOCK_DEPTH 32
+
+// Type of expressions which cannot be resolved statically, no value has ACQUIRE type
+#define INFER_TYPE_UNKNOWN STACK_TYPE_ACQUIRE
+
+enum ExecutionInferTokenKind
+{
+    INFER_TOKEN_IDENTIFIER,
+    INFER_TOKEN_NUMBER,
+    INFER_TOKEN_STRING,
+    INFER_TOKEN_SYMBOL,
+};
+
+enum ExecutionInferBlockKind
+{
+    INFER_BLOCK_FUNCTION,
+    INFER_BLOCK_STRUCT,
+    // instance or map literal
+    INFER_BLOCK_OTHER,
+};
+
+enum ExecutionInferNativeState
+{
+    INFER_NATIVE_UNCHECKED,
+    INFER_NATIVE_KEPT,
+    // script declares or assigns the name, calls can go anywhere
+    INFER_NATIVE_REPLACED,
+};
+
+struct ExecutionInferToken
+{
+    uint8_t kind;
+    // type of number and string literals
+    uint8_t type;
+    int position;
+    int length;
+    // value of number literals, same as exec_number pushes
+    uint64_t value;
+    // index of the matching bracket for '(', ')', '{' and '}', -1 otherwise
+    int match;
+};
+
+// Value of an expression as far as it is known before execution
+struct ExecutionInferValue
+{
+    uint8_t type;
+    // 'value' is known, only numeric values are
+    bool constant;
+    // evaluation does not change anything
+    bool pure;
+    uint64_t value;
+};
+
+struct ExecutionInferVariable
+{
+    char name[MAX_IDENTIFIER_LENGTH];
+    // token index of '{' of the function body, -1 for globals
+    int scope;
+    // token index of the first declaration
+    int declared_at;
+    // same for every declaration of the name in the scope, otherwise unknown
+    uint8_t type;
+    bool is_const;
+    // 'const' with the same known value in every declaration
+    bool constant;
+    uint64_t value;
+    // token index of ';' of the declaration of a constant
+    int statement_end;
+    // token index of the value of the first declaration, -1 for parameters
+    int value_at;
+};
+
+struct ExecutionInferState
+{
+    struct ExecutionContext* context;
+    struct ExecutionInferToken* tokens;
+    int token_count;
+    struct ExecutionInferVariable variables[MAX_INFER_VARIABLES];
+    int variable_count;
+    int blocks[MAX_INFER_BLOCK_DEPTH];
+    uint8_t block_kinds[MAX_INFER_BLOCK_DEPTH];
+    int block_depth;
+    // '{' of the next function body and '(' of its parameters
+    int pending_body;
+    int pending_params;
+    // end of the expression body of a function, it is not analyzed
+    int skip_end;
+    // see ExecutionInferNativeState, by registry function index
+    uint8_t native_states[MAX_REGISTRY_FUNCTIONS];
+    bool changed;
+    // too many variables or blocks, nothing is proven then
+    bool failed;
+};
+
+// Scans the script once when it is loaded. Types of literals, typed, 'let' and 'const'
+// variables, typed parameters and native calls are resolved statically. Declarations and
+// assignments whose value has another type than the variable, assignments of constants and
+// calls of a known function whose arguments do not match its parameters are compile errors. Assignments proven to have the same type are recorded so the executor
+// can skip their runtime checks. Values known before execution are folded, see fold.h,
+// and calls of small functions with a known callee are inlined, see inline.h.
+void exec_infer_script(struct ExecutionContext* context);
+
+// True when assignment at the position of its '=' was proven to keep the variable type
+bool exec_infer_is_typed_assignment(struct ExecutionContext* context, int position);
+
+#pragma endregion --- TYPE INFERENCE ---
@@ -0,0 +1,62 @@
+#include "inline.h"
+
+#include <string.h>
+
+#pragma region --- INLINING ---
+
+void inline_add_call(struct ExecutionContext* context, int start_position, int end_position, int body_position)
+{
+    struct ExecutionContextInlineInfo* inlining = &context->script->inlining;
+
+    if (inlining->call_count >= MAX_INLINED_CALLS)
+    {
+        // Not recorded calls go through exec_call
+        return;
+    }
+
+    int index = inlining->call_count;
+
+    while (index > 0 && inlining->calls[index - 1].start_position > start_position)
+    {
+        index--;
+    }
+
+    memmove(&inlining->calls[index + 1], &inlining->calls[index], (inlining->call_count - index) * sizeof(inlining->calls[0]));
+    inlining->calls[index] = (struct ExecutionContextInlinedCall) {
+        .start_position = start_position,
+        .end_position = end_position,
+        .body_position = body_position,
+    };
+    inlining->call_count++;
+}
+
+struct ExecutionContextInlinedCall* exec_inline_find_call(struct ExecutionContext* context, int position)
+{
+    struct ExecutionContextInlineInfo* inlining = &context->script->inlining;
+    int low = 0;
+    int high = inlining->call_count - 1;
+
+    while (low <= high)
+    {
+        int middle = (low + high) / 2;
+        int start_position = inlining->calls[middle].start_position;
+
+        if (start_position == position)
+        {
+            return &inlining->calls[middle];
+        }
+
+        if (start_position < position)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+
+    return NULL;
+}
+
+#pragma endregion --- INLINING ---
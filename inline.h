@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "context.h"
+
+#pragma region --- INLINING ---
+
+// Tokens of a callee body which can be inlined, bigger functions are always called
+#define MAX_INLINE_BODY_TOKENS 24
+
+// Records a call at the code range which evaluates the callee body in place, without
+// a scope and a frame of its own. Calls are found by type inference, see infer.h
+void inline_add_call(struct ExecutionContext* context, int start_position, int end_position, int body_position);
+
+// Inlined call starting at the position or NULL
+struct ExecutionContextInlinedCall* exec_inline_find_call(struct ExecutionContext* context, int position);
+
+#pragma endregion --- INLINING ---
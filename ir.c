@@ -0,0 +1,359 @@
+#include "ir.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defs.h"
+#include "debug.h"
+#include "parser.h"
+
+#pragma region --- FUNCTION IR ---
+
+// Names visible in the function body, same as its scope in the interpreter
+struct ExecutionIrBuilder
+{
+    const char* code;
+    int position;
+    int end;
+    const uint8_t* feedback_types;
+    int feedback_count;
+    struct ExecutionIrFunction* function;
+    char names[MAX_IR_PARAMS + MAX_IR_LOCALS][MAX_IDENTIFIER_LENGTH];
+    int values[MAX_IR_PARAMS + MAX_IR_LOCALS];
+    int name_count;
+};
+
+void ir_skip_spaces(struct ExecutionIrBuilder* builder)
+{
+    while (builder->position < builder->end && isspace(builder->code[builder->position]))
+    {
+        builder->position++;
+    }
+}
+
+char ir_current(struct ExecutionIrBuilder* builder)
+{
+    return builder->position < builder->end ? builder->code[builder->position] : 0;
+}
+
+bool ir_expect(struct ExecutionIrBuilder* builder, char expected)
+{
+    ir_skip_spaces(builder);
+
+    if (ir_current(builder) != expected)
+    {
+        return false;
+    }
+
+    builder->position++;
+    return true;
+}
+
+int ir_read_identifier(struct ExecutionIrBuilder* builder, char* buffer)
+{
+    // same rules as parse_identifier
+    int length = 0;
+
+    ir_skip_spaces(builder);
+
+    while (builder->position < builder->end
+        && parse_is_identifier_char(builder->code[builder->position])
+        && length < MAX_IDENTIFIER_LENGTH - 1)
+    {
+        buffer[length++] = builder->code[builder->position++];
+    }
+
+    buffer[length] = 0;
+
+    return length;
+}
+
+int ir_lookup_name(struct ExecutionIrBuilder* builder, const char* name)
+{
+    for (int i = 0; i < builder->name_count; i++)
+    {
+        if (strcmp(builder->names[i], name) == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+bool ir_bind_name(struct ExecutionIrBuilder* builder, const char* name, int value)
+{
+    if (ir_lookup_name(builder, name) >= 0 || builder->name_count >= MAX_IR_PARAMS + MAX_IR_LOCALS)
+    {
+        return false;
+    }
+
+    strcpy(builder->names[builder->name_count], name);
+    builder->values[builder->name_count] = value;
+    builder->name_count++;
+
+    return true;
+}
+
+int ir_emit(struct ExecutionIrBuilder* builder, uint8_t op, uint8_t type, int32_t a, int32_t b, int64_t value)
+{
+    struct ExecutionIrFunction* function = builder->function;
+
+    if (function->instruction_count >= MAX_IR_INSTRUCTIONS)
+    {
+        return -1;
+    }
+
+    function->instructions[function->instruction_count] = (struct ExecutionIrInstruction) { .op = op, .type = type, .a = a, .b = b, .value = value };
+
+    return function->instruction_count++;
+}
+
+int ir_parse_expression(struct ExecutionIrBuilder* builder)
+{
+    ir_skip_spaces(builder);
+
+    char current = ir_current(builder);
+
+    if (isdigit(current))
+    {
+        char number[32];
+        int length = 0;
+
+        while (isdigit(ir_current(builder)) && length < (int)sizeof(number) - 1)
+        {
+            number[length++] = builder->code[builder->position++];
+        }
+
+        number[length] = 0;
+
+        // Suffixes and fractions select other types
+        if (parse_is_identifier_char(ir_current(builder)) || ir_current(builder) == '.')
+        {
+            return -1;
+        }
+
+        return ir_emit(builder, IR_OP_CONST, NATIVE_TYPE_I32, 0, 0, (int32_t)atoll(number));
+    }
+
+    if (!parse_is_identifier_start(current))
+    {
+        return -1;
+    }
+
+    char identifier[MAX_IDENTIFIER_LENGTH];
+    ir_read_identifier(builder, identifier);
+    ir_skip_spaces(builder);
+
+    int name = ir_lookup_name(builder, identifier);
+
+    if (ir_current(builder) != '(')
+    {
+        return name >= 0 ? builder->values[name] : -1;
+    }
+
+    // Locals shadow globals, so only a global 'add' is the native
+    if (name >= 0 || strcmp(identifier, "add") != 0)
+    {
+        return -1;
+    }
+
+    builder->position++;
+
+    int a = ir_parse_expression(builder);
+
+    if (a < 0 || !ir_expect(builder, ','))
+    {
+        return -1;
+    }
+
+    int b = ir_parse_expression(builder);
+
+    if (b < 0 || !ir_expect(builder, ')'))
+    {
+        return -1;
+    }
+
+    // Other operand types make fts_add push something else than an i32
+    if (builder->function->instructions[a].type != NATIVE_TYPE_I32 || builder->function->instructions[b].type != NATIVE_TYPE_I32)
+    {
+        return -1;
+    }
+
+    builder->function->add_count++;
+
+    return ir_emit(builder, IR_OP_ADD, NATIVE_TYPE_I32, a, b, 0);
+}
+
+bool ir_is_result(struct ExecutionIrBuilder* builder)
+{
+    // Compiled code pushes the result as an i32
+    int result = builder->function->result;
+
+    return result >= 0 && builder->function->instructions[result].type == NATIVE_TYPE_I32;
+}
+
+bool ir_parse_params(struct ExecutionIrBuilder* builder)
+{
+    char type_identifier[MAX_IDENTIFIER_LENGTH];
+    char identifier[MAX_IDENTIFIER_LENGTH];
+
+    if (ir_expect(builder, ')'))
+    {
+        return true;
+    }
+
+    while (true)
+    {
+        ir_read_identifier(builder, type_identifier);
+
+        int param = builder->function->param_count;
+
+        if (param >= MAX_IR_PARAMS)
+        {
+            return false;
+        }
+
+        if (strcmp(type_identifier, "var") == 0 || strcmp(type_identifier, "let") == 0)
+        {
+            // Untyped parameters are specialized to what callers passed so far
+            if (param >= builder->feedback_count || builder->feedback_types[param] != NATIVE_TYPE_I32)
+            {
+                return false;
+            }
+
+            builder->function->speculative = true;
+        }
+        else if (strcmp(type_identifier, "i32") != 0)
+        {
+            return false;
+        }
+
+        if (!ir_read_identifier(builder, identifier))
+        {
+            // also rejects 'i32[]' parameters
+            return false;
+        }
+
+        builder->function->param_types[param] = NATIVE_TYPE_I32;
+        builder->function->param_count++;
+
+        int value = ir_emit(builder, IR_OP_PARAM, NATIVE_TYPE_I32, 0, 0, param);
+
+        if (value < 0 || !ir_bind_name(builder, identifier, value))
+        {
+            return false;
+        }
+
+        if (ir_expect(builder, ')'))
+        {
+            return true;
+        }
+
+        if (!ir_expect(builder, ','))
+        {
+            return false;
+        }
+    }
+}
+
+bool ir_parse_block(struct ExecutionIrBuilder* builder)
+{
+    char identifier[MAX_IDENTIFIER_LENGTH];
+    char name[MAX_IDENTIFIER_LENGTH];
+
+    while (true)
+    {
+        int statement_start = builder->position;
+
+        ir_read_identifier(builder, identifier);
+
+        if (strcmp(identifier, "let") == 0 || strcmp(identifier, "i32") == 0)
+        {
+            if (!ir_read_identifier(builder, name) || !ir_expect(builder, '=') || ir_current(builder) == '=')
+            {
+                return false;
+            }
+
+            int value = ir_parse_expression(builder);
+
+            // 'let' takes the type of the value, 'i32' is checked like context_add_variable does
+            if (value < 0 || (strcmp(identifier, "i32") == 0 && builder->function->instructions[value].type != NATIVE_TYPE_I32)
+                || !ir_expect(builder, ';') || !ir_bind_name(builder, name, value))
+            {
+                return false;
+            }
+
+            continue;
+        }
+
+        // Last statement is the returned value, a trailing ';' would drop it
+        builder->position = statement_start;
+        builder->function->result = ir_parse_expression(builder);
+
+        return ir_is_result(builder) && ir_expect(builder, '}');
+    }
+}
+
+bool ir_build_function(
+    const char* code, 
+    int code_len, 
+    int function_position, 
+    const uint8_t* feedback_types, 
+    int feedback_count, 
+    struct ExecutionIrFunction* function
+) {
+    struct ExecutionIrBuilder builder;
+
+    builder.code = code;
+    builder.position = function_position;
+    builder.end = code_len;
+    builder.feedback_types = feedback_types;
+    builder.feedback_count = feedback_types ? feedback_count : 0;
+    builder.function = function;
+    builder.name_count = 0;
+
+    function->function_position = function_position;
+    function->param_count = 0;
+    function->instruction_count = 0;
+    function->result = -1;
+    function->add_count = 0;
+    function->speculative = false;
+
+    if (!ir_parse_params(&builder))
+    {
+        return false;
+    }
+
+    // '=>' is optional, same as in exec_function_body
+    ir_expect(&builder, '=');
+    ir_expect(&builder, '>');
+
+    if (ir_expect(&builder, '{'))
+    {
+        if (!ir_parse_block(&builder))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        function->result = ir_parse_expression(&builder);
+
+        if (!ir_is_result(&builder) || !ir_expect(&builder, ';'))
+        {
+            return false;
+        }
+    }
+
+    function->fuel_cost = function->instruction_count * FUEL_COST_OPERATION + function->add_count * FUEL_COST_CALL;
+
+#ifdef TOKEN_DEBUG
+    debug("Built IR of function at %d (params: %d, instructions: %d)\n", function_position, function->param_count, function->instruction_count);
+#endif
+
+    return true;
+}
+
+#pragma endregion --- FUNCTION IR ---
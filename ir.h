@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "context.h"
+
+#pragma region --- FUNCTION IR ---
+
+#define MAX_IR_INSTRUCTIONS 64
+#define MAX_IR_PARAMS 8
+#define MAX_IR_LOCALS 16
+
+// Compiled tiers only handle a subset of the language: i32 parameters, i32 literals,
+// 'let'/'i32' locals and calls of the 'add' native. Other functions stay interpreted.
+enum ExecutionIrOp
+{
+    IR_OP_CONST,
+    // 'value' is the index of the parameter
+    IR_OP_PARAM,
+    // 'a' + 'b' with i32 wrap around, same as fts_add
+    IR_OP_ADD,
+};
+
+// Operands are indices of earlier instructions, every instruction defines one value
+struct ExecutionIrInstruction
+{
+    uint8_t op;
+    // type of the defined value: literal type, guarded type of a parameter, result type of 'add'
+    uint8_t type;
+    int32_t a;
+    int32_t b;
+    int64_t value;
+};
+
+struct ExecutionIrFunction
+{
+    int function_position;
+    int param_count;
+    // types compiled code checks arguments against before it runs
+    uint8_t param_types[MAX_IR_PARAMS];
+    struct ExecutionIrInstruction instructions[MAX_IR_INSTRUCTIONS];
+    int instruction_count;
+    // instruction which defines the returned i32
+    int result;
+    // number of 'add' calls, compiled code checks that 'add' is still the native
+    int add_count;
+    // fuel charged for one call, close to what the interpreter would consume
+    int fuel_cost;
+    // some 'var'/'let' parameter is assumed to be i32 because of type feedback
+    bool speculative;
+};
+
+// Builds IR of the function literal starting right after '(' at function_position,
+// returns false when the function uses anything outside of the supported subset.
+// Parameters declared with 'var' or 'let' are accepted when 'feedback_types' (argument
+// types seen so far, can be NULL) says they were always i32.
+bool ir_build_function(
+    const char* code, 
+    int code_len, 
+    int function_position, 
+    const uint8_t* feedback_types, 
+    int feedback_count, 
+    struct ExecutionIrFunction* function
+);
+
+#pragma endregion --- FUNCTION IR ---
@@ -0,0 +1,492 @@
+#include "jit.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "defs.h"
+#include "debug.h"
+#include "ir.h"
+#include "threaded.h"
+#include "executor.h"
+
+#if JIT_ENABLED && !JIT_THREADED_ONLY && defined(__x86_64__) && defined(__linux__)
+#define JIT_X86_64 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#pragma region --- JIT ---
+
+#ifdef JIT_X86_64
+
+// Code blocks are appended to one mapping, each block starts on its own pages which are
+// writable only until the block is copied and executable only after that, so pages of
+// published code are never written while another thread runs them
+pthread_mutex_t jit_code_lock = PTHREAD_MUTEX_INITIALIZER;
+uint8_t* jit_code_arena = NULL;
+size_t jit_code_used = 0;
+
+struct ExecutionJitCodeHeader
+{
+    uint32_t size;
+    uint32_t reserved[3];
+};
+
+struct ExecutionJitEmitter
+{
+    uint8_t buffer[JIT_MAX_FUNCTION_CODE];
+    int size;
+    bool overflow;
+};
+
+void jit_emit_u8(struct ExecutionJitEmitter* emitter, uint8_t byte)
+{
+    if (emitter->size >= JIT_MAX_FUNCTION_CODE)
+    {
+        emitter->overflow = true;
+        return;
+    }
+
+    emitter->buffer[emitter->size++] = byte;
+}
+
+void jit_emit_u32(struct ExecutionJitEmitter* emitter, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        jit_emit_u8(emitter, value >> (i * 8));
+    }
+}
+
+void jit_emit_bytes(struct ExecutionJitEmitter* emitter, const uint8_t* bytes, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        jit_emit_u8(emitter, bytes[i]);
+    }
+}
+
+// Values of IR instructions are kept in 4 byte slots at [rsp + 4 * index]
+void jit_emit_value_op(struct ExecutionJitEmitter* emitter, uint8_t opcode, int value)
+{
+    // <opcode> eax, [rsp + disp32]
+    jit_emit_bytes(emitter, (uint8_t[]) { opcode, 0x84, 0x24 }, 3);
+    jit_emit_u32(emitter, value * 4);
+}
+
+bool jit_emit_function(struct ExecutionJitEmitter* emitter, struct ExecutionIrFunction* function)
+{
+    uint32_t frame_size = (function->instruction_count * 4 + 15) & ~15u;
+    uint32_t stack_offset = offsetof(struct ExecutionContext, stack);
+
+    emitter->size = 0;
+    emitter->overflow = false;
+
+    // Arguments: rdi = context, esi = frame_start_stack_index
+    // sub rsp, frame_size
+    jit_emit_bytes(emitter, (uint8_t[]) { 0x48, 0x81, 0xEC }, 3);
+    jit_emit_u32(emitter, frame_size);
+    // movsxd rsi, esi
+    jit_emit_bytes(emitter, (uint8_t[]) { 0x48, 0x63, 0xF6 }, 3);
+    // lea r8, [rdi + rsi * 8 + stack], r8 points to the first argument slot
+    jit_emit_bytes(emitter, (uint8_t[]) { 0x4C, 0x8D, 0x84, 0xF7 }, 4);
+    jit_emit_u32(emitter, stack_offset);
+
+    for (int i = 0; i < function->instruction_count; i++)
+    {
+        struct ExecutionIrInstruction* instruction = &function->instructions[i];
+
+        switch (instruction->op)
+        {
+        case IR_OP_CONST:
+            // mov dword [rsp + disp32], imm32
+            jit_emit_bytes(emitter, (uint8_t[]) { 0xC7, 0x84, 0x24 }, 3);
+            jit_emit_u32(emitter, i * 4);
+            jit_emit_u32(emitter, (uint32_t)instruction->value);
+            continue;
+        case IR_OP_PARAM:
+            // mov eax, [r8 + disp32]
+            jit_emit_bytes(emitter, (uint8_t[]) { 0x41, 0x8B, 0x80 }, 3);
+            jit_emit_u32(emitter, instruction->value * 8);
+            break;
+        case IR_OP_ADD:
+            // mov eax, a; add eax, b
+            jit_emit_value_op(emitter, 0x8B, instruction->a);
+            jit_emit_value_op(emitter, 0x03, instruction->b);
+            break;
+        default:
+            return false;
+        }
+
+        // mov [rsp + disp32], eax
+        jit_emit_value_op(emitter, 0x89, i);
+    }
+
+    // Push the result like context_stack_push_value does for an i32 made by fts_add
+    // mov eax, result; cdqe
+    jit_emit_value_op(emitter, 0x8B, function->result);
+    jit_emit_bytes(emitter, (uint8_t[]) { 0x48, 0x98 }, 2);
+    // movsxd rcx, dword [rdi + stack_index]
+    jit_emit_bytes(emitter, (uint8_t[]) { 0x48, 0x63, 0x8F }, 3);
+    jit_emit_u32(emitter, offsetof(struct ExecutionContext, stack_index));
+    // mov [rdi + rcx * 8 + stack], rax
+    jit_emit_bytes(emitter, (uint8_t[]) { 0x48, 0x89, 0x84, 0xCF }, 4);
+    jit_emit_u32(emitter, stack_offset);
+    // mov byte [rdi + rcx + stack_type], NATIVE_TYPE_I32
+    jit_emit_bytes(emitter, (uint8_t[]) { 0xC6, 0x84, 0x0F }, 3);
+    jit_emit_u32(emitter, offsetof(struct ExecutionContext, stack_type));
+    jit_emit_u8(emitter, NATIVE_TYPE_I32);
+    // mov byte [rdi + rcx + stack_flags], STACK_FLAG_NONE
+    jit_emit_bytes(emitter, (uint8_t[]) { 0xC6, 0x84, 0x0F }, 3);
+    jit_emit_u32(emitter, offsetof(struct ExecutionContext, stack_flags));
+    jit_emit_u8(emitter, STACK_FLAG_NONE);
+    // inc dword [rdi + stack_index]
+    jit_emit_bytes(emitter, (uint8_t[]) { 0xFF, 0x87 }, 2);
+    jit_emit_u32(emitter, offsetof(struct ExecutionContext, stack_index));
+    // add rsp, frame_size; ret
+    jit_emit_bytes(emitter, (uint8_t[]) { 0x48, 0x81, 0xC4 }, 3);
+    jit_emit_u32(emitter, frame_size);
+    jit_emit_u8(emitter, 0xC3);
+
+    return !emitter->overflow;
+}
+
+void* jit_install_code(const uint8_t* code, int size)
+{
+    void* installed = NULL;
+
+    pthread_mutex_lock(&jit_code_lock);
+
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    if (!jit_code_arena)
+    {
+        // Nothing is accessible until a block is installed
+        void* arena = mmap(NULL, JIT_CODE_ARENA_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        jit_code_arena = arena == MAP_FAILED ? NULL : arena;
+    }
+
+    if (jit_code_arena)
+    {
+        // Same script compiled by another context produces the same bytes
+        size_t offset = 0;
+
+        while (offset < jit_code_used)
+        {
+            struct ExecutionJitCodeHeader* header = (struct ExecutionJitCodeHeader*)&jit_code_arena[offset];
+            uint8_t* block = (uint8_t*)(header + 1);
+
+            if (header->size == (uint32_t)size && memcmp(block, code, size) == 0)
+            {
+                installed = block;
+                break;
+            }
+
+            offset += (sizeof(struct ExecutionJitCodeHeader) + header->size + page_size - 1) & ~(page_size - 1);
+        }
+
+        size_t block_size = (sizeof(struct ExecutionJitCodeHeader) + size + page_size - 1) & ~(page_size - 1);
+        uint8_t* block = &jit_code_arena[jit_code_used];
+
+        if (!installed && jit_code_used + block_size <= JIT_CODE_ARENA_SIZE && mprotect(block, block_size, PROT_READ | PROT_WRITE) == 0)
+        {
+            struct ExecutionJitCodeHeader* header = (struct ExecutionJitCodeHeader*)block;
+
+            header->size = size;
+            memcpy(header + 1, code, size);
+
+            // x86 keeps instruction fetch coherent, this only orders the writes
+            __builtin___clear_cache((char*)(header + 1), (char*)(header + 1) + size);
+
+            if (mprotect(block, block_size, PROT_READ | PROT_EXEC) == 0)
+            {
+                installed = header + 1;
+                jit_code_used += block_size;
+            }
+            else
+            {
+                debug("ERR!: Cannot make compiled code executable\n");
+                mprotect(block, block_size, PROT_NONE);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&jit_code_lock);
+
+    return installed;
+}
+
+#endif
+
+struct ExecutionContextJitFunction* jit_get_function(struct ExecutionContext* context, int function_position, bool create)
+{
+    struct ExecutionContextJitInfo* jit = &context->jit;
+
+    for (int i = 0; i < jit->function_count; i++)
+    {
+        if (jit->functions[i].function_position == function_position)
+        {
+            return &jit->functions[i];
+        }
+    }
+
+    if (!create || jit->function_count >= MAX_JIT_FUNCTIONS)
+    {
+        // Functions which do not fit are always interpreted
+        return NULL;
+    }
+
+    struct ExecutionContextJitFunction* function = &jit->functions[jit->function_count++];
+
+    memset(function, 0, sizeof(*function));
+    function->function_position = function_position;
+    function->state = JIT_STATE_PROFILING;
+
+    return function;
+}
+
+#if JIT_ENABLED
+
+void jit_compile_function(struct ExecutionContext* context, struct ExecutionContextJitFunction* function)
+{
+    struct ExecutionIrFunction ir;
+
+    function->state = JIT_STATE_FAILED;
+
+    function->compile_count++;
+
+    // Feedback of calls with different numbers of arguments is not used
+    const uint8_t* feedback_types = function->feedback_count >= 0 ? function->feedback_types : NULL;
+
+    if (!ir_build_function(context->code, context->code_len, function->function_position, feedback_types, function->feedback_count, &ir))
+    {
+#ifdef TOKEN_DEBUG
+        debug("Function at %d cannot be compiled, it stays interpreted\n", function->function_position);
+#endif
+        return;
+    }
+
+#ifdef JIT_X86_64
+    struct ExecutionJitEmitter emitter;
+
+    function->code = jit_emit_function(&emitter, &ir) ? jit_install_code(emitter.buffer, emitter.size) : NULL;
+    function->backend = JIT_BACKEND_X86_64;
+#endif
+
+    if (!function->code)
+    {
+        // Portable backend, runs on any target the runtime is compiled for
+        function->code = threaded_compile(&ir);
+        function->backend = JIT_BACKEND_THREADED;
+    }
+
+    if (!function->code)
+    {
+        debug("ERR!: No space left for compiled code, function at %d stays interpreted\n", function->function_position);
+        return;
+    }
+
+    function->param_count = ir.param_count;
+    memcpy(function->param_types, ir.param_types, sizeof(ir.param_types[0]) * ir.param_count);
+    function->add_count = ir.add_count;
+    function->fuel_cost = ir.fuel_cost;
+    function->speculative = ir.speculative;
+    function->deopt_count = 0;
+    function->add_stack_index = -1;
+    function->global_variable_count = -1;
+    function->state = JIT_STATE_COMPILED;
+
+#ifdef TOKEN_DEBUG
+    debug("Compiled function at %d (backend: %d, speculative: %d, code: %p)\n", function->function_position, function->backend, function->speculative, function->code);
+#endif
+}
+
+void jit_record_feedback(struct ExecutionContext* context, struct ExecutionContextJitFunction* function, int frame_start_stack_index, int args_stack_size)
+{
+    if (function->call_count == 0)
+    {
+        function->feedback_count = args_stack_size <= MAX_JIT_FEEDBACK_ARGS ? args_stack_size : -1;
+        
+        for (int i = 0; i < function->feedback_count; i++)
+        {
+            function->feedback_types[i] = context->stack_type[frame_start_stack_index + i];
+        }
+
+        return;
+    }
+
+    if (function->feedback_count != args_stack_size)
+    {
+        function->feedback_count = -1;
+        return;
+    }
+
+    for (int i = 0; i < args_stack_size; i++)
+    {
+        if (function->feedback_types[i] != context->stack_type[frame_start_stack_index + i])
+        {
+            function->feedback_types[i] = STACK_TYPE_DYNAMIC;
+        }
+    }
+}
+
+void jit_deoptimize(struct ExecutionContext* context, struct ExecutionContextJitFunction* function)
+{
+    (void)context;
+
+    // Guards of declared types only fail for calls the interpreter reports as errors,
+    // guards of assumed types fail when callers start passing other types
+    if (!function->speculative || ++function->deopt_count < JIT_DEOPT_THRESHOLD)
+    {
+        return;
+    }
+
+#ifdef TOKEN_DEBUG
+    debug("Deoptimizing function at %d after %d failed guards\n", function->function_position, function->deopt_count);
+#endif
+
+    // Code stays in the arena, another context can still run it
+    function->state = function->compile_count < JIT_MAX_COMPILES ? JIT_STATE_PROFILING : JIT_STATE_FAILED;
+    function->code = NULL;
+    function->speculative = false;
+    function->call_count = 0;
+    function->deopt_count = 0;
+}
+
+#endif
+
+bool jit_register_function(
+    struct ExecutionContext* context, 
+    int function_position, 
+    uint8_t backend, 
+    void* code, 
+    int param_count, 
+    int add_count, 
+    int fuel_cost
+) {
+    if (param_count > MAX_JIT_FEEDBACK_ARGS)
+    {
+        debug("ERR!: Function at %d has too many parameters for compiled code\n", function_position);
+        return false;
+    }
+
+    struct ExecutionContextJitFunction* function = jit_get_function(context, function_position, true);
+
+    if (!function)
+    {
+        return false;
+    }
+
+    function->backend = backend;
+    function->code = code;
+    function->param_count = param_count;
+    function->add_count = add_count;
+
+    for (int i = 0; i < param_count; i++)
+    {
+        // Modules are built from the same IR, which only has i32 parameters
+        function->param_types[i] = NATIVE_TYPE_I32;
+    }
+
+    function->fuel_cost = fuel_cost;
+    function->speculative = false;
+    function->add_stack_index = -1;
+    function->global_variable_count = -1;
+    function->state = JIT_STATE_COMPILED;
+
+    return true;
+}
+
+bool jit_check_add(struct ExecutionContext* context, struct ExecutionContextJitFunction* function)
+{
+    struct ExecutionContextScope* global_scope = context->global_scope;
+
+    if (function->global_variable_count != global_scope->variable_count)
+    {
+        // Function scope is empty before the body runs, so 'add' is looked up in globals
+        int lookup = context_scope_variables_linear_search(global_scope, "add");
+
+        function->add_stack_index = lookup >= 0 ? global_scope->variables[lookup].stack_index : -1;
+        function->global_variable_count = global_scope->variable_count;
+    }
+
+    int index = function->add_stack_index;
+
+    return index >= 0
+        && context->stack_type[index] == NATIVE_TYPE_NATIVE_FUNCTION
+        && context->stack[index] == (uint64_t)&fts_add;
+}
+
+bool jit_try_call(struct ExecutionContext* context, int function_position, int frame_start_stack_index, int args_stack_size)
+{
+    if (!context_is_running(context))
+    {
+        return false;
+    }
+
+    // Without the JIT only functions registered by AOT modules are looked up
+    struct ExecutionContextJitFunction* function = jit_get_function(context, function_position, JIT_ENABLED);
+
+    if (!function)
+    {
+        return false;
+    }
+
+#if JIT_ENABLED
+    if (function->state == JIT_STATE_PROFILING)
+    {
+        jit_record_feedback(context, function, frame_start_stack_index, args_stack_size);
+
+        if (++function->call_count >= JIT_CALL_THRESHOLD)
+        {
+            jit_compile_function(context, function);
+        }
+    }
+#endif
+
+    if (function->state != JIT_STATE_COMPILED || context->stack_index >= MAX_STACK_SIZE)
+    {
+        return false;
+    }
+
+    // Compiled code reads parameters without checks and calls the native 'add', locals
+    // and literals were typed by the IR, anything else runs in the interpreter
+    bool guards_passed = args_stack_size == function->param_count;
+
+    for (int i = 0; guards_passed && i < args_stack_size; i++)
+    {
+        guards_passed = context->stack_type[frame_start_stack_index + i] == function->param_types[i];
+    }
+
+    if (guards_passed && function->add_count > 0)
+    {
+        guards_passed = jit_check_add(context, function);
+    }
+
+    if (!guards_passed)
+    {
+#if JIT_ENABLED
+        jit_deoptimize(context, function);
+#endif
+        return false;
+    }
+
+    if (!context_consume_fuel(context, function->fuel_cost))
+    {
+        return true;
+    }
+
+    if (function->backend == JIT_BACKEND_THREADED)
+    {
+        threaded_run(function->code, context, frame_start_stack_index);
+    }
+    else
+    {
+        ((ExecutionJitCode)function->code)(context, frame_start_stack_index);
+    }
+
+    return true;
+}
+
+#pragma endregion --- JIT ---
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "context.h"
+
+#pragma region --- JIT ---
+
+// Calls of a function literal before it is compiled
+#define JIT_CALL_THRESHOLD 64
+
+// Failed guards of code specialized from type feedback before it is dropped, and how
+// many times a function can be compiled before it stays interpreted
+#define JIT_DEOPT_THRESHOLD 16
+#define JIT_MAX_COMPILES 4
+
+// Executable memory shared by all contexts, compiled code is never freed and
+// identical code is reused, so running the same script again does not grow it.
+// Every function takes whole pages, so this holds 256 functions with 4KB pages
+#define JIT_CODE_ARENA_SIZE (1 << 20)
+#define JIT_MAX_FUNCTION_CODE 2048
+
+enum ExecutionJitBackend
+{
+    // machine code written by jit_emit_function, x86-64 Linux only
+    JIT_BACKEND_X86_64,
+    // call-threaded code of C functions, see threaded.h
+    JIT_BACKEND_THREADED,
+    // function of a shared object loaded by aot_load, see aot.h
+    JIT_BACKEND_AOT,
+};
+
+enum ExecutionJitState
+{
+    JIT_STATE_PROFILING,
+    JIT_STATE_COMPILED,
+    // outside of the compiled subset (see ir.h) or no space left, always interpreted
+    JIT_STATE_FAILED,
+};
+
+// Compiled code takes the same frame as exec_function_body: arguments are stack slots
+// starting at frame_start_stack_index, the i32 result is pushed on top of them
+typedef void (*ExecutionJitCode)(struct ExecutionContext* context, int frame_start_stack_index);
+
+// Counts the call of the function, records types of its arguments and runs its compiled
+// code once it is hot. Returns false when the call has to be interpreted, arguments 
+// are left untouched then.
+bool jit_try_call(struct ExecutionContext* context, int function_position, int frame_start_stack_index, int args_stack_size);
+
+// Marks the function as compiled with code made outside of the JIT, calls dispatch to it
+// right away. Code has to follow ExecutionJitCode and the guards of the compiled subset.
+bool jit_register_function(
+    struct ExecutionContext* context, 
+    int function_position, 
+    uint8_t backend, 
+    void* code, 
+    int param_count, 
+    int add_count, 
+    int fuel_cost
+);
+
+#pragma endregion --- JIT ---
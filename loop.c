@@ -0,0 +1,330 @@
+#include "loop.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "executor.h"
+#include "object.h"
+#include "array.h"
+#include "debug.h"
+
+#pragma region --- LOOP ---
+
+bool loop_push_ready(struct ExecutionLoop* loop, struct ExecutionCoroutine* coroutine)
+{
+    struct ExecutionLoopEntry* entry = malloc(sizeof(struct ExecutionLoopEntry));
+
+    if (!entry)
+    {
+        debug("ERR!: Cannot allocate loop entry\n");
+        return false;
+    }
+
+    entry->coroutine = coroutine;
+    entry->next = NULL;
+
+    if (loop->ready_tail)
+    {
+        loop->ready_tail->next = entry;
+    }
+    else
+    {
+        loop->ready_head = entry;
+    }
+
+    loop->ready_tail = entry;
+    return true;
+}
+
+struct ExecutionCoroutine* loop_pop_ready(struct ExecutionLoop* loop)
+{
+    struct ExecutionLoopEntry* entry = loop->ready_head;
+
+    if (!entry)
+    {
+        return NULL;
+    }
+
+    loop->ready_head = entry->next;
+
+    if (!loop->ready_head)
+    {
+        loop->ready_tail = NULL;
+    }
+
+    struct ExecutionCoroutine* coroutine = entry->coroutine;
+    free(entry);
+
+    return coroutine;
+}
+
+void loop_resume(struct ExecutionLoop* loop, struct ExecutionCoroutine* coroutine)
+{
+    loop->parked = false;
+
+    uint8_t state = exec_coroutine_resume(coroutine);
+
+    // Parked by a native it is already registered in epoll, suspended by the fuel
+    // hook or other native it runs again after the ready ones
+    if (state == EXECUTION_CONTEXT_STATE_SUSPENDED && (loop->parked || loop_push_ready(loop, coroutine)))
+    {
+        return;
+    }
+
+    if (loop->finished)
+    {
+        loop->finished(coroutine, loop->finished_data);
+    }
+
+    exec_coroutine_destroy(coroutine);
+}
+
+int64_t loop_read(int fd, struct ExecutionArray* buffer)
+{
+    // One call fills as much of the buffer as is available
+    ssize_t count;
+
+    do
+    {
+        count = read(fd, buffer->data, (size_t)buffer->length * buffer->element_size);
+    }
+    while (count < 0 && errno == EINTR);
+
+    return count;
+}
+
+void loop_complete_read(struct ExecutionLoop* loop, struct ExecutionLoopWaiter* waiter)
+{
+    struct ExecutionContext* context = &waiter->coroutine->context;
+
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, waiter->fd, NULL);
+    loop->waiting--;
+
+    // Result of the suspended read call goes where the native would push it
+    uint64_t value = (uint64_t)(int32_t)loop_read(waiter->fd, waiter->buffer);
+    object_deref(waiter->buffer);
+
+    context_stack_push_value(
+        context, 
+        (struct ExecutionContextStackValue) { .ptr = &value, .type = NATIVE_TYPE_I32, .size = get_size_of_native_type(NATIVE_TYPE_I32) }
+    );
+
+    struct ExecutionCoroutine* coroutine = waiter->coroutine;
+    free(waiter);
+
+    loop_resume(loop, coroutine);
+}
+
+struct ExecutionLoop* exec_loop_create(struct ExecutionRegistry* registry)
+{
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (epoll_fd < 0)
+    {
+        debug("ERR!: Cannot create epoll instance (errno: %d)\n", errno);
+        return NULL;
+    }
+
+    struct ExecutionLoop* loop = malloc(sizeof(struct ExecutionLoop));
+
+    if (!loop)
+    {
+        debug("ERR!: Cannot allocate loop\n");
+        close(epoll_fd);
+        return NULL;
+    }
+
+    loop->epoll_fd = epoll_fd;
+    loop->registry = registry;
+    loop->ready_head = NULL;
+    loop->ready_tail = NULL;
+    loop->waiting = 0;
+    loop->parked = false;
+    loop->finished = NULL;
+    loop->finished_data = NULL;
+    loop->coroutine_stack_size = 0;
+
+    return loop;
+}
+
+void exec_loop_destroy(struct ExecutionLoop* loop)
+{
+    struct ExecutionCoroutine* coroutine;
+
+    // Coroutines which never started are dropped, parked ones are lost 
+    // with their waiters, loop has to be run until it is empty
+    while ((coroutine = loop_pop_ready(loop)))
+    {
+        exec_coroutine_destroy(coroutine);
+    }
+
+    close(loop->epoll_fd);
+    free(loop);
+}
+
+struct ExecutionCoroutine* exec_loop_spawn(struct ExecutionLoop* loop, const char* code)
+{
+    struct ExecutionScript* script = exec_script_create(loop->registry, code);
+    struct ExecutionCoroutine* coroutine = exec_loop_spawn_script(loop, script);
+
+    object_deref(script);
+
+    return coroutine;
+}
+
+struct ExecutionCoroutine* exec_loop_spawn_script(struct ExecutionLoop* loop, struct ExecutionScript* script)
+{
+    struct ExecutionCoroutine* coroutine = exec_coroutine_create_script(script, loop->coroutine_stack_size);
+
+    if (!coroutine)
+    {
+        return NULL;
+    }
+
+    coroutine->context.loop = loop;
+
+    if (!loop_push_ready(loop, coroutine))
+    {
+        exec_coroutine_destroy(coroutine);
+        return NULL;
+    }
+
+    return coroutine;
+}
+
+bool exec_loop_wait_readable(struct ExecutionLoop* loop, struct ExecutionCoroutine* coroutine, int fd, struct ExecutionArray* buffer)
+{
+    struct ExecutionLoopWaiter* waiter = malloc(sizeof(struct ExecutionLoopWaiter));
+
+    if (!waiter)
+    {
+        debug("ERR!: Cannot allocate loop waiter\n");
+        return false;
+    }
+
+    waiter->coroutine = coroutine;
+    waiter->fd = fd;
+    waiter->buffer = object_ref(buffer);
+
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.ptr = waiter;
+
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+    {
+        // EEXIST when other coroutine already waits on the same descriptor
+        debug("ERR!: Cannot wait for descriptor %d (errno: %d)\n", fd, errno);
+        object_deref(waiter->buffer);
+        free(waiter);
+        return false;
+    }
+
+    loop->waiting++;
+    loop->parked = true;
+    return true;
+}
+
+void exec_loop_run(struct ExecutionLoop* loop)
+{
+    struct epoll_event events[LOOP_MAX_EVENTS];
+
+    while (loop->ready_head || loop->waiting > 0)
+    {
+        struct ExecutionCoroutine* coroutine;
+
+        while ((coroutine = loop_pop_ready(loop)))
+        {
+            loop_resume(loop, coroutine);
+        }
+
+        if (loop->waiting == 0)
+        {
+            break;
+        }
+
+        int count = epoll_wait(loop->epoll_fd, events, LOOP_MAX_EVENTS, -1);
+
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            debug("ERR!: epoll_wait failed (errno: %d)\n", errno);
+            break;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            loop_complete_read(loop, events[i].data.ptr);
+        }
+    }
+}
+
+#pragma endregion --- LOOP ---
+
+#pragma region --- LOOP SCRIPT FUNCTIONS ---
+
+void exec_registry_add_io_functions(struct ExecutionRegistry* registry)
+{
+    exec_registry_add_function(registry, "read", &fts_read);
+}
+
+// read(fd, u8[] buffer) -> count of bytes stored in the buffer, 0 at the end or -1 on error
+void fts_read(struct ExecutionContext* context)
+{
+    int index = context->native_frame_stack_index;
+    struct ExecutionContextStackValue fd_value = index < context->stack_index 
+        ? context_stack_get_value_at_index(context, index) 
+        : (struct ExecutionContextStackValue) { 0 };
+    struct ExecutionContextStackValue buffer_value = fd_value.type == NATIVE_TYPE_I32 && index + fd_value.size < context->stack_index
+        ? context_stack_get_value_at_index(context, index + fd_value.size)
+        : (struct ExecutionContextStackValue) { 0 };
+
+    if (buffer_value.type != STACK_TYPE_ARRAY 
+        || !*(struct ExecutionArray**)buffer_value.ptr
+        || index + fd_value.size + buffer_value.size != context->stack_index)
+    {
+        debug("ERR!: read expects a file descriptor and an array\n");
+        return;
+    }
+
+    int fd = *(int32_t*)fd_value.ptr;
+    struct ExecutionArray* buffer = *(struct ExecutionArray**)buffer_value.ptr;
+    int64_t count = -1;
+
+    // Regular files always report ready, so they are read right away
+    struct pollfd poll_fd = { .fd = fd, .events = POLLIN };
+
+    if (poll(&poll_fd, 1, 0) != 0)
+    {
+        count = loop_read(fd, buffer);
+    }
+    else if (context->loop && context->coroutine)
+    {
+        if (exec_loop_wait_readable(context->loop, context->coroutine, fd, buffer))
+        {
+            // loop pushes the result and resumes the script when data arrives
+            context_suspend(context);
+            return;
+        }
+    }
+    else
+    {
+        // Without a loop waiting would block the whole thread
+        debug("ERR!: read of descriptor %d would block outside of an event loop\n", fd);
+    }
+
+    uint64_t result = (uint64_t)(int32_t)count;
+
+    context_stack_push_value(
+        context, 
+        (struct ExecutionContextStackValue) { .ptr = &result, .type = NATIVE_TYPE_I32, .size = get_size_of_native_type(NATIVE_TYPE_I32) }
+    );
+}
+
+#pragma endregion --- LOOP SCRIPT FUNCTIONS ---
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "context.h"
+#include "coroutine.h"
+#include "array.h"
+
+#pragma region --- LOOP ---
+
+#define LOOP_MAX_EVENTS 64
+
+// Coroutine waiting until its file descriptor becomes readable
+struct ExecutionLoopWaiter
+{
+    struct ExecutionCoroutine* coroutine;
+    int fd;
+    // referenced until the read completes
+    struct ExecutionArray* buffer;
+};
+
+struct ExecutionLoopEntry
+{
+    struct ExecutionCoroutine* coroutine;
+    struct ExecutionLoopEntry* next;
+};
+
+typedef void (*ExecutionLoopFinishedCallback)(struct ExecutionCoroutine* coroutine, void* user_data);
+
+// Epoll backed event loop driving script coroutines on a single thread, 
+// natives doing I/O park the calling coroutine here until the I/O is ready
+struct ExecutionLoop
+{
+    int epoll_fd;
+    struct ExecutionRegistry* registry;
+
+    // coroutines ready to be resumed
+    struct ExecutionLoopEntry* ready_head;
+    struct ExecutionLoopEntry* ready_tail;
+    // coroutines parked on I/O
+    int waiting;
+    // set when the resumed coroutine registered a waiter before it suspended
+    bool parked;
+
+    // called before a finished coroutine is destroyed
+    ExecutionLoopFinishedCallback finished;
+    void* finished_data;
+
+    // native stack of spawned coroutines, 0 for COROUTINE_DEFAULT_STACK_SIZE
+    size_t coroutine_stack_size;
+};
+
+struct ExecutionLoop* exec_loop_create(struct ExecutionRegistry* registry);
+void exec_loop_destroy(struct ExecutionLoop* loop);
+
+struct ExecutionCoroutine* exec_loop_spawn(struct ExecutionLoop* loop, const char* code);
+struct ExecutionCoroutine* exec_loop_spawn_script(struct ExecutionLoop* loop, struct ExecutionScript* script);
+// Parks the running coroutine, it has to suspend right after
+bool exec_loop_wait_readable(struct ExecutionLoop* loop, struct ExecutionCoroutine* coroutine, int fd, struct ExecutionArray* buffer);
+void exec_loop_run(struct ExecutionLoop* loop);
+
+#pragma endregion --- LOOP ---
+
+#pragma region --- LOOP SCRIPT FUNCTIONS ---
+
+// I/O natives are not part of exec_registry_init, hosts which let scripts
+// touch descriptors register them explicitly
+void exec_registry_add_io_functions(struct ExecutionRegistry* registry);
+
+void fts_read(struct ExecutionContext* context);
+
+#pragma endregion --- LOOP SCRIPT FUNCTIONS ---
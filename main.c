@@ -25,6 +25,89 @@
 //   - var - declares a mutable variable which have dynamic type
 //   - <type name> - declares a mutable variable which have explictly defined type
 //
+// Struct instances:
+//   'X { field: value, ... }' constructs an instance of struct 'X' stored by value on the stack,
+//   omitted fields are zeroed. Declaration or assignment moves the instance into the variable,
+//   fields of instance variables can be read and assigned with 'v.field'.
+//   'new X { ... }' creates a reference counted heap object instead. When a function only
+//   uses the variable it was declared with for field access, the object stays on the stack.
+//   Fields of type 'object' can reference other heap objects, reference cycles between them
+//   are found by a cycle collector which runs in small steps as the thread allocates.
+//   A struct can have up to 64 fields.
+//
+// Arrays:
+//   'T[n]' allocates a zeroed reference counted array of n elements of numeric type 'T',
+//   'T[] name = ...' declares an array variable, 'a[i]' reads and 'a[i] = v' writes an element.
+//   Bulk built-ins run vector kernels picked for the CPU: len, sum, min, max, dot(a, b),
+//   add(a, b), scale(a, v) in place, less/greater/equal(a, v) -> u8[] mask and count(a).
+//
+// Column collections:
+//   'S[n]' for a struct 'S' with numeric fields stores n records column-wise, 'S[] name = ...'
+//   declares one. 'c.field' is the column of the field as a regular array, so 'sum(c.price)'
+//   scans only prices. 'c[i].field' reads or writes one field, 'c[i]' gathers a whole record
+//   into an instance and 'c[i] = S { ... }' scatters one back, len(c) counts records.
+//
+// Strings:
+//   '"text"' literals and 'string' type. Up to 7 bytes live inline in the stack slot, longer
+//   strings are immutable reference counted buffers, literals are interned. concat(a, b),
+//   substr(s, start, length) returns a view sharing the buffer, find(s, part) -> index or -1,
+//   intern(s) for keys compared by address, equal(a, b) and len(s).
+//
+// Maps:
+//   'map { key: value, ... }' creates a hash map with integer or string keys and values of
+//   any type, 'map' is also its type. 'm[k]' reads and 'm[k] = v' inserts or replaces a value,
+//   has(m, k), get(m, k, default), remove(m, k) and len(m). Lookups probe 16 slots at once.
+//
+// Parallel tasks:
+//   'spawn(f, args...)' runs script function 'f' on a child context and returns a task handle,
+//   'join(handle)' waits for the task and returns its result. Child sees a read-only snapshot
+//   of globals, arguments can be numbers, structs or objects and results have to be numbers.
+//   Objects passed to tasks are shared together with everything they reference, objects a
+//   task releases are counted back by the thread which created them.
+//   A handle can be joined once, tasks which were not joined are waited for and freed when
+//   the host releases the context with exec_context_release.
+//
+// Compiled functions:
+//   After 64 calls a function literal is compiled when its parameters are i32, or 'var'/'let'
+//   parameters which only ever received i32 arguments, and its block body only declares
+//   'let' or 'i32' locals and returns i32 literals and 'add' results. Code is x86-64 on
+//   Linux, other targets call a C function per operation. Calls with other argument types,
+//   or after 'add' was replaced, interpret it. When assumed parameter types keep failing, the
+//   code is dropped and the function is profiled again. For fixed scripts the host can build
+//   the same functions ahead of time with aot_compile_script(code, path), which writes C and
+//   runs the system compiler, and aot_load(context, path) them before exec_context_run.
+//
+// Type checking:
+//   Before the script runs, types of literals, typed and 'let' variables, typed parameters
+//   and 'add' of two i32 values are inferred. Declaring or assigning a value of another type
+//   to such a variable is an error and the script is not executed. Assignments proven to
+//   keep the variable type store scalars without runtime checks, 'var' stays dynamic.
+//   Analysis runs once per exec_script_create(registry, code), contexts initialized from
+//   the script with exec_context_init_script, and their spawned tasks, share its results.
+//
+// Constant folding:
+//   Calls of pure natives (add, len, find, ...) with numeric literals or 'const' variables
+//   as arguments are evaluated before the script runs, reads of such constants push their
+//   value directly. Statements which only compute a dropped value with pure natives, and
+//   declarations of constants whose every read was folded, are skipped. Hosts mark their
+//   own natives pure with exec_registry_add_pure_function.
+//
+// Inlining:
+//   Calls without arguments of a function or a struct static method whose global name is
+//   bound only once, like 'X.new()' above, run the callee body in place when the body is
+//   a single small expression which reads globals only, no scope or frame is created.
+//
+// Register engine:
+//   Host can set 'context.engine = EXECUTION_ENGINE_REGISTER' after exec_context_init. Then
+//   functions with scalar, 'var' or 'let' parameters whose block body only declares and
+//   assigns scalar or 'let' locals, reads globals and calls globals are translated once to
+//   register code, where every parameter, local and temporary has its own stack slot.
+//   Other functions and calls with other argument types run on the stack engine.
+//   After its first execution an instruction is rewritten to a form specialized for what it
+//   saw, like a call of 'add' with two i32 registers or a read of an i32 global, and goes
+//   back to the generic form when that no longer holds. After 16 executions pairs like an
+//   i32 literal with the 'add' reading it are fused into one instruction.
+//
 
 int main() 
 {
@@ -50,6 +133,13 @@ int main()
         b(a); \
         let c = X.new(); \
         print(c); \
+        \
+        let R = struct { \
+            i32 a; i32 b; i32 c; i32 d; i32 e; i32 f; \
+            i32 g; i32 h; i32 i; i32 j; u8 k; i64 l; \
+        }; \
+        R r = R { i: 9, j: 10, l: 12 }; \
+        print(add(r.i, r.j)); \
     ");
 
     //  exec("\
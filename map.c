@@ -0,0 +1,514 @@
+#include "map.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "str.h"
+
+#if MAP_SIMD_PROBING && defined(__SSE2__)
+    #define MAP_SIMD_SSE2 1
+    #include <emmintrin.h>
+#endif
+
+#pragma region --- MAP ---
+
+#pragma region Groups
+
+#ifdef MAP_SIMD_SSE2
+
+uint32_t map_group_match(const int8_t* group, int8_t control)
+{
+    __m128i bytes = _mm_loadu_si128((const __m128i*)group);
+
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(control)));
+}
+
+uint32_t map_group_match_free(const int8_t* group)
+{
+    // Empty and deleted are the only negative control bytes
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+}
+
+#else
+
+uint32_t map_group_match(const int8_t* group, int8_t control)
+{
+    uint32_t match = 0;
+
+    for (int i = 0; i < MAP_GROUP_SIZE; i++)
+    {
+        match |= (uint32_t)(group[i] == control) << i;
+    }
+
+    return match;
+}
+
+uint32_t map_group_match_free(const int8_t* group)
+{
+    uint32_t match = 0;
+
+    for (int i = 0; i < MAP_GROUP_SIZE; i++)
+    {
+        match |= (uint32_t)(group[i] < 0) << i;
+    }
+
+    return match;
+}
+
+#endif
+
+#pragma endregion Groups
+
+uint64_t map_hash(uint8_t key_type, uint64_t key)
+{
+    uint64_t hash = key_type == NATIVE_TYPE_STRING ? string_hash(&key) : key;
+
+    // Finalizer of MurmurHash3, control bytes and positions both need well mixed bits
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+bool map_key_equal(struct ExecutionMapEntry* entry, uint8_t key_type, uint64_t key)
+{
+    if (entry->key_type != key_type)
+    {
+        return false;
+    }
+
+    return key_type == NATIVE_TYPE_STRING ? string_equal(&entry->key, &key) : entry->key == key;
+}
+
+void map_value_release(uint8_t type, uint64_t value)
+{
+    if (check_type_is_reference(type) || type == STACK_TYPE_STRUCT_INSTANCE)
+    {
+        object_deref((void*)value);
+    }
+}
+
+void map_free(const void* object_ref)
+{
+    struct ExecutionMap* map = (struct ExecutionMap*)((uint8_t*)object_ref + sizeof(struct ref));
+
+    for (uint32_t i = 0; i < map->capacity; i++)
+    {
+        if (map->control[i] >= 0)
+        {
+            map_value_release(map->entries[i].key_type, map->entries[i].key);
+            map_value_release(map->entries[i].value_type, map->entries[i].value);
+        }
+    }
+
+    free(map->control);
+    free(map->entries);
+}
+
+void map_value_trace(uint8_t type, uint64_t value, ObjectVisitor visit, void* visit_data)
+{
+    if ((check_type_is_reference(type) || type == STACK_TYPE_STRUCT_INSTANCE) && value && !(value & OBJECT_IMMEDIATE_TAG))
+    {
+        visit((void*)value, visit_data);
+    }
+}
+
+void map_trace(const void* object, ObjectVisitor visit, void* visit_data)
+{
+    // Keys and values are visited for sharing, cycle collector skips objects without trace
+    const struct ExecutionMap* map = object;
+
+    for (uint32_t i = 0; i < map->capacity; i++)
+    {
+        const struct ExecutionMapEntry* entry = &map->entries[i];
+
+        if (map->control[i] >= 0)
+        {
+            map_value_trace(entry->key_type, entry->key, visit, visit_data);
+            map_value_trace(entry->value_type, entry->value, visit, visit_data);
+        }
+    }
+}
+
+struct ExecutionMap* map_create()
+{
+    // Table is allocated by the first insert
+    struct ExecutionMap* map = object_create_traced(sizeof(struct ExecutionMap), &map_free, &map_trace);
+
+    map->capacity = 0;
+    map->count = 0;
+    map->growth_left = 0;
+    map->control = NULL;
+    map->entries = NULL;
+
+    return map;
+}
+
+bool map_key_from_value(struct ExecutionContextStackValue value, uint8_t* key_type, uint64_t* key)
+{
+    *key_type = NATIVE_TYPE_I64;
+
+    switch (value.type)
+    {
+        case NATIVE_TYPE_I8: *key = (int64_t)*(int8_t*)value.ptr; return true;
+        case NATIVE_TYPE_U8: *key = *(uint8_t*)value.ptr; return true;
+        case NATIVE_TYPE_I16: *key = (int64_t)*(int16_t*)value.ptr; return true;
+        case NATIVE_TYPE_U16: *key = *(uint16_t*)value.ptr; return true;
+        case NATIVE_TYPE_I32: *key = (int64_t)*(int32_t*)value.ptr; return true;
+        case NATIVE_TYPE_U32: *key = *(uint32_t*)value.ptr; return true;
+        case NATIVE_TYPE_I64:
+        case NATIVE_TYPE_U64: *key = *(uint64_t*)value.ptr; return true;
+        case NATIVE_TYPE_STRING: *key_type = NATIVE_TYPE_STRING; *key = *value.ptr; return true;
+    }
+
+    return false;
+}
+
+void map_set_control(struct ExecutionMap* map, uint32_t index, int8_t control)
+{
+    map->control[index] = control;
+
+    // First group is mirrored after the last byte
+    if (index < MAP_GROUP_SIZE)
+    {
+        map->control[map->capacity + index] = control;
+    }
+}
+
+uint32_t map_find_free(struct ExecutionMap* map, uint64_t hash)
+{
+    // There is always an empty slot, so probing ends
+    uint32_t mask = map->capacity - 1;
+    uint32_t position = (hash >> 7) & mask;
+
+    for (uint32_t step = MAP_GROUP_SIZE; ; step += MAP_GROUP_SIZE)
+    {
+        uint32_t match = map_group_match_free(&map->control[position]);
+
+        if (match)
+        {
+            return (position + __builtin_ctz(match)) & mask;
+        }
+
+        position = (position + step) & mask;
+    }
+}
+
+struct ExecutionMapEntry* map_find(struct ExecutionMap* map, uint8_t key_type, uint64_t key)
+{
+    if (!map->count)
+    {
+        return NULL;
+    }
+
+    uint64_t hash = map_hash(key_type, key);
+    int8_t control = hash & 0x7f;
+    uint32_t mask = map->capacity - 1;
+    uint32_t position = (hash >> 7) & mask;
+
+    // Groups are probed triangularly, which visits every group of a power of two table
+    for (uint32_t step = MAP_GROUP_SIZE; ; step += MAP_GROUP_SIZE)
+    {
+        const int8_t* group = &map->control[position];
+
+        for (uint32_t match = map_group_match(group, control); match; match &= match - 1)
+        {
+            struct ExecutionMapEntry* entry = &map->entries[(position + __builtin_ctz(match)) & mask];
+
+            if (map_key_equal(entry, key_type, key))
+            {
+                return entry;
+            }
+        }
+
+        if (map_group_match(group, MAP_CONTROL_EMPTY))
+        {
+            return NULL;
+        }
+
+        position = (position + step) & mask;
+    }
+}
+
+bool map_rebuild(struct ExecutionMap* map)
+{
+    // Grows the table or only drops deleted slots when most of them are deleted
+    uint32_t capacity = MAP_MIN_CAPACITY;
+
+    while (capacity * 7 / 8 < map->count * 3 / 2 + 1)
+    {
+        capacity *= 2;
+    }
+
+    int8_t* control = malloc(capacity + MAP_GROUP_SIZE);
+    struct ExecutionMapEntry* entries = malloc(capacity * sizeof(struct ExecutionMapEntry));
+
+    if (!control || !entries)
+    {
+        free(control);
+        free(entries);
+        return false;
+    }
+
+    memset(control, MAP_CONTROL_EMPTY, capacity + MAP_GROUP_SIZE);
+
+    struct ExecutionMap rebuilt =
+    {
+        .capacity = capacity,
+        .count = map->count,
+        .growth_left = capacity * 7 / 8 - map->count,
+        .control = control,
+        .entries = entries
+    };
+
+    for (uint32_t i = 0; i < map->capacity; i++)
+    {
+        if (map->control[i] < 0)
+        {
+            continue;
+        }
+
+        uint64_t hash = map_hash(map->entries[i].key_type, map->entries[i].key);
+        uint32_t index = map_find_free(&rebuilt, hash);
+
+        map_set_control(&rebuilt, index, hash & 0x7f);
+        rebuilt.entries[index] = map->entries[i];
+    }
+
+    free(map->control);
+    free(map->entries);
+    *map = rebuilt;
+
+    return true;
+}
+
+bool map_value_take(struct ExecutionContextStackValue value, uint64_t* stored)
+{
+    if (value.type == STACK_TYPE_STRUCT_INSTANCE)
+    {
+        // Boxed the same way as 'new' does, so the box is a regular heap instance
+        struct ExecutionContextStructDefinition* definition = *(struct ExecutionContextStructDefinition**)value.ptr;
+        uint8_t* box = object_create_traced(sizeof(definition) + definition->size, &destruct_object, &trace_object);
+
+        memcpy(box, value.ptr, sizeof(definition) + definition->size);
+        object_ref(definition);
+        copy_struct(definition, box + sizeof(definition));
+
+        *stored = (uint64_t)object_ref(box);
+        return true;
+    }
+
+    int size = get_size_of_native_type(value.type);
+
+    if (size <= 0)
+    {
+        return false;
+    }
+
+    *stored = 0;
+    memcpy(stored, value.ptr, size);
+
+    if (check_type_is_reference(value.type))
+    {
+        object_ref((void*)*stored);
+    }
+
+    return true;
+}
+
+bool map_store(struct ExecutionMap* map, uint8_t key_type, uint64_t key, struct ExecutionContextStackValue value)
+{
+    uint64_t stored;
+
+    if (!map_value_take(value, &stored))
+    {
+        return false;
+    }
+
+    if (object_is_shared(map))
+    {
+        // Other threads can reach everything stored in a shared map
+        if (key_type == NATIVE_TYPE_STRING)
+        {
+            object_share((void*)key);
+        }
+
+        if (check_type_is_reference(value.type) || value.type == STACK_TYPE_STRUCT_INSTANCE)
+        {
+            object_share((void*)stored);
+        }
+    }
+
+    struct ExecutionMapEntry* entry = map_find(map, key_type, key);
+
+    if (entry)
+    {
+        // New value is referenced first, it can be the same object
+        map_value_release(entry->value_type, entry->value);
+        entry->value = stored;
+        entry->value_type = value.type;
+
+        return true;
+    }
+
+    if (!map->growth_left && !map_rebuild(map))
+    {
+        map_value_release(value.type, stored);
+        return false;
+    }
+
+    uint64_t hash = map_hash(key_type, key);
+    uint32_t index = map_find_free(map, hash);
+
+    if (map->control[index] == MAP_CONTROL_EMPTY)
+    {
+        map->growth_left--;
+    }
+
+    map_set_control(map, index, hash & 0x7f);
+
+    entry = &map->entries[index];
+    entry->key = key;
+    entry->key_type = key_type;
+    entry->value = stored;
+    entry->value_type = value.type;
+
+    if (key_type == NATIVE_TYPE_STRING)
+    {
+        object_ref((void*)key);
+    }
+
+    map->count++;
+
+    return true;
+}
+
+bool map_remove(struct ExecutionMap* map, uint8_t key_type, uint64_t key)
+{
+    struct ExecutionMapEntry* entry = map_find(map, key_type, key);
+
+    if (!entry)
+    {
+        return false;
+    }
+
+    map_value_release(entry->key_type, entry->key);
+    map_value_release(entry->value_type, entry->value);
+
+    // Slot stays deleted, probing has to continue past it
+    map_set_control(map, entry - map->entries, MAP_CONTROL_DELETED);
+    map->count--;
+
+    return true;
+}
+
+void map_push_value(struct ExecutionContext* context, struct ExecutionMapEntry* entry)
+{
+    if (entry->value_type == STACK_TYPE_STRUCT_INSTANCE)
+    {
+        uint8_t* box = (uint8_t*)entry->value;
+
+        context_stack_push_struct_instance(context, *(struct ExecutionContextStructDefinition**)box, box + sizeof(void*));
+        return;
+    }
+
+    context_stack_push_value(
+        context,
+        (struct ExecutionContextStackValue) { .ptr = &entry->value, .type = entry->value_type, .size = get_size_of_native_type(entry->value_type) }
+    );
+}
+
+bool map_get_args(struct ExecutionContext* context, int count, struct ExecutionContextStackValue* args, uint8_t* key_type, uint64_t* key)
+{
+    // Reads exactly 'count' arguments of the native frame, a map and a key first
+    int index = context->native_frame_stack_index;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (index >= context->stack_index)
+        {
+            return false;
+        }
+
+        args[i] = context_stack_get_value_at_index(context, index);
+        index += args[i].size;
+    }
+
+    return index == context->stack_index
+        && args[0].type == STACK_TYPE_MAP
+        && *(struct ExecutionMap**)args[0].ptr
+        && map_key_from_value(args[1], key_type, key);
+}
+
+void map_push_i32(struct ExecutionContext* context, int32_t value)
+{
+    uint64_t slot = (uint32_t)value;
+
+    context_stack_push_value(
+        context,
+        (struct ExecutionContextStackValue) { .ptr = &slot, .type = NATIVE_TYPE_I32, .size = get_size_of_native_type(NATIVE_TYPE_I32) }
+    );
+}
+
+// has(map, key) -> i32 1 when the key is present
+void fts_has(struct ExecutionContext* context)
+{
+    struct ExecutionContextStackValue args[2];
+    uint8_t key_type;
+    uint64_t key;
+
+    if (!map_get_args(context, 2, args, &key_type, &key))
+    {
+        debug("ERR!: has expects a map and a key\n");
+        return;
+    }
+
+    map_push_i32(context, map_find(*(struct ExecutionMap**)args[0].ptr, key_type, key) != NULL);
+}
+
+// get(map, key, default) -> value of the key or the default
+void fts_get(struct ExecutionContext* context)
+{
+    struct ExecutionContextStackValue args[3];
+    uint8_t key_type;
+    uint64_t key;
+
+    if (!map_get_args(context, 3, args, &key_type, &key))
+    {
+        debug("ERR!: get expects a map, a key and a default value\n");
+        return;
+    }
+
+    struct ExecutionMapEntry* entry = map_find(*(struct ExecutionMap**)args[0].ptr, key_type, key);
+
+    if (entry)
+    {
+        map_push_value(context, entry);
+    }
+    else
+    {
+        context_stack_push_value(context, args[2]);
+    }
+}
+
+// remove(map, key) -> i32 1 when the key was present
+void fts_remove(struct ExecutionContext* context)
+{
+    struct ExecutionContextStackValue args[2];
+    uint8_t key_type;
+    uint64_t key;
+
+    if (!map_get_args(context, 2, args, &key_type, &key))
+    {
+        debug("ERR!: remove expects a map and a key\n");
+        return;
+    }
+
+    map_push_i32(context, map_remove(*(struct ExecutionMap**)args[0].ptr, key_type, key));
+}
+
+#pragma endregion --- MAP ---
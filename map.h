@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "context.h"
+
+#pragma region --- MAP ---
+
+// Control bytes checked by one probe step, a group is compared with one SSE2
+// instruction when MAP_SIMD_PROBING is enabled
+#define MAP_GROUP_SIZE 16
+#define MAP_MIN_CAPACITY 16
+
+// Control byte of a slot, full slots store 7 low bits of the key hash
+enum ExecutionMapControl
+{
+    MAP_CONTROL_EMPTY = -128,
+    MAP_CONTROL_DELETED = -2,
+};
+
+// Integer keys of any width are stored as 64 bit values, string keys as string slots
+struct ExecutionMapEntry
+{
+    uint64_t key;
+    // single slot values are stored as they are, struct instances are boxed
+    // into heap instances like 'new' creates
+    uint64_t value;
+    uint8_t key_type;
+    uint8_t value_type;
+};
+
+// Open addressing hash map with SwissTable layout: control bytes are separate from
+// entries and the first group is mirrored after the last byte, so a group can be
+// loaded from any position. Capacity is a power of two.
+struct ExecutionMap
+{
+    uint32_t capacity;
+    uint32_t count;
+    // inserts into empty slots left before the table is rebuilt
+    uint32_t growth_left;
+    int8_t* control;
+    struct ExecutionMapEntry* entries;
+};
+
+struct ExecutionMap* map_create();
+
+// Integers and strings can be keys
+bool map_key_from_value(struct ExecutionContextStackValue value, uint8_t* key_type, uint64_t* key);
+
+struct ExecutionMapEntry* map_find(struct ExecutionMap* map, uint8_t key_type, uint64_t key);
+
+// Takes references of the key and the value, replaced value is released
+bool map_store(struct ExecutionMap* map, uint8_t key_type, uint64_t key, struct ExecutionContextStackValue value);
+
+bool map_remove(struct ExecutionMap* map, uint8_t key_type, uint64_t key);
+
+// Pushes a copy of the entry value
+void map_push_value(struct ExecutionContext* context, struct ExecutionMapEntry* entry);
+
+void fts_has(struct ExecutionContext* context);
+void fts_get(struct ExecutionContext* context);
+void fts_remove(struct ExecutionContext* context);
+
+#pragma endregion --- MAP ---
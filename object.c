@@ -2,43 +2,771 @@
 
 #include <stdint.h>
 #include <malloc.h>
+#include <string.h>
+
+#include "debug.h"
+
+// Record of the calling thread, created by its first allocation and never freed, 
+// other threads can queue objects into it even after the thread exited
+_Thread_local struct ObjectThread* object_thread;
+// Owner of objects whose count was merged, no thread counts them without atomics
+struct ObjectThread object_thread_merged;
+// Records of all threads, keeps them reachable
+_Atomic(struct ObjectThread*) object_threads;
+
+// Cycle collector state, every thread collects only objects it owns
+_Thread_local struct ref** collector_roots;
+_Thread_local int collector_root_count;
+_Thread_local int collector_root_capacity;
+_Thread_local size_t collector_allocated;
+_Thread_local bool collector_running;
+
+void collector_possible_root(struct ref* object_ref);
+void collector_unbuffer(struct ref* object_ref);
+
+struct ObjectThread* object_thread_id()
+{
+    return object_thread;
+}
+
+void object_thread_register()
+{
+    struct ObjectThread* thread = malloc(sizeof(struct ObjectThread));
+
+    atomic_init(&thread->merge_queue, NULL);
+    thread->next = atomic_load_explicit(&object_threads, memory_order_relaxed);
+
+    while (!atomic_compare_exchange_weak_explicit(&object_threads, &thread->next, thread, memory_order_release, memory_order_relaxed));
+
+    object_thread = thread;
+}
+
+struct ref* object_get_ref(void* object)
+{
+    return (struct ref*)(((uint8_t*)object) - sizeof(struct ref));
+}
+
+void* object_get_object(struct ref* object_ref)
+{
+    return ((uint8_t*)object_ref) + sizeof(struct ref);
+}
+
+uint8_t object_get_flags(struct ref* object_ref)
+{
+    // Flags are only changed by the owner, other threads can read them at any time
+    return atomic_load_explicit(&object_ref->flags, memory_order_relaxed);
+}
+
+void object_set_flags(struct ref* object_ref, uint8_t flags)
+{
+    atomic_fetch_or_explicit(&object_ref->flags, flags, memory_order_relaxed);
+}
+
+void object_clear_flags(struct ref* object_ref, uint8_t flags)
+{
+    atomic_fetch_and_explicit(&object_ref->flags, (uint8_t)~flags, memory_order_relaxed);
+}
+
+void object_free(struct ref* object_ref)
+{
+    if (object_ref->free && !(object_get_flags(object_ref) & REF_FLAG_RELEASED))
+    {
+        object_ref->free(object_ref);
+    }
+
+    free(object_ref);
+}
+
+void object_release(struct ref* object_ref)
+{
+    if (object_get_flags(object_ref) & REF_FLAG_BUFFERED)
+    {
+        // Root buffer still points to the object, only references held by it are 
+        // released now, memory is freed when the collector drops it from the buffer
+        if (!(object_get_flags(object_ref) & REF_FLAG_RELEASED))
+        {
+            object_set_flags(object_ref, REF_FLAG_RELEASED);
+            object_ref->color = REF_COLOR_BLACK;
+
+            if (object_ref->free)
+            {
+                object_ref->free(object_ref);
+            }
+        }
+
+        return;
+    }
+
+    object_free(object_ref);
+}
 
 void* object_create(size_t type_size)
 {
+    if (!object_thread)
+    {
+        object_thread_register();
+    }
+
+    collector_allocated += type_size;
+
+    if (!collector_running && (
+        collector_allocated >= OBJECT_COLLECT_ALLOCATION_THRESHOLD ||
+        collector_root_count >= OBJECT_COLLECT_ROOTS_THRESHOLD
+    )) {
+        // Allocation is a safe point, nothing half constructed is referenced yet
+        collector_allocated = 0;
+        object_collect_cycles_step(OBJECT_COLLECT_STEP_ROOTS);
+    }
+
+    if (atomic_load_explicit(&object_thread->merge_queue, memory_order_relaxed))
+    {
+        object_merge_queued();
+    }
+
     void* object = malloc(type_size + sizeof(struct ref));
     struct ref* object_ref = (struct ref*)(object);
 
     object_ref->count = 0;
     object_ref->free = 0;
+    object_ref->trace = 0;
+    object_ref->color = REF_COLOR_BLACK;
+    object_ref->merge_next = NULL;
+    atomic_init(&object_ref->flags, REF_FLAG_NONE);
+    atomic_init(&object_ref->owner, object_thread);
+    atomic_init(&object_ref->shared, 0);
 
     return ((uint8_t*)object) + sizeof(struct ref);
 }
 
+void* object_create_with_free(size_t type_size, void (*free)(const void* object))
+{
+    // free is called with the reference header before the memory is released
+    void* object = object_create(type_size);
+    object_get_ref(object)->free = free;
+
+    return object;
+}
+
+void* object_create_traced(
+    size_t type_size, 
+    void (*free)(const void* object), 
+    void (*trace)(const void* object, ObjectVisitor visit, void* data)
+) {
+    // trace is called with the object, it has to visit all object references it holds
+    void* object = object_create_with_free(type_size, free);
+    object_get_ref(object)->trace = trace;
+
+    return object;
+}
+
 void* object_ref(void* object)
 {
-    if (!object) 
+    // immediate values own nothing, see OBJECT_IMMEDIATE_TAG
+    if (!object || ((uintptr_t)object & OBJECT_IMMEDIATE_TAG)) 
     {
-        return NULL;
+        return object;
     }
 
-    struct ref* object_ref = (void*)(((uint8_t*)object) - sizeof(struct ref));
+    struct ref* object_ref = object_get_ref(object);
 
-    ++object_ref->count;
+    // Owner is only changed by the owner thread itself, so relaxed load is enough
+    if (atomic_load_explicit(&object_ref->owner, memory_order_relaxed) == object_thread_id())
+    {
+        ++object_ref->count;
+        object_ref->color = REF_COLOR_BLACK;
+        return object;
+    }
+
+    #ifdef TOKEN_DEBUG
+    if (!(object_get_flags(object_ref) & REF_FLAG_SHARED))
+    {
+        debug("ERR!: Object %p referenced from other thread without being shared\n", object);
+    }
+    #endif
+
+    atomic_fetch_add_explicit(&object_ref->shared, REF_SHARED_ONE, memory_order_relaxed);
 
     return object;
 }
 
+void object_queue_merge(struct ref* object_ref, struct ObjectThread* owner)
+{
+    struct ref* head = atomic_load_explicit(&owner->merge_queue, memory_order_relaxed);
+
+    do
+    {
+        object_ref->merge_next = head;
+    }
+    while (!atomic_compare_exchange_weak_explicit(&owner->merge_queue, &head, object_ref, memory_order_release, memory_order_relaxed));
+}
+
 void object_deref(void* object)
 {
-    struct ref* object_ref = (void*)(((uint8_t*)object) - sizeof(struct ref));
+    if (!object || ((uintptr_t)object & OBJECT_IMMEDIATE_TAG)) 
+    {
+        return;
+    }
+
+    struct ref* object_ref = object_get_ref(object);
+    struct ObjectThread* owner = atomic_load_explicit(&object_ref->owner, memory_order_relaxed);
+
+    if (owner == object_thread_id())
+    {
+        if (--object_ref->count != 0)
+        {
+            if (object_ref->trace && !(object_get_flags(object_ref) & REF_FLAG_SHARED))
+            {
+                // Remaining references can come from a cycle
+                collector_possible_root(object_ref);
+            }
+
+            return;
+        }
+
+        if (!(object_get_flags(object_ref) & REF_FLAG_SHARED))
+        {
+            // Never shared, no other thread can have a reference
+            object_release(object_ref);
+            return;
+        }
+
+        // Owner dropped its last reference, from now on the shared counter decides 
+        // and owner thread has to use it as well
+        atomic_store_explicit(&object_ref->owner, &object_thread_merged, memory_order_relaxed);
+
+        int shared = atomic_fetch_or_explicit(&object_ref->shared, REF_SHARED_MERGED, memory_order_acq_rel) | REF_SHARED_MERGED;
+
+        // Queued object is freed by the owner when it takes it from the queue
+        if (shared == REF_SHARED_MERGED)
+        {
+            object_free(object_ref);
+        }
+
+        return;
+    }
+
+    int shared = atomic_load_explicit(&object_ref->shared, memory_order_relaxed);
+    int released;
+
+    // Counter goes below zero by releasing references taken by the owner, object can 
+    // be dead but only the owner knows, so it is queued for the owner to merge its count. 
+    // Queued bit is set together with the decrement, owner does not free it meanwhile. 
+    // When the owner is already merging, its result includes this decrement.
+    do
+    {
+        released = shared - REF_SHARED_ONE;
+
+        if (released < 0 && !(released & (REF_SHARED_QUEUED | REF_SHARED_MERGED)) && owner != &object_thread_merged)
+        {
+            released |= REF_SHARED_QUEUED;
+        }
+    }
+    while (!atomic_compare_exchange_weak_explicit(&object_ref->shared, &shared, released, memory_order_acq_rel, memory_order_relaxed));
+
+    if (released == REF_SHARED_MERGED)
+    {
+        object_free(object_ref);
+    }
+    else if ((released & REF_SHARED_QUEUED) && !(shared & REF_SHARED_QUEUED))
+    {
+        object_queue_merge(object_ref, owner);
+    }
+}
+
+void object_merge_queued()
+{
+    struct ObjectThread* thread = object_thread_id();
+
+    if (!thread)
+    {
+        return;
+    }
+
+    struct ref* object_ref = atomic_exchange_explicit(&thread->merge_queue, NULL, memory_order_acquire);
+
+    while (object_ref)
+    {
+        struct ref* next = object_ref->merge_next;
+        int shared;
+
+        if (atomic_load_explicit(&object_ref->owner, memory_order_relaxed) == thread)
+        {
+            // Owner count moves to the shared counter, every thread uses it from now on
+            int merged = object_ref->count * REF_SHARED_ONE + REF_SHARED_MERGED - REF_SHARED_QUEUED;
+
+            object_ref->count = 0;
+            atomic_store_explicit(&object_ref->owner, &object_thread_merged, memory_order_relaxed);
+
+            shared = atomic_fetch_add_explicit(&object_ref->shared, merged, memory_order_acq_rel) + merged;
+        }
+        else 
+        {
+            // Owner dropped its references while the object waited in the queue
+            shared = atomic_fetch_sub_explicit(&object_ref->shared, REF_SHARED_QUEUED, memory_order_acq_rel) - REF_SHARED_QUEUED;
+        }
+
+        if (shared == REF_SHARED_MERGED)
+        {
+            object_free(object_ref);
+        }
+
+        object_ref = next;
+    }
+}
+
+struct ObjectShareWork
+{
+    void** objects;
+    int count;
+    int capacity;
+};
+
+void object_share_visit(void* child, void* data)
+{
+    struct ObjectShareWork* work = data;
+
+    // Objects reachable from shared ones are shared already, and only those can be 
+    // owned by other threads
+    if (!child || ((uintptr_t)child & OBJECT_IMMEDIATE_TAG) || (object_get_flags(object_get_ref(child)) & REF_FLAG_SHARED))
+    {
+        return;
+    }
+
+    if (work->count == work->capacity)
+    {
+        int capacity = work->capacity ? work->capacity * 2 : 16;
+        void** objects = realloc(work->objects, capacity * sizeof(void*));
+
+        if (!objects)
+        {
+            debug("ERR!: Object %p cannot be shared, out of memory\n", child);
+            return;
+        }
+
+        work->objects = objects;
+        work->capacity = capacity;
+    }
 
-    if (--object_ref->count == 0)
+    work->objects[work->count++] = child;
+}
+
+void object_share_work(struct ObjectShareWork* work)
+{
+    // Graph is walked with an explicit stack, long chains do not grow the native one
+    while (work->count > 0)
     {
+        struct ref* object_ref = object_get_ref(work->objects[--work->count]);
+
+        if (object_get_flags(object_ref) & REF_FLAG_SHARED)
+        {
+            continue;
+        }
+
+        object_set_flags(object_ref, REF_FLAG_SHARED);
+
+        if (object_get_flags(object_ref) & REF_FLAG_BUFFERED)
+        {
+            // Shared objects are freed by the last thread, so buffer can not keep them
+            collector_unbuffer(object_ref);
+        }
+
+        if (object_ref->trace)
+        {
+            object_ref->trace(object_get_object(object_ref), &object_share_visit, work);
+        }
+    }
+
+    free(work->objects);
+}
+
+void* object_share(void* object)
+{
+    // Has to be called by the owner before the object is published to other 
+    // threads, publishing provides the ordering for the flags
+    struct ObjectShareWork work = { .objects = NULL, .count = 0, .capacity = 0 };
+
+    object_share_visit(object, &work);
+    object_share_work(&work);
+
+    return object;
+}
+
+void object_share_references(void* object)
+{
+    struct ref* object_ref = object_get_ref(object);
+    struct ObjectShareWork work = { .objects = NULL, .count = 0, .capacity = 0 };
+
+    if (object_ref->trace)
+    {
+        object_ref->trace(object, &object_share_visit, &work);
+    }
+
+    object_share_work(&work);
+}
+
+bool object_is_shared(void* object)
+{
+    return object && !((uintptr_t)object & OBJECT_IMMEDIATE_TAG) && (object_get_flags(object_get_ref(object)) & REF_FLAG_SHARED);
+}
+
+#pragma region --- CYCLE COLLECTOR ---
+
+void collector_possible_root(struct ref* object_ref)
+{
+    if (collector_running)
+    {
+        return;
+    }
+
+    object_ref->color = REF_COLOR_PURPLE;
+
+    if (object_get_flags(object_ref) & REF_FLAG_BUFFERED)
+    {
+        return;
+    }
+
+    if (collector_root_count == collector_root_capacity)
+    {
+        int capacity = collector_root_capacity ? collector_root_capacity * 2 : 64;
+        struct ref** roots = realloc(collector_roots, capacity * sizeof(struct ref*));
+
+        if (!roots)
+        {
+            // Not buffered objects are still freed by reference counting
+            return;
+        }
+
+        collector_roots = roots;
+        collector_root_capacity = capacity;
+    }
+
+    object_set_flags(object_ref, REF_FLAG_BUFFERED);
+    collector_roots[collector_root_count++] = object_ref;
+}
+
+void collector_unbuffer(struct ref* object_ref)
+{
+    for (int i = collector_root_count - 1; i >= 0; i--)
+    {
+        if (collector_roots[i] == object_ref)
+        {
+            memmove(&collector_roots[i], &collector_roots[i + 1], (collector_root_count - i - 1) * sizeof(struct ref*));
+            collector_root_count--;
+            break;
+        }
+    }
+
+    object_clear_flags(object_ref, REF_FLAG_BUFFERED);
+}
+
+bool collector_is_local(struct ref* object_ref)
+{
+    // Shared objects can be referenced from other threads, they are never collected 
+    // and references to them are treated as external
+    return object_ref->trace 
+        && !(object_get_flags(object_ref) & (REF_FLAG_SHARED | REF_FLAG_RELEASED))
+        && atomic_load_explicit(&object_ref->owner, memory_order_relaxed) == object_thread_id();
+}
+
+struct CollectorList
+{
+    struct ref** objects;
+    int count;
+    int capacity;
+};
+
+bool collector_list_push(struct CollectorList* list, struct ref* object_ref)
+{
+    if (list->count == list->capacity)
+    {
+        int capacity = list->capacity ? list->capacity * 2 : 16;
+        struct ref** objects = realloc(list->objects, capacity * sizeof(struct ref*));
+
+        if (!objects)
+        {
+            return false;
+        }
+
+        list->objects = objects;
+        list->capacity = capacity;
+    }
+
+    list->objects[list->count++] = object_ref;
+    return true;
+}
+
+struct CollectorGather
+{
+    struct CollectorList* nodes;
+    bool failed;
+};
+
+void collector_gather_child(void* child, void* data)
+{
+    struct CollectorGather* gather = data;
+    struct ref* child_ref = object_get_ref(child);
+
+    if (collector_is_local(child_ref) && child_ref->color != REF_COLOR_GRAY)
+    {
+        child_ref->color = REF_COLOR_GRAY;
+
+        if (!collector_list_push(gather->nodes, child_ref))
+        {
+            gather->failed = true;
+        }
+    }
+}
+
+void collector_mark_gray_child(void* child, void* data)
+{
+    (void)data;
+
+    struct ref* child_ref = object_get_ref(child);
+
+    if (collector_is_local(child_ref))
+    {
+        // trial deletion of the internal reference
+        child_ref->count--;
+    }
+}
+
+void collector_scan_black_child(void* child, void* data)
+{
+    struct CollectorList* stack = data;
+    struct ref* child_ref = object_get_ref(child);
+
+    if (collector_is_local(child_ref))
+    {
+        // restore reference deleted by mark gray
+        child_ref->count++;
+
+        if (child_ref->color != REF_COLOR_BLACK)
+        {
+            // every node turns black once, so the stack never outgrows the subgraph
+            child_ref->color = REF_COLOR_BLACK;
+            stack->objects[stack->count++] = child_ref;
+        }
+    }
+}
+
+void collector_scan_black(struct ref* object_ref, struct CollectorList* stack)
+{
+    object_ref->color = REF_COLOR_BLACK;
+    stack->objects[stack->count++] = object_ref;
+
+    while (stack->count > 0)
+    {
+        struct ref* node = stack->objects[--stack->count];
+        node->trace(object_get_object(node), &collector_scan_black_child, stack);
+    }
+}
+
+void collector_restore_child(void* child, void* data)
+{
+    (void)data;
+
+    struct ref* child_ref = object_get_ref(child);
+
+    if (collector_is_local(child_ref))
+    {
+        child_ref->count++;
+    }
+}
+
+void collector_free_garbage(struct CollectorList* garbage)
+{
+    // Counts of objects referenced by garbage are restored first, so free hooks can 
+    // release references the usual way. Garbage is held by the collector while hooks 
+    // run, so none of it is freed from inside a hook.
+    for (int i = 0; i < garbage->count; i++)
+    {
+        struct ref* object_ref = garbage->objects[i];
+        object_ref->trace(object_get_object(object_ref), &collector_restore_child, NULL);
+    }
+
+    for (int i = 0; i < garbage->count; i++)
+    {
+        garbage->objects[i]->count++;
+    }
+
+    for (int i = 0; i < garbage->count; i++)
+    {
+        struct ref* object_ref = garbage->objects[i];
+        object_set_flags(object_ref, REF_FLAG_RELEASED);
+
         if (object_ref->free)
         {
             object_ref->free(object_ref);
         }
+    }
+
+    for (int i = 0; i < garbage->count; i++)
+    {
+        // Roots buffered outside of the step are freed when the buffer drops them
+        if (!(object_get_flags(garbage->objects[i]) & REF_FLAG_BUFFERED))
+        {
+            free(garbage->objects[i]);
+        }
+    }
+}
+
+bool collector_gather(struct ref** roots, int count, struct CollectorList* nodes)
+{
+    // Subgraph of local objects reachable from the roots, the list itself is 
+    // the queue of the walk, so its depth does not use the native stack
+    struct CollectorGather gather = { .nodes = nodes, .failed = false };
+
+    for (int i = 0; i < count; i++)
+    {
+        if (roots[i] && roots[i]->color != REF_COLOR_GRAY)
+        {
+            roots[i]->color = REF_COLOR_GRAY;
+            gather.failed |= !collector_list_push(nodes, roots[i]);
+        }
+    }
 
-        free(object);
+    for (int i = 0; i < nodes->count && !gather.failed; i++)
+    {
+        nodes->objects[i]->trace(object_get_object(nodes->objects[i]), &collector_gather_child, &gather);
     }
-}
\ No newline at end of file
+
+    return !gather.failed;
+}
+
+void object_collect_cycles_step(int max_roots)
+{
+    if (collector_running || collector_root_count == 0)
+    {
+        return;
+    }
+
+    collector_running = true;
+
+    // Roots are taken from the end, buffer does not change while the step runs
+    int count = collector_root_count < max_roots ? collector_root_count : max_roots;
+    struct ref** roots = &collector_roots[collector_root_count - count];
+
+    // Roots which are not candidates anymore are dropped
+    for (int i = 0; i < count; i++)
+    {
+        struct ref* root = roots[i];
+
+        if (root->color == REF_COLOR_PURPLE && root->count > 0 && collector_is_local(root))
+        {
+            continue;
+        }
+
+        object_clear_flags(root, REF_FLAG_BUFFERED);
+        roots[i] = NULL;
+
+        if (object_get_flags(root) & REF_FLAG_RELEASED)
+        {
+            // count reached zero while buffered, memory was kept for the buffer
+            free(root);
+        }
+    }
+
+    // Every node is visited through explicit lists, deep chains do not grow the native 
+    // stack. Stack for scan black is allocated before any count changes, so running 
+    // out of memory leaves the graph untouched and the roots for a later step.
+    struct CollectorList nodes = { .objects = NULL, .count = 0, .capacity = 0 };
+    struct CollectorList stack = { .objects = NULL, .count = 0, .capacity = 0 };
+    bool gathered = collector_gather(roots, count, &nodes);
+
+    if (gathered && nodes.count > 0)
+    {
+        stack.objects = malloc(nodes.count * sizeof(struct ref*));
+        stack.capacity = nodes.count;
+    }
+
+    if (!gathered || (nodes.count > 0 && !stack.objects))
+    {
+        debug("ERR!: Cycle collection step skipped, out of memory\n");
+
+        for (int i = 0; i < nodes.count; i++)
+        {
+            nodes.objects[i]->color = REF_COLOR_BLACK;
+        }
+
+        int kept = 0;
+
+        for (int i = 0; i < count; i++)
+        {
+            if (roots[i])
+            {
+                roots[i]->color = REF_COLOR_PURPLE;
+                roots[kept++] = roots[i];
+            }
+        }
+
+        collector_root_count -= count - kept;
+        free(nodes.objects);
+        collector_running = false;
+        return;
+    }
+
+    // Mark gray, internal references are deleted on trial
+    for (int i = 0; i < nodes.count; i++)
+    {
+        nodes.objects[i]->trace(object_get_object(nodes.objects[i]), &collector_mark_gray_child, NULL);
+    }
+
+    // Scan, nodes still referenced from outside of the subgraph and everything 
+    // they reach are in use
+    for (int i = 0; i < nodes.count; i++)
+    {
+        if (nodes.objects[i]->color == REF_COLOR_GRAY && nodes.objects[i]->count > 0)
+        {
+            collector_scan_black(nodes.objects[i], &stack);
+        }
+    }
+
+    free(stack.objects);
+
+    for (int i = 0; i < count; i++)
+    {
+        if (roots[i])
+        {
+            object_clear_flags(roots[i], REF_FLAG_BUFFERED);
+        }
+    }
+
+    // Collect white, nodes left gray are members of garbage cycles
+    struct CollectorList garbage = { .objects = nodes.objects, .count = 0, .capacity = nodes.capacity };
+
+    for (int i = 0; i < nodes.count; i++)
+    {
+        if (nodes.objects[i]->color == REF_COLOR_GRAY)
+        {
+            nodes.objects[i]->color = REF_COLOR_BLACK;
+            garbage.objects[garbage.count++] = nodes.objects[i];
+        }
+    }
+
+    #ifdef TOKEN_DEBUG
+        debug("Cycle collection step (roots: %d, garbage: %d)\n", count, garbage.count);
+    #endif
+
+    collector_free_garbage(&garbage);
+    free(garbage.objects);
+
+    collector_root_count -= count;
+    collector_running = false;
+}
+
+void object_collect_cycles()
+{
+    // Merged first, objects freed by it can leave new candidate roots
+    object_merge_queued();
+
+    while (collector_root_count > 0)
+    {
+        object_collect_cycles_step(OBJECT_COLLECT_STEP_ROOTS);
+    }
+
+    free(collector_roots);
+    collector_roots = NULL;
+    collector_root_capacity = 0;
+}
+
+#pragma endregion --- CYCLE COLLECTOR ---
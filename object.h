@@ -1,12 +1,103 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
 
+// Bit set in the shared counter after owner count was merged into it
+#define REF_SHARED_MERGED 0x1
+// Bit set in the shared counter while the object waits in the merge queue of its owner
+#define REF_SHARED_QUEUED 0x2
+// Shared counter keeps the count shifted left to make room for the flags
+#define REF_SHARED_ONE 0x4
+
+// Slots of reference types can hold immediate values instead of an address, e.g. short
+// strings, they are tagged by the low bit which object addresses never have
+#define OBJECT_IMMEDIATE_TAG 0x1
+
+// Allocated bytes on a thread after which a cycle collection step runs
+#define OBJECT_COLLECT_ALLOCATION_THRESHOLD (64 * 1024)
+// Buffered candidate roots after which every allocation runs a step
+#define OBJECT_COLLECT_ROOTS_THRESHOLD 1024
+// Candidate roots processed by one collection step, bounds the pause
+#define OBJECT_COLLECT_STEP_ROOTS 32
+
+enum RefFlags
+{
+    REF_FLAG_NONE = 0x0,
+    // Object can be referenced from threads other than the owner
+    REF_FLAG_SHARED = 0x1,
+    // Object is in the cycle collector root buffer
+    REF_FLAG_BUFFERED = 0x2,
+    // Free hook already released references held by the object
+    REF_FLAG_RELEASED = 0x4,
+};
+
+// Cycle collector colors, see object_collect_cycles_step
+enum RefColor
+{
+    // in use or free
+    REF_COLOR_BLACK,
+    // visited by a collection step, member of a garbage cycle when it stays gray after scan
+    REF_COLOR_GRAY,
+    // possible root of a cycle
+    REF_COLOR_PURPLE,
+};
+
+typedef void (*ObjectVisitor)(void* child, void* data);
+
+// Thread which owns objects, other threads queue objects whose shared count went
+// below zero, the owner merges its count into the shared one at its next safe point
+struct ObjectThread {
+    _Atomic(struct ref*) merge_queue;
+    struct ObjectThread* next;
+};
+
+// Biased reference count, thread which created the object counts its references
+// without atomics, other threads use atomic shared counter. Object is freed when
+// both counters drop to zero.
 struct ref {
     void (*free)(const void* object);
+    // owner thread references
     int count;
+    // see RefFlags, owner changes them while other threads read them
+    _Atomic(uint8_t) flags;
+    // see object_thread_id, object_thread_merged after references were merged
+    _Atomic(struct ObjectThread*) owner;
+    // other threads references (count * REF_SHARED_ONE | REF_SHARED_QUEUED | REF_SHARED_MERGED)
+    atomic_int shared;
+    // next object in the merge queue of the owner
+    struct ref* merge_next;
+    // optional, visits all references to other objects, objects with it take part in cycle collection
+    void (*trace)(const void* object, ObjectVisitor visit, void* data);
+    // see RefColor
+    uint8_t color;
 };
 
+struct ObjectThread* object_thread_id();
+
 void* object_create(size_t type_size);
+void* object_create_with_free(size_t type_size, void (*free)(const void* object));
+void* object_create_traced(
+    size_t type_size, 
+    void (*free)(const void* object), 
+    void (*trace)(const void* object, ObjectVisitor visit, void* data)
+);
 void* object_ref(void* object);
-void object_deref(void* object);
\ No newline at end of file
+void object_deref(void* object);
+// Marks the object and every object reachable from it as shared, has to be called by 
+// the owner before the object is published to other threads
+void* object_share(void* object);
+// Shares objects referenced by an already shared object, called after a store into it
+void object_share_references(void* object);
+bool object_is_shared(void* object);
+// Merges counts of owned objects released by other threads, runs on allocation as well
+void object_merge_queued();
+
+// Synchronous cycle collection (trial deletion) of objects owned by the calling thread.
+// Objects whose count dropped but not to zero are buffered as candidate roots, one step 
+// processes at most max_roots of them. Steps also run automatically based on allocation volume.
+void object_collect_cycles_step(int max_roots);
+// Processes all candidate roots and queued objects, releases the root buffer of the calling thread
+void object_collect_cycles();
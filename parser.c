@@ -1,9 +1,19 @@
-#include "context.h"
+#include "parser.h"
 
 #include <ctype.h>
 
 #pragma region --- PARSER ---
 
+bool parse_is_identifier_start(char c)
+{
+    return isalpha(c) || c == '_';
+}
+
+bool parse_is_identifier_char(char c)
+{
+    return isalpha(c) || isdigit(c) || c == '_';
+}
+
 int parse_identifier(struct ExecutionContext* context, char* buffer, int max_len)
 {
     const char* source = &context->code[context->position];
@@ -11,7 +21,7 @@ int parse_identifier(struct ExecutionContext* context, char* buffer, int max_len
     char* destination_end = destination + max_len;
 
     while (
-        (isalpha(*source) || isdigit(*source)) 
+        parse_is_identifier_char(*source) 
         && !context_eof(context) 
         && destination < destination_end - 1
     ) {
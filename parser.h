@@ -1,3 +1,12 @@
 #pragma once
 
+#include <stdbool.h>
+
+#include "context.h"
+
+// Identifier rules shared by the interpreter and every pass scanning the code, 
+// so all of them split the code into the same identifiers
+bool parse_is_identifier_start(char c);
+bool parse_is_identifier_char(char c);
+
 int parse_identifier(struct ExecutionContext* context, char* buffer, int max_len);
@@ -0,0 +1,245 @@
+#include "pool.h"
+
+#include <stdlib.h>
+
+#include "executor.h"
+#include "debug.h"
+
+#pragma region --- POOL ---
+
+struct ExecutionPoolTask* exec_pool_take_task(struct ExecutionPool* pool)
+{
+    // pool mutex has to be locked
+    struct ExecutionPoolTask* task = pool->head;
+
+    if (task)
+    {
+        pool->head = task->next;
+
+        if (!pool->head)
+        {
+            pool->tail = NULL;
+        }
+
+        task->next = NULL;
+    }
+
+    return task;
+}
+
+void exec_pool_run_task(struct ExecutionContext* context, struct ExecutionRegistry* registry, struct ExecutionPoolTask* task)
+{
+    if (task->script)
+    {
+        exec_context_init_script(context, task->script);
+    }
+    else
+    {
+        exec_context_init(context, registry, task->code);
+    }
+
+    context_set_fuel(context, task->fuel, NULL, NULL);
+
+    // Values returned by the script block are left above registered globals
+    int result_stack_index = context->stack_index;
+
+    task->state = exec_context_run(context);
+    task->result_type = NATIVE_TYPE_VOID;
+    task->result = 0;
+
+    if (context->stack_index > result_stack_index)
+    {
+        struct ExecutionContextStackValue value = context_stack_get_last_value(context);
+
+        // Only numeric values can outlive the context, references, pointers and struct 
+        // instances are released with the rest of the stack below
+        if (value.size == 1 && value.type >= NATIVE_TYPE_I8 && value.type <= NATIVE_TYPE_DOUBLE)
+        {
+            task->result_type = value.type;
+            task->result = *value.ptr;
+        }
+    }
+
+    // Worker context is reused for the next task, nothing of this one may stay
+    exec_context_release(context);
+}
+
+void* exec_pool_worker(void* data)
+{
+    struct ExecutionPool* pool = data;
+
+    // Every worker owns its own context, only the code and the registry 
+    // are shared with other workers
+    struct ExecutionContext* context = malloc(sizeof(struct ExecutionContext));
+
+    if (!context)
+    {
+        debug("ERR!: Cannot allocate worker context\n");
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+
+    while (true)
+    {
+        while (!pool->head && !pool->stopping)
+        {
+            pthread_cond_wait(&pool->task_available, &pool->mutex);
+        }
+
+        struct ExecutionPoolTask* task = exec_pool_take_task(pool);
+
+        if (!task)
+        {
+            // stopping and all queued tasks were processed
+            break;
+        }
+
+        pthread_mutex_unlock(&pool->mutex);
+
+        exec_pool_run_task(context, pool->registry, task);
+
+        pthread_mutex_lock(&pool->mutex);
+
+        task->done = true;
+        pthread_cond_broadcast(&pool->task_done);
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    free(context);
+
+    // Cycles left by this thread can not be collected by any other one
+    object_collect_cycles();
+    return NULL;
+}
+
+struct ExecutionPool* exec_pool_create(struct ExecutionRegistry* registry, int thread_count)
+{
+    if (thread_count <= 0)
+    {
+        debug("ERR!: Pool needs at least one thread\n");
+        return NULL;
+    }
+
+    struct ExecutionPool* pool = malloc(sizeof(struct ExecutionPool));
+
+    if (!pool)
+    {
+        debug("ERR!: Cannot allocate pool\n");
+        return NULL;
+    }
+
+    pool->threads = malloc(sizeof(pthread_t) * thread_count);
+
+    if (!pool->threads)
+    {
+        debug("ERR!: Cannot allocate pool threads\n");
+        free(pool);
+        return NULL;
+    }
+
+    pool->registry = registry;
+    pool->thread_count = 0;
+    pool->head = NULL;
+    pool->tail = NULL;
+    pool->stopping = false;
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->task_available, NULL);
+    pthread_cond_init(&pool->task_done, NULL);
+
+    for (int i = 0; i < thread_count; i++)
+    {
+        if (pthread_create(&pool->threads[i], NULL, &exec_pool_worker, pool) != 0)
+        {
+            debug("ERR!: Cannot create worker thread %d\n", i);
+            break;
+        }
+
+        pool->thread_count++;
+    }
+
+    if (pool->thread_count == 0)
+    {
+        exec_pool_destroy(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+void exec_pool_destroy(struct ExecutionPool* pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->task_available);
+    pthread_mutex_unlock(&pool->mutex);
+
+    // Workers drain the queue before exiting
+    for (int i = 0; i < pool->thread_count; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->task_done);
+    pthread_cond_destroy(&pool->task_available);
+    pthread_mutex_destroy(&pool->mutex);
+
+    free(pool->threads);
+    free(pool);
+}
+
+void exec_pool_task_init(struct ExecutionPoolTask* task, const char* code, int64_t fuel)
+{
+    task->code = code;
+    task->script = NULL;
+    task->fuel = fuel > 0 ? fuel : INT64_MAX;
+    task->state = EXECUTION_CONTEXT_STATE_RUNNING;
+    task->result_type = NATIVE_TYPE_VOID;
+    task->result = 0;
+    task->done = false;
+    task->next = NULL;
+}
+
+void exec_pool_task_init_script(struct ExecutionPoolTask* task, struct ExecutionScript* script, int64_t fuel)
+{
+    exec_pool_task_init(task, script->code, fuel);
+    task->script = script;
+}
+
+void exec_pool_submit(struct ExecutionPool* pool, struct ExecutionPoolTask* task)
+{
+    pthread_mutex_lock(&pool->mutex);
+
+    task->done = false;
+    task->next = NULL;
+
+    if (pool->tail)
+    {
+        pool->tail->next = task;
+    }
+    else
+    {
+        pool->head = task;
+    }
+
+    pool->tail = task;
+
+    pthread_cond_signal(&pool->task_available);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void exec_pool_wait(struct ExecutionPool* pool, struct ExecutionPoolTask* task)
+{
+    pthread_mutex_lock(&pool->mutex);
+
+    while (!task->done)
+    {
+        pthread_cond_wait(&pool->task_done, &pool->mutex);
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+#pragma endregion --- POOL ---
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <pthread.h>
+
+#include "context.h"
+
+#pragma region --- POOL ---
+
+// Single script invocation submitted to the pool, memory is owned by the caller
+// and must stay valid until exec_pool_wait returns for it
+struct ExecutionPoolTask
+{
+    const char* code;
+    // already analyzed code, when set it is used instead of 'code'
+    struct ExecutionScript* script;
+    int64_t fuel;
+
+    // Filled by the worker after the script finishes, result is the last value 
+    // left on the stack when it has a primitive type, otherwise NATIVE_TYPE_VOID
+    uint8_t state;
+    uint8_t result_type;
+    uint64_t result;
+    bool done;
+
+    struct ExecutionPoolTask* next;
+};
+
+struct ExecutionPool
+{
+    // Shared by all workers, must not be modified after the pool is created
+    struct ExecutionRegistry* registry;
+    pthread_t* threads;
+    int thread_count;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t task_available;
+    pthread_cond_t task_done;
+    struct ExecutionPoolTask* head;
+    struct ExecutionPoolTask* tail;
+    bool stopping;
+};
+
+struct ExecutionPool* exec_pool_create(struct ExecutionRegistry* registry, int thread_count);
+void exec_pool_destroy(struct ExecutionPool* pool);
+
+void exec_pool_task_init(struct ExecutionPoolTask* task, const char* code, int64_t fuel);
+// Tasks running the same code can share one script, see exec_script_create,
+// like the code it has to stay valid until exec_pool_wait returns for the task
+void exec_pool_task_init_script(struct ExecutionPoolTask* task, struct ExecutionScript* script, int64_t fuel);
+void exec_pool_submit(struct ExecutionPool* pool, struct ExecutionPoolTask* task);
+void exec_pool_wait(struct ExecutionPool* pool, struct ExecutionPoolTask* task);
+
+#pragma endregion --- POOL ---
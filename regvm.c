@@ -0,0 +1,1225 @@
+#include "regvm.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defs.h"
+#include "debug.h"
+#include "parser.h"
+#include "executor.h"
+
+#pragma region --- REGISTER VM ---
+
+// Declared type of names which are not a type
+#define REGISTER_TYPE_NONE 0xFF
+
+// Parser state of one function literal, parameter and local 'i' lives in register 'i'
+struct ExecutionRegisterCompiler
+{
+    const char* code;
+    int position;
+    int end;
+    struct ExecutionContextRegisterFunction* function;
+    char names[MAX_REGISTERS][MAX_IDENTIFIER_LENGTH];
+    bool constants[MAX_REGISTERS];
+    int name_count;
+    // first temporary of the current statement, temporaries are reused by the next one
+    int next_register;
+};
+
+void regvm_skip_spaces(struct ExecutionRegisterCompiler* compiler)
+{
+    while (compiler->position < compiler->end)
+    {
+        char current = compiler->code[compiler->position];
+
+        if (current == '/' && compiler->position + 1 < compiler->end && compiler->code[compiler->position + 1] == '/')
+        {
+            while (compiler->position < compiler->end && compiler->code[compiler->position] != '\n')
+            {
+                compiler->position++;
+            }
+
+            continue;
+        }
+
+        if (!isspace(current))
+        {
+            break;
+        }
+
+        compiler->position++;
+    }
+}
+
+char regvm_current(struct ExecutionRegisterCompiler* compiler)
+{
+    return compiler->position < compiler->end ? compiler->code[compiler->position] : 0;
+}
+
+bool regvm_expect(struct ExecutionRegisterCompiler* compiler, char expected)
+{
+    regvm_skip_spaces(compiler);
+
+    if (regvm_current(compiler) != expected)
+    {
+        return false;
+    }
+
+    compiler->position++;
+    return true;
+}
+
+bool regvm_is_assign(struct ExecutionRegisterCompiler* compiler)
+{
+    // '=', but not '==' or '=>'
+    regvm_skip_spaces(compiler);
+
+    return regvm_current(compiler) == '='
+        && compiler->position + 1 < compiler->end
+        && compiler->code[compiler->position + 1] != '='
+        && compiler->code[compiler->position + 1] != '>';
+}
+
+int regvm_read_identifier(struct ExecutionRegisterCompiler* compiler, char* buffer)
+{
+    // same rules as parse_identifier, too long names are not compiled
+    int length = 0;
+
+    regvm_skip_spaces(compiler);
+
+    if (!parse_is_identifier_start(regvm_current(compiler)))
+    {
+        buffer[0] = 0;
+        return 0;
+    }
+
+    while (compiler->position < compiler->end
+        && parse_is_identifier_char(compiler->code[compiler->position]))
+    {
+        if (length >= MAX_IDENTIFIER_LENGTH - 1)
+        {
+            return 0;
+        }
+
+        buffer[length++] = compiler->code[compiler->position++];
+    }
+
+    buffer[length] = 0;
+
+    return length;
+}
+
+uint8_t regvm_declared_type(const char* name)
+{
+    // Scalar types of context_get_type_from_identifier, same as infer_declared_type
+    static const struct { const char* name; uint8_t type; } types[] = {
+        { "let", STACK_TYPE_ACQUIRE }, { "const", STACK_TYPE_ACQUIRE }, { "var", STACK_TYPE_DYNAMIC },
+        { "i8", NATIVE_TYPE_I8 }, { "u8", NATIVE_TYPE_U8 }, { "i16", NATIVE_TYPE_I16 }, { "u16", NATIVE_TYPE_U16 },
+        { "i32", NATIVE_TYPE_I32 }, { "u32", NATIVE_TYPE_U32 }, { "i64", NATIVE_TYPE_I64 }, { "u64", NATIVE_TYPE_U64 },
+        { "f32", NATIVE_TYPE_FLOAT }, { "f64", NATIVE_TYPE_DOUBLE }, { "string", NATIVE_TYPE_STRING },
+    };
+
+    for (int i = 0; i < (int)(sizeof(types) / sizeof(types[0])); i++)
+    {
+        if (strcmp(name, types[i].name) == 0)
+        {
+            return types[i].type;
+        }
+    }
+
+    return REGISTER_TYPE_NONE;
+}
+
+bool regvm_is_keyword(const char* name)
+{
+    // Names which exec_identifier handles as types or literals instead of variables
+    return regvm_declared_type(name) != REGISTER_TYPE_NONE
+        || strcmp(name, "void") == 0 || strcmp(name, "struct") == 0 || strcmp(name, "new") == 0
+        || strcmp(name, "map") == 0 || strcmp(name, "object") == 0;
+}
+
+int regvm_lookup_name(struct ExecutionRegisterCompiler* compiler, const char* name)
+{
+    for (int i = 0; i < compiler->name_count; i++)
+    {
+        if (strcmp(compiler->names[i], name) == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+bool regvm_bind_name(struct ExecutionRegisterCompiler* compiler, const char* name, bool constant)
+{
+    // Names are bound in register order, parameters and locals cannot be redeclared
+    if (regvm_lookup_name(compiler, name) >= 0 || compiler->name_count >= MAX_REGISTERS)
+    {
+        return false;
+    }
+
+    strcpy(compiler->names[compiler->name_count], name);
+    compiler->constants[compiler->name_count] = constant;
+    compiler->name_count++;
+
+    if (compiler->function->register_count < compiler->name_count)
+    {
+        compiler->function->register_count = compiler->name_count;
+    }
+
+    return true;
+}
+
+int regvm_allocate(struct ExecutionRegisterCompiler* compiler)
+{
+    if (compiler->next_register >= MAX_REGISTERS)
+    {
+        return -1;
+    }
+
+    int index = compiler->next_register++;
+
+    if (compiler->function->register_count < compiler->next_register)
+    {
+        compiler->function->register_count = compiler->next_register;
+    }
+
+    return index;
+}
+
+bool regvm_emit(struct ExecutionRegisterCompiler* compiler, struct ExecutionContextRegisterInstruction instruction)
+{
+    struct ExecutionContextRegisterFunction* function = compiler->function;
+
+    if (function->instruction_count >= MAX_REGISTER_INSTRUCTIONS)
+    {
+        return false;
+    }
+
+    instruction.generic_op = instruction.op;
+    function->instructions[function->instruction_count++] = instruction;
+
+    return true;
+}
+
+bool regvm_parse_number(struct ExecutionRegisterCompiler* compiler, struct ExecutionContextRegisterInstruction* instruction)
+{
+    // same suffixes and conversions as exec_number
+    char number[32];
+    int length = 0;
+    int flags = 0;
+
+    while (isdigit(regvm_current(compiler)) || regvm_current(compiler) == '.')
+    {
+        flags |= regvm_current(compiler) == '.' ? 0x1 : 0;
+
+        if (length < (int)sizeof(number) - 1)
+        {
+            number[length++] = regvm_current(compiler);
+        }
+
+        compiler->position++;
+    }
+
+    number[length] = 0;
+
+    if (regvm_current(compiler) == 'f') { flags |= 0x2; compiler->position++; }
+    if (regvm_current(compiler) == 'l') { flags |= 0x4; compiler->position++; }
+    if (regvm_current(compiler) == 'u') { flags |= 0x8; compiler->position++; }
+
+    double double_value = atof(number);
+    float float_value = (float)double_value;
+
+    instruction->value = 0;
+
+    switch (flags)
+    {
+    case 0x0:
+        instruction->type = NATIVE_TYPE_I32;
+        instruction->value = (int32_t)atoll(number);
+        break;
+    case 0x1:
+        instruction->type = NATIVE_TYPE_DOUBLE;
+        memcpy(&instruction->value, &double_value, sizeof(double_value));
+        break;
+    case 0x3:
+        instruction->type = NATIVE_TYPE_FLOAT;
+        memcpy(&instruction->value, &float_value, sizeof(float_value));
+        break;
+    case 0x4:
+        instruction->type = NATIVE_TYPE_I64;
+        instruction->value = (int64_t)atoll(number);
+        break;
+    case 0x8:
+        instruction->type = NATIVE_TYPE_U32;
+        instruction->value = (uint32_t)atoll(number);
+        break;
+    case 0xC:
+        instruction->type = NATIVE_TYPE_U64;
+        instruction->value = (uint64_t)atoll(number);
+        break;
+    default:
+        return false;
+    }
+
+    return !parse_is_identifier_char(regvm_current(compiler));
+}
+
+int regvm_compile_expression(struct ExecutionRegisterCompiler* compiler, int dst, bool drop)
+{
+    // Returns the register holding the value, or -1 when the expression is outside of
+    // register code. New values are written to 'dst' when it is set, results of calls
+    // are not kept at all when 'drop' is set.
+    struct ExecutionContextRegisterInstruction instruction = { .dst = -1, .global_variable_count = -1 };
+    char name[MAX_IDENTIFIER_LENGTH];
+
+    regvm_skip_spaces(compiler);
+
+    if (isdigit(regvm_current(compiler)))
+    {
+        instruction.op = REGISTER_OP_CONST;
+
+        if (!regvm_parse_number(compiler, &instruction))
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        instruction.name_position = compiler->position;
+        instruction.name_length = regvm_read_identifier(compiler, name);
+
+        if (!instruction.name_length || regvm_is_keyword(name))
+        {
+            return -1;
+        }
+
+        int local = regvm_lookup_name(compiler, name);
+
+        if (!regvm_expect(compiler, '('))
+        {
+            if (local >= 0)
+            {
+                // Parameters and locals are read right from their registers
+                regvm_skip_spaces(compiler);
+                char next = regvm_current(compiler);
+
+                return next == ',' || next == ')' || next == ';' || next == '}' ? local : -1;
+            }
+
+            instruction.op = REGISTER_OP_GLOBAL;
+        }
+        else
+        {
+            if (local >= 0)
+            {
+                // function values in registers are called by the stack engine
+                return -1;
+            }
+
+            instruction.op = REGISTER_OP_CALL;
+
+            if (!regvm_expect(compiler, ')'))
+            {
+                do
+                {
+                    int arg = instruction.arg_count < MAX_REGISTER_CALL_ARGS ? regvm_compile_expression(compiler, -1, false) : -1;
+
+                    if (arg < 0)
+                    {
+                        return -1;
+                    }
+
+                    instruction.args[instruction.arg_count++] = arg;
+                }
+                while (regvm_expect(compiler, ','));
+
+                if (!regvm_expect(compiler, ')'))
+                {
+                    return -1;
+                }
+            }
+        }
+    }
+
+    // Field access, indexing, literal blocks and function literals follow values the
+    // register code does not have
+    regvm_skip_spaces(compiler);
+    char next = regvm_current(compiler);
+
+    if (next != ',' && next != ')' && next != ';' && next != '}')
+    {
+        return -1;
+    }
+
+    if (!(drop && instruction.op == REGISTER_OP_CALL))
+    {
+        instruction.dst = dst >= 0 ? dst : regvm_allocate(compiler);
+    }
+
+    if ((instruction.dst < 0 && !drop) || !regvm_emit(compiler, instruction))
+    {
+        return -1;
+    }
+
+    return drop ? 0 : instruction.dst;
+}
+
+bool regvm_compile_block(struct ExecutionRegisterCompiler* compiler)
+{
+    // Statements until '}', value of the last one without ';' is returned
+    char type_name[MAX_IDENTIFIER_LENGTH];
+    char name[MAX_IDENTIFIER_LENGTH];
+
+    while (true)
+    {
+        compiler->next_register = compiler->name_count;
+
+        if (regvm_expect(compiler, '}'))
+        {
+            return regvm_emit(compiler, (struct ExecutionContextRegisterInstruction) { .op = REGISTER_OP_RETURN, .dst = -1 });
+        }
+
+        regvm_skip_spaces(compiler);
+
+        int statement_start = compiler->position;
+        int type_length = regvm_read_identifier(compiler, type_name);
+
+        regvm_skip_spaces(compiler);
+
+        int name_position = compiler->position;
+        int name_length = type_length ? regvm_read_identifier(compiler, name) : 0;
+
+        if (name_length && regvm_is_assign(compiler))
+        {
+            // 'type name = value;'
+            uint8_t type = regvm_declared_type(type_name);
+            int local = regvm_allocate(compiler);
+
+            compiler->position++;
+
+            if (type == REGISTER_TYPE_NONE || local < 0 || regvm_lookup_name(compiler, name) >= 0)
+            {
+                return false;
+            }
+
+            int value = regvm_compile_expression(compiler, local, false);
+
+            if (value < 0 || !regvm_expect(compiler, ';'))
+            {
+                return false;
+            }
+
+            if (value != local
+                && !regvm_emit(compiler, (struct ExecutionContextRegisterInstruction) { .op = REGISTER_OP_MOVE, .dst = local, .args = { value } }))
+            {
+                return false;
+            }
+
+            struct ExecutionContextRegisterInstruction declare = {
+                .op = REGISTER_OP_DECLARE,
+                .type = type,
+                .dst = local,
+                .name_position = name_position,
+                .name_length = name_length,
+                .global_variable_count = -1,
+            };
+
+            if (!regvm_emit(compiler, declare) || !regvm_bind_name(compiler, name, strcmp(type_name, "const") == 0))
+            {
+                return false;
+            }
+
+            continue;
+        }
+
+        if (name_length)
+        {
+            // 'new X', 'X v' and other statements of the stack engine
+            return false;
+        }
+
+        if (type_length && regvm_is_assign(compiler))
+        {
+            // 'name = value;', globals are assigned by the stack engine
+            int local = regvm_lookup_name(compiler, type_name);
+
+            compiler->position++;
+
+            if (local < 0 || compiler->constants[local])
+            {
+                return false;
+            }
+
+            int value = regvm_compile_expression(compiler, -1, false);
+
+            if (value < 0 || !regvm_expect(compiler, ';')
+                || !regvm_emit(compiler, (struct ExecutionContextRegisterInstruction) { .op = REGISTER_OP_ASSIGN, .dst = local, .args = { value } }))
+            {
+                return false;
+            }
+
+            continue;
+        }
+
+        // Expression statement drops its value, the last expression is returned
+        int instruction_count = compiler->function->instruction_count;
+
+        compiler->position = statement_start;
+
+        if (regvm_compile_expression(compiler, -1, true) >= 0 && regvm_expect(compiler, ';'))
+        {
+            continue;
+        }
+
+        compiler->function->instruction_count = instruction_count;
+        compiler->next_register = compiler->name_count;
+        compiler->position = statement_start;
+
+        int value = regvm_compile_expression(compiler, -1, false);
+
+        return value >= 0 && regvm_expect(compiler, '}')
+            && regvm_emit(compiler, (struct ExecutionContextRegisterInstruction) { .op = REGISTER_OP_RETURN, .dst = -1, .arg_count = 1, .args = { value } });
+    }
+}
+
+bool regvm_compile_function(struct ExecutionContext* context, struct ExecutionContextRegisterFunction* function)
+{
+    struct ExecutionRegisterCompiler compiler;
+    char type_name[MAX_IDENTIFIER_LENGTH];
+    char name[MAX_IDENTIFIER_LENGTH];
+
+    compiler.code = context->code;
+    compiler.position = function->function_position;
+    compiler.end = context->code_len;
+    compiler.function = function;
+    compiler.name_count = 0;
+    compiler.next_register = 0;
+
+    function->param_count = 0;
+    function->register_count = 0;
+    function->instruction_count = 0;
+
+    if (!regvm_expect(&compiler, ')'))
+    {
+        do
+        {
+            uint8_t type = regvm_read_identifier(&compiler, type_name) ? regvm_declared_type(type_name) : REGISTER_TYPE_NONE;
+
+            // also rejects 'T[]' and struct parameters
+            if (type == REGISTER_TYPE_NONE || !regvm_read_identifier(&compiler, name) || !regvm_bind_name(&compiler, name, false))
+            {
+                return false;
+            }
+
+            // untyped parameters take the type of the argument
+            function->param_types[function->param_count++] = type == STACK_TYPE_DYNAMIC ? STACK_TYPE_ACQUIRE : type;
+        }
+        while (regvm_expect(&compiler, ','));
+
+        if (!regvm_expect(&compiler, ')'))
+        {
+            return false;
+        }
+    }
+
+    // '=>' is optional, same as in exec_function_body
+    regvm_expect(&compiler, '=');
+    regvm_expect(&compiler, '>');
+
+    if (!regvm_expect(&compiler, '{') || !regvm_compile_block(&compiler))
+    {
+        return false;
+    }
+
+#ifdef TOKEN_DEBUG
+    debug("Compiled register code of function at %d (registers: %d, instructions: %d)\n", function->function_position, function->register_count, function->instruction_count);
+#endif
+
+    return true;
+}
+
+struct ExecutionContextRegisterFunction* regvm_get_function(struct ExecutionContext* context, int function_position)
+{
+    struct ExecutionContextRegisterInfo* registers = context->registers;
+
+    if (!registers)
+    {
+        registers = malloc(sizeof(struct ExecutionContextRegisterInfo));
+
+        if (!registers)
+        {
+            debug("ERR!: Cannot allocate register code\n");
+            return NULL;
+        }
+
+        registers->function_count = 0;
+        context->registers = registers;
+    }
+
+    for (int i = 0; i < registers->function_count; i++)
+    {
+        if (registers->functions[i].function_position == function_position)
+        {
+            return &registers->functions[i];
+        }
+    }
+
+    if (registers->function_count >= MAX_REGISTER_FUNCTIONS)
+    {
+        // Functions which do not fit run on the stack engine
+        return NULL;
+    }
+
+    struct ExecutionContextRegisterFunction* function = &registers->functions[registers->function_count++];
+
+    function->function_position = function_position;
+    function->state = regvm_compile_function(context, function) ? REGISTER_STATE_COMPILED : REGISTER_STATE_FAILED;
+
+#ifdef TOKEN_DEBUG
+    if (function->state == REGISTER_STATE_FAILED)
+    {
+        debug("Function at %d is outside of register code, it runs on the stack engine\n", function_position);
+    }
+#endif
+
+    return function;
+}
+
+int regvm_global(struct ExecutionContext* context, struct ExecutionContextRegisterInstruction* instruction)
+{
+    // Function scope only holds registers, so names are looked up in globals like
+    // context_lookup_variable does after the function scope
+    struct ExecutionContextScope* global_scope = context->global_scope;
+
+    if (instruction->global_variable_count != global_scope->variable_count)
+    {
+        char name[MAX_IDENTIFIER_LENGTH];
+
+        memcpy(name, &context->code[instruction->name_position], instruction->name_length);
+        name[instruction->name_length] = 0;
+
+        int lookup = context_scope_variables_linear_search(global_scope, name);
+
+        instruction->global_stack_index = lookup >= 0 ? global_scope->variables[lookup].stack_index : -1;
+        instruction->global_variable_count = global_scope->variable_count;
+    }
+
+    return instruction->global_stack_index;
+}
+
+void regvm_set(struct ExecutionContext* context, int index, uint64_t value, uint8_t type)
+{
+    // Previous value of the register is released, the new one is owned by it
+    context_stack_unset_value_at_index(context, index);
+
+    context->stack[index] = value;
+    context->stack_type[index] = type;
+    context->stack_flags[index] = STACK_FLAG_NONE;
+}
+
+void regvm_copy(struct ExecutionContext* context, int index, int source)
+{
+    if (index == source)
+    {
+        return;
+    }
+
+    regvm_set(context, index, context->stack[source], context->stack_type[source]);
+    context_stack_value_ref(context_stack_get_value_at_index(context, index));
+}
+
+void regvm_quicken(struct ExecutionContextRegisterInstruction* instruction, uint8_t op, uint8_t type)
+{
+    // Instruction which kept failing its guards stays generic
+    if (instruction->deopt_count >= REGISTER_MAX_DEOPTS)
+    {
+        return;
+    }
+
+#ifdef TOKEN_DEBUG
+    if (instruction->op != op)
+    {
+        debug("Quickened register instruction %d to %d (type: %s)\n", instruction->generic_op, op, get_stack_type_name(type));
+    }
+#endif
+
+    instruction->op = op;
+    instruction->quickened_type = type;
+}
+
+void regvm_deopt(struct ExecutionContextRegisterInstruction* instruction)
+{
+    // Generic op checks everything again and quickens for what it finds
+#ifdef TOKEN_DEBUG
+    debug("Deoptimized register instruction %d back to %d\n", instruction->op, instruction->generic_op);
+#endif
+
+    instruction->op = instruction->generic_op;
+    instruction->count = 0;
+    instruction->deopt_count++;
+}
+
+bool regvm_global_is_cached(struct ExecutionContext* context, struct ExecutionContextRegisterInstruction* instruction)
+{
+    // Slot of the name stays the same until globals change
+    return instruction->global_variable_count == context->global_scope->variable_count;
+}
+
+bool regvm_load_global(struct ExecutionContext* context, struct ExecutionContextRegisterInstruction* instruction, int dst)
+{
+    int index = regvm_global(context, instruction);
+
+    if (index < 0)
+    {
+        debug("ERR!: Variable %.*s is not defined in current scope.\n", instruction->name_length, &context->code[instruction->name_position]);
+        context_abort(context);
+        return false;
+    }
+
+    if (context->stack_type[index] == STACK_TYPE_STRUCT_INSTANCE)
+    {
+        debug("ERR!: Struct instance '%.*s' does not fit a register\n", instruction->name_length, &context->code[instruction->name_position]);
+        return false;
+    }
+
+    if (check_type_is_numeric(context->stack_type[index]))
+    {
+        regvm_quicken(instruction, REGISTER_OP_GLOBAL_SCALAR, context->stack_type[index]);
+    }
+
+    regvm_copy(context, dst, index);
+
+    return true;
+}
+
+bool regvm_load_global_scalar(struct ExecutionContext* context, struct ExecutionContextRegisterInstruction* instruction, int dst)
+{
+    int index = instruction->global_stack_index;
+
+    if (!regvm_global_is_cached(context, instruction) || context->stack_type[index] != instruction->quickened_type)
+    {
+        regvm_deopt(instruction);
+        return regvm_load_global(context, instruction, dst);
+    }
+
+    regvm_set(context, dst, context->stack[index], instruction->quickened_type);
+
+    return true;
+}
+
+bool regvm_declare(struct ExecutionContext* context, struct ExecutionContextRegisterInstruction* instruction, int dst)
+{
+    // Same failures as a declaration in exec_expression_with_flags and context_add_variable
+    if (regvm_global(context, instruction) >= 0)
+    {
+        debug("ERR!: Variable %.*s is aready defined.\n", instruction->name_length, &context->code[instruction->name_position]);
+        return false;
+    }
+
+    if (context->stack_type[dst] == NATIVE_TYPE_VOID)
+    {
+        // Same as exec_check_expression_value, callee returned nothing
+        debug("ERR!: Expression has no value\n");
+        context_abort(context);
+        return false;
+    }
+
+    if (!check_type_is_assignable_to(instruction->type, context->stack_type[dst]))
+    {
+        debug("ERR!: Cannot add variable overriding stack, types are incorrect (to: %s, from: %s)\n", get_stack_type_name(instruction->type), get_stack_type_name(context->stack_type[dst]));
+        return false;
+    }
+
+    regvm_quicken(instruction, REGISTER_OP_DECLARE_CHECKED, context->stack_type[dst]);
+
+    return true;
+}
+
+bool regvm_declare_checked(struct ExecutionContext* context, struct ExecutionContextRegisterInstruction* instruction, int dst)
+{
+    if (!regvm_global_is_cached(context, instruction) || context->stack_type[dst] != instruction->quickened_type)
+    {
+        regvm_deopt(instruction);
+        return regvm_declare(context, instruction, dst);
+    }
+
+    return true;
+}
+
+void regvm_assign(struct ExecutionContext* context, struct ExecutionContextRegisterInstruction* instruction, int dst, int source)
+{
+    if (context->stack_type[source] == NATIVE_TYPE_VOID)
+    {
+        debug("ERR!: Expression has no value\n");
+        context_abort(context);
+        return;
+    }
+
+    // Variable keeps the type of its first value, see exec_assignment
+    if (!check_type_is_assignable_to(context->stack_type[dst], context->stack_type[source]))
+    {
+        debug("ERR!: Cannot assign to variable, types are incorrect (to: %s, from: %s)\n", get_stack_type_name(context->stack_type[dst]), get_stack_type_name(context->stack_type[source]));
+        return;
+    }
+
+    if (context->stack_type[dst] == context->stack_type[source] && check_type_is_numeric(context->stack_type[source]))
+    {
+        regvm_quicken(instruction, REGISTER_OP_ASSIGN_SCALAR, context->stack_type[source]);
+    }
+
+    regvm_copy(context, dst, source);
+}
+
+void regvm_assign_scalar(struct ExecutionContext* context, struct ExecutionContextRegisterInstruction* instruction, int dst, int source)
+{
+    if (context->stack_type[dst] != instruction->quickened_type || context->stack_type[source] != instruction->quickened_type)
+    {
+        regvm_deopt(instruction);
+        regvm_assign(context, instruction, dst, source);
+        return;
+    }
+
+    // Scalars hold no references, so the bits are just copied
+    context->stack[dst] = context->stack[source];
+}
+
+bool regvm_is_add_i32(struct ExecutionContext* context, struct ExecutionContextRegisterInstruction* instruction, int frame_start_stack_index)
+{
+    return instruction->dst >= 0 && instruction->arg_count == 2
+        && context->stack_type[frame_start_stack_index + instruction->args[0]] == NATIVE_TYPE_I32
+        && context->stack_type[frame_start_stack_index + instruction->args[1]] == NATIVE_TYPE_I32;
+}
+
+void regvm_add_i32(struct ExecutionContext* context, struct ExecutionContextRegisterInstruction* instruction, int frame_start_stack_index)
+{
+    // fts_add of two i32 values, computed from the registers without a native frame
+    int32_t result = (int32_t)((uint32_t)context->stack[frame_start_stack_index + instruction->args[0]]
+        + (uint32_t)context->stack[frame_start_stack_index + instruction->args[1]]);
+
+    regvm_set(context, frame_start_stack_index + instruction->dst, (uint64_t)(int64_t)result, NATIVE_TYPE_I32);
+}
+
+bool regvm_callee_is_cached(struct ExecutionContext* context, struct ExecutionContextRegisterInstruction* instruction)
+{
+    // Global can be assigned another function, so the slot is compared every time
+    return regvm_global_is_cached(context, instruction)
+        && context->stack[instruction->global_stack_index] == instruction->value
+        && context->stack_type[instruction->global_stack_index] == instruction->quickened_type;
+}
+
+bool regvm_call_value(
+    struct ExecutionContext* context,
+    struct ExecutionContextRegisterInstruction* instruction,
+    int frame_start_stack_index,
+    uint8_t callee_type,
+    uint64_t callee_value
+) {
+    int dst = instruction->dst >= 0 ? frame_start_stack_index + instruction->dst : -1;
+
+    // Callee takes copies of the argument registers on top of the frame
+    int call_stack_index = context->stack_index;
+
+    for (int i = 0; i < instruction->arg_count; i++)
+    {
+        // Calls which returned nothing push no argument, same as in the stack engine
+        if (context->stack_type[frame_start_stack_index + instruction->args[i]] != NATIVE_TYPE_VOID)
+        {
+            context_stack_push_borrowed_value(context, context_stack_get_value_at_index(context, frame_start_stack_index + instruction->args[i]));
+        }
+    }
+
+    int args_end_stack_index = context->stack_index;
+    int results_stack_index = call_stack_index;
+
+    if (callee_type == NATIVE_TYPE_NATIVE_FUNCTION)
+    {
+        int native_frame_stack_index = context->native_frame_stack_index;
+        context->native_frame_stack_index = call_stack_index;
+
+        (*(void(**)(struct ExecutionContext*))&callee_value)(context);
+
+        if (context->state == EXECUTION_CONTEXT_STATE_SUSPENDED)
+        {
+            // Native is waiting for the host, it pushes the result before resuming
+            context_yield(context);
+        }
+
+        context->native_frame_stack_index = native_frame_stack_index;
+        results_stack_index = args_end_stack_index;
+    }
+    else
+    {
+        // Script function replaces its arguments with results
+        exec_invoke_function(context, (int)callee_value, call_stack_index);
+    }
+
+    int result_count = context->stack_index - results_stack_index;
+    bool stored = context_is_running(context);
+
+    if (stored && dst >= 0 && result_count == 1 && context->stack_type[results_stack_index] != STACK_TYPE_STRUCT_INSTANCE)
+    {
+        // Result is moved into the register, borrowed one takes its own references first
+        context_stack_own_value_at_index(context, results_stack_index);
+        uint64_t value = context->stack[results_stack_index];
+        uint8_t type = context->stack_type[results_stack_index];
+
+        context->stack_index--;
+
+        while (context->stack_index > call_stack_index)
+        {
+            context_stack_pop_value(context);
+        }
+
+        regvm_set(context, dst, value, type);
+        return true;
+    }
+
+    while (context->stack_index > call_stack_index)
+    {
+        context_stack_pop_value(context);
+    }
+
+    if (stored && dst >= 0 && result_count == 0)
+    {
+        // Nothing was returned, register stays empty
+        regvm_set(context, dst, 0, NATIVE_TYPE_VOID);
+    }
+    else if (stored && dst >= 0)
+    {
+        debug("ERR!: Call returned %d values, register code takes one\n", result_count);
+        return false;
+    }
+
+    return stored;
+}
+
+bool regvm_call(struct ExecutionContext* context, struct ExecutionContextRegisterInstruction* instruction, int frame_start_stack_index)
+{
+    int callee = regvm_global(context, instruction);
+
+    if (callee < 0)
+    {
+        debug("ERR!: Variable %.*s is not defined in current scope.\n", instruction->name_length, &context->code[instruction->name_position]);
+        context_abort(context);
+        return false;
+    }
+
+    if (!context_consume_fuel(context, FUEL_COST_CALL))
+    {
+        return false;
+    }
+
+    uint8_t callee_type = context->stack_type[callee];
+    uint64_t callee_value = context->stack[callee];
+
+    if (callee_type != NATIVE_TYPE_NATIVE_FUNCTION && callee_type != NATIVE_TYPE_FUNCTION)
+    {
+        debug("ERR!: Value is not a function\n");
+        return false;
+    }
+
+    // Next executions skip the lookup and checks of the callee
+    instruction->value = callee_value;
+
+    if (callee_value == (uint64_t)&fts_add && regvm_is_add_i32(context, instruction, frame_start_stack_index))
+    {
+        regvm_quicken(instruction, REGISTER_OP_CALL_ADD_I32, callee_type);
+        regvm_add_i32(context, instruction, frame_start_stack_index);
+        return true;
+    }
+
+    regvm_quicken(instruction, callee_type == NATIVE_TYPE_NATIVE_FUNCTION ? REGISTER_OP_CALL_NATIVE : REGISTER_OP_CALL_FUNCTION, callee_type);
+
+    return regvm_call_value(context, instruction, frame_start_stack_index, callee_type, callee_value);
+}
+
+bool regvm_call_add_i32(struct ExecutionContext* context, struct ExecutionContextRegisterInstruction* instruction, int frame_start_stack_index)
+{
+    if (!regvm_callee_is_cached(context, instruction) || !regvm_is_add_i32(context, instruction, frame_start_stack_index))
+    {
+        regvm_deopt(instruction);
+        return regvm_call(context, instruction, frame_start_stack_index);
+    }
+
+    if (!context_consume_fuel(context, FUEL_COST_CALL))
+    {
+        return false;
+    }
+
+    regvm_add_i32(context, instruction, frame_start_stack_index);
+
+    return true;
+}
+
+bool regvm_call_cached(struct ExecutionContext* context, struct ExecutionContextRegisterInstruction* instruction, int frame_start_stack_index)
+{
+    if (!regvm_callee_is_cached(context, instruction))
+    {
+        regvm_deopt(instruction);
+        return regvm_call(context, instruction, frame_start_stack_index);
+    }
+
+    if (!context_consume_fuel(context, FUEL_COST_CALL))
+    {
+        return false;
+    }
+
+    return regvm_call_value(context, instruction, frame_start_stack_index, instruction->quickened_type, instruction->value);
+}
+
+void regvm_fuse(struct ExecutionContextRegisterFunction* function, int pc)
+{
+    // Instruction at 'pc' ran REGISTER_FUSE_THRESHOLD times and the next one ran as often,
+    // so both took the quickened forms of their common case by now
+    if (pc + 1 >= function->instruction_count)
+    {
+        return;
+    }
+
+    struct ExecutionContextRegisterInstruction* first = &function->instructions[pc];
+    struct ExecutionContextRegisterInstruction* second = &function->instructions[pc + 1];
+    uint8_t op = first->op;
+
+    if (first->deopt_count >= REGISTER_MAX_DEOPTS)
+    {
+        return;
+    }
+
+    if (first->op == REGISTER_OP_CONST && first->type == NATIVE_TYPE_I32 && second->op == REGISTER_OP_CALL_ADD_I32
+        && (second->args[0] == first->dst || second->args[1] == first->dst))
+    {
+        op = REGISTER_OP_ADD_I32_CONST;
+    }
+    else if (first->op == REGISTER_OP_CALL_ADD_I32 && second->op == REGISTER_OP_DECLARE_CHECKED
+        && second->dst == first->dst && second->quickened_type == NATIVE_TYPE_I32)
+    {
+        op = REGISTER_OP_ADD_I32_DECLARE;
+    }
+
+#ifdef TOKEN_DEBUG
+    if (op != first->op)
+    {
+        debug("Fused register instructions %d and %d at %d into %d\n", first->op, second->op, pc, op);
+    }
+#endif
+
+    first->op = op;
+}
+
+void regvm_return(struct ExecutionContext* context, struct ExecutionContextRegisterFunction* function, int frame_start_stack_index, int result)
+{
+    // Registers after parameters are released, parameters are released by exec_call_cleanup
+    // together with the arguments. Result is left on top of them like exec_function_body does.
+    int result_index = frame_start_stack_index + result;
+    int params_end_stack_index = frame_start_stack_index + function->param_count;
+    uint64_t value = 0;
+    uint8_t type = NATIVE_TYPE_VOID;
+    uint8_t flags = STACK_FLAG_NONE;
+
+    if (result >= 0 && context->stack_type[result_index] != NATIVE_TYPE_VOID)
+    {
+        value = context->stack[result_index];
+        type = context->stack_type[result_index];
+
+        if (result < function->param_count)
+        {
+            // exec_call_cleanup owns it before the parameter is destructed
+            flags = STACK_FLAG_BORROWED;
+        }
+        else
+        {
+            context->stack_type[result_index] = NATIVE_TYPE_VOID;
+        }
+    }
+
+    for (int i = frame_start_stack_index + function->register_count - 1; i >= params_end_stack_index; i--)
+    {
+        context_stack_unset_value_at_index(context, i);
+    }
+
+    context->stack_index = params_end_stack_index;
+
+    if (type != NATIVE_TYPE_VOID)
+    {
+        context->stack[context->stack_index] = value;
+        context->stack_type[context->stack_index] = type;
+        context->stack_flags[context->stack_index] = flags;
+        context->stack_index++;
+    }
+}
+
+void regvm_run(struct ExecutionContext* context, struct ExecutionContextRegisterFunction* function, int frame_start_stack_index)
+{
+    for (int pc = 0; pc < function->instruction_count; pc++)
+    {
+        struct ExecutionContextRegisterInstruction* instruction = &function->instructions[pc];
+        struct ExecutionContextRegisterInstruction* next = &function->instructions[pc + 1];
+        int instruction_pc = pc;
+        int dst = frame_start_stack_index + instruction->dst;
+        bool failed = false;
+
+        if (!context_consume_fuel(context, FUEL_COST_OPERATION))
+        {
+            break;
+        }
+
+        switch (instruction->op)
+        {
+        case REGISTER_OP_CONST:
+            regvm_set(context, dst, instruction->value, instruction->type);
+            break;
+        case REGISTER_OP_MOVE:
+            regvm_copy(context, dst, frame_start_stack_index + instruction->args[0]);
+            break;
+        case REGISTER_OP_GLOBAL:
+            failed = !regvm_load_global(context, instruction, dst);
+            break;
+        case REGISTER_OP_DECLARE:
+            failed = !regvm_declare(context, instruction, dst);
+            break;
+        case REGISTER_OP_ASSIGN:
+            regvm_assign(context, instruction, dst, frame_start_stack_index + instruction->args[0]);
+            break;
+        case REGISTER_OP_CALL:
+            failed = !regvm_call(context, instruction, frame_start_stack_index);
+            break;
+        case REGISTER_OP_RETURN:
+            regvm_return(context, function, frame_start_stack_index, instruction->arg_count ? instruction->args[0] : -1);
+            return;
+        case REGISTER_OP_GLOBAL_SCALAR:
+            failed = !regvm_load_global_scalar(context, instruction, dst);
+            break;
+        case REGISTER_OP_DECLARE_CHECKED:
+            failed = !regvm_declare_checked(context, instruction, dst);
+            break;
+        case REGISTER_OP_ASSIGN_SCALAR:
+            regvm_assign_scalar(context, instruction, dst, frame_start_stack_index + instruction->args[0]);
+            break;
+        case REGISTER_OP_CALL_ADD_I32:
+            failed = !regvm_call_add_i32(context, instruction, frame_start_stack_index);
+            break;
+        case REGISTER_OP_CALL_NATIVE:
+        case REGISTER_OP_CALL_FUNCTION:
+            failed = !regvm_call_cached(context, instruction, frame_start_stack_index);
+            break;
+        case REGISTER_OP_ADD_I32_CONST:
+            regvm_set(context, dst, instruction->value, NATIVE_TYPE_I32);
+
+            if (!regvm_callee_is_cached(context, next) || !regvm_is_add_i32(context, next, frame_start_stack_index))
+            {
+                // CONST is done, the call runs on its own
+                regvm_deopt(instruction);
+            }
+            else if (context_consume_fuel(context, FUEL_COST_OPERATION + FUEL_COST_CALL))
+            {
+                regvm_add_i32(context, next, frame_start_stack_index);
+                pc++;
+            }
+            else
+            {
+                failed = true;
+            }
+            break;
+        case REGISTER_OP_ADD_I32_DECLARE:
+            if (!regvm_callee_is_cached(context, instruction) || !regvm_is_add_i32(context, instruction, frame_start_stack_index)
+                || !regvm_global_is_cached(context, next))
+            {
+                regvm_deopt(instruction);
+                failed = !regvm_call(context, instruction, frame_start_stack_index);
+            }
+            else if (context_consume_fuel(context, FUEL_COST_CALL + FUEL_COST_OPERATION))
+            {
+                // Result of the add is i32, which DECLARE_CHECKED was quickened for
+                regvm_add_i32(context, instruction, frame_start_stack_index);
+                pc++;
+            }
+            else
+            {
+                failed = true;
+            }
+            break;
+        }
+
+        if (failed)
+        {
+            break;
+        }
+
+        if (++instruction->count == REGISTER_FUSE_THRESHOLD)
+        {
+            regvm_fuse(function, instruction_pc);
+        }
+    }
+
+    // Failed instruction or no fuel, nothing is returned
+    regvm_return(context, function, frame_start_stack_index, -1);
+}
+
+bool regvm_try_call(struct ExecutionContext* context, int function_position, int frame_start_stack_index, int args_stack_size)
+{
+    if (context->engine != EXECUTION_ENGINE_REGISTER || !context_is_running(context))
+    {
+        return false;
+    }
+
+    struct ExecutionContextRegisterFunction* function = regvm_get_function(context, function_position);
+
+    // Calls of natives copy their arguments above the frame
+    if (!function || function->state != REGISTER_STATE_COMPILED
+        || frame_start_stack_index + function->register_count + MAX_REGISTER_CALL_ARGS >= MAX_STACK_SIZE)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < args_stack_size; i++)
+    {
+        uint8_t type = context->stack_type[frame_start_stack_index + i];
+
+        // Struct instances take more than one slot, stack engine binds them
+        if (type == STACK_TYPE_STRUCT_INSTANCE || type == STACK_TYPE_STRUCT_END)
+        {
+            return false;
+        }
+    }
+
+    bool matches = args_stack_size == function->param_count;
+
+    for (int i = 0; matches && i < function->param_count; i++)
+    {
+        matches = function->param_types[i] == STACK_TYPE_ACQUIRE 
+            || function->param_types[i] == context->stack_type[frame_start_stack_index + i];
+    }
+
+    if (!matches)
+    {
+        // Aborts like the stack engine, arguments are released by exec_call_cleanup
+        debug("ERR!: Arguments do not match parameters of the called function\n");
+        context_abort(context);
+        return true;
+    }
+
+    for (int i = 0; i < function->param_count; i++)
+    {
+        // Arguments become parameters, so they own their references
+        context_stack_own_value_at_index(context, frame_start_stack_index + i);
+    }
+
+    for (int i = function->param_count; i < function->register_count; i++)
+    {
+        context->stack[frame_start_stack_index + i] = 0;
+        context->stack_type[frame_start_stack_index + i] = NATIVE_TYPE_VOID;
+        context->stack_flags[frame_start_stack_index + i] = STACK_FLAG_NONE;
+    }
+
+    context->stack_index = frame_start_stack_index + function->register_count;
+
+    regvm_run(context, function, frame_start_stack_index);
+
+    return true;
+}
+
+#pragma endregion --- REGISTER VM ---
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "context.h"
+
+#pragma region --- REGISTER VM ---
+
+// Executions of an instruction after which it is fused with the next one, when both
+// are quickened into forms which have a superinstruction
+#define REGISTER_FUSE_THRESHOLD 16
+// Instruction whose quickened forms failed their guards this many times stays generic
+#define REGISTER_MAX_DEOPTS 4
+
+// Register code covers block bodies made of declarations of scalar typed, 'let', 'var' and
+// 'const' locals, assignments of locals and parameters, numeric literals, reads of globals
+// and calls of globals. Parameters have to be scalar typed, 'var' or 'let'. Other bodies
+// run on the stack engine.
+enum ExecutionRegisterOp
+{
+    // dst = 'value' of 'type'
+    REGISTER_OP_CONST,
+    // dst = args[0], the copy takes its own references
+    REGISTER_OP_MOVE,
+    // dst = global named by the instruction
+    REGISTER_OP_GLOBAL,
+    // dst is declared: fails when the name is a global or the value has another type
+    REGISTER_OP_DECLARE,
+    // dst = args[0] with the same checks as exec_assignment
+    REGISTER_OP_ASSIGN,
+    // dst = global function called with args, dst -1 drops the result
+    REGISTER_OP_CALL,
+    // returns args[0], or nothing when arg_count is 0
+    REGISTER_OP_RETURN,
+
+    // Quickened forms, generic op is rewritten to them after its first execution. Each
+    // checks the assumptions it was specialized for and goes back to 'generic_op' otherwise.
+
+    // GLOBAL of a scalar of 'quickened_type' from the cached slot, no references are taken
+    REGISTER_OP_GLOBAL_SCALAR,
+    // DECLARE already checked for a value of 'quickened_type' while globals did not change
+    REGISTER_OP_DECLARE_CHECKED,
+    // ASSIGN of a scalar of 'quickened_type' to a local of the same type
+    REGISTER_OP_ASSIGN_SCALAR,
+    // CALL of 'add' with two i32 registers, computed without a native frame
+    REGISTER_OP_CALL_ADD_I32,
+    // CALL of the native or script function in 'value' from the cached slot
+    REGISTER_OP_CALL_NATIVE,
+    REGISTER_OP_CALL_FUNCTION,
+
+    // Superinstructions, quickened pairs fused after REGISTER_FUSE_THRESHOLD executions. They
+    // run both instructions and skip the second one, which is kept for deoptimization.
+
+    // CONST of an i32 followed by CALL_ADD_I32 which reads it
+    REGISTER_OP_ADD_I32_CONST,
+    // CALL_ADD_I32 followed by DECLARE_CHECKED of its result
+    REGISTER_OP_ADD_I32_DECLARE,
+};
+
+enum ExecutionRegisterState
+{
+    REGISTER_STATE_COMPILED,
+    // outside of register code subset, runs on the stack engine
+    REGISTER_STATE_FAILED,
+};
+
+// Runs the function on the register engine when the context uses it. Takes the same frame
+// as exec_function_body and pushes the result on top of the arguments. Returns false when
+// the call has to be interpreted, arguments are left untouched then.
+bool regvm_try_call(struct ExecutionContext* context, int function_position, int frame_start_stack_index, int args_stack_size);
+
+#pragma endregion --- REGISTER VM ---
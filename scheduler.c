@@ -0,0 +1,498 @@
+#include "scheduler.h"
+
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+
+#include "executor.h"
+#include "debug.h"
+
+// Index of the worker running on current thread and its scheduler, 
+// -1 for threads that are not workers
+_Thread_local int scheduler_worker_index = -1;
+_Thread_local struct ExecutionScheduler* scheduler_current = NULL;
+
+#pragma region --- SCHEDULER DEQUE ---
+
+void scheduler_deque_init(struct ExecutionSchedulerDeque* deque)
+{
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+}
+
+bool scheduler_deque_push(struct ExecutionSchedulerDeque* deque, struct ExecutionSchedulerTask* task)
+{
+    long long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    long long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+
+    if (bottom - top >= SCHEDULER_DEQUE_CAPACITY)
+    {
+        return false;
+    }
+
+    atomic_store_explicit(&deque->tasks[bottom % SCHEDULER_DEQUE_CAPACITY], task, memory_order_relaxed);
+    // release publishes the task and its child context to thieves
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+
+    return true;
+}
+
+struct ExecutionSchedulerTask* scheduler_deque_pop(struct ExecutionSchedulerDeque* deque)
+{
+    long long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom)
+    {
+        // deque was empty
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    struct ExecutionSchedulerTask* task = atomic_load_explicit(&deque->tasks[bottom % SCHEDULER_DEQUE_CAPACITY], memory_order_relaxed);
+
+    if (top == bottom)
+    {
+        // last task, race against thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+        {
+            task = NULL;
+        }
+
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+
+    return task;
+}
+
+struct ExecutionSchedulerTask* scheduler_deque_steal(struct ExecutionSchedulerDeque* deque)
+{
+    long long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if (top >= bottom)
+    {
+        return NULL;
+    }
+
+    struct ExecutionSchedulerTask* task = atomic_load_explicit(&deque->tasks[top % SCHEDULER_DEQUE_CAPACITY], memory_order_relaxed);
+
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+    {
+        // lost the race with another thief or with the owner
+        return NULL;
+    }
+
+    return task;
+}
+
+#pragma endregion --- SCHEDULER DEQUE ---
+
+#pragma region --- SCHEDULER ---
+
+void scheduler_run_task(struct ExecutionSchedulerTask* task)
+{
+    struct ExecutionContext* context = &task->context;
+
+    exec_invoke_function(context, task->func_position, task->frame_start_stack_index);
+
+    task->result_type = NATIVE_TYPE_VOID;
+    task->result = 0;
+
+    if (context->stack_index > task->frame_start_stack_index)
+    {
+        struct ExecutionContextStackValue value = context_stack_get_last_value(context);
+
+        if (value.size == 1 && value.type >= NATIVE_TYPE_I8 && value.type <= NATIVE_TYPE_DOUBLE)
+        {
+            task->result_type = value.type;
+            task->result = *value.ptr;
+        }
+    }
+
+    // Arguments and everything the function left behind are dropped on the thread
+    // which ran it, only the result is kept for join
+    exec_context_release(context);
+    atomic_store_explicit(&task->done, true, memory_order_release);
+}
+
+struct ExecutionSchedulerTask* scheduler_find_task(struct ExecutionScheduler* scheduler)
+{
+    struct ExecutionSchedulerTask* task = NULL;
+    int worker_index = scheduler_current == scheduler ? scheduler_worker_index : -1;
+
+    if (worker_index >= 0)
+    {
+        // newest own task first, it is most likely still in cache
+        task = scheduler_deque_pop(&scheduler->deques[worker_index]);
+
+        if (task)
+        {
+            return task;
+        }
+    }
+
+    task = scheduler_deque_steal(&scheduler->external);
+
+    if (task)
+    {
+        return task;
+    }
+
+    // Steal the oldest task from other workers, start from the next worker 
+    // so thieves do not all hit the same victim
+    for (int i = 1; i <= scheduler->worker_count; i++)
+    {
+        int victim = (worker_index + i + scheduler->worker_count) % scheduler->worker_count;
+
+        if (victim == worker_index)
+        {
+            continue;
+        }
+
+        task = scheduler_deque_steal(&scheduler->deques[victim]);
+
+        if (task)
+        {
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+void scheduler_wait_for_work(struct ExecutionScheduler* scheduler)
+{
+    // Timed wait, so a wakeup lost between failed steal and sleep only costs 
+    // one period and not a hang
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += 1000000;
+
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&scheduler->sleep_mutex);
+    atomic_fetch_add(&scheduler->sleeping, 1);
+
+    if (!atomic_load(&scheduler->stopping))
+    {
+        pthread_cond_timedwait(&scheduler->wake, &scheduler->sleep_mutex, &deadline);
+    }
+
+    atomic_fetch_sub(&scheduler->sleeping, 1);
+    pthread_mutex_unlock(&scheduler->sleep_mutex);
+}
+
+struct SchedulerWorkerArgs
+{
+    struct ExecutionScheduler* scheduler;
+    int index;
+};
+
+void* scheduler_worker(void* data)
+{
+    struct SchedulerWorkerArgs args = *(struct SchedulerWorkerArgs*)data;
+    free(data);
+
+    scheduler_current = args.scheduler;
+    scheduler_worker_index = args.index;
+
+    while (!atomic_load(&args.scheduler->stopping))
+    {
+        struct ExecutionSchedulerTask* task = scheduler_find_task(args.scheduler);
+
+        if (task)
+        {
+            scheduler_run_task(task);
+        }
+        else
+        {
+            scheduler_wait_for_work(args.scheduler);
+        }
+    }
+
+    object_collect_cycles();
+    return NULL;
+}
+
+struct ExecutionScheduler* exec_scheduler_create(int worker_count)
+{
+    if (worker_count <= 0 || worker_count > MAX_SCHEDULER_WORKERS)
+    {
+        debug("ERR!: Invalid scheduler worker count %d\n", worker_count);
+        return NULL;
+    }
+
+    struct ExecutionScheduler* scheduler = malloc(sizeof(struct ExecutionScheduler));
+    scheduler->worker_count = worker_count;
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        scheduler_deque_init(&scheduler->deques[i]);
+    }
+
+    scheduler_deque_init(&scheduler->external);
+    pthread_mutex_init(&scheduler->external_mutex, NULL);
+    pthread_mutex_init(&scheduler->sleep_mutex, NULL);
+    pthread_cond_init(&scheduler->wake, NULL);
+    atomic_init(&scheduler->sleeping, 0);
+    atomic_init(&scheduler->stopping, false);
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        struct SchedulerWorkerArgs* args = malloc(sizeof(struct SchedulerWorkerArgs));
+        args->scheduler = scheduler;
+        args->index = i;
+
+        if (pthread_create(&scheduler->threads[i], NULL, &scheduler_worker, args) != 0)
+        {
+            debug("ERR!: Cannot create scheduler worker %d\n", i);
+            free(args);
+
+            // Workers above this index never run, their deques stay empty 
+            // and are still valid steal victims
+            scheduler->worker_count = i;
+            break;
+        }
+    }
+
+    if (scheduler->worker_count == 0)
+    {
+        exec_scheduler_destroy(scheduler);
+        return NULL;
+    }
+
+    return scheduler;
+}
+
+void exec_scheduler_destroy(struct ExecutionScheduler* scheduler)
+{
+    // Spawned tasks have to be joined before the scheduler is destroyed
+    atomic_store(&scheduler->stopping, true);
+
+    pthread_mutex_lock(&scheduler->sleep_mutex);
+    pthread_cond_broadcast(&scheduler->wake);
+    pthread_mutex_unlock(&scheduler->sleep_mutex);
+
+    for (int i = 0; i < scheduler->worker_count; i++)
+    {
+        pthread_join(scheduler->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&scheduler->wake);
+    pthread_mutex_destroy(&scheduler->sleep_mutex);
+    pthread_mutex_destroy(&scheduler->external_mutex);
+
+    free(scheduler);
+}
+
+void exec_scheduler_spawn(struct ExecutionScheduler* scheduler, struct ExecutionSchedulerTask* task)
+{
+    atomic_init(&task->done, false);
+
+    bool pushed;
+
+    if (scheduler_current == scheduler && scheduler_worker_index >= 0)
+    {
+        pushed = scheduler_deque_push(&scheduler->deques[scheduler_worker_index], task);
+    }
+    else
+    {
+        pthread_mutex_lock(&scheduler->external_mutex);
+        pushed = scheduler_deque_push(&scheduler->external, task);
+        pthread_mutex_unlock(&scheduler->external_mutex);
+    }
+
+    if (!pushed)
+    {
+        // Deque is full, there is already enough parallel work queued
+        scheduler_run_task(task);
+        return;
+    }
+
+    if (atomic_load(&scheduler->sleeping) > 0)
+    {
+        pthread_mutex_lock(&scheduler->sleep_mutex);
+        pthread_cond_signal(&scheduler->wake);
+        pthread_mutex_unlock(&scheduler->sleep_mutex);
+    }
+}
+
+void exec_scheduler_join(struct ExecutionScheduler* scheduler, struct ExecutionSchedulerTask* task)
+{
+    // Joining thread helps with queued work instead of blocking, this also
+    // makes nested spawn/join inside tasks deadlock free
+    while (!atomic_load_explicit(&task->done, memory_order_acquire))
+    {
+        struct ExecutionSchedulerTask* other = scheduler_find_task(scheduler);
+
+        if (other)
+        {
+            scheduler_run_task(other);
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+}
+
+#pragma endregion --- SCHEDULER ---
+
+#pragma region --- SCHEDULER SCRIPT FUNCTIONS ---
+
+// spawn(function, args...) -> task handle
+void fts_spawn(struct ExecutionContext* context)
+{
+    int index = context->native_frame_stack_index;
+    struct ExecutionContextStackValue function = context_stack_get_value_at_index(context, index);
+
+    if (index >= context->stack_index || function.type != NATIVE_TYPE_FUNCTION)
+    {
+        debug("ERR!: spawn expects a function as first argument\n");
+        return;
+    }
+
+    index += function.size;
+
+    // Arguments are checked before the child takes any references
+    for (int i = index; i < context->stack_index; )
+    {
+        struct ExecutionContextStackValue value = context_stack_get_value_at_index(context, i);
+        i += value.size;
+
+        if (value.type == STACK_TYPE_STRUCT_INSTANCE)
+        {
+            debug("ERR!: spawn arguments cannot be struct instances\n");
+            return;
+        }
+    }
+
+    struct ExecutionSchedulerTask* task = malloc(sizeof(struct ExecutionSchedulerTask));
+
+    if (!task)
+    {
+        debug("ERR!: Cannot allocate task\n");
+        return;
+    }
+
+    exec_context_init_child(&task->context, context);
+    task->func_position = *function.ptr;
+    task->frame_start_stack_index = task->context.stack_index;
+    task->id = ++context->last_task_id;
+    task->next = context->tasks;
+    context->tasks = task;
+
+    while (index < context->stack_index)
+    {
+        struct ExecutionContextStackValue value = context_stack_get_value_at_index(context, index);
+        index += value.size;
+
+        // Task can run on other thread, which will release the references
+        exec_share_value(value);
+        context_stack_push_value(&task->context, value);
+    }
+
+    if (context->scheduler)
+    {
+        exec_scheduler_spawn(context->scheduler, task);
+    }
+    else
+    {
+        // No scheduler, run it right away so join still works
+        atomic_init(&task->done, false);
+        scheduler_run_task(task);
+    }
+
+    uint64_t handle = task->id;
+
+    context_stack_push_value(
+        context, 
+        (struct ExecutionContextStackValue) { .ptr = &handle, .type = NATIVE_TYPE_PTR, .size = get_size_of_native_type(NATIVE_TYPE_PTR) }
+    );
+}
+
+struct ExecutionSchedulerTask* scheduler_take_task(struct ExecutionContext* context, uint64_t id)
+{
+    // Unlinks the task, so a second join of the same handle does not find it
+    struct ExecutionSchedulerTask** link = &context->tasks;
+
+    while (*link)
+    {
+        struct ExecutionSchedulerTask* task = *link;
+
+        if (task->id == id)
+        {
+            *link = task->next;
+            return task;
+        }
+
+        link = &task->next;
+    }
+
+    return NULL;
+}
+
+void scheduler_wait_task(struct ExecutionContext* context, struct ExecutionSchedulerTask* task)
+{
+    if (context->scheduler)
+    {
+        exec_scheduler_join(context->scheduler, task);
+    }
+}
+
+void exec_scheduler_release_tasks(struct ExecutionContext* context)
+{
+    while (context->tasks)
+    {
+        struct ExecutionSchedulerTask* task = context->tasks;
+        context->tasks = task->next;
+
+        scheduler_wait_task(context, task);
+        free(task);
+    }
+}
+
+// join(task handle) -> function result
+void fts_join(struct ExecutionContext* context)
+{
+    struct ExecutionContextStackValue value = context_stack_get_last_value(context);
+
+    if (context->stack_index <= context->native_frame_stack_index || value.type != NATIVE_TYPE_PTR)
+    {
+        debug("ERR!: join expects a task handle\n");
+        return;
+    }
+
+    struct ExecutionSchedulerTask* task = scheduler_take_task(context, *value.ptr);
+
+    if (!task)
+    {
+        debug("ERR!: Task %llu was already joined or was not spawned by this context\n", (unsigned long long)*value.ptr);
+        return;
+    }
+
+    scheduler_wait_task(context, task);
+
+    uint8_t result_type = task->result_type;
+    uint64_t result = task->result;
+
+    free(task);
+
+    if (result_type != NATIVE_TYPE_VOID)
+    {
+        context_stack_push_value(
+            context, 
+            (struct ExecutionContextStackValue) { .ptr = &result, .type = result_type, .size = get_size_of_native_type(result_type) }
+        );
+    }
+}
+
+#pragma endregion --- SCHEDULER SCRIPT FUNCTIONS ---
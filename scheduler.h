@@ -0,0 +1,72 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "context.h"
+
+#pragma region --- SCHEDULER ---
+
+#define SCHEDULER_DEQUE_CAPACITY 256
+#define MAX_SCHEDULER_WORKERS 64
+
+// Function spawned by a script, it runs on its own child context which is
+// initialized when the task is spawned, so any thread can execute it
+struct ExecutionSchedulerTask
+{
+    struct ExecutionContext context;
+    int func_position;
+    int frame_start_stack_index;
+    // handle of the task in the spawning context, ids are never reused
+    uint64_t id;
+    // next not joined task of the spawning context
+    struct ExecutionSchedulerTask* next;
+
+    // Filled after the function returns, only numeric values are kept
+    uint8_t result_type;
+    uint64_t result;
+    atomic_bool done;
+};
+
+// Chase-Lev work stealing deque, owner pushes and pops at the bottom, 
+// other threads steal from the top
+struct ExecutionSchedulerDeque
+{
+    atomic_llong top;
+    atomic_llong bottom;
+    struct ExecutionSchedulerTask* _Atomic tasks[SCHEDULER_DEQUE_CAPACITY];
+};
+
+struct ExecutionScheduler
+{
+    struct ExecutionSchedulerDeque deques[MAX_SCHEDULER_WORKERS];
+    pthread_t threads[MAX_SCHEDULER_WORKERS];
+    int worker_count;
+
+    // Tasks spawned by threads which are not workers of this scheduler, 
+    // owner side of this deque is protected by the mutex
+    struct ExecutionSchedulerDeque external;
+    pthread_mutex_t external_mutex;
+
+    pthread_mutex_t sleep_mutex;
+    pthread_cond_t wake;
+    atomic_int sleeping;
+    atomic_bool stopping;
+};
+
+struct ExecutionScheduler* exec_scheduler_create(int worker_count);
+void exec_scheduler_destroy(struct ExecutionScheduler* scheduler);
+
+void exec_scheduler_spawn(struct ExecutionScheduler* scheduler, struct ExecutionSchedulerTask* task);
+void exec_scheduler_join(struct ExecutionScheduler* scheduler, struct ExecutionSchedulerTask* task);
+// Waits for and frees tasks the context spawned and did not join
+void exec_scheduler_release_tasks(struct ExecutionContext* context);
+
+#pragma endregion --- SCHEDULER ---
+
+#pragma region --- SCHEDULER SCRIPT FUNCTIONS ---
+
+void fts_spawn(struct ExecutionContext* context);
+void fts_join(struct ExecutionContext* context);
+
+#pragma endregion --- SCHEDULER SCRIPT FUNCTIONS ---
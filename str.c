@@ -0,0 +1,432 @@
+#include "str.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "debug.h"
+#include "array.h"
+
+#pragma region --- STRING ---
+
+// Intern table is global, so interned keys compare by address across threads.
+// Interned strings are shared and the table keeps a reference to them.
+pthread_mutex_t string_intern_lock = PTHREAD_MUTEX_INITIALIZER;
+struct ExecutionString** string_intern_table = NULL;
+uint32_t string_intern_capacity = 0;
+uint32_t string_intern_count = 0;
+
+bool string_is_inline(uint64_t string)
+{
+    return string & OBJECT_IMMEDIATE_TAG;
+}
+
+uint32_t string_hash_data(const char* data, uint32_t length)
+{
+    // FNV-1a, 0 is reserved for not computed hashes
+    uint32_t hash = 2166136261u;
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ (uint8_t)data[i]) * 16777619u;
+    }
+
+    return hash ? hash : 1;
+}
+
+void string_free_view(const void* object_ref)
+{
+    struct ExecutionString* view = (struct ExecutionString*)((uint8_t*)object_ref + sizeof(struct ref));
+
+    object_deref(view->parent);
+}
+
+struct ExecutionString* string_create_buffer(const char* data, uint32_t length)
+{
+    struct ExecutionString* string = object_create(sizeof(struct ExecutionString) + length + 1);
+
+    string->parent = NULL;
+    string->data = string->buffer;
+    string->length = length;
+    string->hash = 0;
+    string->flags = STRING_FLAG_NONE;
+
+    if (data)
+    {
+        memcpy(string->buffer, data, length);
+    }
+
+    string->buffer[length] = 0;
+
+    return string;
+}
+
+uint64_t string_create(const char* data, uint32_t length)
+{
+    if (length > STRING_INLINE_CAPACITY)
+    {
+        return (uint64_t)string_create_buffer(data, length);
+    }
+
+    // Tag is the low bit of the slot, which is the first byte on little endian targets
+    uint64_t string = 0;
+    uint8_t* bytes = (uint8_t*)&string;
+
+    bytes[0] = length << 1 | OBJECT_IMMEDIATE_TAG;
+    memcpy(&bytes[1], data, length);
+
+    return string;
+}
+
+const char* string_get_data(const uint64_t* string, uint32_t* length)
+{
+    if (string_is_inline(*string))
+    {
+        *length = *(const uint8_t*)string >> 1;
+        return (const char*)string + 1;
+    }
+
+    // Strings in zeroed struct fields are empty
+    if (!*string)
+    {
+        *length = 0;
+        return "";
+    }
+
+    struct ExecutionString* heap_string = (struct ExecutionString*)*string;
+
+    *length = heap_string->length;
+    return heap_string->data;
+}
+
+uint64_t string_view(uint64_t string, uint32_t start, uint32_t length)
+{
+    uint32_t string_length;
+    const char* data = string_get_data(&string, &string_length);
+
+    if (length <= STRING_INLINE_CAPACITY)
+    {
+        return string_create(data + start, length);
+    }
+
+    if (start == 0 && length == string_length)
+    {
+        return string;
+    }
+
+    // Views always point to the buffer, so they do not form chains
+    struct ExecutionString* source = (struct ExecutionString*)string;
+    struct ExecutionString* parent = source->parent ? source->parent : source;
+    struct ExecutionString* view = object_create_with_free(sizeof(struct ExecutionString), &string_free_view);
+
+    // Parent is shared up front, the view alone can be handed to other threads
+    view->parent = object_share(object_ref(parent));
+    view->data = data + start;
+    view->length = length;
+    view->hash = 0;
+    view->flags = STRING_FLAG_NONE;
+
+    return (uint64_t)view;
+}
+
+uint64_t string_concat(const uint64_t* a, const uint64_t* b)
+{
+    uint32_t a_length, b_length;
+    const char* a_data = string_get_data(a, &a_length);
+    const char* b_data = string_get_data(b, &b_length);
+
+    if (b_length == 0)
+    {
+        return *a;
+    }
+
+    if (a_length == 0)
+    {
+        return *b;
+    }
+
+    uint32_t length = a_length + b_length;
+
+    if (length <= STRING_INLINE_CAPACITY)
+    {
+        char data[STRING_INLINE_CAPACITY];
+
+        memcpy(data, a_data, a_length);
+        memcpy(data + a_length, b_data, b_length);
+
+        return string_create(data, length);
+    }
+
+    // Characters are written straight into the result, no intermediate copies
+    struct ExecutionString* string = string_create_buffer(NULL, length);
+
+    memcpy(string->buffer, a_data, a_length);
+    memcpy(string->buffer + a_length, b_data, b_length);
+
+    return (uint64_t)string;
+}
+
+bool string_intern_grow()
+{
+    uint32_t capacity = string_intern_capacity ? string_intern_capacity * 2 : STRING_INTERN_INITIAL_CAPACITY;
+    struct ExecutionString** table = calloc(capacity, sizeof(struct ExecutionString*));
+
+    if (!table)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < string_intern_capacity; i++)
+    {
+        struct ExecutionString* string = string_intern_table[i];
+
+        if (!string)
+        {
+            continue;
+        }
+
+        uint32_t index = string->hash & (capacity - 1);
+
+        while (table[index])
+        {
+            index = (index + 1) & (capacity - 1);
+        }
+
+        table[index] = string;
+    }
+
+    free(string_intern_table);
+    string_intern_table = table;
+    string_intern_capacity = capacity;
+
+    return true;
+}
+
+uint64_t string_intern_data(const char* data, uint32_t length)
+{
+    // Inline strings are canonical by their value
+    if (length <= STRING_INLINE_CAPACITY)
+    {
+        return string_create(data, length);
+    }
+
+    uint32_t hash = string_hash_data(data, length);
+
+    pthread_mutex_lock(&string_intern_lock);
+
+    if (string_intern_count * 2 >= string_intern_capacity && !string_intern_grow() && string_intern_count == string_intern_capacity)
+    {
+        pthread_mutex_unlock(&string_intern_lock);
+        debug("ERR!: Cannot grow intern table, string is not interned\n");
+        return string_create(data, length);
+    }
+
+    uint32_t index = hash & (string_intern_capacity - 1);
+    struct ExecutionString* string;
+
+    while ((string = string_intern_table[index]))
+    {
+        if (string->hash == hash && string->length == length && memcmp(string->data, data, length) == 0)
+        {
+            pthread_mutex_unlock(&string_intern_lock);
+            return (uint64_t)string;
+        }
+
+        index = (index + 1) & (string_intern_capacity - 1);
+    }
+
+    // Copy is always a buffer, so the table never keeps a large parent of a view alive
+    string = string_create_buffer(data, length);
+    string->hash = hash;
+    string->flags = STRING_FLAG_INTERNED;
+
+    string_intern_table[index] = object_share(object_ref(string));
+    string_intern_count++;
+
+    pthread_mutex_unlock(&string_intern_lock);
+
+    return (uint64_t)string;
+}
+
+uint64_t string_intern(const uint64_t* string)
+{
+    if (!*string || string_is_inline(*string) || (((struct ExecutionString*)*string)->flags & STRING_FLAG_INTERNED))
+    {
+        return *string;
+    }
+
+    struct ExecutionString* heap_string = (struct ExecutionString*)*string;
+
+    return string_intern_data(heap_string->data, heap_string->length);
+}
+
+bool string_equal(const uint64_t* a, const uint64_t* b)
+{
+    // Same slot value covers equal inline strings and the same object
+    if (*a == *b)
+    {
+        return true;
+    }
+
+    if (*a && *b && !string_is_inline(*a) && !string_is_inline(*b)
+        && (((struct ExecutionString*)*a)->flags & ((struct ExecutionString*)*b)->flags & STRING_FLAG_INTERNED))
+    {
+        // Equal interned strings are always the same object
+        return false;
+    }
+
+    uint32_t a_length, b_length;
+    const char* a_data = string_get_data(a, &a_length);
+    const char* b_data = string_get_data(b, &b_length);
+
+    return a_length == b_length && memcmp(a_data, b_data, a_length) == 0;
+}
+
+uint32_t string_hash(const uint64_t* string)
+{
+    // Cached for interned strings, others are immutable but can be read by many threads
+    if (*string && !string_is_inline(*string) && ((struct ExecutionString*)*string)->hash)
+    {
+        return ((struct ExecutionString*)*string)->hash;
+    }
+
+    uint32_t length;
+    const char* data = string_get_data(string, &length);
+
+    return string_hash_data(data, length);
+}
+
+bool string_get_args(struct ExecutionContext* context, int count, struct ExecutionContextStackValue* args)
+{
+    // Reads exactly 'count' arguments of the native frame, first one is the string
+    int index = context->native_frame_stack_index;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (index >= context->stack_index)
+        {
+            return false;
+        }
+
+        args[i] = context_stack_get_value_at_index(context, index);
+        index += args[i].size;
+    }
+
+    return index == context->stack_index && args[0].type == NATIVE_TYPE_STRING;
+}
+
+void string_push(struct ExecutionContext* context, uint64_t string)
+{
+    context_stack_push_value(
+        context,
+        (struct ExecutionContextStackValue) { .ptr = &string, .type = NATIVE_TYPE_STRING, .size = get_size_of_native_type(NATIVE_TYPE_STRING) }
+    );
+}
+
+void string_push_i32(struct ExecutionContext* context, int32_t value)
+{
+    uint64_t slot = (uint32_t)value;
+
+    context_stack_push_value(
+        context,
+        (struct ExecutionContextStackValue) { .ptr = &slot, .type = NATIVE_TYPE_I32, .size = get_size_of_native_type(NATIVE_TYPE_I32) }
+    );
+}
+
+// concat(a, b) -> string
+void fts_concat(struct ExecutionContext* context)
+{
+    struct ExecutionContextStackValue args[2];
+
+    if (!string_get_args(context, 2, args) || args[1].type != NATIVE_TYPE_STRING)
+    {
+        debug("ERR!: concat expects two strings\n");
+        return;
+    }
+
+    string_push(context, string_concat(args[0].ptr, args[1].ptr));
+}
+
+// substr(s, start, length) -> view of the characters
+void fts_substr(struct ExecutionContext* context)
+{
+    struct ExecutionContextStackValue args[3];
+    int64_t start, length;
+    uint32_t string_length;
+
+    if (!string_get_args(context, 3, args)
+        || !array_index_from_value(args[1], &start)
+        || !array_index_from_value(args[2], &length))
+    {
+        debug("ERR!: substr expects a string and two integers\n");
+        return;
+    }
+
+    string_get_data(args[0].ptr, &string_length);
+
+    if (start < 0 || length < 0 || start + length > string_length)
+    {
+        debug("ERR!: substr range %lld..%lld is out of bounds (length: %u)\n", (long long)start, (long long)(start + length), string_length);
+        return;
+    }
+
+    string_push(context, string_view(*args[0].ptr, start, length));
+}
+
+// find(s, part) -> i32 index of the first occurrence or -1
+void fts_find(struct ExecutionContext* context)
+{
+    struct ExecutionContextStackValue args[2];
+    uint32_t length, part_length;
+
+    if (!string_get_args(context, 2, args) || args[1].type != NATIVE_TYPE_STRING)
+    {
+        debug("ERR!: find expects two strings\n");
+        return;
+    }
+
+    const char* data = string_get_data(args[0].ptr, &length);
+    const char* part = string_get_data(args[1].ptr, &part_length);
+    int32_t found = -1;
+
+    for (uint32_t i = 0; part_length <= length && i <= length - part_length; i++)
+    {
+        if (memcmp(data + i, part, part_length) == 0)
+        {
+            found = i;
+            break;
+        }
+    }
+
+    string_push_i32(context, found);
+}
+
+// intern(s) -> canonical string, interned strings compare by address
+void fts_intern(struct ExecutionContext* context)
+{
+    struct ExecutionContextStackValue args[1];
+
+    if (!string_get_args(context, 1, args))
+    {
+        debug("ERR!: intern expects a string\n");
+        return;
+    }
+
+    string_push(context, string_intern(args[0].ptr));
+}
+
+// equal(a, b) -> i32 1 when strings have the same characters
+void fts_string_equal(struct ExecutionContext* context)
+{
+    struct ExecutionContextStackValue args[2];
+
+    if (!string_get_args(context, 2, args) || args[1].type != NATIVE_TYPE_STRING)
+    {
+        debug("ERR!: equal expects two strings\n");
+        return;
+    }
+
+    string_push_i32(context, string_equal(args[0].ptr, args[1].ptr));
+}
+
+#pragma endregion --- STRING ---
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "context.h"
+
+#pragma region --- STRING ---
+
+// Strings take one stack slot. Up to STRING_INLINE_CAPACITY bytes are packed into
+// the slot itself: first byte is 'length << 1 | OBJECT_IMMEDIATE_TAG', characters
+// follow. Longer strings are addresses of immutable ExecutionString objects.
+#define STRING_INLINE_CAPACITY 7
+
+// Initial capacity of the intern table, it grows at half load
+#define STRING_INTERN_INITIAL_CAPACITY 256
+
+enum ExecutionStringFlags
+{
+    STRING_FLAG_NONE = 0x0,
+    // String is owned by the intern table, equal interned strings are the same object
+    STRING_FLAG_INTERNED = 0x1,
+};
+
+// Buffers own their characters, views point into the buffer of their parent
+struct ExecutionString
+{
+    struct ExecutionString* parent;
+    const char* data;
+    uint32_t length;
+    // 0 when not computed yet
+    uint32_t hash;
+    // see ExecutionStringFlags
+    uint8_t flags;
+    char buffer[];
+};
+
+// New buffer with a copy of the characters, short strings are packed into the slot
+uint64_t string_create(const char* data, uint32_t length);
+
+// Characters of the string in the slot, the slot has to outlive returned pointer
+const char* string_get_data(const uint64_t* string, uint32_t* length);
+
+// Substring sharing the buffer of the string, caller checks the range
+uint64_t string_view(uint64_t string, uint32_t start, uint32_t length);
+
+uint64_t string_concat(const uint64_t* a, const uint64_t* b);
+
+// Canonical string of the characters, created on first use and kept until exit
+uint64_t string_intern_data(const char* data, uint32_t length);
+uint64_t string_intern(const uint64_t* string);
+
+bool string_equal(const uint64_t* a, const uint64_t* b);
+
+uint32_t string_hash(const uint64_t* string);
+
+void fts_concat(struct ExecutionContext* context);
+void fts_substr(struct ExecutionContext* context);
+void fts_find(struct ExecutionContext* context);
+void fts_intern(struct ExecutionContext* context);
+
+// equal(a, b) on two strings, called by 'equal' for string arguments
+void fts_string_equal(struct ExecutionContext* context);
+
+#pragma endregion --- STRING ---
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include "executor.h"
+#include "coroutine.h"
+#include "object.h"
+
+// Cycle collection of long chains inside a coroutine, whose native stack is small
+
+#define CHAIN_LENGTH 200000
+
+struct Node
+{
+    struct Node* next;
+};
+
+int freed_nodes;
+int failures;
+
+void node_free(const void* object_ref)
+{
+    struct Node* node = (struct Node*)((uint8_t*)object_ref + sizeof(struct ref));
+
+    object_deref(node->next);
+    freed_nodes++;
+}
+
+void node_trace(const void* object, ObjectVisitor visit, void* data)
+{
+    const struct Node* node = object;
+
+    if (node->next)
+    {
+        visit(node->next, data);
+    }
+}
+
+struct Node* chain_create(int length)
+{
+    // Last node points back to the head, the returned head is referenced once by the caller
+    struct Node* head = object_ref(object_create_traced(sizeof(struct Node), &node_free, &node_trace));
+    struct Node* node = head;
+
+    for (int i = 1; i < length; i++)
+    {
+        node->next = object_ref(object_create_traced(sizeof(struct Node), &node_free, &node_trace));
+        node = node->next;
+    }
+
+    node->next = object_ref(head);
+
+    return head;
+}
+
+void expect(bool condition, const char* message)
+{
+    if (!condition)
+    {
+        printf("FAIL: %s\n", message);
+        failures++;
+    }
+}
+
+void fts_test_chains(struct ExecutionContext* context)
+{
+    (void)context;
+
+    // Chain still referenced from outside is kept
+    struct Node* alive = chain_create(CHAIN_LENGTH);
+    object_ref(alive);
+    object_deref(alive);
+
+    freed_nodes = 0;
+    object_collect_cycles();
+    expect(freed_nodes == 0, "referenced chain was collected");
+
+    // Dropping the last outside reference leaves a garbage cycle
+    object_deref(alive);
+    object_collect_cycles();
+    expect(freed_nodes == CHAIN_LENGTH, "garbage chain was not collected");
+}
+
+int main()
+{
+    struct ExecutionRegistry registry;
+
+    exec_registry_init(&registry);
+    exec_registry_add_function(&registry, "test_chains", &fts_test_chains);
+
+    struct ExecutionCoroutine* coroutine = exec_coroutine_create(&registry, "test_chains();", 0);
+
+    if (!coroutine)
+    {
+        printf("FAIL: coroutine was not created\n");
+        return 1;
+    }
+
+    uint8_t state = exec_coroutine_resume(coroutine);
+    expect(state == EXECUTION_CONTEXT_STATE_FINISHED, "coroutine did not finish");
+
+    exec_coroutine_destroy(coroutine);
+    object_collect_cycles();
+
+    printf("%s: collector\n", failures ? "FAIL" : "PASS");
+    return failures ? 1 : 0;
+}
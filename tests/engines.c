@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "executor.h"
+
+// Same scripts run by the stack engine and the register engine must show the same values
+
+#define MAX_SHOWN 32
+
+struct Shown
+{
+    int arg_count;
+    uint8_t type;
+    uint64_t value;
+};
+
+struct Run
+{
+    struct Shown shown[MAX_SHOWN];
+    int shown_count;
+    uint8_t state;
+};
+
+struct Run* current_run;
+int failures;
+
+void fts_show(struct ExecutionContext* context)
+{
+    int arg_count = context->stack_index - context->native_frame_stack_index;
+
+    if (current_run->shown_count == MAX_SHOWN)
+    {
+        return;
+    }
+
+    struct Shown* shown = &current_run->shown[current_run->shown_count];
+
+    shown->arg_count = arg_count;
+    shown->type = arg_count ? context->stack_type[context->native_frame_stack_index] : NATIVE_TYPE_VOID;
+    shown->value = arg_count ? context->stack[context->native_frame_stack_index] : 0;
+    current_run->shown_count++;
+}
+
+void run_script(struct ExecutionRegistry* registry, const char* code, uint8_t engine, struct Run* run)
+{
+    static struct ExecutionContext context;
+
+    memset(run, 0, sizeof(*run));
+    current_run = run;
+
+    exec_context_init(&context, registry, code);
+    context.engine = engine;
+    exec_context_run(&context);
+
+    run->state = context.state;
+    exec_context_release(&context);
+}
+
+void expect_same(struct ExecutionRegistry* registry, const char* name, const char* code, uint8_t state, int shown_count)
+{
+    struct Run stack;
+    struct Run registers;
+
+    run_script(registry, code, EXECUTION_ENGINE_STACK, &stack);
+    run_script(registry, code, EXECUTION_ENGINE_REGISTER, &registers);
+
+    if (stack.state != state || stack.shown_count != shown_count)
+    {
+        printf("FAIL: %s, stack engine state %d shown %d\n", name, stack.state, stack.shown_count);
+        failures++;
+        return;
+    }
+
+    if (registers.state != stack.state || registers.shown_count != stack.shown_count
+        || memcmp(registers.shown, stack.shown, sizeof(stack.shown[0]) * stack.shown_count) != 0)
+    {
+        printf("FAIL: %s, register engine state %d shown %d\n", name, registers.state, registers.shown_count);
+        failures++;
+    }
+}
+
+int main()
+{
+    struct ExecutionRegistry registry;
+
+    exec_registry_init(&registry);
+    exec_registry_add_function(&registry, "show", &fts_show);
+
+    expect_same(&registry, "parameter passed to another function",
+        "var f = void(i32 a) => { show(a); }; var g = i32(i32 x) => { f(x); 5 }; show(g(3));",
+        EXECUTION_CONTEXT_STATE_FINISHED, 2);
+
+    // Callee is a parameter, so type inference does not reject the mismatched calls
+    expect_same(&registry, "too many arguments",
+        "var f = i32(i32 a) => { a }; var g = i32(var h) => { h(1, 2) }; show(7); show(g(f)); show(8);",
+        EXECUTION_CONTEXT_STATE_ABORTED, 1);
+
+    expect_same(&registry, "too few arguments",
+        "var f = i32(i32 a, i32 b) => { a }; var g = i32(var h) => { h(1) }; show(7); show(g(f)); show(8);",
+        EXECUTION_CONTEXT_STATE_ABORTED, 1);
+
+    expect_same(&registry, "argument of another type",
+        "var f = i32(i32 a) => { a }; var g = i32(var h) => { h(4l) }; show(7); show(g(f)); show(8);",
+        EXECUTION_CONTEXT_STATE_ABORTED, 1);
+
+    expect_same(&registry, "void last statement",
+        "var h = void(i32 a) => { a; }; show(h(3)); var k = i32(i32 a) => { a }; show(k(4));",
+        EXECUTION_CONTEXT_STATE_FINISHED, 2);
+
+    expect_same(&registry, "void result passed as argument",
+        "var f = void(i32 a) => { a; }; var h = i32(i32 x) => { show(f(x)); x }; show(h(8));",
+        EXECUTION_CONTEXT_STATE_FINISHED, 2);
+
+    expect_same(&registry, "void result declared",
+        "var f = void(i32 a) => { a; }; var g = i32(i32 x) => { var y = f(x); y }; show(1); show(g(6)); show(2);",
+        EXECUTION_CONTEXT_STATE_ABORTED, 1);
+
+    printf("%s: engines\n", failures ? "FAIL" : "PASS");
+    return failures ? 1 : 0;
+}
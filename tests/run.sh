@@ -0,0 +1,13 @@
+# Builds every test program against the interpreter sources and runs it,
+# only PASS and FAIL lines are shown from the debug output
+set -o pipefail
+cd "$(dirname "$0")/.."
+
+for test in tests/*.c
+do
+    name=$(basename "$test" .c)
+
+    gcc -I. "$test" $(ls *.c | grep -v main.c) -o "tests/$name" -lpthread -ldl || exit 1
+    "./tests/$name" | grep -E "^(PASS|FAIL)" || { rm -f "tests/$name"; exit 1; }
+    rm -f "tests/$name"
+done
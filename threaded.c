@@ -0,0 +1,204 @@
+#include "threaded.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "debug.h"
+
+#pragma region --- THREADED CODE ---
+
+// Installed programs, only appended to
+struct ExecutionThreadedProgramEntry
+{
+    struct ExecutionThreadedProgramEntry* next;
+    struct ExecutionThreadedProgram* program;
+};
+
+pthread_mutex_t threaded_programs_lock = PTHREAD_MUTEX_INITIALIZER;
+struct ExecutionThreadedProgramEntry* threaded_programs = NULL;
+
+void threaded_const(const struct ExecutionThreadedOp* op, struct ExecutionThreadedFrame* frame)
+{
+    frame->values[op->target] = (int32_t)op->immediate;
+}
+
+void threaded_load_param(const struct ExecutionThreadedOp* op, struct ExecutionThreadedFrame* frame)
+{
+    frame->values[op->target] = (int32_t)frame->args[op->a];
+}
+
+void threaded_add_i32(const struct ExecutionThreadedOp* op, struct ExecutionThreadedFrame* frame)
+{
+    // wraps around like fts_add
+    frame->values[op->target] = (int32_t)((uint32_t)frame->values[op->a] + (uint32_t)frame->values[op->b]);
+}
+
+void threaded_add_i32_immediate(const struct ExecutionThreadedOp* op, struct ExecutionThreadedFrame* frame)
+{
+    frame->values[op->target] = (int32_t)((uint32_t)frame->values[op->a] + (uint32_t)op->immediate);
+}
+
+void threaded_return_i32(const struct ExecutionThreadedOp* op, struct ExecutionThreadedFrame* frame)
+{
+    // Same as context_stack_push_value of an i32 made by fts_add
+    struct ExecutionContext* context = frame->context;
+    int index = context->stack_index;
+
+    context->stack[index] = (uint64_t)(int64_t)frame->values[op->a];
+    context->stack_type[index] = NATIVE_TYPE_I32;
+    context->stack_flags[index] = STACK_FLAG_NONE;
+    context->stack_index++;
+}
+
+struct ExecutionThreadedProgram* threaded_install(struct ExecutionThreadedProgram* program)
+{
+    // Takes the program, returns the installed one
+    size_t size = sizeof(struct ExecutionThreadedProgram) + program->count * sizeof(struct ExecutionThreadedOp);
+
+    pthread_mutex_lock(&threaded_programs_lock);
+
+    // Same script compiled by another context produces the same program, programs 
+    // come from calloc so padding compares equal too
+    for (struct ExecutionThreadedProgramEntry* entry = threaded_programs; entry; entry = entry->next)
+    {
+        if (entry->program->count == program->count && memcmp(entry->program, program, size) == 0)
+        {
+            pthread_mutex_unlock(&threaded_programs_lock);
+            free(program);
+            return entry->program;
+        }
+    }
+
+    struct ExecutionThreadedProgramEntry* entry = malloc(sizeof(struct ExecutionThreadedProgramEntry));
+
+    if (!entry)
+    {
+        pthread_mutex_unlock(&threaded_programs_lock);
+        free(program);
+        return NULL;
+    }
+
+    entry->program = program;
+    entry->next = threaded_programs;
+    threaded_programs = entry;
+
+    pthread_mutex_unlock(&threaded_programs_lock);
+
+    return program;
+}
+
+struct ExecutionThreadedProgram* threaded_compile(struct ExecutionIrFunction* function)
+{
+    // Constant operands of additions become immediates, so the constant itself is
+    // only kept when some other instruction or the result reads its slot
+    bool used[MAX_IR_INSTRUCTIONS] = { false };
+
+    used[function->result] = true;
+
+    for (int i = 0; i < function->instruction_count; i++)
+    {
+        struct ExecutionIrInstruction* instruction = &function->instructions[i];
+
+        if (instruction->op != IR_OP_ADD)
+        {
+            continue;
+        }
+
+        // Same operand choice as the add ops below
+        if (function->instructions[instruction->b].op == IR_OP_CONST)
+        {
+            used[instruction->a] = true;
+        }
+        else if (function->instructions[instruction->a].op == IR_OP_CONST)
+        {
+            used[instruction->b] = true;
+        }
+        else
+        {
+            used[instruction->a] = true;
+            used[instruction->b] = true;
+        }
+    }
+
+    // One op per kept instruction and the return
+    struct ExecutionThreadedProgram* program = calloc(1, sizeof(struct ExecutionThreadedProgram) + (function->instruction_count + 1) * sizeof(struct ExecutionThreadedOp));
+
+    if (!program)
+    {
+        return NULL;
+    }
+
+    for (int i = 0; i < function->instruction_count; i++)
+    {
+        struct ExecutionIrInstruction* instruction = &function->instructions[i];
+
+        if ((instruction->op == IR_OP_CONST || instruction->op == IR_OP_PARAM) && !used[i])
+        {
+            continue;
+        }
+
+        struct ExecutionThreadedOp* op = &program->ops[program->count++];
+
+        op->target = i;
+        op->a = instruction->a;
+        op->b = instruction->b;
+        op->immediate = instruction->value;
+
+        switch (instruction->op)
+        {
+        case IR_OP_CONST:
+            op->function = &threaded_const;
+            break;
+        case IR_OP_PARAM:
+            op->function = &threaded_load_param;
+            op->a = instruction->value;
+            op->immediate = 0;
+            break;
+        case IR_OP_ADD:
+            if (function->instructions[instruction->b].op == IR_OP_CONST)
+            {
+                // Constant operand is stored in the op instead of read from its slot
+                op->function = &threaded_add_i32_immediate;
+                op->immediate = function->instructions[instruction->b].value;
+            }
+            else if (function->instructions[instruction->a].op == IR_OP_CONST)
+            {
+                op->function = &threaded_add_i32_immediate;
+                op->a = instruction->b;
+                op->immediate = function->instructions[instruction->a].value;
+            }
+            else
+            {
+                op->function = &threaded_add_i32;
+            }
+            break;
+        default:
+            free(program);
+            return NULL;
+        }
+    }
+
+    struct ExecutionThreadedOp* op = &program->ops[program->count++];
+
+    op->function = &threaded_return_i32;
+    op->a = function->result;
+
+    return threaded_install(program);
+}
+
+void threaded_run(const struct ExecutionThreadedProgram* program, struct ExecutionContext* context, int frame_start_stack_index)
+{
+    struct ExecutionThreadedFrame frame;
+
+    frame.context = context;
+    frame.args = &context->stack[frame_start_stack_index];
+
+    // Every op returns to this loop, so the native stack does not grow with the program
+    for (int i = 0; i < program->count; i++)
+    {
+        program->ops[i].function(&program->ops[i], &frame);
+    }
+}
+
+#pragma endregion --- THREADED CODE ---
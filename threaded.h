@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "context.h"
+#include "ir.h"
+
+#pragma region --- THREADED CODE ---
+
+// Values of IR instructions while a threaded program runs
+struct ExecutionThreadedFrame
+{
+    struct ExecutionContext* context;
+    const uint64_t* args;
+    int32_t values[MAX_IR_INSTRUCTIONS];
+};
+
+struct ExecutionThreadedOp;
+
+// Operations are small C functions compiled together with the runtime, a program
+// is an array of them with their operands, run by a loop which calls them in order
+typedef void (*ExecutionThreadedFunction)(const struct ExecutionThreadedOp* op, struct ExecutionThreadedFrame* frame);
+
+// Operation with its operands: value slots and an immediate
+struct ExecutionThreadedOp
+{
+    ExecutionThreadedFunction function;
+    int32_t target;
+    int32_t a;
+    int32_t b;
+    int64_t immediate;
+};
+
+struct ExecutionThreadedProgram
+{
+    int count;
+    struct ExecutionThreadedOp ops[];
+};
+
+// Translates the IR to call-threaded code, programs are kept until exit and identical
+// programs are shared between contexts. Returns NULL for unsupported IR.
+struct ExecutionThreadedProgram* threaded_compile(struct ExecutionIrFunction* function);
+
+// Same frame as exec_function_body, pushes the i32 result on top of the arguments
+void threaded_run(const struct ExecutionThreadedProgram* program, struct ExecutionContext* context, int frame_start_stack_index);
+
+#pragma endregion --- THREADED CODE ---